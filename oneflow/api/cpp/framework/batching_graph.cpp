@@ -0,0 +1,374 @@
+/*
+Copyright 2020 The OneFlow Authors. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "oneflow/api/cpp/framework/batching_graph.h"
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "oneflow/core/common/just.h"
+#include "oneflow/core/common/maybe.h"
+#include "oneflow/core/common/scalar.h"
+#include "oneflow/core/common/shape.h"
+#include "oneflow/core/framework/tensor.h"
+#include "oneflow/core/framework/tensor_tuple.h"
+#include "oneflow/core/functional/functional_api.yaml.h"
+
+namespace oneflow_api {
+
+namespace of = oneflow;
+
+namespace {
+
+struct Request {
+  std::vector<Tensor> inputs;
+  int64_t batch_size;
+  std::chrono::steady_clock::time_point enqueue_time;
+  std::promise<std::vector<Tensor>> outputs;
+};
+
+// The number of recent requests the latency percentiles are computed over.
+constexpr size_t kLatencyWindowSize = 10000;
+
+std::vector<Tensor> ToTensorVector(const IValue& value) {
+  if (value.IsTensor()) {
+    return {value.ToTensor()};
+  } else if (value.IsTensorVector()) {
+    return value.ToTensorVector();
+  }
+  return {};
+}
+
+IValue FromTensorVector(std::vector<Tensor>&& tensors) {
+  if (tensors.empty()) {
+    return IValue{};
+  } else if (tensors.size() == 1) {
+    return IValue(std::move(tensors.front()));
+  } else {
+    return IValue(std::move(tensors));
+  }
+}
+
+// Returns the attributes of `infos` in the order of the graph inputs or outputs.
+std::vector<InputOutputAttribute> SortedAttributes(const InputOutputInfos& infos) {
+  std::vector<InputOutputAttribute> attrs(infos.size());
+  for (const auto& pair : infos) { attrs.at(pair.second.input_output_index_) = pair.second; }
+  return attrs;
+}
+
+double Percentile(const std::vector<double>& sorted_values, double percentile) {
+  if (sorted_values.empty()) { return 0; }
+  const size_t index = std::min(sorted_values.size() - 1,
+                                static_cast<size_t>(percentile * sorted_values.size()));
+  return sorted_values[index];
+}
+
+}  // namespace
+
+class BatchingGraph::BatchingGraphImpl final {
+ public:
+  BatchingGraphImpl(const std::string& model_path, const Device& device,
+                    const BatchingOptions& options);
+  ~BatchingGraphImpl();
+
+  InputOutputInfos GetInputInfos() { return graph_.GetInputInfos(); }
+  InputOutputInfos GetOutputInfos() { return graph_.GetOutputInfos(); }
+  std::vector<Tensor> Forward(std::vector<Tensor>&& inputs);
+
+  BatchingStats GetStats() const;
+  void ResetStats();
+
+ private:
+  // Every input and output of the graph must be batched along dimension 0.
+  of::Maybe<void> CheckGraph();
+  of::Maybe<void> CheckInputs(const std::vector<Tensor>& inputs) const;
+  void Loop();
+  // Pops the requests of the next batch, returns nothing once stopped and drained.
+  std::vector<std::unique_ptr<Request>> NextBatch();
+  of::Maybe<void> RunBatch(const std::vector<std::unique_ptr<Request>>& batch);
+
+  Graph graph_;
+  const BatchingOptions options_;
+  // in the order of the graph inputs
+  std::vector<InputOutputAttribute> input_attrs_;
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::deque<std::unique_ptr<Request>> queue_;
+  bool stopped_;
+
+  mutable std::mutex stats_mutex_;
+  int64_t request_num_;
+  int64_t batch_num_;
+  int64_t batched_row_num_;
+  std::vector<double> latencies_;
+
+  std::thread thread_;
+};
+
+BatchingGraph::BatchingGraphImpl::BatchingGraphImpl(const std::string& model_path,
+                                                    const Device& device,
+                                                    const BatchingOptions& options)
+    : graph_(Graph::Load(model_path, device)),
+      options_(options),
+      stopped_(false),
+      request_num_(0),
+      batch_num_(0),
+      batched_row_num_(0) {
+  CHECK_GT(options_.max_batch_size, 0);
+  CheckGraph().GetOrThrow();
+  graph_.set_batch_size(options_.max_batch_size);
+  thread_ = std::thread(&BatchingGraphImpl::Loop, this);
+}
+
+BatchingGraph::BatchingGraphImpl::~BatchingGraphImpl() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopped_ = true;
+  }
+  cond_.notify_all();
+  thread_.join();
+}
+
+of::Maybe<void> BatchingGraph::BatchingGraphImpl::CheckGraph() {
+  input_attrs_ = SortedAttributes(graph_.GetInputInfos());
+  if (input_attrs_.empty()) {
+    return of::Error::RuntimeError() << "batching needs at least one input";
+  }
+  // The model is saved with the same batch size for all inputs and outputs.
+  const Shape& front_shape = input_attrs_.front().input_output_shape_;
+  if (front_shape.NumAxes() == 0) {
+    return of::Error::RuntimeError() << "graph inputs to batch must have the batch dimension 0";
+  }
+  const int64_t saved_batch_size = front_shape.At(0);
+  for (const auto& attr : input_attrs_) {
+    const Shape& shape = attr.input_output_shape_;
+    if (shape.NumAxes() == 0 || shape.At(0) != saved_batch_size) {
+      return of::Error::RuntimeError() << "graph input " << attr.input_output_index_ << " of shape "
+                                       << shape << " has no batch dimension 0 of size "
+                                       << saved_batch_size;
+    }
+  }
+  for (const auto& pair : graph_.GetOutputInfos()) {
+    const Shape& shape = pair.second.input_output_shape_;
+    if (shape.NumAxes() == 0 || shape.At(0) != saved_batch_size) {
+      return of::Error::RuntimeError() << "graph output " << pair.first << " of shape " << shape
+                                       << " has no batch dimension 0 of size " << saved_batch_size;
+    }
+  }
+  return of::Maybe<void>::Ok();
+}
+
+of::Maybe<void> BatchingGraph::BatchingGraphImpl::CheckInputs(
+    const std::vector<Tensor>& inputs) const {
+  if (inputs.size() != input_attrs_.size()) {
+    return of::Error::RuntimeError() << "the graph has " << input_attrs_.size()
+                                     << " inputs, but got " << inputs.size();
+  }
+  const Shape& shape = inputs.front().shape();
+  if (shape.NumAxes() == 0) {
+    return of::Error::RuntimeError() << "inputs to batch must have the batch dimension 0";
+  }
+  const int64_t batch_size = shape.At(0);
+  if (batch_size <= 0 || batch_size > options_.max_batch_size) {
+    return of::Error::RuntimeError() << "batch size " << batch_size
+                                     << " of the inputs is out of (0, " << options_.max_batch_size
+                                     << "]";
+  }
+  // A mismatch found at concat or graph execution time would fail the whole batch, so check
+  // everything but the batch dimension against the graph before enqueuing.
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    const Shape& input_shape = inputs[i].shape();
+    const Shape& expected_shape = input_attrs_[i].input_output_shape_;
+    if (input_shape.NumAxes() == 0 || input_shape.At(0) != batch_size) {
+      return of::Error::RuntimeError() << "inputs of a request must have the same batch size";
+    }
+    if (inputs[i].dtype() != input_attrs_[i].datatype_) {
+      return of::Error::RuntimeError() << "input " << i << " has data type "
+                                       << static_cast<int>(inputs[i].dtype())
+                                       << ", but the graph expects "
+                                       << static_cast<int>(input_attrs_[i].datatype_);
+    }
+    bool shape_matched = input_shape.NumAxes() == expected_shape.NumAxes();
+    for (int64_t axis = 1; shape_matched && axis < input_shape.NumAxes(); ++axis) {
+      shape_matched = input_shape.At(axis) == expected_shape.At(axis);
+    }
+    if (!shape_matched) {
+      return of::Error::RuntimeError() << "input " << i << " of shape " << input_shape
+                                       << " does not match the graph input shape "
+                                       << expected_shape << " out of the batch dimension";
+    }
+  }
+  return of::Maybe<void>::Ok();
+}
+
+std::vector<Tensor> BatchingGraph::BatchingGraphImpl::Forward(std::vector<Tensor>&& inputs) {
+  CheckInputs(inputs).GetOrThrow();
+  auto request = std::make_unique<Request>();
+  request->batch_size = inputs.front().shape().At(0);
+  request->inputs = std::move(inputs);
+  request->enqueue_time = std::chrono::steady_clock::now();
+  std::future<std::vector<Tensor>> outputs = request->outputs.get_future();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.emplace_back(std::move(request));
+  }
+  cond_.notify_all();
+  return outputs.get();
+}
+
+void BatchingGraph::BatchingGraphImpl::Loop() {
+  while (true) {
+    const auto& batch = NextBatch();
+    if (batch.empty()) { break; }
+    try {
+      RunBatch(batch).GetOrThrow();
+    } catch (...) {
+      const std::exception_ptr error = std::current_exception();
+      for (const auto& request : batch) { request->outputs.set_exception(error); }
+    }
+  }
+}
+
+std::vector<std::unique_ptr<Request>> BatchingGraph::BatchingGraphImpl::NextBatch() {
+  std::vector<std::unique_ptr<Request>> batch;
+  std::unique_lock<std::mutex> lock(mutex_);
+  cond_.wait(lock, [&]() { return stopped_ || !queue_.empty(); });
+  if (queue_.empty()) { return batch; }
+  const auto deadline = queue_.front()->enqueue_time + options_.batch_timeout;
+  int64_t row_num = 0;
+  while (true) {
+    while (!queue_.empty() && row_num + queue_.front()->batch_size <= options_.max_batch_size) {
+      row_num += queue_.front()->batch_size;
+      batch.emplace_back(std::move(queue_.front()));
+      queue_.pop_front();
+    }
+    // Stop when the batch is full or the next request does not fit in.
+    if (row_num == options_.max_batch_size || !queue_.empty() || stopped_) { break; }
+    if (!cond_.wait_until(lock, deadline, [&]() { return stopped_ || !queue_.empty(); })) {
+      break;
+    }
+  }
+  return batch;
+}
+
+of::Maybe<void> BatchingGraph::BatchingGraphImpl::RunBatch(
+    const std::vector<std::unique_ptr<Request>>& batch) {
+  int64_t row_num = 0;
+  for (const auto& request : batch) { row_num += request->batch_size; }
+  const size_t input_num = batch.front()->inputs.size();
+  std::vector<Tensor> batch_inputs;
+  batch_inputs.reserve(input_num);
+  for (size_t i = 0; i < input_num; ++i) {
+    of::one::TensorTuple parts;
+    parts.reserve(batch.size() + 1);
+    for (const auto& request : batch) {
+      parts.emplace_back(request->inputs[i].__internal_tensor());
+    }
+    if (row_num < options_.max_batch_size) {
+      const auto& front = parts.front();
+      of::Shape padding_shape(*front->shape());
+      padding_shape.Set(0, options_.max_batch_size - row_num);
+      parts.emplace_back(JUST(of::one::functional::Constant(
+          padding_shape, of::Scalar(0), front->dtype(), JUST(front->device()))));
+    }
+    batch_inputs.emplace_back(
+        parts.size() == 1 ? parts.front() : JUST(of::one::functional::Concat(parts, 0)));
+  }
+  const std::vector<Tensor>& batch_outputs = ToTensorVector(graph_.Forward(batch_inputs));
+
+  std::vector<std::vector<Tensor>> outputs(batch.size());
+  int64_t offset = 0;
+  for (size_t i = 0; i < batch.size(); ++i) {
+    for (const auto& batch_output : batch_outputs) {
+      // Clone the rows since the graph reuses its output tensors in the next execution.
+      const auto& rows = JUST(of::one::functional::Narrow(batch_output.__internal_tensor(), 0,
+                                                          offset, batch[i]->batch_size));
+      outputs[i].emplace_back(JUST(of::one::functional::Clone(rows)));
+    }
+    offset += batch[i]->batch_size;
+  }
+  const auto now = std::chrono::steady_clock::now();
+  {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    for (const auto& request : batch) {
+      const double latency =
+          std::chrono::duration<double, std::milli>(now - request->enqueue_time).count();
+      if (latencies_.size() < kLatencyWindowSize) {
+        latencies_.emplace_back(latency);
+      } else {
+        latencies_[request_num_ % kLatencyWindowSize] = latency;
+      }
+      request_num_ += 1;
+    }
+    batch_num_ += 1;
+    batched_row_num_ += row_num;
+  }
+  for (size_t i = 0; i < batch.size(); ++i) { batch[i]->outputs.set_value(std::move(outputs[i])); }
+  return of::Maybe<void>::Ok();
+}
+
+BatchingStats BatchingGraph::BatchingGraphImpl::GetStats() const {
+  BatchingStats stats;
+  std::vector<double> latencies;
+  {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats.request_num = request_num_;
+    stats.batch_num = batch_num_;
+    if (batch_num_ > 0) {
+      stats.average_batch_size = static_cast<double>(batched_row_num_) / batch_num_;
+      stats.average_batch_fill = stats.average_batch_size / options_.max_batch_size;
+    }
+    latencies = latencies_;
+  }
+  std::sort(latencies.begin(), latencies.end());
+  stats.latency_p50_ms = Percentile(latencies, 0.5);
+  stats.latency_p90_ms = Percentile(latencies, 0.9);
+  stats.latency_p99_ms = Percentile(latencies, 0.99);
+  stats.latency_max_ms = latencies.empty() ? 0 : latencies.back();
+  return stats;
+}
+
+void BatchingGraph::BatchingGraphImpl::ResetStats() {
+  std::lock_guard<std::mutex> lock(stats_mutex_);
+  request_num_ = 0;
+  batch_num_ = 0;
+  batched_row_num_ = 0;
+  latencies_.clear();
+}
+
+BatchingGraph::BatchingGraph(const std::string& model_path, const Device& device,
+                             const BatchingOptions& options)
+    : graph_(std::make_unique<BatchingGraphImpl>(model_path, device, options)) {}
+
+BatchingGraph::~BatchingGraph() = default;
+
+InputOutputInfos BatchingGraph::GetInputInfos() { return graph_->GetInputInfos(); }
+
+InputOutputInfos BatchingGraph::GetOutputInfos() { return graph_->GetOutputInfos(); }
+
+IValue BatchingGraph::Forward(const IValue& inputs) {
+  return FromTensorVector(graph_->Forward(ToTensorVector(inputs)));
+}
+
+BatchingStats BatchingGraph::GetStats() const { return graph_->GetStats(); }
+
+void BatchingGraph::ResetStats() { graph_->ResetStats(); }
+
+}  // namespace oneflow_api
@@ -0,0 +1,80 @@
+/*
+Copyright 2020 The OneFlow Authors. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef ONEFLOW_API_CPP_FRAMEWORK_BATCHING_GRAPH_H_
+#define ONEFLOW_API_CPP_FRAMEWORK_BATCHING_GRAPH_H_
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "device.h"
+#include "graph.h"
+#include "ivalue.h"
+
+namespace oneflow_api {
+
+struct BatchingOptions {
+  // The batch size the graph is compiled with, also the max number of rows of a batch.
+  int max_batch_size = 8;
+  // How long the first request of a batch waits for more requests.
+  std::chrono::microseconds batch_timeout = std::chrono::microseconds(1000);
+};
+
+struct BatchingStats {
+  int64_t request_num = 0;
+  int64_t batch_num = 0;
+  // The average number of rows per batch, and its ratio to max_batch_size.
+  double average_batch_size = 0;
+  double average_batch_fill = 0;
+  // Latencies from Forward being called to its outputs being ready, over the recent requests.
+  double latency_p50_ms = 0;
+  double latency_p90_ms = 0;
+  double latency_p99_ms = 0;
+  double latency_max_ms = 0;
+};
+
+// A Graph serving concurrent Forward calls with dynamic batching.
+//
+// Forward may be called from any number of threads. Each call is a request whose inputs share
+// the batch dimension 0. Queued requests are coalesced into one batch of at most max_batch_size
+// rows, or fewer once the first of them has waited batch_timeout. The batch is padded with zeros
+// to max_batch_size rows, run by one graph execution, and the rows of the outputs are scattered
+// back to the requests.
+class BatchingGraph final {
+ public:
+  explicit BatchingGraph(const std::string& model_path, const Device& device = Device("cpu"),
+                         const BatchingOptions& options = BatchingOptions());
+  ~BatchingGraph();
+
+  BatchingGraph(const BatchingGraph& graph) = delete;
+  BatchingGraph& operator=(const BatchingGraph& graph) = delete;
+
+  InputOutputInfos GetInputInfos();
+  InputOutputInfos GetOutputInfos();
+  // Blocks until the outputs of `inputs` are ready, the outputs are owned by the caller.
+  IValue Forward(const IValue& inputs);
+
+  BatchingStats GetStats() const;
+  void ResetStats();
+
+ private:
+  class BatchingGraphImpl;
+  std::unique_ptr<BatchingGraphImpl> graph_;
+};
+
+}  // namespace oneflow_api
+
+#endif  // ONEFLOW_API_CPP_FRAMEWORK_BATCHING_GRAPH_H_
@@ -13,6 +13,11 @@ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 See the License for the specific language governing permissions and
 limitations under the License.
 */
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <numeric>
 #include "nlohmann/json.hpp"
 #include "oneflow/api/common/variable_tensor_mgr.h"
 #include "oneflow/api/cpp/env_impl.h"
@@ -25,21 +30,28 @@ limitations under the License.
 #include "oneflow/api/cpp/embedding/embedding.h"
 #include "oneflow/api/common/job_build_and_infer_ctx.h"
 #include "oneflow/api/python/job_build/job_build_and_infer.h"
+#include "oneflow/core/common/blocking_counter.h"
 #include "oneflow/core/common/data_type.pb.h"
 #include "oneflow/core/common/singleton.h"
 #include "oneflow/core/common/hash_container.h"
 #include "oneflow/core/common/just.h"
+#include "oneflow/core/common/scalar.h"
 #include "oneflow/core/common/shape.h"
 #include "oneflow/core/common/symbol.h"
 #include "oneflow/core/common/util.h"
 #include "oneflow/core/embedding/posix_file.h"
 #include "oneflow/core/eager/eager_blob_object.h"
+#include "oneflow/core/eager/local_dep_object.h"
+#include "oneflow/core/eager/tensor_storage.h"
 #include "oneflow/core/framework/device.h"
 #include "oneflow/core/framework/dtype.h"
 #include "oneflow/core/framework/multi_client_session_context.h"
 #include "oneflow/core/framework/nn_graph.h"
 #include "oneflow/core/framework/scope_util.h"
+#include "oneflow/core/framework/stream.h"
 #include "oneflow/core/framework/tensor.h"
+#include "oneflow/core/framework/tensor_impl.h"
+#include "oneflow/core/framework/tensor_storage.h"
 #include "oneflow/core/framework/tensor_tuple.h"
 #include "oneflow/core/framework/tensor_util.h"
 #include "oneflow/core/functional/functional_api.yaml.h"
@@ -59,6 +71,7 @@ limitations under the License.
 #include "oneflow/core/operator/interface_blob_conf.pb.h"
 #include "oneflow/core/operator/op_conf.pb.h"
 #include "oneflow/core/register/logical_blob_id.pb.h"
+#include "oneflow/core/thread/thread_pool.h"
 #include "oneflow/core/vm/vm_util.h"
 
 namespace oneflow_api {
@@ -112,6 +125,53 @@ Shape OfShapeToOfApiShape(const of::Shape& of_shape) {
   return Shape(dims);
 }
 
+of::Shape OfApiShapeToOfShape(const Shape& shape) {
+  of::DimVector dims(shape.NumAxes());
+  for (int64_t i = 0; i < shape.NumAxes(); ++i) { dims[i] = shape.At(i); }
+  return of::Shape(dims);
+}
+
+// Graphs are built and compiled one at a time.
+std::mutex* GraphCompileMutex() {
+  static std::mutex mutex;
+  return &mutex;
+}
+
+bool FitsInShapes(const std::vector<Tensor>& inputs, const std::vector<of::Shape>& shapes) {
+  if (inputs.size() != shapes.size()) { return false; }
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    const Shape& shape = inputs[i].shape();
+    if (shape.NumAxes() != shapes[i].NumAxes()) { return false; }
+    for (int64_t axis = 0; axis < shape.NumAxes(); ++axis) {
+      if (shape.At(axis) > shapes[i].At(axis)) { return false; }
+    }
+  }
+  return true;
+}
+
+// Pads the end of each axis of `inputs` with zeros to `shapes`.
+of::Maybe<std::vector<Tensor>> PadToShapes(const std::vector<Tensor>& inputs,
+                                           const std::vector<of::Shape>& shapes) {
+  std::vector<Tensor> padded_inputs;
+  padded_inputs.reserve(inputs.size());
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    const auto& tensor = inputs[i].__internal_tensor();
+    if (*tensor->shape() == shapes[i]) {
+      padded_inputs.emplace_back(inputs[i]);
+      continue;
+    }
+    // ConstantPad takes the paddings of the last axis first.
+    std::vector<int64_t> paddings;
+    for (int64_t axis = shapes[i].NumAxes() - 1; axis >= 0; --axis) {
+      paddings.emplace_back(0);
+      paddings.emplace_back(shapes[i].At(axis) - tensor->shape()->At(axis));
+    }
+    padded_inputs.emplace_back(
+        JUST(of::one::functional::ConstantPad(tensor, paddings, of::Scalar(0))));
+  }
+  return padded_inputs;
+}
+
 #ifdef __linux__
 
 void LoadOneEmbedding(const std::string& model_path, const Device& device) {
@@ -134,6 +194,62 @@ void LoadOneEmbedding(const std::string& model_path, const Device& device) {
   }
 }
 
+// Shares the host memory of `mapped_file` with a new cpu tensor like `tensor`.
+of::Maybe<of::one::Tensor> NewTensorOnMappedFile(
+    const std::shared_ptr<of::one::Tensor>& tensor,
+    const std::shared_ptr<of::embedding::PosixMappedFile>& mapped_file, size_t size) {
+  const auto& device = JUST(tensor->device());
+  const auto& tensor_meta = of::SymbolOf(
+      of::one::LocalTensorMeta(*tensor->shape(), tensor->dtype()->data_type(), device));
+  auto vm_tensor_storage = std::make_shared<of::vm::TensorStorage>(false);
+  // The mapping is released with the tensor.
+  vm_tensor_storage->set_blob_dptr(
+      std::unique_ptr<char, std::function<void(char*)>>(
+          static_cast<char*>(mapped_file->ptr()), [mapped_file](char*) {}),
+      size);
+  auto tensor_impl = std::make_shared<of::one::EagerLocalTensorImpl>(
+      std::make_shared<of::one::TensorStorage>(vm_tensor_storage), /*requires_grad=*/false,
+      /*is_leaf=*/true);
+  JUST(tensor_impl->InitEagerBlobObject(tensor_meta, of::NewLocalDepObject()));
+  const auto& stream = JUST(of::GetDefaultStreamByDevice(device));
+  const auto& eager_blob_object = JUST(tensor_impl->eager_blob_object());
+  JUST(eager_blob_object->init_producer_stream(stream));
+  eager_blob_object->set_last_used_stream(stream);
+  return std::shared_ptr<of::one::Tensor>(new of::one::LocalTensor(tensor_impl));
+}
+
+// Loads `<variable_filename>` of `size` bytes into `tensor`. The file is mapped with
+// MAP_POPULATE so its pages are read by the calling thread, then copied straight into the blob of
+// `tensor`. If `map_weights`, `tensor` is replaced by a tensor on the private mapping instead, so
+// processes loading the same model share the page cache unless they write the weights.
+of::Maybe<void> LoadVariable(const std::string& variable_filename, size_t size, bool map_weights,
+                             std::shared_ptr<of::one::Tensor>* tensor) {
+  if (!of::embedding::PosixFile::FileExists(variable_filename)) {
+    return of::Error::RuntimeError() << "variable file " << variable_filename << " does not exist";
+  }
+  of::embedding::PosixFile file(variable_filename, O_RDONLY, 0);
+  if (file.Size() != size) {
+    return of::Error::RuntimeError() << "variable file " << variable_filename << " has "
+                                     << file.Size() << " bytes, but " << size << " are expected";
+  }
+  if (size == 0) { return of::Maybe<void>::Ok(); }
+  if (map_weights) {
+    const auto& mapped_file = std::make_shared<of::embedding::PosixMappedFile>(
+        std::move(file), size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_POPULATE);
+    *tensor = JUST(NewTensorOnMappedFile(*tensor, mapped_file, size));
+  } else {
+    of::embedding::PosixMappedFile mapped_file(std::move(file), size, PROT_READ,
+                                               MAP_PRIVATE | MAP_POPULATE);
+    const auto& callback = [&](of::ep::Stream* stream,
+                               const std::shared_ptr<of::vm::EagerBlobObject>& eager_blob_object) {
+      of::AutoMemcpy(stream, eager_blob_object->mut_dptr(), mapped_file.ptr(), size,
+                     eager_blob_object->mem_case(), of::memory::MakeHostMemCase());
+    };
+    JUST(of::one::SyncAccessTensorWithTimeOut(*tensor, callback, "mut"));
+  }
+  return of::Maybe<void>::Ok();
+}
+
 #endif  // __linux__
 
 }  // namespace
@@ -143,27 +259,50 @@ class Graph::GraphImpl final {
   explicit GraphImpl(const std::string& model_path, const Device& device = Device("cpu"));
 
   GraphImpl(const GraphImpl& graph) = delete;
-  GraphImpl(GraphImpl&& graph) = default;
+  GraphImpl(GraphImpl&& graph) = delete;
 
   ~GraphImpl();
 
   GraphImpl& operator=(const GraphImpl& graph) = delete;
-  GraphImpl& operator=(GraphImpl&& graph) = default;
+  GraphImpl& operator=(GraphImpl&& graph) = delete;
 
   InputOutputInfos GetInputInfos();
   InputOutputInfos GetOutputInfos();
   std::vector<Tensor> Forward(const std::vector<Tensor>& inputs);
   void set_batch_size(int batch_size) { batch_size_ = batch_size; }
+  void set_input_shape_buckets(const std::vector<std::vector<Shape>>& buckets);
 
   of::Maybe<void> RegisterJobPass(
       const std::function<std::string(const std::string& job)>& pass_fn);
 
  private:
+  // A compiled plan of an input shape bucket.
+  struct BucketPlan {
+    std::shared_ptr<of::NNGraph> graph;
+    std::shared_ptr<of::one::TensorTuple> output_tensor_tuple;
+  };
+  struct ShapeBucket {
+    std::vector<of::Shape> input_shapes;
+    std::shared_ptr<const BucketPlan> plan;
+    // valid once the plan starts compiling
+    std::shared_future<void> compiling;
+  };
+
   of::Maybe<void> CollectInputOutputInfos();
-  of::Maybe<void> Compile(const std::vector<Tensor>& inputs);
-  of::Maybe<std::vector<Tensor>> Run(const std::vector<Tensor>& inputs) const;
-  of::Maybe<void> AddOp(of::OperatorConf op_conf);
-  of::Maybe<void> BuildGraph();
+  of::Maybe<void> Compile(const std::vector<Tensor>& inputs,
+                          const of::HashMap<std::string, of::Shape>& input_name_to_shape);
+  of::Maybe<std::vector<Tensor>> Run(
+      const std::vector<Tensor>& inputs, const std::shared_ptr<of::NNGraph>& graph,
+      const std::shared_ptr<of::one::TensorTuple>& output_tensor_tuple) const;
+  of::Maybe<std::vector<Tensor>> BucketedForward(const std::vector<Tensor>& inputs);
+  of::Maybe<void> CompileBucket(size_t bucket_index);
+  of::HashMap<std::string, of::Shape> InputName2Shape(const std::vector<of::Shape>& shapes) const;
+  of::Maybe<void> AddOp(of::OperatorConf op_conf,
+                        const of::HashMap<std::string, of::Shape>& input_name_to_shape);
+  of::Maybe<void> BuildGraph(const of::HashMap<std::string, of::Shape>& input_name_to_shape);
+  of::Maybe<of::Job> BuildBucketJob(const std::string& job_name,
+                                    const of::HashMap<std::string, of::Shape>& input_name_to_shape,
+                                    int64_t* job_id);
   of::Maybe<void> LoadCheckpoint();
   of::Maybe<void> RegisterTensors(const std::vector<Tensor>& inputs);
   of::Maybe<of::Job> ApplyJobPasses(const of::Job& job);
@@ -182,6 +321,17 @@ class Graph::GraphImpl final {
   std::shared_ptr<of::one::TensorTuple> output_tensor_tuple_;
   std::shared_ptr<of::one::TensorTuple> parameter_tensor_tuple_;
   std::vector<std::function<std::string(const std::string&)>> registered_job_passes_;
+
+  std::vector<std::string> input_op_names_;
+  std::vector<std::string> output_op_names_;
+  // Ops of the job built from the model, in the order they are added.
+  std::vector<std::string> original_op_names_;
+  // The completed job of the first compiled bucket, the plans of other buckets are compiled from
+  // it with new inputs.
+  of::Job shared_job_;
+  // sorted by the number of elements
+  std::vector<ShapeBucket> shape_buckets_;
+  std::mutex shape_bucket_mutex_;
 };
 
 Graph::Graph(const std::string& model_path, const Device& device)
@@ -229,6 +379,10 @@ IValue Graph::Forward(const IValue& inputs) {
 
 void Graph::set_batch_size(int batch_size) { graph_->set_batch_size(batch_size); }
 
+void Graph::set_input_shape_buckets(const std::vector<std::vector<Shape>>& buckets) {
+  graph_->set_input_shape_buckets(buckets);
+}
+
 Graph Graph::Load(const std::string& model_path, const Device& device) {
 #ifdef __linux__
   LoadOneEmbedding(model_path, device);
@@ -296,42 +450,218 @@ of::Maybe<of::Job> Graph::GraphImpl::ApplyJobPasses(const of::Job& job) {
   return current_job;
 }
 
+void Graph::GraphImpl::set_input_shape_buckets(const std::vector<std::vector<Shape>>& buckets) {
+  CHECK(!is_compiled_) << "input shape buckets should be set before compile and forward";
+  shape_buckets_.clear();
+  for (const auto& shapes : buckets) {
+    CHECK_EQ(shapes.size(), input_infos_.size())
+        << "an input shape bucket should have a shape for each input";
+    ShapeBucket bucket;
+    for (const auto& shape : shapes) {
+      bucket.input_shapes.emplace_back(OfApiShapeToOfShape(shape));
+    }
+    shape_buckets_.emplace_back(std::move(bucket));
+  }
+  const auto& ElemCnt = [](const ShapeBucket& bucket) {
+    int64_t elem_cnt = 0;
+    for (const auto& shape : bucket.input_shapes) { elem_cnt += shape.elem_cnt(); }
+    return elem_cnt;
+  };
+  std::stable_sort(shape_buckets_.begin(), shape_buckets_.end(),
+                   [&](const ShapeBucket& lhs, const ShapeBucket& rhs) {
+                     return ElemCnt(lhs) < ElemCnt(rhs);
+                   });
+}
+
 std::vector<Tensor> Graph::GraphImpl::Forward(const std::vector<Tensor>& inputs) {
+  if (!shape_buckets_.empty()) { return BucketedForward(inputs).GetOrThrow(); }
   if (!is_compiled_) {
-    static std::mutex mtx;
-    std::lock_guard<std::mutex> lock(mtx);
-    Compile(inputs).GetOrThrow();
+    std::lock_guard<std::mutex> lock(*GraphCompileMutex());
+    Compile(inputs, {}).GetOrThrow();
     is_compiled_ = true;
   }
-  return Run(inputs).GetOrThrow();
+  return Run(inputs, graph_, output_tensor_tuple_).GetOrThrow();
 }
 
-of::Maybe<void> Graph::GraphImpl::Compile(const std::vector<Tensor>& inputs) {
-  JUST(BuildGraph());
+of::Maybe<std::vector<Tensor>> Graph::GraphImpl::BucketedForward(
+    const std::vector<Tensor>& inputs) {
+  std::vector<size_t> fitting_bucket_indices;
+  for (size_t i = 0; i < shape_buckets_.size(); ++i) {
+    if (FitsInShapes(inputs, shape_buckets_[i].input_shapes)) {
+      fitting_bucket_indices.emplace_back(i);
+    }
+  }
+  if (fitting_bucket_indices.empty()) {
+    return of::Error::RuntimeError() << "the inputs fit in none of the input shape buckets";
+  }
+  const size_t nearest_bucket_index = fitting_bucket_indices.front();
+  if (!is_compiled_) {
+    // The first bucket is built and compiled from the model, like a graph without buckets.
+    std::lock_guard<std::mutex> lock(*GraphCompileMutex());
+    ShapeBucket& bucket = shape_buckets_[nearest_bucket_index];
+    JUST(Compile(*JUST(PadToShapes(inputs, bucket.input_shapes)),
+                 InputName2Shape(bucket.input_shapes)));
+    std::lock_guard<std::mutex> bucket_lock(shape_bucket_mutex_);
+    bucket.plan = std::make_shared<const BucketPlan>(BucketPlan{graph_, output_tensor_tuple_});
+    is_compiled_ = true;
+  }
+  size_t bucket_index = nearest_bucket_index;
+  std::shared_ptr<const BucketPlan> plan;
+  std::shared_future<void> compiling;
+  {
+    std::lock_guard<std::mutex> lock(shape_bucket_mutex_);
+    ShapeBucket& nearest_bucket = shape_buckets_[nearest_bucket_index];
+    if (!nearest_bucket.plan && !nearest_bucket.compiling.valid()) {
+      const auto& CompileNearestBucket = [this, nearest_bucket_index]() {
+        CompileBucket(nearest_bucket_index).GetOrThrow();
+      };
+      nearest_bucket.compiling = std::async(std::launch::async, CompileNearestBucket).share();
+    }
+    // Serve with the nearest compiled bucket while the nearest bucket is compiling.
+    for (size_t index : fitting_bucket_indices) {
+      if (shape_buckets_[index].plan) {
+        bucket_index = index;
+        plan = shape_buckets_[index].plan;
+        break;
+      }
+    }
+    if (!plan) { compiling = nearest_bucket.compiling; }
+  }
+  if (!plan) {
+    compiling.get();
+    std::lock_guard<std::mutex> lock(shape_bucket_mutex_);
+    plan = shape_buckets_[nearest_bucket_index].plan;
+  }
+  const auto& padded_inputs =
+      JUST(PadToShapes(inputs, shape_buckets_[bucket_index].input_shapes));
+  return Run(*padded_inputs, plan->graph, plan->output_tensor_tuple);
+}
+
+of::HashMap<std::string, of::Shape> Graph::GraphImpl::InputName2Shape(
+    const std::vector<of::Shape>& shapes) const {
+  of::HashMap<std::string, of::Shape> input_name_to_shape;
+  for (const auto& input_info : input_infos_) {
+    input_name_to_shape.emplace(input_info.first,
+                                shapes.at(input_info.second.input_output_index_));
+  }
+  return input_name_to_shape;
+}
+
+of::Maybe<void> Graph::GraphImpl::Compile(
+    const std::vector<Tensor>& inputs,
+    const of::HashMap<std::string, of::Shape>& input_name_to_shape) {
+  JUST(BuildGraph(input_name_to_shape));
   JUST(RegisterTensors(inputs));
-  JUST(graph_->CompileAndInitRuntime());
+  JUST(graph_->AlignStatesAfterLogicalGraphCompile());
+  JUST(graph_->CompleteLogicalGraphForRuntime());
+  // Compiling the plan modifies the job.
+  if (!shape_buckets_.empty()) { shared_job_ = graph_->job(); }
+  JUST(graph_->CompilePlanForRuntime());
+  JUST(graph_->InitRuntime());
   return of::Maybe<void>::Ok();
 }
 
-of::Maybe<std::vector<Tensor>> Graph::GraphImpl::Run(const std::vector<Tensor>& inputs) const {
+of::Maybe<void> Graph::GraphImpl::CompileBucket(size_t bucket_index) {
+  std::lock_guard<std::mutex> lock(*GraphCompileMutex());
+  const std::vector<of::Shape>& input_shapes = shape_buckets_[bucket_index].input_shapes;
+  const std::string job_name = job_.job_conf().job_name() + "_bucket" + of::NewUniqueId();
+  int64_t job_id = 0;
+  const auto& original_job = JUST(BuildBucketJob(job_name, InputName2Shape(input_shapes), &job_id));
+  if (original_job->net().op_size() != original_op_names_.size()) {
+    return of::Error::RuntimeError() << "the job of input shape bucket " << job_name
+                                     << " has different ops from the model";
+  }
+
+  of::Job job = shared_job_;
+  job.mutable_job_conf()->set_job_name(job_name);
+  auto graph = std::make_shared<of::NNGraph>(job_name, job, job_id,
+                                             of::Singleton<OneFlowEnv>::Get()->GetSessionCtx());
+  std::vector<std::shared_ptr<of::one::Tensor>> input_tensors;
+  {
+    const of::LazyMode::Guard lazy_mode_disabled_guard{false};
+    for (size_t i = 0; i < input_op_names_.size(); ++i) {
+      const auto& input_info = input_infos_.at(input_op_names_[i]);
+      input_tensors.emplace_back(JUST(of::one::functional::Empty(
+          input_shapes[i],
+          JUST(of::DType::Get(static_cast<of::DataType>(input_info.datatype_))),
+          *device_.device_, /*requires_grad=*/false, /*pin_memory=*/false)));
+    }
+  }
+  JUST(graph->BuildWithNewInputFromSharedGraph(input_op_names_, input_tensors,
+                                               original_op_names_,
+                                               original_job->SerializeAsString()));
+  // The outputs have new shapes inferred from the new inputs.
+  std::vector<std::shared_ptr<of::one::Tensor>> output_tensors;
+  {
+    const of::LazyMode::Guard lazy_mode_disabled_guard{false};
+    const auto& lbn2logical_blob_desc = graph->job().helper().lbn2logical_blob_desc();
+    for (size_t i = 0; i < output_op_names_.size(); ++i) {
+      const auto& iter = lbn2logical_blob_desc.find(output_op_names_[i] + "/out");
+      if (iter == lbn2logical_blob_desc.end()) {
+        return of::Error::RuntimeError()
+               << "output " << output_op_names_[i] << " of job " << job_name << " not found";
+      }
+      output_tensors.emplace_back(JUST(of::one::functional::Empty(
+          of::Shape(iter->second.shape()), output_tensor_tuple_->at(i)->dtype(),
+          *device_.device_, /*requires_grad=*/false, /*pin_memory=*/false)));
+    }
+  }
+  JUST(graph->RegisterOutputOpNamesAndTensors(output_op_names_, output_tensors));
+  {
+    // All plans share the variables.
+    const auto& t = of::DumpVariableTensorMgr();
+    JUST(graph->RegisterVariableOpNamesAndTensors(std::get<0>(t), std::get<1>(t)));
+  }
+  JUST(graph->AlignStatesAfterLogicalGraphCompile());
+  JUST(graph->CompilePlanForRuntime());
+  JUST(graph->InitRuntime());
+
+  std::lock_guard<std::mutex> bucket_lock(shape_bucket_mutex_);
+  shape_buckets_[bucket_index].plan =
+      std::make_shared<const BucketPlan>(BucketPlan{graph, ConvertToTensorTuple(output_tensors)});
+  return of::Maybe<void>::Ok();
+}
+
+of::Maybe<of::Job> Graph::GraphImpl::BuildBucketJob(
+    const std::string& job_name, const of::HashMap<std::string, of::Shape>& input_name_to_shape,
+    int64_t* job_id) {
+  of::JobConfigProto job_conf = job_.job_conf();
+  job_conf.set_job_name(job_name);
+  CompileScope build_graph_scope(job_conf, *device_.device_->shared_from_symbol());
+  const of::OpGraph op_graph(job_);
+  JUST(op_graph.TopoForEachNodeWithErrorCaptured([&](const of::OpNode* node) -> of::Maybe<void> {
+    return AddOp(node->op().op_conf(), input_name_to_shape);
+  }));
+  JUST(of::CurJobBuildAndInferCtx_Complete());
+  *job_id = JUST(of::JobBuildAndInferCtx_GetCurrentJobId());
+  return ApplyJobPasses(*JUST(of::GetCurrentJob()));
+}
+
+of::Maybe<std::vector<Tensor>> Graph::GraphImpl::Run(
+    const std::vector<Tensor>& inputs, const std::shared_ptr<of::NNGraph>& graph,
+    const std::shared_ptr<of::one::TensorTuple>& output_tensor_tuple) const {
   const auto input_tensor_tuple = std::make_shared<of::one::TensorTuple>();
   for (const auto& tensor : inputs) { input_tensor_tuple->emplace_back(tensor.tensor_); }
 
-  JUST(of::RunLazyNNGraph(*input_tensor_tuple, *output_tensor_tuple_, graph_));
-  JUST(of::SoftSyncNNGraphBuffers(*output_tensor_tuple_, graph_));
+  JUST(of::RunLazyNNGraph(*input_tensor_tuple, *output_tensor_tuple, graph));
+  JUST(of::SoftSyncNNGraphBuffers(*output_tensor_tuple, graph));
 
   std::vector<Tensor> outputs;
-  for (const auto& tensor : *output_tensor_tuple_) { outputs.emplace_back(Tensor(tensor)); }
+  for (const auto& tensor : *output_tensor_tuple) { outputs.emplace_back(Tensor(tensor)); }
   return outputs;
 }
 
-of::Maybe<void> Graph::GraphImpl::AddOp(of::OperatorConf op_conf) {
+of::Maybe<void> Graph::GraphImpl::AddOp(
+    of::OperatorConf op_conf, const of::HashMap<std::string, of::Shape>& input_name_to_shape) {
   {
     const std::shared_ptr<of::Scope> scope = JUST(of::GetCurrentScope());
     op_conf.set_scope_symbol_id(scope->symbol_id().value_or(0));
   }
   op_conf.set_device_tag(GetDeviceTag(device_));
-  if (batch_size_ > 0 && op_conf.has_input_conf()) {
+  const auto& iter = input_name_to_shape.find(op_conf.name());
+  if (iter != input_name_to_shape.end()) {
+    iter->second.ToProto(op_conf.mutable_input_conf()->mutable_blob_conf()->mutable_shape());
+  } else if (batch_size_ > 0 && op_conf.has_input_conf()) {
     op_conf.mutable_input_conf()->mutable_blob_conf()->mutable_shape()->mutable_dim()->Set(
         0, batch_size_);
   }
@@ -340,13 +670,14 @@ of::Maybe<void> Graph::GraphImpl::AddOp(of::OperatorConf op_conf) {
   return of::Maybe<void>::Ok();
 }
 
-of::Maybe<void> Graph::GraphImpl::BuildGraph() {
+of::Maybe<void> Graph::GraphImpl::BuildGraph(
+    const of::HashMap<std::string, of::Shape>& input_name_to_shape) {
   CompileScope build_graph_scope(job_.job_conf(), *device_.device_->shared_from_symbol());
   {
     const of::OpGraph op_graph(job_);
     op_graph.TopoForEachNode([&](const of::OpNode* node) -> of::Maybe<void> {
       const of::OperatorConf& op_conf = node->op().op_conf();
-      JUST(AddOp(op_conf));
+      JUST(AddOp(op_conf, input_name_to_shape));
       if (op_conf.has_variable_conf()) {
         const of::LazyMode::Guard lazy_mode_disabled_guard{false};
         const of::VariableOpConf& variable_conf = op_conf.variable_conf();
@@ -366,6 +697,10 @@ of::Maybe<void> Graph::GraphImpl::BuildGraph() {
 
   // apply custom job passes
   complete_job = JUST(ApplyJobPasses(*complete_job));
+  original_op_names_.clear();
+  for (const auto& op_conf : complete_job->net().op()) {
+    original_op_names_.emplace_back(op_conf.name());
+  }
   graph_ = std::make_shared<of::NNGraph>(job_.job_conf().job_name(), *complete_job, job_id,
                                          of::Singleton<OneFlowEnv>::Get()->GetSessionCtx());
   {
@@ -375,7 +710,7 @@ of::Maybe<void> Graph::GraphImpl::BuildGraph() {
       const of::OperatorConf& op_conf = node->op().op_conf();
       if (op_conf.has_output_conf()) {
         of::InterfaceBlobConf blob_conf = op_conf.output_conf().blob_conf();
-        if (batch_size_ > 0) {
+        if (batch_size_ > 0 || !input_name_to_shape.empty()) {
           const std::string input_lbi_str = op_conf.output_conf().in();
           const of::LogicalBlobId input_lbi = of::GenLogicalBlobId(input_lbi_str);
           int64_t batch_size = node->LogicalBlobDesc4Lbi(input_lbi).shape().At(0);
@@ -393,10 +728,58 @@ of::Maybe<void> Graph::GraphImpl::BuildGraph() {
 }
 
 of::Maybe<void> Graph::GraphImpl::LoadCheckpoint() {
-  for (const auto& variable_op_name_and_tensor : variable_op_name_to_tensor_) {
-    const auto& variable_op_name = variable_op_name_and_tensor.first;
-    const auto& variable_tensor = variable_op_name_and_tensor.second;
-    const std::string variable_filename = model_path_ + "/" + variable_op_name + "/out";
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<std::string> variable_op_names;
+  std::vector<std::shared_ptr<of::one::Tensor>> variable_tensors;
+  std::tie(variable_op_names, variable_tensors) = Unzip(variable_op_name_to_tensor_);
+  std::vector<size_t> variable_sizes(variable_tensors.size());
+  for (size_t i = 0; i < variable_tensors.size(); ++i) {
+    variable_sizes[i] = variable_tensors[i]->shape()->elem_cnt()
+                        * of::GetSizeOfDataType(variable_tensors[i]->dtype()->data_type());
+  }
+#ifdef __linux__
+  // Mapping the weights only works for host memory.
+  const bool map_weights = device_.type() == "cpu"
+                           && of::ParseBooleanFromEnv("ONEFLOW_SERVING_MAP_WEIGHTS", false);
+  const size_t thread_num = std::min<size_t>(
+      std::max<int64_t>(of::ParseIntegerFromEnv("ONEFLOW_SERVING_LOAD_THREAD_NUM", 8), 1),
+      variable_tensors.size());
+  std::vector<std::shared_ptr<of::StackedError>> errors(variable_tensors.size());
+  if (thread_num > 0) {
+    // Large variables first, so that the loading threads finish at about the same time.
+    std::vector<size_t> order(variable_tensors.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t lhs, size_t rhs) {
+      return variable_sizes[lhs] > variable_sizes[rhs];
+    });
+    std::atomic<size_t> next_index(0);
+    of::ThreadPool thread_pool(thread_num);
+    of::BlockingCounter counter(thread_num);
+    for (size_t thread_id = 0; thread_id < thread_num; ++thread_id) {
+      thread_pool.AddWork([&]() {
+        for (size_t i = next_index++; i < order.size(); i = next_index++) {
+          const size_t index = order[i];
+          const std::string variable_filename =
+              model_path_ + "/" + variable_op_names[index] + "/out";
+          errors[index] = LoadVariable(variable_filename, variable_sizes[index], map_weights,
+                                       &variable_tensors[index])
+                              .GetDataAndStackedError();
+        }
+        counter.Decrease();
+      });
+    }
+    counter.WaitForeverUntilCntEqualZero();
+  }
+  for (const auto& error : errors) {
+    if (error) { return error; }
+  }
+  for (size_t i = 0; i < variable_tensors.size(); ++i) {
+    variable_op_name_to_tensor_[variable_op_names[i]] = variable_tensors[i];
+  }
+#else
+  for (size_t i = 0; i < variable_tensors.size(); ++i) {
+    const auto& variable_tensor = variable_tensors[i];
+    const std::string variable_filename = model_path_ + "/" + variable_op_names[i] + "/out";
     const std::string buffer = [&]() {
       std::ifstream variable_file(variable_filename, std::ios::binary);
       CHECK(variable_file.is_open());
@@ -406,15 +789,18 @@ of::Maybe<void> Graph::GraphImpl::LoadCheckpoint() {
     }();
     const auto& callback = [&](of::ep::Stream* stream,
                                const std::shared_ptr<of::vm::EagerBlobObject>& eager_blob_object) {
-      of::AutoMemcpy(stream, eager_blob_object->mut_dptr(), buffer.data(),
-                     variable_tensor->shape()->elem_cnt()
-                         * of::GetSizeOfDataType(variable_tensor->dtype()->data_type()),
+      of::AutoMemcpy(stream, eager_blob_object->mut_dptr(), buffer.data(), variable_sizes[i],
                      eager_blob_object->mem_case(), of::memory::MakeHostMemCase());
     };
     JUST(of::one::SyncAccessTensorWithTimeOut(variable_tensor, callback, "mut"));
   }
-  const auto& pair = Unzip(variable_op_name_to_tensor_);
-  JUST(of::FillVariableTensorMgr(pair.first, pair.second));
+#endif  // __linux__
+  JUST(of::FillVariableTensorMgr(variable_op_names, variable_tensors));
+  const double seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  LOG(INFO) << "Loaded " << variable_tensors.size() << " variables ("
+            << std::accumulate(variable_sizes.begin(), variable_sizes.end(), size_t(0))
+            << " bytes) from " << model_path_ << " in " << seconds << " s";
   return of::Maybe<void>::Ok();
 }
 
@@ -428,12 +814,14 @@ of::Maybe<void> Graph::GraphImpl::RegisterTensors(const std::vector<Tensor>& inp
       input_tensors[index] = inputs.at(index).tensor_;
     }
     JUST(graph_->RegisterInputOpNamesAndTensors(input_op_names, input_tensors));
+    input_op_names_ = input_op_names;
   }
   {
     const auto& pair = Unzip(output_name_to_tensor_);
     const std::vector<std::string>& output_op_names = pair.first;
     const std::vector<std::shared_ptr<of::one::Tensor>>& output_tensors = pair.second;
     JUST(graph_->RegisterOutputOpNamesAndTensors(output_op_names, output_tensors));
+    output_op_names_ = output_op_names;
     output_tensor_tuple_ = ConvertToTensorTuple(output_tensors);
   }
   {
@@ -446,6 +834,11 @@ of::Maybe<void> Graph::GraphImpl::RegisterTensors(const std::vector<Tensor>& inp
   return of::Maybe<void>::Ok();
 }
 
-Graph::GraphImpl::~GraphImpl() { of::vm::ClusterSync().GetOrThrow(); }
+Graph::GraphImpl::~GraphImpl() {
+  for (const auto& bucket : shape_buckets_) {
+    if (bucket.compiling.valid()) { bucket.compiling.wait(); }
+  }
+  of::vm::ClusterSync().GetOrThrow();
+}
 
 }  // namespace oneflow_api
@@ -26,6 +26,7 @@ limitations under the License.
 #include <string>
 #include <functional>
 #include <unordered_map>
+#include <vector>
 
 namespace oneflow {
 
@@ -64,6 +65,11 @@ class Graph {
   InputOutputInfos GetOutputInfos();
   IValue Forward(const IValue& inputs);
   void set_batch_size(int batch_size);
+  // Compiles a plan for each of `buckets` on first use, each bucket is the shapes of all inputs.
+  // Inputs are padded with zeros at the end of each axis to the smallest bucket they fit in, and
+  // the outputs are those of the padded inputs. All plans share the variables. While a bucket is
+  // compiling in the background, inputs fitting in it are served by a larger compiled bucket.
+  void set_input_shape_buckets(const std::vector<std::vector<Shape>>& buckets);
 
   void RegisterJobPass(const std::function<std::string(const std::string& job)>& pass_fn);
 
@@ -0,0 +1,193 @@
+/*
+Copyright 2020 The OneFlow Authors. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <gtest/gtest.h>
+#include "oneflow/api/cpp/tests/api_test.h"
+#include "oneflow/core/autograd/autograd_engine.h"
+#include "oneflow/core/framework/dtype.h"
+#include "oneflow/core/framework/tensor_tuple.h"
+#include "oneflow/core/functional/functional.h"
+#include "oneflow/core/job/parallel_desc.h"
+#include "oneflow/core/job/sbp_parallel.h"
+
+namespace oneflow_api {
+
+namespace of = oneflow;
+namespace functional = of::one::functional;
+
+namespace {
+
+std::shared_ptr<of::one::Tensor> RandomLeaf(const Shape& shape) {
+  const auto data = RandomData<float>(shape.Count(0));
+  auto tensor = Tensor::from_buffer(data.data(), shape, Device("cpu"), DType::kFloat);
+  const auto& leaf = tensor.__internal_tensor();
+  leaf->set_requires_grad(true).GetOrThrow();
+  return leaf;
+}
+
+// Casts the local `tensor` to a global tensor broadcast on the cpu of rank 0.
+std::shared_ptr<of::one::Tensor> ToBroadcastGlobal(const std::shared_ptr<of::one::Tensor>& tensor) {
+  of::ParallelConf parallel_conf;
+  parallel_conf.set_device_tag("cpu");
+  parallel_conf.add_device_name("0:0");
+  const auto& placement = of::SymbolOf(of::ParallelDesc(parallel_conf));
+  const auto& broadcast = of::MakeBroadcastSbpParallel().GetOrThrow();
+  return functional::LocalToGlobal(tensor, placement, {broadcast}, *tensor->shape(),
+                                   tensor->dtype(), /*sync_data=*/false, /*copy=*/false)
+      .GetPtrOrThrow();
+}
+
+// A wide graph: `width` independent chains of matmul and tanh sharing the input `x`. If
+// `to_global`, the end of each chain is cast to a global tensor, whose backward runs a boxing.
+struct WideGraph {
+  std::shared_ptr<of::one::Tensor> x;
+  std::vector<std::shared_ptr<of::one::Tensor>> weights;
+  bool to_global;
+
+  WideGraph(int64_t width, int64_t depth, int64_t size, bool to_global = false)
+      : to_global(to_global) {
+    x = RandomLeaf(Shape({size, size}));
+    for (int64_t i = 0; i < width * depth; ++i) {
+      weights.push_back(RandomLeaf(Shape({size, size})));
+    }
+  }
+
+  // Runs forward and backward, returns the grads of `x` and of the weights.
+  std::vector<std::vector<float>> RunBackward(int64_t width, int64_t depth) const {
+    std::shared_ptr<of::one::Tensor> loss;
+    for (int64_t i = 0; i < width; ++i) {
+      auto hidden = x;
+      for (int64_t j = 0; j < depth; ++j) {
+        hidden = functional::MatMul(hidden, weights[i * depth + j], false, false, 1.0)
+                     .GetPtrOrThrow();
+        hidden = functional::Tanh(hidden).GetPtrOrThrow();
+      }
+      if (to_global) { hidden = ToBroadcastGlobal(hidden); }
+      const auto& sum = functional::ReduceSumWhole(hidden).GetPtrOrThrow();
+      loss = loss ? functional::Add(loss, sum, 1.0, false).GetPtrOrThrow() : sum;
+    }
+    std::vector<std::shared_ptr<of::one::Tensor>> leaves{x};
+    leaves.insert(leaves.end(), weights.begin(), weights.end());
+    for (const auto& leaf : leaves) { leaf->set_acc_grad(nullptr).GetOrThrow(); }
+    const auto& loss_grad = functional::OnesLike(loss).GetPtrOrThrow();
+    of::one::GetThreadLocalAutogradEngine()
+        ->RunBackwardAndSaveGrads4LeafTensorIf({loss}, {loss_grad}, /*retain_graph=*/false,
+                                               /*create_graph=*/false)
+        .GetOrThrow();
+    std::vector<std::vector<float>> grads;
+    for (const auto& leaf : leaves) {
+      // leaves are local, so are their grads
+      const Tensor grad(leaf->acc_grad().GetPtrOrThrow());
+      grads.emplace_back(grad.shape().Count(0));
+      grad.copy_to(grads.back().data());
+    }
+    return grads;
+  }
+};
+
+// Returns the grads of every run.
+std::vector<std::vector<std::vector<float>>> RunWideGraph(const WideGraph& graph, int64_t width,
+                                                          int64_t depth, int64_t worker_num,
+                                                          int64_t repeat) {
+  setenv("ONEFLOW_AUTOGRAD_BACKWARD_WORKER_NUM", std::to_string(worker_num).c_str(), 1);
+  std::vector<std::vector<std::vector<float>>> grads;
+  // NOTE: the env var is cached per thread, so run in a new thread.
+  std::thread thread([&]() {
+    for (int64_t i = 0; i < repeat; ++i) { grads.push_back(graph.RunBackward(width, depth)); }
+  });
+  thread.join();
+  unsetenv("ONEFLOW_AUTOGRAD_BACKWARD_WORKER_NUM");
+  return grads;
+}
+
+// Returns the average latency of forward and backward.
+double BenchmarkWideGraph(const WideGraph& graph, int64_t width, int64_t depth,
+                          int64_t worker_num) {
+  setenv("ONEFLOW_AUTOGRAD_BACKWARD_WORKER_NUM", std::to_string(worker_num).c_str(), 1);
+  double milliseconds = 0;
+  std::thread thread([&]() {
+    graph.RunBackward(width, depth);  // warm up
+    const int iter_num = 10;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iter_num; ++i) { graph.RunBackward(width, depth); }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    milliseconds = std::chrono::duration<double, std::milli>(elapsed).count() / iter_num;
+  });
+  thread.join();
+  unsetenv("ONEFLOW_AUTOGRAD_BACKWARD_WORKER_NUM");
+  return milliseconds;
+}
+
+void TestParallelBackward(int64_t width, int64_t depth, int64_t size, int64_t worker_num,
+                          int64_t repeat, bool to_global = false) {
+  const WideGraph graph(width, depth, size, to_global);
+  const auto& serial = RunWideGraph(graph, width, depth, /*worker_num=*/0, /*repeat=*/1).at(0);
+  for (const auto& parallel : RunWideGraph(graph, width, depth, worker_num, repeat)) {
+    ASSERT_EQ(serial.size(), parallel.size());
+    for (size_t i = 0; i < serial.size(); ++i) {
+      ASSERT_EQ(serial[i].size(), parallel[i].size());
+      for (size_t j = 0; j < serial[i].size(); ++j) {
+        ASSERT_NEAR(serial[i][j], parallel[i][j], 1e-4 * (1 + std::abs(serial[i][j])))
+            << "grad " << i << ", element " << j;
+      }
+    }
+  }
+}
+
+}  // namespace
+
+TEST(Api, autograd_parallel_backward) {
+  EnvScope scope;
+
+  TestParallelBackward(/*width=*/8, /*depth=*/2, /*size=*/16, /*worker_num=*/4, /*repeat=*/1);
+}
+
+TEST(Api, autograd_parallel_backward_repeated) {
+  EnvScope scope;
+
+  // The input is read by the backward bodies of all the chains, which run on different workers.
+  TestParallelBackward(/*width=*/64, /*depth=*/4, /*size=*/32, /*worker_num=*/8, /*repeat=*/10);
+}
+
+TEST(Api, autograd_parallel_backward_local_to_global) {
+  EnvScope scope;
+
+  // The local chains run on the workers, the local_to_global backward bodies on the calling
+  // thread.
+  TestParallelBackward(/*width=*/16, /*depth=*/2, /*size=*/16, /*worker_num=*/4, /*repeat=*/3,
+                       /*to_global=*/true);
+}
+
+TEST(Api, autograd_parallel_backward_benchmark) {
+  EnvScope scope;
+
+  const int64_t width = 64;
+  const int64_t depth = 4;
+  const WideGraph graph(width, depth, 128);
+  for (int64_t worker_num : {0, 2, 4, 8}) {
+    const double milliseconds = BenchmarkWideGraph(graph, width, depth, worker_num);
+    std::cout << "wide graph (width " << width << ", depth " << depth << ") forward and backward "
+              << "with " << worker_num << " backward workers: " << milliseconds << " ms"
+              << std::endl;
+  }
+}
+
+}  // namespace oneflow_api
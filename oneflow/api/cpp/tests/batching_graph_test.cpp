@@ -0,0 +1,130 @@
+/*
+Copyright 2020 The OneFlow Authors. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "oneflow/api/cpp/framework.h"
+#include "oneflow/api/cpp/tests/api_test.h"
+
+namespace oneflow_api {
+
+namespace {
+
+const char* const kModelPath = "./oneflow/api/cpp/tests/graph_test_model/affine_with_parameter";
+
+// The model maps inputs of shape (n, 3) filled with ones to outputs of shape (n, 4) filled with 4.
+bool ForwardAndCheck(BatchingGraph& graph, const Device& device, int batch_size) {
+  std::vector<float> data(batch_size * 3, 1);
+  const auto& value = graph.Forward(
+      Tensor::from_buffer(data.data(), Shape({batch_size, 3}), device, DType::kFloat));
+  if (!value.IsTensor()) { return false; }
+  const Tensor output = value.ToTensor();
+  if (output.shape().At(0) != batch_size || output.shape().At(1) != 4) { return false; }
+  std::vector<float> buf(batch_size * 4);
+  output.copy_to(buf.data());
+  return std::all_of(buf.begin(), buf.end(), [](float element) { return element == 4; });
+}
+
+// Sends `request_num` requests of batch size 1 from each of `client_num` threads, returns the
+// number of requests per second.
+double RunClients(BatchingGraph& graph, const Device& device, int client_num, int request_num) {
+  std::atomic<int> failed_num(0);
+  std::vector<std::thread> threads;
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < client_num; ++i) {
+    threads.emplace_back([&]() {
+      for (int j = 0; j < request_num; ++j) {
+        if (!ForwardAndCheck(graph, device, 1)) { failed_num += 1; }
+      }
+    });
+  }
+  for (auto& thread : threads) { thread.join(); }
+  const double seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  EXPECT_EQ(failed_num, 0);
+  return client_num * request_num / seconds;
+}
+
+}  // namespace
+
+TEST(Api, batching_graph_test) {
+  EnvScope scope;
+  Device device("cpu");
+  BatchingOptions options;
+  options.max_batch_size = 8;
+  BatchingGraph graph(kModelPath, device, options);
+
+  const int client_num = 8;
+  const int request_num = 10;
+  std::atomic<int> failed_num(0);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < client_num; ++i) {
+    threads.emplace_back([&, i]() {
+      for (int j = 0; j < request_num; ++j) {
+        if (!ForwardAndCheck(graph, device, 1 + (i + j) % 3)) { failed_num += 1; }
+      }
+    });
+  }
+  for (auto& thread : threads) { thread.join(); }
+  ASSERT_EQ(failed_num, 0);
+
+  const BatchingStats stats = graph.GetStats();
+  ASSERT_EQ(stats.request_num, client_num * request_num);
+  ASSERT_GT(stats.batch_num, 0);
+  ASSERT_LE(stats.batch_num, stats.request_num);
+  ASSERT_LE(stats.average_batch_size, options.max_batch_size);
+  ASSERT_LE(stats.latency_p50_ms, stats.latency_p99_ms);
+
+  std::vector<float> data(3 * (options.max_batch_size + 1), 1);
+  ASSERT_ANY_THROW(graph.Forward(Tensor::from_buffer(
+      data.data(), Shape({options.max_batch_size + 1, 3}), device, DType::kFloat)));
+  // requests not matching the graph inputs are rejected without failing the others
+  ASSERT_ANY_THROW(
+      graph.Forward(Tensor::from_buffer(data.data(), Shape({1, 4}), device, DType::kFloat)));
+  ASSERT_ANY_THROW(
+      graph.Forward(Tensor::from_buffer(data.data(), Shape({1, 3}), device, DType::kInt32)));
+  ASSERT_TRUE(ForwardAndCheck(graph, device, 1));
+}
+
+TEST(Api, batching_graph_benchmark) {
+  EnvScope scope;
+  Device device("cpu");
+  const int request_num = 50;
+  for (int max_batch_size : {1, 8, 32}) {
+    BatchingOptions options;
+    options.max_batch_size = max_batch_size;
+    options.batch_timeout = std::chrono::microseconds(500);
+    BatchingGraph graph(kModelPath, device, options);
+    // compile the graph
+    ASSERT_TRUE(ForwardAndCheck(graph, device, 1));
+    for (int client_num : {1, 8, 32}) {
+      graph.ResetStats();
+      const double throughput = RunClients(graph, device, client_num, request_num);
+      const BatchingStats stats = graph.GetStats();
+      std::cout << "max batch size " << max_batch_size << ", " << client_num
+                << " clients: " << throughput << " requests/s, batch fill "
+                << stats.average_batch_fill << ", latency p50 " << stats.latency_p50_ms
+                << " ms, p90 " << stats.latency_p90_ms << " ms, p99 " << stats.latency_p99_ms
+                << " ms" << std::endl;
+    }
+  }
+}
+
+}  // namespace oneflow_api
@@ -19,6 +19,7 @@ limitations under the License.
 #include <array>
 #include <chrono>
 #include <cstdint>
+#include <cstdlib>
 #include <functional>
 #include <iostream>
 #include <thread>
@@ -55,6 +56,17 @@ inline void Forward(Graph& graph, const Device& device, int expected_batch_dim =
   for (const float& element : buf) { ASSERT_EQ(element, 4); }
 }
 
+// Runs a forward pass on an input of varying values, so that every weight affects the output.
+inline std::vector<float> ForwardVaryingInput(Graph& graph, const Device& device) {
+  std::vector<float> data = {-1.0f, 0.5f, 2.0f};
+  std::vector<Tensor> inputs;
+  inputs.emplace_back(Tensor::from_buffer(data.data(), Shape({1, 3}), device, DType::kFloat));
+  const Tensor output = graph.Forward(inputs).ToTensor();
+  std::vector<float> buf(output.shape().elem_cnt());
+  output.copy_to(buf.data());
+  return buf;
+}
+
 }  // namespace
 
 TEST(Api, graph_cpu_test) {
@@ -92,6 +104,56 @@ TEST(Api, graph_cpu_batching_test) {
   Forward(graph, device, 10);
 }
 
+TEST(Api, graph_cpu_input_shape_buckets_test) {
+  EnvScope scope;
+  Device device("cpu");
+  Graph graph = LoadGraph(device);
+  graph.set_input_shape_buckets({{Shape({2, 3})}, {Shape({8, 3})}, {Shape({4, 3})}});
+
+  // Returns the batch size of the bucket which runs `batch_size` rows.
+  const auto& BucketedForward = [&](int batch_size) {
+    std::vector<float> data(batch_size * 3, 1);
+    const auto& value = graph.Forward(
+        Tensor::from_buffer(data.data(), Shape({batch_size, 3}), device, DType::kFloat));
+    const Tensor output = value.ToTensor();
+    EXPECT_EQ(output.shape().At(1), 4);
+    std::vector<float> buf(output.shape().Count(0));
+    output.copy_to(buf.data());
+    for (int i = 0; i < batch_size * 4; ++i) { EXPECT_EQ(buf[i], 4); }
+    return output.shape().At(0);
+  };
+  // The first bucket compiles in place, so does a bucket no compiled bucket can stand in for.
+  ASSERT_EQ(BucketedForward(3), 4);
+  ASSERT_EQ(BucketedForward(7), 8);
+  // Bucket (2, 3) compiles in the background, and the compiled buckets serve meanwhile.
+  int64_t bucket_batch_size = BucketedForward(1);
+  ASSERT_TRUE(bucket_batch_size == 2 || bucket_batch_size == 4);
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::minutes(1);
+  while (bucket_batch_size != 2 && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    bucket_batch_size = BucketedForward(2);
+  }
+  ASSERT_EQ(bucket_batch_size, 2);
+  ASSERT_ANY_THROW(BucketedForward(9));
+}
+
+TEST(Api, graph_cpu_map_weights_test) {
+  EnvScope scope;
+  setenv("ONEFLOW_SERVING_MAP_WEIGHTS", "1", 1);
+  setenv("ONEFLOW_SERVING_LOAD_THREAD_NUM", "2", 1);
+  Device device("cpu");
+  Graph graph = LoadGraph(device);
+  Forward(graph, device, 1);
+  const std::vector<float> mapped_output = ForwardVaryingInput(graph, device);
+  unsetenv("ONEFLOW_SERVING_MAP_WEIGHTS");
+  unsetenv("ONEFLOW_SERVING_LOAD_THREAD_NUM");
+
+  Graph loaded_graph = LoadGraph(device);
+  const std::vector<float> loaded_output = ForwardVaryingInput(loaded_graph, device);
+  ASSERT_EQ(mapped_output.size(), 4);
+  ASSERT_EQ(mapped_output, loaded_output);
+}
+
 #ifdef WITH_CUDA
 TEST(Api, graph_gpu_batching_test) {
   EnvScope scope;
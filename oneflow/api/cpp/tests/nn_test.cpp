@@ -14,10 +14,20 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
 #include <random>
 #include <thread>
 #include <gtest/gtest.h>
 #include "oneflow/api/cpp/tests/api_test.h"
+#include "oneflow/core/framework/local_tensor_infer_cache.h"
+#include "oneflow/core/framework/mutable_attr_map.h"
+#include "oneflow/core/framework/op_builder.h"
+#include "oneflow/core/framework/op_expr.h"
+#include "oneflow/core/framework/op_interpreter/op_interpreter_util.h"
+#include "oneflow/core/framework/tensor_tuple.h"
+#include "oneflow/core/functional/functional.h"
 
 namespace oneflow_api {
 
@@ -69,4 +79,146 @@ TEST(Api, nn_relu_multithreading) {
   for (auto& x : threads) { x.join(); }
 }
 
+namespace {
+
+namespace of = oneflow;
+
+template<typename T>
+std::shared_ptr<of::one::Tensor> RandomTensor(const Shape& shape, DType dtype) {
+  const auto data = RandomData<T>(shape.Count(0));
+  return Tensor::from_buffer(data.data(), shape, Device("cpu"), dtype).__internal_tensor();
+}
+
+std::shared_ptr<of::one::UserOpExpr> LeakyReluOp() {
+  return of::one::OpBuilder("leaky_relu").Input("x").Output("y").Build().GetPtrOrThrow();
+}
+
+of::AttrMap LeakyReluAttrs(float alpha) {
+  of::MutableAttrMap attrs(std::vector<std::string>{"alpha"});
+  attrs.SetAllAttrs(alpha);
+  return of::AttrMap(attrs);
+}
+
+std::shared_ptr<const of::one::LocalOpCallEntry> GetOpCall(const of::one::UserOpExpr& op,
+                                                           const of::AttrMap& attrs,
+                                                           const of::one::TensorTuple& inputs) {
+  return op.mut_local_tensor_infer_cache()
+      ->GetOrInferOpCall(attrs, inputs.at(0)->device().GetOrThrow(), inputs)
+      .GetPtrOrThrow();
+}
+
+// Returns the average latency of a relu on a tiny tensor, which is dominated by the dispatch.
+double ReluDispatchMicroseconds(bool enable_op_call_inline_cache) {
+  setenv("ONEFLOW_EAGER_ENABLE_OP_CALL_INLINE_CACHE", enable_op_call_inline_cache ? "1" : "0", 1);
+  double microseconds = 0;
+  // NOTE: the env var is cached per thread, so measure in a new thread.
+  std::thread thread([&]() {
+    const Shape shape({4});
+    const auto data = RandomData<float>(shape.Count(0));
+    std::vector<float> result(shape.Count(0));
+    auto tensor = Tensor::from_buffer(data.data(), shape, Device("cpu"), DType::kFloat);
+    for (int i = 0; i < 100; ++i) { tensor = nn::relu(tensor); }
+    tensor.copy_to(result.data());
+    const int iter_num = 10000;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iter_num; ++i) { tensor = nn::relu(tensor); }
+    tensor.copy_to(result.data());
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    microseconds = std::chrono::duration<double, std::micro>(elapsed).count() / iter_num;
+  });
+  thread.join();
+  unsetenv("ONEFLOW_EAGER_ENABLE_OP_CALL_INLINE_CACHE");
+  return microseconds;
+}
+
+}  // namespace
+
+TEST(Api, op_call_inline_cache) {
+  EnvScope scope;
+
+  const auto op = LeakyReluOp();
+  const auto x = RandomTensor<float>(Shape({2, 3}), DType::kFloat);
+  const auto entry = GetOpCall(*op, LeakyReluAttrs(0.1), {x});
+  ASSERT_TRUE(entry->kernel_memo);
+  // identical calls hit the entry
+  ASSERT_EQ(GetOpCall(*op, LeakyReluAttrs(0.1), {x}), entry);
+  const auto y = RandomTensor<float>(Shape({2, 3}), DType::kFloat);
+  ASSERT_EQ(GetOpCall(*op, LeakyReluAttrs(0.1), {y}), entry);
+  // different attrs, shapes and dtypes miss it
+  const auto other_attrs = GetOpCall(*op, LeakyReluAttrs(0.2), {x});
+  ASSERT_NE(other_attrs, entry);
+  ASSERT_NE(other_attrs->kernel_memo, entry->kernel_memo);
+  const auto other_shape =
+      GetOpCall(*op, LeakyReluAttrs(0.1), {RandomTensor<float>(Shape({3, 2}), DType::kFloat)});
+  ASSERT_NE(other_shape, entry);
+  ASSERT_EQ(other_shape->result->output_tensor_metas().at(0)->shape(), of::Shape({3, 2}));
+  const auto other_dtype =
+      GetOpCall(*op, LeakyReluAttrs(0.1), {RandomTensor<double>(Shape({2, 3}), DType::kDouble)});
+  ASSERT_NE(other_dtype, entry);
+  ASSERT_EQ(other_dtype->result->output_tensor_metas().at(0)->dtype(), of::DataType::kDouble);
+  ASSERT_EQ(GetOpCall(*op, LeakyReluAttrs(0.1), {x}), entry);
+}
+
+TEST(Api, op_call_inline_cache_disabled_with_local_infer_cache) {
+  EnvScope scope;
+
+  setenv("ONEFLOW_EAGER_ENABLE_LOCAL_INFER_CACHE", "0", 1);
+  // NOTE: the env var is cached per thread, so call in a new thread.
+  std::thread thread([]() {
+    const auto op = LeakyReluOp();
+    const auto x = RandomTensor<float>(Shape({2, 3}), DType::kFloat);
+    const auto entry = GetOpCall(*op, LeakyReluAttrs(0.1), {x});
+    ASSERT_FALSE(entry->kernel_memo);
+    ASSERT_NE(GetOpCall(*op, LeakyReluAttrs(0.1), {x}), entry);
+  });
+  thread.join();
+  unsetenv("ONEFLOW_EAGER_ENABLE_LOCAL_INFER_CACHE");
+}
+
+TEST(Api, op_call_kernel_memo) {
+  EnvScope scope;
+
+  const auto attrs = LeakyReluAttrs(0.1);
+  const auto x = RandomTensor<float>(Shape({2, 3}), DType::kFloat);
+  {
+    const auto op = LeakyReluOp();
+    of::one::OpInterpUtil::Dispatch<of::one::Tensor>(*op, {x}, attrs).GetPtrOrThrow();
+    ASSERT_NE(GetOpCall(*op, attrs, {x})->kernel_memo->user_opkernel.load(), nullptr);
+  }
+  {
+    // inplaced outputs do not record the kernel choice
+    const auto op = LeakyReluOp();
+    of::one::TensorTuple outputs{x};
+    of::one::OpInterpUtil::Dispatch(*op, {x}, &outputs, attrs).GetOrThrow();
+    ASSERT_EQ(GetOpCall(*op, attrs, {x})->kernel_memo->user_opkernel.load(), nullptr);
+  }
+  {
+    // neither do outputs whose shape is set by the kernel
+    const auto op = of::one::OpBuilder("tensor_buffer_to_list_of_tensors_v2")
+                        .Input("in")
+                        .Output("out", 2)
+                        .Build()
+                        .GetPtrOrThrow();
+    of::MutableAttrMap mut_attrs(
+        std::vector<std::string>{"out_shapes", "out_dtypes", "dynamic_out"});
+    mut_attrs.SetAllAttrs(std::vector<of::Shape>{of::Shape({3}), of::Shape({3})},
+                          std::vector<of::DataType>{of::DataType::kFloat, of::DataType::kFloat},
+                          true);
+    const of::AttrMap buffer_attrs(mut_attrs);
+    const auto buffer = of::one::functional::TensorToTensorBuffer(x, 1).GetPtrOrThrow();
+    of::one::TensorTuple outputs(2);
+    of::one::OpInterpUtil::Dispatch(*op, {buffer}, &outputs, buffer_attrs).GetOrThrow();
+    ASSERT_EQ(GetOpCall(*op, buffer_attrs, {buffer})->kernel_memo->user_opkernel.load(), nullptr);
+  }
+}
+
+TEST(Api, nn_relu_dispatch_benchmark) {
+  EnvScope scope;
+
+  const double without_inline_cache = ReluDispatchMicroseconds(false);
+  const double with_inline_cache = ReluDispatchMicroseconds(true);
+  std::cout << "relu dispatch latency without op call inline cache: " << without_inline_cache
+            << " us, with op call inline cache: " << with_inline_cache << " us" << std::endl;
+}
+
 }  // namespace oneflow_api
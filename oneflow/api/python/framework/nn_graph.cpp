@@ -25,6 +25,7 @@ limitations under the License.
 #include "oneflow/core/job/runtime.h"
 #include "oneflow/core/register/blob.h"
 #include "oneflow/core/job/job.pb.h"
+#include "oneflow/core/job/compiled_plan_cache.h"
 #include "oneflow/core/job/job_ir.h"
 #include "oneflow/core/job/job_interpreter.h"
 
@@ -117,6 +118,7 @@ ONEFLOW_API_PYBIND11_MODULE("nn.graph.", m) {
   m.def("RunLazyNNGraph", &RunLazyNNGraph);
   m.def("RunLazyNNGraphByVM", &one::InterpretJob);
   m.def("SoftSyncNNGraphBuffers", &SoftSyncNNGraphBuffers);
+  m.def("ClearGraphPlanCache", &CompiledPlanCache::Clear);
   m.def("AddTensorAsGraphLoss", &AddTensorAsGraphLoss);
   m.def("MarkVariableGradients", [](const std::vector<std::shared_ptr<one::Tensor>>& variables,
                                     const std::vector<std::shared_ptr<one::Tensor>>& gradients) {
@@ -37,6 +37,12 @@ ONEFLOW_API_PYBIND11_MODULE("profiler", m) {
   m.def("StartRecord", &profiler::StartRecord);
 
   m.def("EndRecord", &profiler::EndRecord);
+
+  m.def("StartTrace", &profiler::StartTrace);
+
+  m.def("StopTrace", &profiler::StopTrace);
+
+  m.def("TraceStep", &profiler::TraceStep);
 }
 
 }  // namespace oneflow
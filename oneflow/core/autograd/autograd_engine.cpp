@@ -14,7 +14,11 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <memory>
+#include <mutex>
 #include <stack>
 #include <queue>
 #include "fmt/core.h"
@@ -22,7 +26,14 @@ limitations under the License.
 #include "oneflow/core/autograd/autograd_engine.h"
 #include "oneflow/core/autograd/autograd_meta.h"
 #include "oneflow/core/autograd/autograd_mode.h"
+#include "oneflow/core/autograd/grad_bucket_reducer.h"
 #include "oneflow/core/common/container_util.h"
+#include "oneflow/core/common/env_var/eager.h"
+#include "oneflow/core/common/foreign_lock_helper.h"
+#include "oneflow/core/eager/dev_vm_dep_object_consume_mode.h"
+#include "oneflow/core/framework/autocast.h"
+#include "oneflow/core/framework/instructions_builder.h"
+#include "oneflow/core/framework/stream_guard.h"
 #include "oneflow/core/framework/tensor.h"
 #include "oneflow/core/framework/tensor_arg.h"
 #include "oneflow/core/framework/tensor_methods.h"
@@ -36,6 +47,7 @@ limitations under the License.
 #include "oneflow/core/profiler/profiler.h"
 #include "oneflow/core/common/env_var/debug_mode.h"
 #include "oneflow/core/persistence/tee_persistent_log_stream.h"
+#include "oneflow/core/thread/thread_pool.h"
 
 namespace oneflow {
 namespace one {
@@ -117,6 +129,116 @@ Maybe<void> CheckGlobalTensorsMeta(const TensorTuple& tensor_tuple) {
   return Maybe<void>::Ok();
 }
 
+// A node whose backward body runs on a backward worker thread.
+struct BackwardWork {
+  FunctionNode* node = nullptr;
+  TensorTuple output_grads;
+  std::shared_ptr<TensorTuple> input_grads;
+  std::shared_ptr<StackedError> error;
+};
+
+// The thread local states eager op dispatch depends on. They are captured on the thread calling
+// backward and installed on the worker running a backward body, so that the body dispatches its
+// ops as if it ran on the calling thread.
+class DispatchThreadLocalState final {
+ public:
+  DispatchThreadLocalState()
+      : stream_converter_(StreamGuard::CurrentStreamConverter()),
+        autocast_enabled_(autocast::is_enabled()),
+        autocast_device_type_(autocast::get_autocast_device_type()),
+        autocast_dtype_(autocast::get_autocast_dtype()),
+        autocast_cpu_dtype_(autocast::get_autocast_cpu_dtype()),
+        autocast_gpu_dtype_(autocast::get_autocast_gpu_dtype()),
+        autocast_cache_enabled_(autocast::is_autocast_cache_enabled()),
+        dev_vm_dep_object_consume_mode_(*CurrentDevVmDepObjectConsumeMode()) {}
+
+  Maybe<void> Run(const std::function<Maybe<void>()>& Body) const {
+    const DispatchThreadLocalState worker_state;
+    // The autocast cache is cleared on the calling thread only, the worker must not fill its own.
+    Install(/*autocast_cache_enabled=*/false);
+    std::unique_ptr<StreamGuard> stream_guard;
+    if (stream_converter_) { stream_guard.reset(new StreamGuard(stream_converter_)); }
+    const auto& ret = Body();
+    stream_guard.reset();
+    worker_state.Install(worker_state.autocast_cache_enabled_);
+    return ret;
+  }
+
+ private:
+  void Install(bool autocast_cache_enabled) const {
+    autocast::set_enabled(autocast_enabled_);
+    autocast::set_autocast_device_type(autocast_device_type_);
+    autocast::set_autocast_dtype(autocast_dtype_);
+    autocast::set_autocast_cpu_dtype(autocast_cpu_dtype_);
+    autocast::set_autocast_gpu_dtype(autocast_gpu_dtype_);
+    autocast::set_autocast_cache_enabled(autocast_cache_enabled);
+    *CurrentDevVmDepObjectConsumeMode() = dev_vm_dep_object_consume_mode_;
+  }
+
+  std::shared_ptr<StreamConverter> stream_converter_;
+  bool autocast_enabled_;
+  DeviceType autocast_device_type_;
+  Symbol<DType> autocast_dtype_;
+  Symbol<DType> autocast_cpu_dtype_;
+  Symbol<DType> autocast_gpu_dtype_;
+  bool autocast_cache_enabled_;
+  DevVmDepObjectConsumeMode dev_vm_dep_object_consume_mode_;
+};
+
+ThreadPool* GetBackwardThreadPool(int64_t worker_num) {
+  static std::mutex mutex;
+  static HashMap<int64_t, std::unique_ptr<ThreadPool>> worker_num2thread_pool;
+  std::unique_lock<std::mutex> lock(mutex);
+  auto& thread_pool = worker_num2thread_pool[worker_num];
+  if (!thread_pool) { thread_pool.reset(new ThreadPool(worker_num)); }
+  return thread_pool.get();
+}
+
+// Runs backward bodies on a thread pool and hands the finished works back to the thread calling
+// backward.
+class BackwardWorkerGroup final {
+ public:
+  OF_DISALLOW_COPY_AND_MOVE(BackwardWorkerGroup);
+  explicit BackwardWorkerGroup(ThreadPool* thread_pool)
+      : thread_pool_(thread_pool), running_num_(0) {}
+  // Running works refer to this group, wait for them even if backward failed.
+  ~BackwardWorkerGroup() {
+    while (running_num_ > 0) { WaitOne(); }
+  }
+
+  size_t running_num() const { return running_num_; }
+
+  void Launch(const std::shared_ptr<BackwardWork>& work, const std::function<Maybe<void>()>& Run) {
+    ++running_num_;
+    thread_pool_->AddWork([this, work, Run]() {
+      work->error = Run().GetDataAndStackedError();
+      std::unique_lock<std::mutex> lock(mutex_);
+      finished_works_.push_back(work);
+      cond_.notify_one();
+    });
+  }
+
+  std::shared_ptr<BackwardWork> WaitOne() {
+    std::shared_ptr<BackwardWork> work;
+    CHECK_JUST(Singleton<ForeignLockHelper>::Get()->WithScopedRelease([&]() -> Maybe<void> {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cond_.wait(lock, [this]() { return !finished_works_.empty(); });
+      work = finished_works_.front();
+      finished_works_.pop_front();
+      return Maybe<void>::Ok();
+    }));
+    --running_num_;
+    return work;
+  }
+
+ private:
+  ThreadPool* thread_pool_;
+  size_t running_num_;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::deque<std::shared_ptr<BackwardWork>> finished_works_;
+};
+
 std::string GetDebugGraphFileName(const std::string& mode, const std::string& suffix) {
   return fmt::format("autograd_{}_rank{}_suffix_graph.dot", mode, GlobalProcessCtx::Rank(), suffix);
 }
@@ -151,7 +273,7 @@ Maybe<void> FunctionNode::AccGrad4RetainGradTensor(bool create_graph) {
   return Maybe<void>::Ok();
 }
 
-Maybe<void> FunctionNode::AccGrad4LeafTensor(bool create_graph) {
+Maybe<void> FunctionNode::AccGrad4LeafTensor(bool create_graph, GradBucketReducer* reducer) {
   for (auto i = 0; i < output_meta_data_.size(); i++) {
     auto& out = output_meta_data_[i];
 
@@ -162,12 +284,11 @@ Maybe<void> FunctionNode::AccGrad4LeafTensor(bool create_graph) {
       const auto& acc_grad = out->acc_grad();
       if (!LazyMode::is_enabled() && GlobalGradSyncMode::is_enabled() && acc_grad->is_global()
           && acc_grad->is_eager()) {
-        auto& tensor_info = output_tensor_infos_[i];
-        const auto& placement = JUST(tensor_info.placement());
-        const auto& nd_sbp = JUST(tensor_info.sbp());
-        JUST(out->set_acc_grad(
-            JUST(functional::ToGlobal(acc_grad, placement, *JUST(GetSbpList(nd_sbp)),
-                                      GetNoneSbpList(), /* check_meta */ false, /*copy=*/false))));
+        if (reducer && reducer->Contains(out.get())) {
+          JUST(reducer->MarkGradReady(out.get()));
+        } else {
+          JUST(SyncGlobalGrad(out.get(), output_tensor_infos_[i]));
+        }
       }
     }
   }
@@ -180,44 +301,80 @@ void FunctionNode::ReleaseOutTensorArgs() {
   }
 }
 
+/*static*/ int64_t FunctionNode::NewSeq() {
+  static std::atomic<int64_t> seq(0);
+  return seq++;
+}
+
+size_t FunctionNode::saved_tensor_num() const {
+  if (!backward_fn_ || !backward_fn_->saved_tensor_num) { return 0; }
+  return backward_fn_->saved_tensor_num();
+}
+
+bool FunctionNode::thread_safe() const {
+  // post hooks are python callables
+  if (!hooks_.empty()) { return false; }
+  return backward_fn_ && backward_fn_->thread_safe && backward_fn_->thread_safe();
+}
+
 Maybe<bool> FunctionNode::Apply(bool create_graph) {
+  TensorTuple output_grads(output_meta_data_.size());
+  if (!JUST(PrepareOutGrads(&output_grads))) { return false; }
+  TensorTuple input_grads(input_meta_data_.size());
+  JUST(RunBody(output_grads, &input_grads, create_graph));
+  JUST(PushInGrads(output_grads, &input_grads));
+  return true;
+}
+
+Maybe<bool> FunctionNode::PrepareOutGrads(TensorTuple* output_grads) {
   CHECK_NOTNULL_OR_RETURN(backward_fn_)
       << "This FunctionNode with name `" << name() << "` has been released.\n"
       << "Maybe you try to backward through the node a second time. Specify retain_graph=True when "
          "calling .backward() or autograd.grad() the first time.";
   if (!IsReadyToRun(output_meta_data_)) { return false; }
-  TensorTuple input_grads(input_meta_data_.size());
-  TensorTuple output_grads(output_meta_data_.size());
+  output_grads->resize(output_meta_data_.size());
   for (int i = 0; i < output_meta_data_.size(); ++i) {
     if (output_meta_data_[i]->current_grad()->Empty()) {
       // Only initialize out_grads for those requires_grad outputs
       if (output_meta_data_[i]->requires_grad()) {
-        output_grads[i] = JUST(output_tensor_infos_[i].zeros());
+        (*output_grads)[i] = JUST(output_tensor_infos_[i].zeros());
       }
     } else {
-      JUST(oneflow::VectorAt(output_grads, i)) =
+      JUST(oneflow::VectorAt(*output_grads, i)) =
           JUST(JUST(oneflow::VectorAt(output_meta_data_, i))->current_grad_value());
     }
   }
-  JUST(backward_fn_->body(output_grads, &input_grads, create_graph));
+  return true;
+}
+
+Maybe<void> FunctionNode::RunBody(const TensorTuple& output_grads, TensorTuple* input_grads,
+                                  bool create_graph) {
+  input_grads->resize(input_meta_data_.size());
+  JUST(backward_fn_->body(output_grads, input_grads, create_graph));
+  return Maybe<void>::Ok();
+}
+
+Maybe<void> FunctionNode::PushInGrads(const TensorTuple& output_grads, TensorTuple* input_grads) {
   for (const auto& hook : hooks_) {
-    auto new_input_grads = hook(input_grads, output_grads);
+    auto new_input_grads = hook(*input_grads, output_grads);
     if (new_input_grads.has_value()) {
       auto new_input_grads_value = *JUST(new_input_grads);
-      CHECK_EQ_OR_RETURN(new_input_grads_value.size(), input_grads.size())
+      CHECK_EQ_OR_RETURN(new_input_grads_value.size(), input_grads->size())
           << "The number of input grads returned by hook is not correct, expected "
-          << input_grads.size() << ", but got " << new_input_grads_value.size() << ".";
-      for (int i = 0; i < input_grads.size(); ++i) { input_grads[i] = new_input_grads_value[i]; }
+          << input_grads->size() << ", but got " << new_input_grads_value.size() << ".";
+      for (int i = 0; i < input_grads->size(); ++i) {
+        (*input_grads)[i] = new_input_grads_value[i];
+      }
     }
   }
   for (int i = 0; i < input_meta_data_.size(); ++i) {
-    if (JUST(VectorAt(input_grads, i))) {
+    if (JUST(VectorAt(*input_grads, i))) {
       CHECK_NOTNULL_OR_RETURN(input_meta_data_[i])
           << name_
           << " calculate grad for tensor which requires_grad is False. Please submit an issue in "
              "`https://github.com/Oneflow-Inc/oneflow/issues` and we will fix it as soon as "
              "possible";
-      JUST(input_meta_data_[i]->current_grad()->PushPartialTensor(JUST(VectorAt(input_grads, i))));
+      JUST(input_meta_data_[i]->current_grad()->PushPartialTensor(JUST(VectorAt(*input_grads, i))));
     } else {
       CHECK_OR_RETURN(!input_meta_data_[i])
           << name() << "'s input[" << i
@@ -226,7 +383,7 @@ Maybe<bool> FunctionNode::Apply(bool create_graph) {
              "possible;";
     }
   }
-  return true;
+  return Maybe<void>::Ok();
 }
 
 void GraphFunctionNode::ReleaseData() {
@@ -408,7 +565,65 @@ Maybe<void> GraphTask::ComputeDependenciesAndPruneNode(const TensorTuple& inputs
   return Maybe<void>::Ok();
 }
 
+Maybe<void> GraphTask::FinishNode(FunctionNode* node, bool save_grad_for_leaf) {
+  const auto& exec_info = grad_fn2exec_info_[node];
+  if (exec_info.capture_indices) {
+    CHECK_NOTNULL_OR_RETURN(captured_grads_.get()) << "captured grads in GraphTask is nullptr";
+    for (const auto& out_idx_and_capture_idx : *exec_info.capture_indices) {
+      JUST(VectorAt(*captured_grads_, out_idx_and_capture_idx.second)) =
+          JUST(JUST(VectorAt(node->output_meta_data_, out_idx_and_capture_idx.first))
+                   ->current_grad_value());
+    }
+  }
+  if (save_grad_for_leaf) {
+    JUST(node->AccGrad4LeafTensor(create_graph_, grad_bucket_reducer_.get()));
+  }
+  JUST(node->AccGrad4RetainGradTensor(create_graph_));
+  node->ReleaseOutTensorArgs();
+  if (!retain_graph_) { node->ReleaseData(); }
+  return Maybe<void>::Ok();
+}
+
+Maybe<void> GraphTask::InitGradBucketReducer() {
+  const int64_t bucket_size = ThreadLocalEnvInteger<ONEFLOW_EAGER_GLOBAL_GRAD_BUCKET_SIZE>();
+  if (bucket_size <= 0 || create_graph_ || LazyMode::is_enabled()
+      || !GlobalGradSyncMode::is_enabled()) {
+    return Maybe<void>::Ok();
+  }
+  // The accumulate grad nodes of leaf tensors are created when the tensors are used the first
+  // time, their creation order is taken as the registration order of leaf tensors.
+  std::vector<FunctionNode*> nodes;
+  for (const auto& pair : grad_fn2exec_info_) {
+    if (pair.second.need_execute) { nodes.push_back(pair.first); }
+  }
+  std::sort(nodes.begin(), nodes.end(), [](const FunctionNode* lhs, const FunctionNode* rhs) {
+    return lhs->seq() < rhs->seq();
+  });
+  std::vector<std::pair<AutogradMeta*, const TensorInfo*>> leaf_tensors;
+  for (FunctionNode* node : nodes) {
+    for (int i = 0; i < node->output_meta_data_.size(); ++i) {
+      AutogradMeta* autograd_meta = node->output_meta_data_[i].get();
+      const TensorInfo& tensor_info = node->output_tensor_infos_[i];
+      if (autograd_meta->is_leaf() && autograd_meta->requires_grad()
+          && JUST(GradBucketReducer::IsBucketable(tensor_info))) {
+        leaf_tensors.emplace_back(autograd_meta, &tensor_info);
+      }
+    }
+  }
+  if (leaf_tensors.size() > 1) {
+    grad_bucket_reducer_ = JUST(GradBucketReducer::New(leaf_tensors, bucket_size));
+  }
+  return Maybe<void>::Ok();
+}
+
 Maybe<void> GraphTask::Apply(bool save_grad_for_leaf) {
+  if (save_grad_for_leaf) { JUST(InitGradBucketReducer()); }
+  const int64_t worker_num = ThreadLocalEnvInteger<ONEFLOW_AUTOGRAD_BACKWARD_WORKER_NUM>();
+  // Double backward records new nodes and lazy mode records the backward graph, both in the
+  // order the bodies run, so they always run serially.
+  if (worker_num > 1 && !create_graph_ && !LazyMode::is_enabled()) {
+    return ParallelApply(save_grad_for_leaf, worker_num);
+  }
   std::queue<FunctionNode*> queue;
   for (FunctionNode* node : roots_) {
     if (grad_fn2exec_info_[node].dependencies == 0) { queue.push(node); }
@@ -425,18 +640,7 @@ Maybe<void> GraphTask::Apply(bool save_grad_for_leaf) {
     }
     BackwardPassScopeGuard backward_guard(node->scope());
     if (/*bool not_ready_to_apply=*/!(JUST(node->Apply(create_graph_)))) { continue; }
-    if (exec_info.capture_indices) {
-      CHECK_NOTNULL_OR_RETURN(captured_grads_.get()) << "captured grads in GraphTask is nullptr";
-      for (const auto& out_idx_and_capture_idx : *exec_info.capture_indices) {
-        JUST(VectorAt(*captured_grads_, out_idx_and_capture_idx.second)) =
-            JUST(JUST(VectorAt(node->output_meta_data_, out_idx_and_capture_idx.first))
-                     ->current_grad_value());
-      }
-    }
-    if (save_grad_for_leaf) { JUST(node->AccGrad4LeafTensor(create_graph_)); }
-    JUST(node->AccGrad4RetainGradTensor(create_graph_));
-    node->ReleaseOutTensorArgs();
-    if (!retain_graph_) { node->ReleaseData(); }
+    JUST(FinishNode(node, save_grad_for_leaf));
 
     for (const auto& next_grad_fn : node->next_functions()) {
       FunctionNode* next_node = next_grad_fn.get();
@@ -445,6 +649,84 @@ Maybe<void> GraphTask::Apply(bool save_grad_for_leaf) {
       if (dependencies == 0) { queue.push(next_node); }
     }
   }
+  if (grad_bucket_reducer_) { JUST(grad_bucket_reducer_->Finish()); }
+  return Maybe<void>::Ok();
+}
+
+Maybe<void> GraphTask::ParallelApply(bool save_grad_for_leaf, int64_t worker_num) {
+  // Ready nodes releasing more saved tensors first, then in the order they become ready.
+  struct ReadyNode {
+    size_t saved_tensor_num;
+    int64_t seq;
+    FunctionNode* node;
+  };
+  const auto& ReadyNodeLess = [](const ReadyNode& lhs, const ReadyNode& rhs) {
+    if (lhs.saved_tensor_num != rhs.saved_tensor_num) {
+      return lhs.saved_tensor_num < rhs.saved_tensor_num;
+    }
+    return lhs.seq > rhs.seq;
+  };
+  std::priority_queue<ReadyNode, std::vector<ReadyNode>, decltype(ReadyNodeLess)> ready_nodes(
+      ReadyNodeLess);
+  int64_t seq = 0;
+  const auto& PushReadyNode = [&](FunctionNode* node) {
+    // Nothing is released if the graph is retained.
+    const size_t saved_tensor_num = retain_graph_ ? 0 : node->saved_tensor_num();
+    ready_nodes.push(ReadyNode{saved_tensor_num, seq++, node});
+  };
+  for (FunctionNode* node : roots_) {
+    if (grad_fn2exec_info_[node].dependencies == 0) { PushReadyNode(node); }
+  }
+
+  // Only the backward bodies run on workers, all the autograd meta are updated on this thread so
+  // accumulating grads needs no lock. The instructions of all the threads are built one at a time.
+  ConcurrentDispatchScope dispatch_scope;
+  const DispatchThreadLocalState dispatch_state;
+  BackwardWorkerGroup workers(GetBackwardThreadPool(worker_num));
+  const auto& FinishWork = [&](const BackwardWork& work) -> Maybe<void> {
+    FunctionNode* node = work.node;
+    JUST(node->PushInGrads(work.output_grads, work.input_grads.get()));
+    JUST(FinishNode(node, save_grad_for_leaf));
+    for (const auto& next_grad_fn : node->next_functions()) {
+      FunctionNode* next_node = next_grad_fn.get();
+      int32_t& dependencies = grad_fn2exec_info_[next_node].dependencies;
+      dependencies -= 1;
+      if (dependencies == 0) { PushReadyNode(next_node); }
+    }
+    return Maybe<void>::Ok();
+  };
+  while (!ready_nodes.empty() || workers.running_num() > 0) {
+    if (ready_nodes.empty()) {
+      const auto& work = workers.WaitOne();
+      if (work->error) { return work->error; }
+      JUST(FinishWork(*work));
+      continue;
+    }
+    FunctionNode* node = ready_nodes.top().node;
+    ready_nodes.pop();
+    if (!grad_fn2exec_info_[node].need_execute) {
+      node->ReleaseOutTensorArgs();
+      continue;
+    }
+    auto work = std::make_shared<BackwardWork>();
+    work->node = node;
+    if (/*bool not_ready_to_apply=*/!(JUST(node->PrepareOutGrads(&work->output_grads)))) {
+      continue;
+    }
+    work->input_grads = std::make_shared<TensorTuple>();
+    if (node->thread_safe()) {
+      workers.Launch(work, [node, work, &dispatch_state]() -> Maybe<void> {
+        return dispatch_state.Run([&]() -> Maybe<void> {
+          return node->RunBody(work->output_grads, work->input_grads.get(),
+                               /*create_graph=*/false);
+        });
+      });
+    } else {
+      JUST(node->RunBody(work->output_grads, work->input_grads.get(), create_graph_));
+      JUST(FinishWork(*work));
+    }
+  }
+  if (grad_bucket_reducer_) { JUST(grad_bucket_reducer_->Finish()); }
   return Maybe<void>::Ok();
 }
 
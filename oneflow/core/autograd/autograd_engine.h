@@ -33,12 +33,19 @@ namespace one {
 
 class Tensor;
 class TensorTuple;
+class GradBucketReducer;
 
 using CaptureStatus = bool;
 
 struct BackwardFunction {
   std::function<Maybe<void>(const TensorTuple&, TensorTuple*, bool)> body;
   std::function<CaptureStatus()> status;
+  // Optional. The number of tensors saved for backward, they are released together with this
+  // function once the node has run and the graph is not retained.
+  std::function<size_t()> saved_tensor_num;
+  // Optional. Whether `body` may run on a backward worker thread, which is false for bodies that
+  // call back into python or launch global ops whose order must agree on all ranks.
+  std::function<bool()> thread_safe;
 };
 
 // Calculates one backward op
@@ -47,7 +54,8 @@ class FunctionNode {
   virtual ~FunctionNode() = default;
 
   Maybe<bool> Apply(bool create_graph);
-  Maybe<void> AccGrad4LeafTensor(bool create_graph);
+  // Leaf grads which `reducer` contains are synchronized by it rather than one by one.
+  Maybe<void> AccGrad4LeafTensor(bool create_graph, GradBucketReducer* reducer = nullptr);
   Maybe<void> AccGrad4RetainGradTensor(bool create_graph);
   void ReleaseOutTensorArgs();
   // Releases the eventual c++ std::function for backward if retain_graph=False to avoid calling
@@ -58,10 +66,15 @@ class FunctionNode {
     return next_functions_;
   }
   const std::string& name() const { return name_; }
+  // Increases in the order nodes are created.
+  int64_t seq() const { return seq_; }
 
   const std::shared_ptr<Scope>& scope() const { return scope_; }
   void set_scope(const std::shared_ptr<Scope>& scope) { scope_ = scope; }
 
+  size_t saved_tensor_num() const;
+  bool thread_safe() const;
+
   using Hook = std::function<Optional<std::vector<std::shared_ptr<Tensor>>>(const TensorTuple&,
                                                                             const TensorTuple&)>;
   void add_post_hook(const Hook& hook) { hooks_.push_back(hook); }
@@ -70,9 +83,19 @@ class FunctionNode {
   friend class GraphTask;
   explicit FunctionNode(const std::string& name,
                         const std::shared_ptr<BackwardFunction>& backward_fn)
-      : name_(name), backward_fn_(backward_fn), scope_(nullptr) {}
+      : name_(name), seq_(NewSeq()), backward_fn_(backward_fn), scope_(nullptr) {}
+
+  // The steps of `Apply`. The parallel backward executor runs `RunBody` on worker threads and the
+  // other two on the thread calling backward, which owns all the autograd meta.
+  Maybe<bool> PrepareOutGrads(TensorTuple* output_grads);
+  Maybe<void> RunBody(const TensorTuple& output_grads, TensorTuple* input_grads,
+                      bool create_graph);
+  Maybe<void> PushInGrads(const TensorTuple& output_grads, TensorTuple* input_grads);
+
+  static int64_t NewSeq();
 
   const std::string name_;
+  const int64_t seq_;
   std::vector<std::shared_ptr<FunctionNode>> next_functions_;
 
   std::vector<std::shared_ptr<AutogradMeta>> input_meta_data_;
@@ -150,6 +173,13 @@ class GraphTask final {
   Maybe<void> WriteGraphToDotFile(const std::string& file_name) const;
 
  private:
+  // Schedules ready nodes on `worker_num` backward worker threads, preferring the nodes which
+  // release the most saved tensors.
+  Maybe<void> ParallelApply(bool save_grad_for_leaf, int64_t worker_num);
+  // Captures and accumulates the output grads of `node` after it has been applied.
+  Maybe<void> FinishNode(FunctionNode* node, bool save_grad_for_leaf);
+  Maybe<void> InitGradBucketReducer();
+
   class ExecInfo {
    public:
     ExecInfo() = default;
@@ -166,6 +196,8 @@ class GraphTask final {
   std::vector<FunctionNode*> roots_;
   HashMap<FunctionNode*, ExecInfo> grad_fn2exec_info_;
   std::shared_ptr<TensorTuple> captured_grads_;
+  // Synchronizes the grads of global leaf tensors in buckets, nullptr if disabled.
+  std::shared_ptr<GradBucketReducer> grad_bucket_reducer_;
 };
 
 class GraphAutogradEngine final : public AutogradEngine {
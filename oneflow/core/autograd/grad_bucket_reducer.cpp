@@ -0,0 +1,197 @@
+/*
+Copyright 2020 The OneFlow Authors. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "oneflow/core/autograd/grad_bucket_reducer.h"
+#include "oneflow/core/autograd/autograd_mode.h"
+#include "oneflow/core/common/container_util.h"
+#include "oneflow/core/framework/nd_sbp.h"
+#include "oneflow/core/framework/tensor.h"
+#include "oneflow/core/framework/tensor_tuple.h"
+#include "oneflow/core/functional/functional.h"
+#include "oneflow/core/job/parallel_desc.h"
+
+namespace oneflow {
+namespace one {
+
+namespace {
+
+using LeafTensorList = std::vector<std::pair<AutogradMeta*, const TensorInfo*>>;
+
+bool HasSplit(Symbol<NdSbp> nd_sbp) {
+  for (const auto& sbp_parallel : nd_sbp->sbp_parallel()) {
+    if (sbp_parallel.has_split_parallel()) { return true; }
+  }
+  return false;
+}
+
+// Boxes the grads, all with `grad_nd_sbp`, by one collective on their flattened concatenation.
+Maybe<void> SyncGlobalGradsInBucket(const LeafTensorList& leaf_tensors, Symbol<NdSbp> grad_nd_sbp) {
+  const TensorInfo& tensor_info = *leaf_tensors.front().second;
+  const auto& placement = JUST(tensor_info.placement());
+  const auto& nd_sbp = JUST(tensor_info.sbp());
+  const auto& dtype = tensor_info.dtype();
+  TensorTuple flat_local_grads;
+  flat_local_grads.reserve(leaf_tensors.size());
+  int64_t elem_cnt = 0;
+  for (const auto& pair : leaf_tensors) {
+    const auto& acc_grad = pair.first->acc_grad();
+    const auto& local_grad = JUST(functional::GlobalToLocal(acc_grad, /*copy=*/false));
+    flat_local_grads.emplace_back(JUST(functional::Flatten(local_grad, 0, -1)));
+    elem_cnt += acc_grad->shape()->elem_cnt();
+  }
+  const auto& local_buffer = JUST(functional::Concat(flat_local_grads, 0));
+  const auto& buffer =
+      JUST(functional::LocalToGlobal(local_buffer, placement, *JUST(GetSbpList(grad_nd_sbp)),
+                                     Shape({elem_cnt}), dtype, /*sync_data=*/false,
+                                     /*copy=*/false));
+  const auto& synced_buffer =
+      JUST(functional::ToGlobal(buffer, placement, *JUST(GetSbpList(nd_sbp)), GetNoneSbpList(),
+                                /*check_meta=*/false, /*copy=*/false));
+  const auto& local_synced_buffer = JUST(functional::GlobalToLocal(synced_buffer, /*copy=*/false));
+  int64_t offset = 0;
+  for (const auto& pair : leaf_tensors) {
+    const auto& shape = pair.first->acc_grad()->shape();
+    const int64_t grad_elem_cnt = shape->elem_cnt();
+    // a view of the synchronized buffer if possible
+    const auto& local_grad = JUST(functional::Reshape(
+        JUST(functional::Narrow(local_synced_buffer, 0, offset, grad_elem_cnt)), *shape));
+    JUST(pair.first->set_acc_grad(JUST(functional::LocalToGlobal(
+        local_grad, placement, *JUST(GetSbpList(nd_sbp)), *shape, dtype, /*sync_data=*/false,
+        /*copy=*/false))));
+    offset += grad_elem_cnt;
+  }
+  return Maybe<void>::Ok();
+}
+
+}  // namespace
+
+Maybe<void> SyncGlobalGrad(AutogradMeta* autograd_meta, const TensorInfo& tensor_info) {
+  const auto& placement = JUST(tensor_info.placement());
+  const auto& nd_sbp = JUST(tensor_info.sbp());
+  JUST(autograd_meta->set_acc_grad(JUST(functional::ToGlobal(
+      autograd_meta->acc_grad(), placement, *JUST(GetSbpList(nd_sbp)), GetNoneSbpList(),
+      /* check_meta */ false, /*copy=*/false))));
+  return Maybe<void>::Ok();
+}
+
+/*static*/ Maybe<bool> GradBucketReducer::IsBucketable(const TensorInfo& tensor_info) {
+  if (!tensor_info.placement().has_value() || !tensor_info.sbp().has_value()) { return false; }
+  // The local grads of split tensors are not the same part of the logical grads on each rank.
+  // Ranks out of the placement hold no grads, they skip the whole bucket group of the placement,
+  // which leaves the buckets of other groups unchanged.
+  return JUST(tensor_info.placement())->containing_current_rank()
+         && !HasSplit(JUST(tensor_info.sbp()));
+}
+
+/*static*/ Maybe<GradBucketReducer> GradBucketReducer::New(
+    const std::vector<std::pair<AutogradMeta*, const TensorInfo*>>& leaf_tensors,
+    size_t bucket_size) {
+  auto reducer = std::shared_ptr<GradBucketReducer>(new GradBucketReducer());
+  reducer->leaf_tensors_.reserve(leaf_tensors.size());
+  reducer->leaf_tensor_index2bucket_index_.resize(leaf_tensors.size());
+  for (auto iter = leaf_tensors.rbegin(); iter != leaf_tensors.rend(); ++iter) {
+    const TensorInfo& tensor_info = *iter->second;
+    CHECK_OR_RETURN(JUST(IsBucketable(tensor_info)));  // NOLINT
+    const size_t tensor_size =
+        tensor_info.shape()->elem_cnt() * JUST(tensor_info.dtype()->bytes());
+    size_t group_index = 0;
+    for (; group_index < reducer->groups_.size(); ++group_index) {
+      const TensorInfo& front = *reducer->groups_[group_index].front_tensor_info;
+      if (JUST(front.placement()) == JUST(tensor_info.placement())
+          && JUST(front.sbp()) == JUST(tensor_info.sbp()) && front.dtype() == tensor_info.dtype()) {
+        break;
+      }
+    }
+    if (group_index == reducer->groups_.size()) {
+      reducer->groups_.emplace_back(BucketGroup{&tensor_info, {}, 0, 0});
+    }
+    BucketGroup& group = reducer->groups_[group_index];
+    if (group.bucket_indices.empty() || group.last_bucket_size + tensor_size > bucket_size) {
+      group.bucket_indices.push_back(reducer->buckets_.size());
+      group.last_bucket_size = 0;
+      reducer->buckets_.emplace_back(Bucket{{}, 0, group_index});
+    }
+    const size_t index = reducer->leaf_tensors_.size();
+    reducer->leaf_tensors_.emplace_back(LeafTensor{iter->first, &tensor_info, false});
+    reducer->autograd_meta2index_.emplace(iter->first, index);
+    reducer->buckets_[group.bucket_indices.back()].leaf_tensor_indices.push_back(index);
+    reducer->leaf_tensor_index2bucket_index_[index] = group.bucket_indices.back();
+    group.last_bucket_size += tensor_size;
+  }
+  return reducer;
+}
+
+Maybe<void> GradBucketReducer::MarkGradReady(const AutogradMeta* autograd_meta) {
+  const size_t index = JUST(MapAt(autograd_meta2index_, autograd_meta));
+  LeafTensor& leaf_tensor = leaf_tensors_[index];
+  if (leaf_tensor.ready) { return Maybe<void>::Ok(); }
+  leaf_tensor.ready = true;
+  Bucket& ready_bucket = buckets_[leaf_tensor_index2bucket_index_[index]];
+  ready_bucket.ready_num += 1;
+  BucketGroup& group = groups_[ready_bucket.group_index];
+  while (group.next_bucket_index < group.bucket_indices.size()) {
+    const Bucket& bucket = buckets_[group.bucket_indices[group.next_bucket_index]];
+    if (bucket.ready_num < bucket.leaf_tensor_indices.size()) { break; }
+    JUST(LaunchBucket(bucket));
+    group.next_bucket_index += 1;
+  }
+  return Maybe<void>::Ok();
+}
+
+Maybe<void> GradBucketReducer::Finish() {
+  for (BucketGroup& group : groups_) {
+    for (; group.next_bucket_index < group.bucket_indices.size(); ++group.next_bucket_index) {
+      JUST(LaunchBucket(buckets_[group.bucket_indices[group.next_bucket_index]]));
+    }
+  }
+  return Maybe<void>::Ok();
+}
+
+Maybe<void> GradBucketReducer::LaunchBucket(const Bucket& bucket) {
+  autograd::AutoGradMode mode(false);
+  // The ready grads grouped by their nd_sbp, usually all of them are partial sum.
+  std::vector<std::pair<Symbol<NdSbp>, LeafTensorList>> grad_nd_sbp2leaf_tensors;
+  for (size_t index : bucket.leaf_tensor_indices) {
+    const LeafTensor& leaf_tensor = leaf_tensors_[index];
+    if (!leaf_tensor.ready) { continue; }
+    const auto& acc_grad = leaf_tensor.autograd_meta->acc_grad();
+    if (!acc_grad) { continue; }
+    const auto& grad_nd_sbp = JUST(acc_grad->nd_sbp());
+    if (grad_nd_sbp == JUST(leaf_tensor.tensor_info->sbp())) { continue; }
+    if (HasSplit(grad_nd_sbp) || acc_grad->dtype() != leaf_tensor.tensor_info->dtype()
+        || JUST(acc_grad->parallel_desc()) != JUST(leaf_tensor.tensor_info->placement())) {
+      JUST(SyncGlobalGrad(leaf_tensor.autograd_meta, *leaf_tensor.tensor_info));
+      continue;
+    }
+    auto iter = std::find_if(grad_nd_sbp2leaf_tensors.begin(), grad_nd_sbp2leaf_tensors.end(),
+                             [&](const auto& pair) { return pair.first == grad_nd_sbp; });
+    if (iter == grad_nd_sbp2leaf_tensors.end()) {
+      iter = grad_nd_sbp2leaf_tensors.emplace(grad_nd_sbp2leaf_tensors.end(), grad_nd_sbp,
+                                              LeafTensorList{});
+    }
+    iter->second.emplace_back(leaf_tensor.autograd_meta, leaf_tensor.tensor_info);
+  }
+  for (const auto& pair : grad_nd_sbp2leaf_tensors) {
+    if (pair.second.size() == 1) {
+      JUST(SyncGlobalGrad(pair.second.front().first, *pair.second.front().second));
+    } else {
+      JUST(SyncGlobalGradsInBucket(pair.second, pair.first));
+    }
+  }
+  return Maybe<void>::Ok();
+}
+
+}  // namespace one
+}  // namespace oneflow
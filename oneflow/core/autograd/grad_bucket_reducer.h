@@ -0,0 +1,100 @@
+/*
+Copyright 2020 The OneFlow Authors. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef ONEFLOW_CORE_AUTOGRAD_GRAD_BUCKET_REDUCER_H_
+#define ONEFLOW_CORE_AUTOGRAD_GRAD_BUCKET_REDUCER_H_
+
+#include <vector>
+#include "oneflow/core/autograd/autograd_meta.h"
+#include "oneflow/core/common/maybe.h"
+#include "oneflow/core/common/util.h"
+
+namespace oneflow {
+namespace one {
+
+// Synchronizes the grads of eager global leaf tensors, i.e. boxes them to the sbp of the leaf
+// tensors, in buckets instead of one by one.
+//
+// Leaf tensors are grouped by their placement, sbp and dtype. In each group they are assigned to
+// buckets of at most `bucket_size` bytes in the reverse order of registration, which is about the
+// order their grads get ready in backward. Once all grads of a bucket are accumulated, they are
+// flattened into one contiguous buffer which is boxed by a single collective, e.g. partial sum to
+// broadcast is one all-reduce, and the synchronized grads are views of the boxed buffer. The
+// buckets of a group are launched in order, so every rank of the placement issues the same
+// collectives in the same order, whatever tensors of other placements the rank holds. Like other
+// eager ops, the collectives run asynchronously and overlap with the rest of backward.
+class GradBucketReducer final {
+ public:
+  OF_DISALLOW_COPY_AND_MOVE(GradBucketReducer);
+  ~GradBucketReducer() = default;
+
+  // `leaf_tensors` in registration order, all of them must be bucketable.
+  static Maybe<GradBucketReducer> New(
+      const std::vector<std::pair<AutogradMeta*, const TensorInfo*>>& leaf_tensors,
+      size_t bucket_size);
+
+  // Whether grads of the tensor with `tensor_info` can be synchronized in buckets.
+  static Maybe<bool> IsBucketable(const TensorInfo& tensor_info);
+
+  bool Contains(const AutogradMeta* autograd_meta) const {
+    return autograd_meta2index_.find(autograd_meta) != autograd_meta2index_.end();
+  }
+  size_t bucket_num() const { return buckets_.size(); }
+
+  // Marks the grad of `autograd_meta` accumulated, and launches the complete buckets.
+  Maybe<void> MarkGradReady(const AutogradMeta* autograd_meta);
+  // Launches the remaining buckets with the grads accumulated in this backward.
+  Maybe<void> Finish();
+
+ private:
+  struct LeafTensor {
+    AutogradMeta* autograd_meta;
+    const TensorInfo* tensor_info;
+    bool ready;
+  };
+  struct Bucket {
+    std::vector<size_t> leaf_tensor_indices;
+    size_t ready_num;
+    size_t group_index;
+  };
+  // Buckets of the leaf tensors with the same placement, sbp and dtype.
+  struct BucketGroup {
+    const TensorInfo* front_tensor_info;
+    std::vector<size_t> bucket_indices;
+    // bytes of the last bucket
+    size_t last_bucket_size;
+    // the first bucket not launched yet
+    size_t next_bucket_index;
+  };
+
+  GradBucketReducer() = default;
+
+  Maybe<void> LaunchBucket(const Bucket& bucket);
+
+  std::vector<LeafTensor> leaf_tensors_;
+  HashMap<const AutogradMeta*, size_t> autograd_meta2index_;
+  std::vector<Bucket> buckets_;
+  // in the order their first tensors are registered
+  std::vector<BucketGroup> groups_;
+  std::vector<size_t> leaf_tensor_index2bucket_index_;
+};
+
+// Boxes the accumulated grad of an eager global leaf tensor to the sbp of the tensor.
+Maybe<void> SyncGlobalGrad(AutogradMeta* autograd_meta, const TensorInfo& tensor_info);
+
+}  // namespace one
+}  // namespace oneflow
+
+#endif  // ONEFLOW_CORE_AUTOGRAD_GRAD_BUCKET_REDUCER_H_
@@ -20,7 +20,7 @@ limitations under the License.
 
 namespace oneflow {
 
-enum ChannelStatus { kChannelStatusSuccess = 0, kChannelStatusErrorClosed };
+enum ChannelStatus { kChannelStatusSuccess = 0, kChannelStatusErrorClosed, kChannelStatusErrorFull };
 
 template<typename T>
 class Channel final {
@@ -28,5 +28,23 @@ DEFINE_THREAD_LOCAL_ENV_BOOL(ONEFLOW_EAGER_ENABLE_LOCAL_INFER_CACHE, true);
 // infer cache in op interpret.
 DEFINE_THREAD_LOCAL_ENV_INTEGER(ONEFLOW_EAGER_TENSOR_INFER_CACHE_SIZE, 128 * 1024);
 
+// NOTE: use env variable 'ONEFLOW_EAGER_ENABLE_OP_CALL_INLINE_CACHE' indicate whether the
+// per op inline cache of infer results and kernel choices is used in naive local op interpret.
+DEFINE_THREAD_LOCAL_ENV_BOOL(ONEFLOW_EAGER_ENABLE_OP_CALL_INLINE_CACHE, true);
+
+// NOTE: use env variable 'ONEFLOW_EAGER_OP_CALL_INLINE_CACHE_SIZE' indicate the number of
+// entries of the per op inline cache.
+DEFINE_THREAD_LOCAL_ENV_INTEGER(ONEFLOW_EAGER_OP_CALL_INLINE_CACHE_SIZE, 8);
+
+// NOTE: use env variable 'ONEFLOW_AUTOGRAD_BACKWARD_WORKER_NUM' indicate the number of worker
+// threads running independent backward functions concurrently. Backward runs serially if it is
+// not greater than 1.
+DEFINE_THREAD_LOCAL_ENV_INTEGER(ONEFLOW_AUTOGRAD_BACKWARD_WORKER_NUM, 0);
+
+// NOTE: use env variable 'ONEFLOW_EAGER_GLOBAL_GRAD_BUCKET_SIZE' indicate the max bytes of a
+// bucket in which the grads of eager global parameters are synchronized by one collective.
+// Grads are synchronized one by one if it is not greater than 0.
+DEFINE_THREAD_LOCAL_ENV_INTEGER(ONEFLOW_EAGER_GLOBAL_GRAD_BUCKET_SIZE, 25 * 1024 * 1024);
+
 }  // namespace oneflow
 #endif  // ONEFLOW_CORE_COMMON_ENV_VAR_EAGER_H_
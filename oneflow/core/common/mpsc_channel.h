@@ -0,0 +1,283 @@
+/*
+Copyright 2020 The OneFlow Authors. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef ONEFLOW_CORE_COMMON_MPSC_CHANNEL_H_
+#define ONEFLOW_CORE_COMMON_MPSC_CHANNEL_H_
+
+#include <deque>
+#include "oneflow/core/common/util.h"
+#include "oneflow/core/common/channel.h"
+#include "oneflow/core/common/spin_wait.h"
+
+namespace oneflow {
+
+// A lock-free multi-producer/single-consumer channel.
+//
+// Producers reserve a contiguous run of cells of a ring with a single compare-and-swap on the
+// tail, so a batch of messages is published by one atomic read-modify-write no matter how large
+// it is. Each cell carries a sequence number telling whether it is free for the position being
+// written or holds a published item. Sending never waits: when the ring is full, or a previous
+// message has already overflowed, the messages go to an unbounded overflow list behind a mutex.
+// Actor threads send to each other, so a producer waiting for room could deadlock with a
+// consumer which is itself waiting to send. The ring capacity only bounds the lock-free fast
+// path, not the number of messages in flight.
+//
+// Messages of one producer are received in the order they were sent: the consumer only takes the
+// overflow list once the ring is empty, and producers keep using the overflow list until the
+// consumer has taken it. The consumer spins for a while before parking on a condition variable,
+// and producers only touch the mutex when the consumer is actually parked.
+template<typename T>
+class MpscChannel final {
+ public:
+  OF_DISALLOW_COPY_AND_MOVE(MpscChannel);
+  explicit MpscChannel(size_t capacity);
+  ~MpscChannel() = default;
+
+  size_t capacity() const { return mask_ + 1; }
+
+  template<typename U>
+  ChannelStatus Send(U&& item);
+  template<typename InputIt>
+  ChannelStatus SendMany(InputIt first, InputIt last);
+  // Only one thread may receive at a time.
+  ChannelStatus Receive(T* item);
+  ChannelStatus ReceiveMany(std::queue<T>* items);
+  // Like Send, but fails with kChannelStatusErrorFull instead of overflowing a full ring.
+  template<typename U>
+  ChannelStatus TrySend(U&& item);
+  void Close();
+
+ private:
+  static constexpr size_t kSpinCountBeforePark = 1 << 12;
+
+  static size_t RoundUpCapacity(size_t capacity) {
+    size_t rounded = 2;
+    while (rounded < capacity) { rounded <<= 1; }
+    return rounded;
+  }
+
+  struct alignas(64) Cell {
+    std::atomic<uint64_t> seq;
+    T item;
+  };
+
+  // Reserves `n` cells if all of them are free. Cells are freed in order, so checking the last
+  // one is enough.
+  bool TryReserve(uint64_t n, uint64_t* pos);
+  void Publish(uint64_t pos, T&& item) {
+    Cell* cell = &cells_[pos & mask_];
+    cell->item = std::move(item);
+    cell->seq.store(pos + 1, std::memory_order_release);
+  }
+  template<typename InputIt>
+  void SendToOverflow(InputIt first, InputIt last);
+  bool IsHeadReady() const {
+    return cells_[head_ & mask_].seq.load(std::memory_order_acquire) == head_ + 1;
+  }
+  // Moves the overflow list to `overflow_received_` if the ring is empty.
+  bool TryTakeOverflow();
+  // Blocks until an item is ready, returns false if the channel is closed and drained.
+  bool WaitReady();
+  void PopHead(T* item) {
+    Cell* cell = &cells_[head_ & mask_];
+    *item = std::move(cell->item);
+    cell->seq.store(head_ + mask_ + 1, std::memory_order_release);
+    head_ += 1;
+  }
+  void NotifyConsumer();
+
+  std::unique_ptr<Cell[]> cells_;
+  const uint64_t mask_;
+  alignas(64) std::atomic<uint64_t> tail_;
+  alignas(64) uint64_t head_;
+  std::atomic<bool> is_closed_;
+  std::atomic<bool> consumer_parked_;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::mutex overflow_mutex_;
+  std::deque<T> overflow_;
+  std::atomic<size_t> overflow_size_;
+  // Overflowed items taken by the consumer, received before the ring.
+  std::deque<T> overflow_received_;
+};
+
+template<typename T>
+MpscChannel<T>::MpscChannel(size_t capacity)
+    : cells_(new Cell[RoundUpCapacity(capacity)]),
+      mask_(RoundUpCapacity(capacity) - 1),
+      tail_(0),
+      head_(0),
+      is_closed_(false),
+      consumer_parked_(false),
+      overflow_size_(0) {
+  for (uint64_t i = 0; i <= mask_; ++i) { cells_[i].seq.store(i, std::memory_order_relaxed); }
+}
+
+template<typename T>
+bool MpscChannel<T>::TryReserve(uint64_t n, uint64_t* pos) {
+  if (n > mask_ + 1) { return false; }
+  uint64_t cur = tail_.load(std::memory_order_relaxed);
+  while (true) {
+    const uint64_t last = cur + n - 1;
+    if (cells_[last & mask_].seq.load(std::memory_order_acquire) != last) { return false; }
+    if (tail_.compare_exchange_weak(cur, cur + n, std::memory_order_relaxed)) { break; }
+  }
+  *pos = cur;
+  return true;
+}
+
+template<typename T>
+template<typename InputIt>
+void MpscChannel<T>::SendToOverflow(InputIt first, InputIt last) {
+  std::unique_lock<std::mutex> lock(overflow_mutex_);
+  for (auto it = first; it != last; ++it) { overflow_.push_back(*it); }
+  overflow_size_.store(overflow_.size(), std::memory_order_release);
+}
+
+template<typename T>
+template<typename U>
+ChannelStatus MpscChannel<T>::Send(U&& item) {
+  if (is_closed_.load(std::memory_order_acquire)) { return kChannelStatusErrorClosed; }
+  uint64_t pos = 0;
+  if (overflow_size_.load(std::memory_order_acquire) == 0 && TryReserve(1, &pos)) {
+    Publish(pos, T(std::forward<U>(item)));
+  } else {
+    T value(std::forward<U>(item));
+    SendToOverflow(&value, &value + 1);
+  }
+  NotifyConsumer();
+  return kChannelStatusSuccess;
+}
+
+template<typename T>
+template<typename InputIt>
+ChannelStatus MpscChannel<T>::SendMany(InputIt first, InputIt last) {
+  if (first == last) { return kChannelStatusSuccess; }
+  if (is_closed_.load(std::memory_order_acquire)) { return kChannelStatusErrorClosed; }
+  const uint64_t n = std::distance(first, last);
+  uint64_t pos = 0;
+  if (overflow_size_.load(std::memory_order_acquire) == 0 && TryReserve(n, &pos)) {
+    for (auto it = first; it != last; ++it, ++pos) { Publish(pos, T(*it)); }
+  } else {
+    SendToOverflow(first, last);
+  }
+  NotifyConsumer();
+  return kChannelStatusSuccess;
+}
+
+template<typename T>
+template<typename U>
+ChannelStatus MpscChannel<T>::TrySend(U&& item) {
+  if (is_closed_.load(std::memory_order_acquire)) { return kChannelStatusErrorClosed; }
+  uint64_t pos = 0;
+  if (overflow_size_.load(std::memory_order_acquire) != 0 || !TryReserve(1, &pos)) {
+    return kChannelStatusErrorFull;
+  }
+  Publish(pos, T(std::forward<U>(item)));
+  NotifyConsumer();
+  return kChannelStatusSuccess;
+}
+
+template<typename T>
+ChannelStatus MpscChannel<T>::Receive(T* item) {
+  if (!WaitReady()) { return kChannelStatusErrorClosed; }
+  if (!overflow_received_.empty()) {
+    *item = std::move(overflow_received_.front());
+    overflow_received_.pop_front();
+  } else {
+    PopHead(item);
+  }
+  return kChannelStatusSuccess;
+}
+
+template<typename T>
+ChannelStatus MpscChannel<T>::ReceiveMany(std::queue<T>* items) {
+  if (!WaitReady()) { return kChannelStatusErrorClosed; }
+  for (auto& item : overflow_received_) { items->push(std::move(item)); }
+  overflow_received_.clear();
+  while (IsHeadReady()) {
+    T item;
+    PopHead(&item);
+    items->push(std::move(item));
+  }
+  return kChannelStatusSuccess;
+}
+
+template<typename T>
+void MpscChannel<T>::Close() {
+  is_closed_.store(true, std::memory_order_release);
+  std::unique_lock<std::mutex> lock(mutex_);
+  cond_.notify_all();
+}
+
+template<typename T>
+bool MpscChannel<T>::TryTakeOverflow() {
+  if (overflow_size_.load(std::memory_order_acquire) == 0) { return false; }
+  std::unique_lock<std::mutex> lock(overflow_mutex_);
+  // A producer reserves its ring cells before overflowing, so under the lock an empty ring means
+  // no earlier message of any producer with an overflowed message is left in it.
+  if (tail_.load(std::memory_order_acquire) != head_) { return false; }
+  overflow_received_.swap(overflow_);
+  overflow_size_.store(0, std::memory_order_release);
+  return !overflow_received_.empty();
+}
+
+template<typename T>
+bool MpscChannel<T>::WaitReady() {
+  const auto IsReady = [this]() {
+    return !overflow_received_.empty() || IsHeadReady() || TryTakeOverflow();
+  };
+  const auto IsDrained = [this]() {
+    return is_closed_.load(std::memory_order_acquire)
+           && tail_.load(std::memory_order_acquire) == head_
+           && overflow_size_.load(std::memory_order_acquire) == 0;
+  };
+  for (size_t i = 0; i < kSpinCountBeforePark; ++i) {
+    if (IsReady()) { return true; }
+    if (IsDrained()) { return false; }
+    CpuRelax();
+  }
+  while (true) {
+    consumer_parked_.store(true);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      // A non-empty overflow list wakes the consumer, which then waits for the ring to drain.
+      cond_.wait(lock, [&]() {
+        return IsHeadReady() || overflow_size_.load(std::memory_order_acquire) != 0
+               || IsDrained();
+      });
+    }
+    consumer_parked_.store(false, std::memory_order_relaxed);
+    if (IsReady()) { return true; }
+    if (IsDrained()) { return false; }
+    CpuRelax();
+  }
+}
+
+template<typename T>
+void MpscChannel<T>::NotifyConsumer() {
+  // Pairs with the fence in WaitReady: either the consumer sees the published item or we see
+  // that it is parked.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (consumer_parked_.load(std::memory_order_relaxed)) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.notify_one();
+  }
+}
+
+}  // namespace oneflow
+
+#endif  // ONEFLOW_CORE_COMMON_MPSC_CHANNEL_H_
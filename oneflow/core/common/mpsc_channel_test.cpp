@@ -0,0 +1,170 @@
+/*
+Copyright 2020 The OneFlow Authors. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include <chrono>
+#include "gtest/gtest.h"
+#include "oneflow/core/common/channel.h"
+#include "oneflow/core/common/mpsc_channel.h"
+
+namespace oneflow {
+
+namespace {
+
+struct TestMsg {
+  int64_t sender;
+  int64_t seq;
+  // pad to the size of an ActorMsg
+  int64_t payload[4];
+};
+
+void SendFromThread(MpscChannel<TestMsg>* channel, int64_t sender, int64_t num_msgs,
+                    size_t batch_size) {
+  std::vector<TestMsg> batch;
+  for (int64_t i = 0; i < num_msgs; ++i) {
+    batch.emplace_back(TestMsg{sender, i, {}});
+    if (batch.size() == batch_size || i + 1 == num_msgs) {
+      if (batch.size() == 1) {
+        ASSERT_EQ(channel->Send(batch.front()), kChannelStatusSuccess);
+      } else {
+        ASSERT_EQ(channel->SendMany(batch.cbegin(), batch.cend()), kChannelStatusSuccess);
+      }
+      batch.clear();
+    }
+  }
+}
+
+void TestMpscChannel(int64_t num_senders, int64_t num_msgs, size_t batch_size, size_t capacity) {
+  MpscChannel<TestMsg> channel(capacity);
+  std::vector<std::thread> senders;
+  for (int64_t i = 0; i < num_senders; ++i) {
+    senders.emplace_back(SendFromThread, &channel, i, num_msgs, batch_size);
+  }
+  std::vector<int64_t> next_seq(num_senders, 0);
+  std::queue<TestMsg> received;
+  int64_t num_received = 0;
+  while (num_received < num_senders * num_msgs) {
+    ASSERT_EQ(channel.ReceiveMany(&received), kChannelStatusSuccess);
+    while (!received.empty()) {
+      const TestMsg& msg = received.front();
+      // messages of one sender must arrive in order
+      ASSERT_EQ(msg.seq, next_seq.at(msg.sender));
+      next_seq.at(msg.sender) += 1;
+      num_received += 1;
+      received.pop();
+    }
+  }
+  for (std::thread& sender : senders) { sender.join(); }
+  channel.Close();
+  ASSERT_EQ(channel.ReceiveMany(&received), kChannelStatusErrorClosed);
+}
+
+template<typename ChannelT>
+double MsgsPerSecond(ChannelT* channel, int64_t num_senders, int64_t num_msgs) {
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> senders;
+  for (int64_t i = 0; i < num_senders; ++i) {
+    senders.emplace_back([channel, i, num_msgs]() {
+      for (int64_t j = 0; j < num_msgs; ++j) { channel->Send(TestMsg{i, j, {}}); }
+    });
+  }
+  std::queue<TestMsg> received;
+  int64_t num_received = 0;
+  while (num_received < num_senders * num_msgs) {
+    CHECK_EQ(channel->ReceiveMany(&received), kChannelStatusSuccess);
+    num_received += received.size();
+    while (!received.empty()) { received.pop(); }
+  }
+  for (std::thread& sender : senders) { sender.join(); }
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  return num_received / std::chrono::duration<double>(elapsed).count();
+}
+
+}  // namespace
+
+TEST(MpscChannel, SingleSender) { TestMpscChannel(1, 10000, 1, 64); }
+
+TEST(MpscChannel, MultiSenders) { TestMpscChannel(8, 10000, 1, 64); }
+
+TEST(MpscChannel, MultiSendersBatched) { TestMpscChannel(8, 10000, 7, 64); }
+
+TEST(MpscChannel, BatchLargerThanCapacity) { TestMpscChannel(4, 10000, 100, 16); }
+
+TEST(MpscChannel, TrySendOnFullRing) {
+  MpscChannel<int> channel(4);
+  for (int i = 0; i < 4; ++i) { ASSERT_EQ(channel.TrySend(i), kChannelStatusSuccess); }
+  ASSERT_EQ(channel.TrySend(4), kChannelStatusErrorFull);
+  int item = -1;
+  ASSERT_EQ(channel.Receive(&item), kChannelStatusSuccess);
+  ASSERT_EQ(item, 0);
+  ASSERT_EQ(channel.TrySend(4), kChannelStatusSuccess);
+  channel.Close();
+  ASSERT_EQ(channel.Send(5), kChannelStatusErrorClosed);
+  for (int i = 1; i < 5; ++i) {
+    ASSERT_EQ(channel.Receive(&item), kChannelStatusSuccess);
+    ASSERT_EQ(item, i);
+  }
+  ASSERT_EQ(channel.Receive(&item), kChannelStatusErrorClosed);
+}
+
+TEST(MpscChannel, SendOnFullRingDoesNotWait) {
+  // Two consumers which first send many messages to each other, like two actor threads, must not
+  // wait for each other to drain their full rings.
+  const int64_t num_msgs = 10000;
+  MpscChannel<TestMsg> channels[2] = {MpscChannel<TestMsg>(4), MpscChannel<TestMsg>(4)};
+  std::vector<std::thread> threads;
+  for (int64_t i = 0; i < 2; ++i) {
+    threads.emplace_back([&, i]() {
+      SendFromThread(&channels[1 - i], i, num_msgs, 3);
+      int64_t next_seq = 0;
+      TestMsg msg{};
+      while (next_seq < num_msgs) {
+        ASSERT_EQ(channels[i].Receive(&msg), kChannelStatusSuccess);
+        ASSERT_EQ(msg.sender, 1 - i);
+        ASSERT_EQ(msg.seq, next_seq);
+        next_seq += 1;
+      }
+    });
+  }
+  for (std::thread& thread : threads) { thread.join(); }
+}
+
+TEST(MpscChannel, OverflowKeepsOrder) {
+  MpscChannel<int> channel(4);
+  for (int i = 0; i < 10; ++i) { ASSERT_EQ(channel.Send(i), kChannelStatusSuccess); }
+  // the ring has room again, but earlier messages are still in the overflow list
+  int item = -1;
+  ASSERT_EQ(channel.Receive(&item), kChannelStatusSuccess);
+  ASSERT_EQ(item, 0);
+  ASSERT_EQ(channel.TrySend(10), kChannelStatusErrorFull);
+  ASSERT_EQ(channel.Send(10), kChannelStatusSuccess);
+  for (int i = 1; i <= 10; ++i) {
+    ASSERT_EQ(channel.Receive(&item), kChannelStatusSuccess);
+    ASSERT_EQ(item, i);
+  }
+}
+
+TEST(MpscChannel, ThroughputBenchmark) {
+  const int64_t num_msgs = 200000;
+  for (int64_t num_senders : {1, 2, 4, 8, 16}) {
+    Channel<TestMsg> channel;
+    MpscChannel<TestMsg> mpsc_channel(4096);
+    const double channel_rate = MsgsPerSecond(&channel, num_senders, num_msgs / num_senders);
+    const double mpsc_rate = MsgsPerSecond(&mpsc_channel, num_senders, num_msgs / num_senders);
+    std::cout << "senders " << num_senders << ", Channel " << channel_rate
+              << " msgs/s, MpscChannel " << mpsc_rate << " msgs/s" << std::endl;
+  }
+}
+
+}  // namespace oneflow
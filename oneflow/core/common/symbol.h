@@ -16,6 +16,7 @@ limitations under the License.
 #ifndef ONEFLOW_CORE_COMMON_SYMBOL_H_
 #define ONEFLOW_CORE_COMMON_SYMBOL_H_
 
+#include <atomic>
 #include <mutex>
 #include <memory>
 #include <unordered_map>
@@ -67,66 +68,163 @@ struct IsScalarType<Symbol<T>> final {
   static const bool value = true;
 };
 
+struct SymbolInternStats {
+  // lookups served by the thread local cache
+  int64_t local_hits = 0;
+  // lookups served by the global table without allocation
+  int64_t global_hits = 0;
+  // lookups that allocated a new symbol
+  int64_t misses = 0;
+  // global table lookups that had to wait for the shard lock
+  int64_t contentions = 0;
+  // entries dropped from full thread local caches
+  int64_t evictions = 0;
+
+  double HitRate() const {
+    const int64_t total = local_hits + global_hits + misses;
+    return total == 0 ? 0 : static_cast<double>(local_hits + global_hits) / total;
+  }
+};
+
+// Symbols are interned in a global table split into kShardNum shards, each guarded by its own
+// lock, so that threads creating symbols of different values rarely wait for each other. The
+// global table never erases entries, hence references to its values stay valid forever. Each
+// thread keeps a bounded cache in front of it which is dropped as a whole when it is full.
 template<typename T>
 struct SymbolUtil final {
   using SymbolMap = std::unordered_map<HashEqTraitPtr<const T>, std::shared_ptr<const T>>;
+  using LocalSymbolMap =
+      std::unordered_map<HashEqTraitPtr<const T>, const std::shared_ptr<const T>*>;
+
+  static constexpr size_t kShardNum = 64;
+  static constexpr size_t kThreadLocalCacheCapacity = 4096;
+  // local hits are published to the global counter in batches to keep the hit path unshared
+  static constexpr int64_t kLocalHitsFlushInterval = 256;
+
+  struct alignas(64) Shard {
+    std::mutex mutex;
+    SymbolMap symbol_map;
+    std::atomic<int64_t> global_hits{0};
+    std::atomic<int64_t> misses{0};
+    std::atomic<int64_t> contentions{0};
+  };
+
+  static Shard* GlobalShards() {
+    static Shard shards[kShardNum];
+    return shards;
+  }
+
+  static Shard* GlobalShard(size_t hash_value) {
+    // the low bits of std::hash are often poor (e.g. identity for integers), so mix them first
+    return &GlobalShards()[(hash_value ^ (hash_value >> 29) ^ (hash_value >> 47)) % kShardNum];
+  }
 
-  static SymbolMap* GlobalSymbolMap() {
-    static SymbolMap symbol_map;
-    return &symbol_map;
+  static std::atomic<int64_t>* GlobalLocalHits() {
+    static std::atomic<int64_t> local_hits{0};
+    return &local_hits;
   }
 
-  static std::mutex* GlobalSymbolMapMutex() {
-    static std::mutex mutex;
-    return &mutex;
+  static std::atomic<int64_t>* GlobalEvictions() {
+    static std::atomic<int64_t> evictions{0};
+    return &evictions;
   }
 
-  static SymbolMap* ThreadLocalSymbolMap() {
-    static thread_local SymbolMap thread_local_symbol_map;
+  static LocalSymbolMap* ThreadLocalSymbolMap() {
+    static thread_local LocalSymbolMap thread_local_symbol_map;
     return &thread_local_symbol_map;
   }
 
-  static std::unordered_set<const T*>* ThreadLocalSymbolPtrSet() {
-    static thread_local std::unordered_set<const T*> thread_local_symbol_ptr_set;
-    return &thread_local_symbol_ptr_set;
+  static int64_t* ThreadLocalUnflushedHits() {
+    static thread_local int64_t unflushed_hits = 0;
+    return &unflushed_hits;
   }
 
-  template<typename SymbolMap::iterator (*GetIter4ObjectAndHashValue)(const T&, size_t)>
+  static void FlushThreadLocalHits() {
+    int64_t* unflushed_hits = ThreadLocalUnflushedHits();
+    if (*unflushed_hits > 0) {
+      GlobalLocalHits()->fetch_add(*unflushed_hits, std::memory_order_relaxed);
+      *unflushed_hits = 0;
+    }
+  }
+
+  static std::unique_lock<std::mutex> LockShard(Shard* shard) {
+    std::unique_lock<std::mutex> lock(shard->mutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+      shard->contentions.fetch_add(1, std::memory_order_relaxed);
+      lock.lock();
+    }
+    return lock;
+  }
+
+  template<const std::shared_ptr<const T>* (*GetPtr4ObjectAndHashValue)(const T&, size_t)>
   static const std::shared_ptr<const T>& LocalThreadGetOr(const T& obj) {
     auto* thread_local_symbol_map = ThreadLocalSymbolMap();
     size_t hash_value = std::hash<T>()(obj);
     HashEqTraitPtr<const T> obj_ptr_wraper(&obj, hash_value);
     const auto& local_iter = thread_local_symbol_map->find(obj_ptr_wraper);
-    if (local_iter != thread_local_symbol_map->end()) { return local_iter->second; }
-    const auto& iter = GetIter4ObjectAndHashValue(obj, hash_value);
-    (*thread_local_symbol_map)[iter->first] = iter->second;
-    CHECK(ThreadLocalSymbolPtrSet()->emplace(iter->second.get()).second);
-    return iter->second;
+    if (local_iter != thread_local_symbol_map->end()) {
+      if (++*ThreadLocalUnflushedHits() >= kLocalHitsFlushInterval) { FlushThreadLocalHits(); }
+      return *local_iter->second;
+    }
+    FlushThreadLocalHits();
+    const std::shared_ptr<const T>* ptr = GetPtr4ObjectAndHashValue(obj, hash_value);
+    if (thread_local_symbol_map->size() >= kThreadLocalCacheCapacity) {
+      GlobalEvictions()->fetch_add(thread_local_symbol_map->size(), std::memory_order_relaxed);
+      thread_local_symbol_map->clear();
+    }
+    thread_local_symbol_map->emplace(HashEqTraitPtr<const T>(ptr->get(), hash_value), ptr);
+    return *ptr;
   }
 
-  static typename SymbolMap::iterator FindGlobalSymbol(const T& obj, size_t hash_value) {
+  static const std::shared_ptr<const T>* FindGlobalSymbol(const T& obj, size_t hash_value) {
     HashEqTraitPtr<const T> new_obj_ptr_wraper(&obj, hash_value);
-    auto* symbol_map = GlobalSymbolMap();
-    std::unique_lock<std::mutex> lock(*GlobalSymbolMapMutex());
-    const auto& iter = symbol_map->find(new_obj_ptr_wraper);
-    CHECK(iter != symbol_map->end());
-    return iter;
+    Shard* shard = GlobalShard(hash_value);
+    auto lock = LockShard(shard);
+    const auto& iter = shard->symbol_map.find(new_obj_ptr_wraper);
+    CHECK(iter != shard->symbol_map.end());
+    shard->global_hits.fetch_add(1, std::memory_order_relaxed);
+    return &iter->second;
   }
 
   static const std::shared_ptr<const T>& SharedFromObject(const T& obj) {
     return LocalThreadGetOr<FindGlobalSymbol>(obj);
   }
 
-  static typename SymbolMap::iterator CreateGlobalSymbol(const T& obj, size_t hash_value) {
+  static const std::shared_ptr<const T>* CreateGlobalSymbol(const T& obj, size_t hash_value) {
+    HashEqTraitPtr<const T> obj_ptr_wraper(&obj, hash_value);
+    Shard* shard = GlobalShard(hash_value);
+    auto lock = LockShard(shard);
+    // probe before allocating so that a hit does not copy the object
+    const auto& iter = shard->symbol_map.find(obj_ptr_wraper);
+    if (iter != shard->symbol_map.end()) {
+      shard->global_hits.fetch_add(1, std::memory_order_relaxed);
+      return &iter->second;
+    }
     std::shared_ptr<const T> ptr(new T(obj));
     HashEqTraitPtr<const T> new_obj_ptr_wraper(ptr.get(), hash_value);
-    std::unique_lock<std::mutex> lock(*GlobalSymbolMapMutex());
-    return GlobalSymbolMap()->emplace(new_obj_ptr_wraper, ptr).first;
+    shard->misses.fetch_add(1, std::memory_order_relaxed);
+    return &shard->symbol_map.emplace(new_obj_ptr_wraper, std::move(ptr)).first->second;
   }
 
   static const std::shared_ptr<const T>& GetOrCreatePtr(const T& obj) {
     return LocalThreadGetOr<CreateGlobalSymbol>(obj);
   }
+
+  // Local hits of other threads are only counted once they are flushed, at most
+  // kLocalHitsFlushInterval - 1 per thread may be missing.
+  static SymbolInternStats GetStats() {
+    FlushThreadLocalHits();
+    SymbolInternStats stats;
+    stats.local_hits = GlobalLocalHits()->load(std::memory_order_relaxed);
+    stats.evictions = GlobalEvictions()->load(std::memory_order_relaxed);
+    for (size_t i = 0; i < kShardNum; ++i) {
+      const Shard* shard = &GlobalShards()[i];
+      stats.global_hits += shard->global_hits.load(std::memory_order_relaxed);
+      stats.misses += shard->misses.load(std::memory_order_relaxed);
+      stats.contentions += shard->contentions.load(std::memory_order_relaxed);
+    }
+    return stats;
+  }
 };
 
 template<typename T>
@@ -148,6 +246,11 @@ Symbol<T> SymbolOf(const T& obj) {
   return Symbol<T>(obj);
 }
 
+template<typename T>
+SymbolInternStats GetSymbolInternStats() {
+  return SymbolUtil<T>::GetStats();
+}
+
 }  // namespace oneflow
 
 namespace std {
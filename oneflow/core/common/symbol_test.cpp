@@ -13,6 +13,9 @@ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 See the License for the specific language governing permissions and
 limitations under the License.
 */
+#include <chrono>
+#include <iostream>
+#include <thread>
 #include "gtest/gtest.h"
 #include "oneflow/core/common/symbol.h"
 #include "oneflow/core/common/util.h"
@@ -34,6 +37,32 @@ class SymObject {
   std::string name_;
 };
 
+class IntObject {
+ public:
+  explicit IntObject(int64_t value) : value_(value) {}
+
+  int64_t value() const { return value_; }
+
+  bool operator==(const IntObject& other) const { return value_ == other.value_; }
+
+ private:
+  int64_t value_;
+};
+
+// A separated type for each test so that the intern stats do not mix.
+template<int kTag>
+class TaggedObject {
+ public:
+  explicit TaggedObject(int64_t value) : value_(value) {}
+
+  int64_t value() const { return value_; }
+
+  bool operator==(const TaggedObject& other) const { return value_ == other.value_; }
+
+ private:
+  int64_t value_;
+};
+
 }  // namespace detail
 
 TEST(Symbol, shared_from_symbol) {
@@ -42,6 +71,91 @@ TEST(Symbol, shared_from_symbol) {
               == SymbolOf(detail::SymObject("SymbolObjectFoo")).shared_from_symbol().get());
 }
 
+TEST(Symbol, intern_stats) {
+  using ObjectT = detail::TaggedObject<0>;
+  Symbol<ObjectT> symbol(ObjectT(1));
+  SymbolInternStats stats = GetSymbolInternStats<ObjectT>();
+  ASSERT_EQ(stats.misses, 1);
+  ASSERT_EQ(stats.global_hits, 0);
+  ASSERT_EQ(stats.local_hits, 0);
+  for (int i = 0; i < 10; ++i) { ASSERT_TRUE(SymbolOf(ObjectT(1)) == symbol); }
+  stats = GetSymbolInternStats<ObjectT>();
+  ASSERT_EQ(stats.misses, 1);
+  ASSERT_EQ(stats.local_hits, 10);
+  // a new thread misses its local cache but finds the symbol in the global table
+  std::thread thread([&]() { ASSERT_TRUE(SymbolOf(ObjectT(1)) == symbol); });
+  thread.join();
+  stats = GetSymbolInternStats<ObjectT>();
+  ASSERT_EQ(stats.misses, 1);
+  ASSERT_EQ(stats.global_hits, 1);
+}
+
+TEST(Symbol, bounded_thread_local_cache) {
+  using ObjectT = detail::TaggedObject<1>;
+  const int64_t num = SymbolUtil<ObjectT>::kThreadLocalCacheCapacity * 2 + 1;
+  std::vector<Symbol<ObjectT>> symbols;
+  std::vector<const std::shared_ptr<const ObjectT>*> shared_ptrs;
+  for (int64_t i = 0; i < num; ++i) {
+    symbols.emplace_back(ObjectT(i));
+    shared_ptrs.emplace_back(&symbols.back().shared_from_symbol());
+  }
+  SymbolInternStats stats = GetSymbolInternStats<ObjectT>();
+  ASSERT_EQ(stats.misses, num);
+  ASSERT_EQ(stats.evictions, SymbolUtil<ObjectT>::kThreadLocalCacheCapacity * 2);
+  // evicted symbols are found again and the references returned before stay valid
+  for (int64_t i = 0; i < num; ++i) {
+    ASSERT_TRUE(SymbolOf(ObjectT(i)) == symbols.at(i));
+    ASSERT_EQ(symbols.at(i)->value(), i);
+    ASSERT_EQ(shared_ptrs.at(i)->get(), &*symbols.at(i));
+  }
+  ASSERT_EQ(GetSymbolInternStats<ObjectT>().misses, num);
+}
+
+TEST(Symbol, multi_thread_interning) {
+  using ObjectT = detail::TaggedObject<2>;
+  const int thread_num = 8;
+  const int64_t num = 1000;
+  std::vector<std::vector<const ObjectT*>> thread2ptrs(thread_num);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < thread_num; ++t) {
+    threads.emplace_back([&, t]() {
+      for (int64_t i = 0; i < num; ++i) { thread2ptrs.at(t).emplace_back(&*SymbolOf(ObjectT(i))); }
+    });
+  }
+  for (auto& thread : threads) { thread.join(); }
+  for (int t = 1; t < thread_num; ++t) { ASSERT_EQ(thread2ptrs.at(t), thread2ptrs.at(0)); }
+  const SymbolInternStats stats = GetSymbolInternStats<ObjectT>();
+  ASSERT_EQ(stats.misses, num);
+  ASSERT_EQ(stats.global_hits, num * (thread_num - 1));
+}
+
+TEST(Symbol, multi_thread_benchmark) {
+  using ObjectT = detail::IntObject;
+  // the working set fits in the thread local caches for the first case only
+  for (int64_t num : {int64_t{1024}, int64_t{SymbolUtil<ObjectT>::kThreadLocalCacheCapacity * 4}}) {
+    for (int thread_num : {1, 4, 16}) {
+      const SymbolInternStats before = GetSymbolInternStats<ObjectT>();
+      const int64_t iter_num = 100000;
+      auto start = std::chrono::steady_clock::now();
+      std::vector<std::thread> threads;
+      for (int t = 0; t < thread_num; ++t) {
+        threads.emplace_back([&, t]() {
+          for (int64_t i = 0; i < iter_num; ++i) { SymbolOf(ObjectT((i * 7 + t) % num)); }
+        });
+      }
+      for (auto& thread : threads) { thread.join(); }
+      double seconds =
+          std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      const SymbolInternStats after = GetSymbolInternStats<ObjectT>();
+      std::cout << "Symbol interning distinct objects: " << num << ", threads: " << thread_num
+                << ", Mops/s: " << iter_num * thread_num / seconds / 1e6
+                << ", misses: " << after.misses - before.misses
+                << ", global hits: " << after.global_hits - before.global_hits
+                << ", contentions: " << after.contentions - before.contentions << std::endl;
+    }
+  }
+}
+
 }  // namespace test
 }  // namespace oneflow
 
@@ -54,4 +168,18 @@ struct hash<oneflow::test::detail::SymObject> final {
   }
 };
 
+template<>
+struct hash<oneflow::test::detail::IntObject> final {
+  size_t operator()(const oneflow::test::detail::IntObject& obj) const {
+    return std::hash<int64_t>()(obj.value());
+  }
+};
+
+template<int kTag>
+struct hash<oneflow::test::detail::TaggedObject<kTag>> final {
+  size_t operator()(const oneflow::test::detail::TaggedObject<kTag>& obj) const {
+    return std::hash<int64_t>()(obj.value());
+  }
+};
+
 }  // namespace std
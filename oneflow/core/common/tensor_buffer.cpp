@@ -52,7 +52,7 @@ void TensorBufferImpl::Reset(const Shape& shape, DataType dtype) {
   if (dtype == DataType::kInvalidDataType || elem_cnt == 0) { return; }
   CheckTensorBufferDataType(dtype);
 
-  if (shape == shape_ && dtype == data_type_) { return; }
+  if (shape == shape_ && dtype == data_type_ && !is_external()) { return; }
 
   shape_ = shape;
   data_type_ = dtype;
@@ -78,6 +78,18 @@ void TensorBufferImpl::Reset() {
   DeallocateBuffer();
 }
 
+void TensorBufferImpl::ResetExternal(const Shape& shape, DataType dtype, void* ptr,
+                                     std::shared_ptr<const void> holder) {
+  CheckTensorBufferDataType(dtype);
+  CHECK(holder) << "external TensorBuffer memory must have an owner";
+  DeallocateBuffer();
+  shape_ = shape;
+  data_type_ = dtype;
+  buffer_ = ptr;
+  buffer_size_ = shape.elem_cnt() * GetSizeOfDataType(dtype);
+  external_holder_ = std::move(holder);
+}
+
 void TensorBufferImpl::AllocateBuffer(size_t size) {
   CHECK(buffer_ == nullptr);
   buffer_ = MemoryAllocatorImpl::AllocateUnPinnedHostMem(size);
@@ -85,12 +97,17 @@ void TensorBufferImpl::AllocateBuffer(size_t size) {
 }
 
 void TensorBufferImpl::DeallocateBuffer() {
-  if (buffer_) { MemoryAllocatorImpl::DeallocateUnPinnedHostMem(buffer_); }
+  if (is_external()) {
+    external_holder_.reset();
+  } else if (buffer_) {
+    MemoryAllocatorImpl::DeallocateUnPinnedHostMem(buffer_);
+  }
   buffer_ = nullptr;
   buffer_size_ = 0;
 }
 
 void TensorBufferImpl::Reserve(size_t new_size) {
+  if (is_external()) { DeallocateBuffer(); }
   if (new_size > buffer_size_) {
     size_t growth_size = std::max(new_size, GetTensorBufferGrowthSize(new_size));
     DeallocateBuffer();
@@ -107,7 +124,8 @@ void TensorBufferImpl::Reserve(size_t new_size) {
 void TensorBufferImpl::CopyFrom(const TensorBufferImpl* src) {
   if (src == this) { return; }
   Reset(src->shape(), src->data_type());
-  memcpy(buffer_, src->buffer(), buffer_size_);
+  // buffer_size_ may be rounded up past the end of an external src.
+  memcpy(buffer_, src->buffer(), shape_.elem_cnt() * GetSizeOfDataType(data_type_));
 }
 
 void TensorBufferImpl::Swap(TensorBufferImpl* other) {
@@ -115,6 +133,7 @@ void TensorBufferImpl::Swap(TensorBufferImpl* other) {
   std::swap(buffer_size_, other->buffer_size_);
   std::swap(shape_, other->shape_);
   std::swap(data_type_, other->data_type_);
+  std::swap(external_holder_, other->external_holder_);
 }
 
 }  // namespace detail
@@ -161,6 +180,12 @@ void TensorBuffer::Reset() {
   if (impl_) { impl_->Reset(); }
 }
 
+void TensorBuffer::ResetExternal(const Shape& shape, DataType dtype, void* ptr,
+                                 std::shared_ptr<const void> holder) {
+  if (!is_allocated()) { impl_.reset(new detail::TensorBufferImpl()); }
+  impl_->ResetExternal(shape, dtype, ptr, std::move(holder));
+}
+
 const Shape& TensorBuffer::shape() const {
   CHECK(is_allocated()) << "TensorBuffer is not allocated";
   return impl_->shape();
@@ -245,6 +270,11 @@ void TensorBufferPool::Allocate(ItemT* item, const Shape& shape, DataType dtype)
 
 void TensorBufferPool::Deallocate(ItemT* item) {
   if (!(*item)) { return; }
+  // An external buffer owns no memory worth recycling, and pooling it would keep its holder alive.
+  if ((*item)->is_external()) {
+    item->reset();
+    return;
+  }
   auto& thread_local_cache = ThreadLocalCache();
   if (thread_local_cache.size() < thread_local_cache_size_) {
     thread_local_cache.push_back(std::move(*item));
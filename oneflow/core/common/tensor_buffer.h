@@ -43,12 +43,17 @@ class TensorBufferImpl final {
   void Reset(const Shape& shape);
   void Reset(DataType dtype);
   void Reset();
+  // Points the buffer at memory owned by `holder` instead of allocating one. A later Reset to
+  // another shape or data type allocates a buffer of its own again.
+  void ResetExternal(const Shape& shape, DataType dtype, void* ptr,
+                     std::shared_ptr<const void> holder);
 
   void CopyFrom(const TensorBufferImpl* src);
   void Swap(TensorBufferImpl* other);
 
   const Shape& shape() const { return shape_; }
   DataType data_type() const { return data_type_; }
+  bool is_external() const { return external_holder_ != nullptr; }
 
   void* buffer() { return buffer_; }
   const void* buffer() const { return buffer_; }
@@ -64,6 +69,7 @@ class TensorBufferImpl final {
 
   void* buffer_;
   size_t buffer_size_;
+  std::shared_ptr<const void> external_holder_;
 };
 
 }  // namespace detail
@@ -93,6 +99,11 @@ class TensorBuffer final {
   void Reset(DataType dtype);
   void Reset();
 
+  // Zero-copy view of `ptr`, e.g. a record inside a memory mapped file. `holder` keeps the memory
+  // alive for as long as the TensorBuffer refers to it.
+  void ResetExternal(const Shape& shape, DataType dtype, void* ptr,
+                     std::shared_ptr<const void> holder);
+
   // backward compatible interface and will be deprecated in future
   void Resize(const Shape& shape, DataType dtype) { Reset(shape, dtype); }
 
@@ -0,0 +1,64 @@
+/*
+Copyright 2020 The OneFlow Authors. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include <gtest/gtest.h>
+#include "oneflow/core/common/tensor_buffer.h"
+
+namespace oneflow {
+namespace test {
+
+TEST(TensorBuffer, ResetExternal) {
+  auto holder = std::make_shared<std::vector<char>>(16, 'x');
+  std::weak_ptr<std::vector<char>> weak_holder = holder;
+  {
+    TensorBuffer buffer;
+    buffer.ResetExternal(Shape({8}), DataType::kChar, holder->data() + 4, holder);
+    holder.reset();
+    ASSERT_FALSE(weak_holder.expired());
+    ASSERT_EQ(buffer.nbytes(), 8);
+    ASSERT_EQ(buffer.data<char>(), weak_holder.lock()->data() + 4);
+
+    TensorBuffer copy;
+    copy.CopyFrom(buffer);
+    ASSERT_NE(copy.data<char>(), buffer.data<char>());
+    ASSERT_EQ(std::string(copy.data<char>(), copy.nbytes()), std::string(8, 'x'));
+
+    // Reshaping must not write into the external memory.
+    buffer.Reset(Shape({32}), DataType::kChar);
+    ASSERT_TRUE(weak_holder.expired());
+    std::memset(buffer.mut_data<char>(), 0, buffer.nbytes());
+  }
+}
+
+TEST(TensorBuffer, ResetExternalWithPool) {
+  TensorBufferPool::New();
+  auto holder = std::make_shared<std::vector<char>>(16, 'x');
+  std::weak_ptr<std::vector<char>> weak_holder = holder;
+  {
+    TensorBuffer buffer;
+    buffer.ResetExternal(Shape({16}), DataType::kChar, holder->data(), holder);
+    holder.reset();
+  }
+  // The pool must not keep external memory alive.
+  ASSERT_TRUE(weak_holder.expired());
+  {
+    TensorBuffer buffer(Shape({16}), DataType::kChar);
+    std::memset(buffer.mut_data<char>(), 0, buffer.nbytes());
+  }
+  TensorBufferPool::Delete();
+}
+
+}  // namespace test
+}  // namespace oneflow
@@ -16,16 +16,28 @@ limitations under the License.
 #include "oneflow/core/embedding/cache.h"
 #include "oneflow/core/embedding/full_cache.h"
 #include "oneflow/core/embedding/lru_cache.h"
+#include "oneflow/core/embedding/host_full_cache.h"
+#include "oneflow/core/embedding/host_lru_cache.h"
 
 namespace oneflow {
 
 namespace embedding {
 
 std::unique_ptr<Cache> NewCache(const CacheOptions& options) {
-#ifdef WITH_CUDA
   CHECK_GT(options.key_size, 0);
   CHECK_GT(options.value_size, 0);
   CHECK_GT(options.capacity, 0);
+  if (options.device_type == DeviceType::kCPU) {
+    if (options.policy == CacheOptions::Policy::kLRU) {
+      return NewHostLruCache(options);
+    } else if (options.policy == CacheOptions::Policy::kFull) {
+      return NewHostFullCache(options);
+    } else {
+      UNIMPLEMENTED();
+      return nullptr;
+    }
+  }
+#ifdef WITH_CUDA
   if (options.policy == CacheOptions::Policy::kLRU) {
     return NewLruCache(options);
   } else if (options.policy == CacheOptions::Policy::kFull) {
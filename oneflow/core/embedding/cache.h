@@ -35,6 +35,9 @@ struct CacheOptions {
     kHost,
   };
   Policy policy = Policy::kLRU;
+  // The device that runs the cache queries, kCPU selects the host implementations which take host
+  // pointers and a CpuStream.
+  DeviceType device_type = DeviceType::kCUDA;
   MemoryKind value_memory_kind = MemoryKind::kDevice;
   uint64_t capacity{};
   uint32_t key_size{};
@@ -52,6 +55,7 @@ class Cache {
   virtual uint32_t KeySize() const = 0;
   virtual uint32_t ValueSize() const = 0;
   virtual DataType ValueType() const = 0;
+  virtual DeviceType device_type() const { return DeviceType::kCUDA; }
   virtual uint32_t MaxQueryLength() const = 0;
   virtual void ReserveQueryLength(uint32_t query_length) = 0;
   virtual uint64_t Capacity() const = 0;
@@ -17,6 +17,9 @@ limitations under the License.
 #include "oneflow/core/device/cuda_util.h"
 #include <gtest/gtest.h>
 #include "oneflow/core/ep/include/device_manager_registry.h"
+#include "oneflow/core/ep/cpu/cpu_device.h"
+#include "oneflow/core/embedding/cached_key_value_store.h"
+#include "oneflow/core/embedding/key_value_store_options.h"
 
 namespace oneflow {
 
@@ -244,6 +247,270 @@ TEST(Cache, LruCache) {
 
 #endif  // WITH_CUDA
 
+void TestHostCache(Cache* cache, uint32_t line_size) {
+  std::unique_ptr<ep::DeviceManagerRegistry> device_manager_registry(
+      new ep::DeviceManagerRegistry());
+  auto device = device_manager_registry->GetDevice(DeviceType::kCPU, 0);
+  std::dynamic_pointer_cast<ep::CpuDevice>(device)->SetNumThreads(
+      std::max<size_t>(std::thread::hardware_concurrency(), 2));
+  ep::Stream* stream = device->CreateStream();
+
+  std::unordered_set<int64_t> in_cache;
+  const size_t n_iter = 32;
+  const uint32_t n_keys = 1024;
+  std::vector<int64_t> keys(n_keys);
+  uint32_t n_missing = 0;
+  std::vector<int64_t> missing_keys(n_keys);
+  std::vector<uint32_t> missing_indices(n_keys);
+  std::vector<float> values(n_keys * line_size);
+  uint32_t n_evicted = 0;
+  std::vector<int64_t> evicted_keys(n_keys);
+  std::vector<float> evicted_values(n_keys * line_size);
+  std::vector<uint8_t> mask(n_keys);
+  std::vector<int64_t> random_keys(n_keys * 32);
+  std::iota(random_keys.begin(), random_keys.end(), 1);
+  std::random_device rd;
+  std::mt19937 g(rd());
+  for (size_t iter = 0; iter < n_iter; ++iter) {
+    std::shuffle(random_keys.begin(), random_keys.end(), g);
+    std::copy(random_keys.begin(), random_keys.begin() + n_keys, keys.begin());
+    uint32_t expect_n_missing = 0;
+    std::unordered_set<int64_t> expect_missing_keys_set;
+    std::unordered_set<uint32_t> expect_missing_indices_set;
+    std::unordered_set<int64_t> keys_set;
+    for (size_t i = 0; i < n_keys; ++i) {
+      keys_set.emplace(keys[i]);
+      if (in_cache.count(keys[i]) == 0) {
+        expect_missing_keys_set.emplace(keys[i]);
+        expect_missing_indices_set.emplace(i);
+        expect_n_missing += 1;
+      }
+    }
+    // test
+    cache->Test(stream, n_keys, keys.data(), &n_missing, missing_keys.data(),
+                missing_indices.data());
+    ASSERT_EQ(n_missing, expect_n_missing);
+    std::unordered_set<int64_t> test_missing_keys_set;
+    std::unordered_set<uint32_t> test_missing_indices_set;
+    for (size_t i = 0; i < n_missing; ++i) {
+      test_missing_keys_set.emplace(missing_keys[i]);
+      test_missing_indices_set.emplace(missing_indices[i]);
+      ASSERT_EQ(keys[missing_indices[i]], missing_keys[i]);
+    }
+    ASSERT_EQ(test_missing_keys_set, expect_missing_keys_set);
+    ASSERT_EQ(test_missing_indices_set, expect_missing_indices_set);
+
+    // get
+    if (cache->Policy() == CacheOptions::Policy::kFull) {
+      cache->Get(stream, n_keys, keys.data(), values.data(), mask.data());
+      for (size_t i = 0; i < n_keys; ++i) {
+        ASSERT_EQ(mask[i], expect_missing_keys_set.count(keys[i]) == 0);
+      }
+    }
+    cache->Get(stream, n_keys, keys.data(), values.data(), &n_missing, missing_keys.data(),
+               missing_indices.data());
+    ASSERT_EQ(n_missing, expect_n_missing);
+    std::unordered_set<int64_t> get_missing_keys_set;
+    std::unordered_set<uint32_t> get_missing_indices_set;
+    for (size_t i = 0; i < n_missing; ++i) {
+      get_missing_keys_set.emplace(missing_keys[i]);
+      get_missing_indices_set.emplace(missing_indices[i]);
+      ASSERT_EQ(keys[missing_indices[i]], missing_keys[i]);
+    }
+    ASSERT_EQ(get_missing_keys_set, expect_missing_keys_set);
+    ASSERT_EQ(get_missing_indices_set, expect_missing_indices_set);
+    for (size_t i = 0; i < n_keys; ++i) {
+      if (get_missing_keys_set.count(keys[i]) == 0) {
+        for (size_t j = 0; j < line_size; ++j) {
+          ASSERT_EQ(values[i * line_size + j], static_cast<float>(keys[i] * line_size + j))
+              << "iter " << iter << " i " << i << " j " << j;
+        }
+      }
+    }
+
+    // put
+    for (size_t i = 0; i < n_keys; ++i) {
+      for (size_t j = 0; j < line_size; ++j) {
+        values[i * line_size + j] = static_cast<float>(keys[i] * line_size + j);
+      }
+    }
+    cache->Put(stream, n_keys, keys.data(), values.data(), &n_evicted, evicted_keys.data(),
+               evicted_values.data());
+    for (size_t i = 0; i < n_evicted; ++i) {
+      ASSERT_TRUE(in_cache.count(evicted_keys[i]) > 0 || keys_set.count(evicted_keys[i]) > 0);
+      for (size_t j = 0; j < line_size; ++j) {
+        ASSERT_EQ(evicted_values[i * line_size + j],
+                  static_cast<float>(evicted_keys[i] * line_size + j));
+      }
+    }
+    for (size_t i = 0; i < n_keys; ++i) { in_cache.emplace(keys[i]); }
+    for (size_t i = 0; i < n_evicted; ++i) { in_cache.erase(evicted_keys[i]); }
+  }
+  const uint64_t dump_capacity = cache->DumpCapacity();
+  for (size_t start_key_index = 0; start_key_index < dump_capacity; start_key_index += n_keys) {
+    cache->Dump(stream, start_key_index, std::min(start_key_index + n_keys, dump_capacity),
+                &n_evicted, evicted_keys.data(), evicted_values.data());
+    for (size_t i = 0; i < n_evicted; ++i) {
+      ASSERT_TRUE(in_cache.count(evicted_keys[i]) > 0);
+      in_cache.erase(evicted_keys[i]);
+      for (size_t j = 0; j < line_size; ++j) {
+        ASSERT_EQ(evicted_values[i * line_size + j],
+                  static_cast<float>(evicted_keys[i] * line_size + j));
+      }
+    }
+  }
+  CHECK_EQ(in_cache.size(), 0);
+  device->DestroyStream(stream);
+}
+
+// A KeyValueStore over a std::unordered_map, just enough to back a host cache.
+class HostMapKeyValueStore : public KeyValueStore {
+ public:
+  OF_DISALLOW_COPY_AND_MOVE(HostMapKeyValueStore);
+  explicit HostMapKeyValueStore(uint32_t value_size) : value_size_(value_size) {}
+  ~HostMapKeyValueStore() override = default;
+
+  uint32_t KeySize() const override { return sizeof(int64_t); }
+  uint32_t ValueSize() const override { return value_size_; }
+  uint32_t MaxQueryLength() const override { return UINT32_MAX; }
+  void ReserveQueryLength(uint32_t query_length) override {}
+
+  void Get(ep::Stream* stream, uint32_t num_keys, const void* keys, void* values,
+           uint32_t* n_missing, uint32_t* missing_indices) override {
+    *n_missing = 0;
+    for (uint32_t i = 0; i < num_keys; ++i) {
+      auto it = map_.find(static_cast<const int64_t*>(keys)[i]);
+      if (it == map_.end()) {
+        missing_indices[(*n_missing)++] = i;
+      } else {
+        std::memcpy(static_cast<char*>(values) + i * value_size_, it->second.data(), value_size_);
+      }
+    }
+  }
+  void Put(ep::Stream* stream, uint32_t num_keys, const void* keys, const void* values) override {
+    for (uint32_t i = 0; i < num_keys; ++i) {
+      const char* value = static_cast<const char*>(values) + i * value_size_;
+      map_[static_cast<const int64_t*>(keys)[i]].assign(value, value + value_size_);
+    }
+  }
+  bool SnapshotExists(const std::string& name) override { return false; }
+  void LoadSnapshot(const std::string& name) override { UNIMPLEMENTED(); }
+  void LoadSnapshot(const std::string& name,
+                    const std::function<void(KVIterator* iter)>& Hook) override {
+    UNIMPLEMENTED();
+  }
+  void SaveSnapshot(const std::string& name) override { UNIMPLEMENTED(); }
+
+ private:
+  uint32_t value_size_;
+  std::unordered_map<int64_t, std::vector<char>> map_;
+};
+
+TEST(Cache, HostFullCache) {
+  CacheOptions options{};
+  options.policy = CacheOptions::Policy::kFull;
+  options.device_type = DeviceType::kCPU;
+  const uint32_t line_size = 128;
+  options.value_size = 512;
+  options.capacity = 65536;
+  options.key_size = 8;
+  std::unique_ptr<Cache> cache(NewCache(options));
+  cache->ReserveQueryLength(65536);
+  TestHostCache(cache.get(), line_size);
+}
+
+TEST(Cache, HostLruCache) {
+  CacheOptions options{};
+  options.policy = CacheOptions::Policy::kLRU;
+  options.device_type = DeviceType::kCPU;
+  const uint32_t line_size = 128;
+  options.value_size = 512;
+  options.capacity = 16384;
+  options.key_size = 8;
+  std::unique_ptr<Cache> cache(NewCache(options));
+  cache->ReserveQueryLength(65536);
+  TestHostCache(cache.get(), line_size);
+}
+
+// Puts 8x `n_keys` keys into `store`, most of them end up in the backing store by eviction, then
+// gets them back.
+void TestHostCachedKeyValueStore(KeyValueStore* store, uint32_t line_size, uint32_t n_keys) {
+  std::unique_ptr<ep::DeviceManagerRegistry> device_manager_registry(
+      new ep::DeviceManagerRegistry());
+  auto device = device_manager_registry->GetDevice(DeviceType::kCPU, 0);
+  ep::Stream* stream = device->CreateStream();
+  store->ReserveQueryLength(n_keys);
+  std::vector<int64_t> keys(n_keys);
+  std::vector<float> values(n_keys * line_size);
+  std::vector<uint32_t> missing_indices(n_keys);
+  uint32_t n_missing = 0;
+  for (int64_t round = 0; round < 8; ++round) {
+    for (uint32_t i = 0; i < n_keys; ++i) {
+      keys[i] = round * n_keys + i;
+      for (uint32_t j = 0; j < line_size; ++j) {
+        values[i * line_size + j] = static_cast<float>(keys[i] * line_size + j);
+      }
+    }
+    store->Put(stream, n_keys, keys.data(), values.data());
+  }
+  for (int64_t round = 0; round < 9; ++round) {
+    for (uint32_t i = 0; i < n_keys; ++i) { keys[i] = round * n_keys + i; }
+    std::fill(values.begin(), values.end(), 0.f);
+    store->Get(stream, n_keys, keys.data(), values.data(), &n_missing, missing_indices.data());
+    if (round == 8) {
+      ASSERT_EQ(n_missing, n_keys);
+      continue;
+    }
+    ASSERT_EQ(n_missing, 0);
+    for (uint32_t i = 0; i < n_keys * line_size; ++i) {
+      ASSERT_EQ(values[i], static_cast<float>(keys[i / line_size] * line_size + i % line_size));
+    }
+  }
+  device->DestroyStream(stream);
+}
+
+TEST(Cache, HostCachedKeyValueStore) {
+  const uint32_t line_size = 32;
+  const uint32_t n_keys = 1024;
+  CacheOptions options{};
+  options.policy = CacheOptions::Policy::kLRU;
+  options.device_type = DeviceType::kCPU;
+  options.value_size = line_size * sizeof(float);
+  options.capacity = n_keys;
+  options.key_size = 8;
+  std::unique_ptr<KeyValueStore> store = NewCachedKeyValueStore(
+      std::make_unique<HostMapKeyValueStore>(options.value_size), NewCache(options));
+  TestHostCachedKeyValueStore(store.get(), line_size, n_keys);
+}
+
+TEST(Cache, HostCachedKeyValueStoreFromOptions) {
+  const uint32_t line_size = 32;
+  const uint32_t n_keys = 1024;
+  const std::string options_json = R"({
+    "name": "host_cached_embedding",
+    "device_type": "cpu",
+    "key_type_size": 8,
+    "value_type_size": 4,
+    "value_type": "oneflow.float32",
+    "storage_dim": 32,
+    "parallel_num": 1,
+    "kv_store": {
+      "caches": [{"policy": "lru", "capacity": 1024, "value_memory_kind": "host"}],
+      "persistent_table": {"path": "unused", "physical_block_size": 4096}
+    }
+  })";
+  const KeyValueStoreOptions options(options_json);
+  ASSERT_EQ(options.GetDeviceType(), DeviceType::kCPU);
+  ASSERT_EQ(options.GetCachesOptions().size(), 1);
+  const CacheOptions& cache_options = options.GetCachesOptions().at(0);
+  ASSERT_EQ(cache_options.device_type, DeviceType::kCPU);
+  std::unique_ptr<Cache> cache = NewCache(cache_options);
+  ASSERT_EQ(cache->device_type(), DeviceType::kCPU);
+  std::unique_ptr<KeyValueStore> store = NewCachedKeyValueStore(
+      std::make_unique<HostMapKeyValueStore>(cache_options.value_size), std::move(cache));
+  TestHostCachedKeyValueStore(store.get(), line_size, n_keys);
+}
+
 }  // namespace
 
 }  // namespace embedding
@@ -26,6 +26,13 @@ namespace embedding {
 std::unique_ptr<KeyValueStore> NewCachedKeyValueStore(std::unique_ptr<KeyValueStore>&& store,
                                                       std::unique_ptr<Cache>&& cache);
 
+#ifdef WITH_CUDA
+
+std::unique_ptr<KeyValueStore> NewCudaCachedKeyValueStore(std::unique_ptr<KeyValueStore>&& store,
+                                                          std::unique_ptr<Cache>&& cache);
+
+#endif  // WITH_CUDA
+
 }  // namespace embedding
 
 }  // namespace oneflow
@@ -0,0 +1,75 @@
+/*
+Copyright 2020 The OneFlow Authors. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "oneflow/core/embedding/host_cache_util.h"
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/mempolicy.h>
+
+namespace oneflow {
+
+namespace embedding {
+
+namespace {
+
+// Parses the node list in /sys/devices/system/node/online, e.g. "0-1,3".
+std::vector<int> GetOnlineNumaNodes() {
+  std::vector<int> nodes;
+  std::ifstream in("/sys/devices/system/node/online");
+  std::string list;
+  if (!in || !std::getline(in, list)) { return nodes; }
+  std::stringstream ss(list);
+  std::string range;
+  while (std::getline(ss, range, ',')) {
+    const size_t dash = range.find('-');
+    const int first = std::stoi(range.substr(0, dash));
+    const int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+    for (int node = first; node <= last; ++node) { nodes.push_back(node); }
+  }
+  return nodes;
+}
+
+void InterleaveOverNumaNodes(void* ptr, size_t size) {
+  static const std::vector<int> nodes = GetOnlineNumaNodes();
+  if (nodes.size() <= 1) { return; }
+  constexpr size_t kBitsPerMask = sizeof(unsigned long) * 8;
+  const size_t max_node = nodes.back() + 1;
+  std::vector<unsigned long> node_mask((max_node + kBitsPerMask - 1) / kBitsPerMask, 0);
+  for (int node : nodes) { node_mask[node / kBitsPerMask] |= 1UL << (node % kBitsPerMask); }
+  if (syscall(SYS_mbind, ptr, size, MPOL_INTERLEAVE, node_mask.data(), max_node + 1, 0) != 0) {
+    LOG(WARNING) << "mbind failed: " << strerror(errno);
+  }
+}
+
+}  // namespace
+
+void* AllocateHostCacheMemory(size_t size) {
+  void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  PCHECK(ptr != MAP_FAILED);
+  // Cache lookups are random accesses over the whole table, huge pages save most of the TLB misses.
+  madvise(ptr, size, MADV_HUGEPAGE);
+  if (!ParseBooleanFromEnv("ONEFLOW_ONE_EMBEDDING_DISABLE_NUMA_AWARE_ALLOCATION", false)) {
+    InterleaveOverNumaNodes(ptr, size);
+  }
+  return ptr;
+}
+
+void FreeHostCacheMemory(void* ptr, size_t size) { PCHECK(munmap(ptr, size) == 0); }
+
+}  // namespace embedding
+
+}  // namespace oneflow
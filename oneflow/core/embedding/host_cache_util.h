@@ -0,0 +1,165 @@
+/*
+Copyright 2020 The OneFlow Authors. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef ONEFLOW_CORE_EMBEDDING_HOST_CACHE_UTIL_H_
+#define ONEFLOW_CORE_EMBEDDING_HOST_CACHE_UTIL_H_
+
+#include "oneflow/core/common/util.h"
+#include "oneflow/core/common/spin_wait.h"
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace oneflow {
+
+namespace embedding {
+
+// Allocates zero-filled memory for host cache tables. The pages are interleaved over all online
+// NUMA nodes, since every worker thread probes the whole table.
+void* AllocateHostCacheMemory(size_t size);
+
+void FreeHostCacheMemory(void* ptr, size_t size);
+
+// Number of keys a ParallelFor chunk of cache queries handles, about 64KB worth of values.
+inline int64_t GetKeysPerChunk(uint32_t value_size) {
+  return std::max<int64_t>(64, (64 << 10) / std::max<uint32_t>(value_size, 1));
+}
+
+class SpinLock final {
+ public:
+  OF_DISALLOW_COPY_AND_MOVE(SpinLock);
+  SpinLock() : locked_(false) {}
+  ~SpinLock() = default;
+
+  void Lock() {
+    while (locked_.exchange(true, std::memory_order_acquire)) {
+      while (locked_.load(std::memory_order_relaxed)) { CpuRelax(); }
+    }
+  }
+  void Unlock() { locked_.store(false, std::memory_order_release); }
+
+ private:
+  std::atomic<bool> locked_;
+};
+
+// Collects the (key, index) pairs found by one ParallelFor chunk, e.g. the missing keys of a
+// lookup, and appends them to the shared output arrays with one atomic add per batch.
+template<typename Key>
+class BufferedKeyWriter final {
+ public:
+  OF_DISALLOW_COPY_AND_MOVE(BufferedKeyWriter);
+  BufferedKeyWriter(std::atomic<uint32_t>* counter, Key* keys, uint32_t* indices)
+      : counter_(counter), keys_(keys), indices_(indices), size_(0) {}
+  ~BufferedKeyWriter() { Flush(); }
+
+  void Append(Key key, uint32_t index) {
+    if (size_ == kBufferSize) { Flush(); }
+    buffered_keys_[size_] = key;
+    buffered_indices_[size_] = index;
+    size_ += 1;
+  }
+
+  void Flush() {
+    if (size_ == 0) { return; }
+    const uint32_t offset = counter_->fetch_add(size_, std::memory_order_relaxed);
+    std::copy(buffered_keys_, buffered_keys_ + size_, keys_ + offset);
+    std::copy(buffered_indices_, buffered_indices_ + size_, indices_ + offset);
+    size_ = 0;
+  }
+
+ private:
+  static constexpr uint32_t kBufferSize = 64;
+  std::atomic<uint32_t>* counter_;
+  Key* keys_;
+  uint32_t* indices_;
+  uint32_t size_;
+  Key buffered_keys_[kBufferSize];
+  uint32_t buffered_indices_[kBufferSize];
+};
+
+// Returns a bit mask with bit i set if keys[i] == key, for i in [0, n). `keys` must be aligned to
+// 32 bytes.
+template<typename Key, int n>
+inline uint32_t MatchKeys(const Key* keys, Key key) {
+  static_assert(n <= 32, "");
+  uint32_t mask = 0;
+  for (int i = 0; i < n; ++i) { mask |= static_cast<uint32_t>(keys[i] == key) << i; }
+  return mask;
+}
+
+#if defined(__x86_64__)
+
+#if defined(__AVX2__)
+
+template<>
+inline uint32_t MatchKeys<uint32_t, 16>(const uint32_t* keys, uint32_t key) {
+  const __m256i k = _mm256_set1_epi32(static_cast<int32_t>(key));
+  const __m256i lo = _mm256_load_si256(reinterpret_cast<const __m256i*>(keys));
+  const __m256i hi = _mm256_load_si256(reinterpret_cast<const __m256i*>(keys + 8));
+  const uint32_t lo_mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(lo, k)));
+  const uint32_t hi_mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(hi, k)));
+  return lo_mask | (hi_mask << 8);
+}
+
+template<>
+inline uint32_t MatchKeys<uint64_t, 16>(const uint64_t* keys, uint64_t key) {
+  const __m256i k = _mm256_set1_epi64x(static_cast<int64_t>(key));
+  uint32_t mask = 0;
+  for (int i = 0; i < 4; ++i) {
+    const __m256i v = _mm256_load_si256(reinterpret_cast<const __m256i*>(keys + i * 4));
+    mask |= static_cast<uint32_t>(
+                _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(v, k))))
+            << (i * 4);
+  }
+  return mask;
+}
+
+#else
+
+template<>
+inline uint32_t MatchKeys<uint32_t, 16>(const uint32_t* keys, uint32_t key) {
+  const __m128i k = _mm_set1_epi32(static_cast<int32_t>(key));
+  uint32_t mask = 0;
+  for (int i = 0; i < 4; ++i) {
+    const __m128i v = _mm_load_si128(reinterpret_cast<const __m128i*>(keys + i * 4));
+    mask |= static_cast<uint32_t>(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, k))))
+            << (i * 4);
+  }
+  return mask;
+}
+
+template<>
+inline uint32_t MatchKeys<uint64_t, 16>(const uint64_t* keys, uint64_t key) {
+  const __m128i k = _mm_set1_epi64x(static_cast<int64_t>(key));
+  uint32_t mask = 0;
+  for (int i = 0; i < 8; ++i) {
+    const __m128i v = _mm_load_si128(reinterpret_cast<const __m128i*>(keys + i * 2));
+    // SSE2 has no 64-bit compare, a lane matches if both of its 32-bit halves match.
+    const __m128i eq32 = _mm_cmpeq_epi32(v, k);
+    const __m128i eq64 = _mm_and_si128(eq32, _mm_shuffle_epi32(eq32, _MM_SHUFFLE(2, 3, 0, 1)));
+    mask |= static_cast<uint32_t>(_mm_movemask_pd(_mm_castsi128_pd(eq64))) << (i * 2);
+  }
+  return mask;
+}
+
+#endif  // __AVX2__
+
+#endif  // __x86_64__
+
+}  // namespace embedding
+
+}  // namespace oneflow
+
+#endif  // ONEFLOW_CORE_EMBEDDING_HOST_CACHE_UTIL_H_
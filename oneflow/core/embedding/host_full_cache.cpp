@@ -0,0 +1,363 @@
+/*
+Copyright 2020 The OneFlow Authors. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "oneflow/core/embedding/host_full_cache.h"
+#include "oneflow/core/embedding/host_cache_util.h"
+#include "oneflow/core/embedding/hash_functions.cuh"
+#include "oneflow/core/ep/cpu/cpu_stream.h"
+
+namespace oneflow {
+
+namespace embedding {
+
+namespace {
+
+// The table is probed a group of kGroupSize slots at a time, a lookup compares the whole group
+// with SIMD and stops at the first group that still has an empty slot.
+constexpr uint64_t kGroupSize = 16;
+
+// Like full_cache.cu, a slot stores (key | 0x1) so that 0 marks an empty slot, and the low bit of
+// the key is kept in the low bit of the slot index, which is ((row + 1) << 1) | (key & 0x1).
+template<typename Key, typename Index>
+class HostFullCache : public Cache {
+ public:
+  OF_DISALLOW_COPY_AND_MOVE(HostFullCache);
+  explicit HostFullCache(const CacheOptions& options)
+      : if_dump_dirty_(ParseBooleanFromEnv("ONEFLOW_ONE_EMBEDDING_DUMP_DIRTY_ONLY", false)),
+        options_(options),
+        num_groups_(std::max<uint64_t>(
+            (static_cast<uint64_t>(options.capacity / options.load_factor) + kGroupSize - 1)
+                / kGroupSize,
+            1)),
+        table_size_(0),
+        max_query_length_(0) {
+    static_assert(sizeof(std::atomic<Key>) == sizeof(Key), "");
+    static_assert(sizeof(std::atomic<Index>) == sizeof(Index), "");
+    table_keys_ = static_cast<Key*>(AllocateHostCacheMemory(TableCapacity() * sizeof(Key)));
+    table_indices_ = static_cast<Index*>(AllocateHostCacheMemory(TableCapacity() * sizeof(Index)));
+    if (if_dump_dirty_) {
+      table_dirty_flags_ = static_cast<uint8_t*>(AllocateHostCacheMemory(TableCapacity()));
+    }
+    values_ = static_cast<char*>(AllocateHostCacheMemory(ValuesSize()));
+  }
+  ~HostFullCache() override {
+    FreeHostCacheMemory(table_keys_, TableCapacity() * sizeof(Key));
+    FreeHostCacheMemory(table_indices_, TableCapacity() * sizeof(Index));
+    if (if_dump_dirty_) { FreeHostCacheMemory(table_dirty_flags_, TableCapacity()); }
+    FreeHostCacheMemory(values_, ValuesSize());
+  }
+
+  uint64_t Capacity() const override { return options_.capacity; }
+  uint64_t DumpCapacity() const override { return TableCapacity(); }
+  uint32_t KeySize() const override { return options_.key_size; }
+  uint32_t ValueSize() const override { return options_.value_size; }
+  DataType ValueType() const override { return options_.value_type; }
+  DeviceType device_type() const override { return DeviceType::kCPU; }
+  uint32_t MaxQueryLength() const override { return max_query_length_; }
+
+  void ReserveQueryLength(uint32_t query_length) override {
+    max_query_length_ = std::max(max_query_length_, query_length);
+  }
+
+  CacheOptions::Policy Policy() const override { return CacheOptions::Policy::kFull; }
+
+  void Test(ep::Stream* stream, uint32_t n_keys, const void* keys, uint32_t* n_missing,
+            void* missing_keys, uint32_t* missing_indices) override;
+
+  void Get(ep::Stream* stream, uint32_t n_keys, const void* keys, void* values, uint32_t* n_missing,
+           void* missing_keys, uint32_t* missing_indices) override;
+
+  void Get(ep::Stream* stream, uint32_t n_keys, const void* keys, void* values,
+           uint8_t* mask) override;
+
+  void Put(ep::Stream* stream, uint32_t n_keys, const void* keys, const void* values,
+           uint32_t* n_evicted, void* evicted_keys, void* evicted_values) override;
+
+  void FusedHalfUpdatePut(ep::Stream* stream, uint32_t n_keys, const void* keys, const void* values,
+                          const void* update, const float* lr, float scale, uint32_t* n_evicted,
+                          void* evicted_keys, void* evicted_values) override;
+
+  void Dump(ep::Stream* stream, uint64_t start_key_index, uint64_t end_key_index,
+            uint32_t* n_dumped, void* keys, void* values) override;
+
+  void ClearDirtyFlags() override {
+    if (if_dump_dirty_) { std::memset(table_dirty_flags_, 0, TableCapacity()); }
+  }
+
+  void Clear() override {
+    std::memset(table_keys_, 0, TableCapacity() * sizeof(Key));
+    std::memset(table_indices_, 0, TableCapacity() * sizeof(Index));
+    ClearDirtyFlags();
+    table_size_.store(0);
+  }
+
+ private:
+  uint64_t TableCapacity() const { return num_groups_ * kGroupSize; }
+  size_t ValuesSize() const { return options_.capacity * options_.value_size; }
+  uint64_t FirstGroup(Key key) const { return FullCacheHash()(key) % num_groups_; }
+  uint64_t NextGroup(uint64_t group) const { return group + 1 == num_groups_ ? 0 : group + 1; }
+  char* Row(Index row) const { return values_ + static_cast<size_t>(row - 1) * ValueSize(); }
+
+  // Returns the 1-based row of `key`, or 0 if it is not in the cache. Only safe while no Put is
+  // running on the cache.
+  Index Lookup(Key key) const;
+  // Inserts `key` if it is absent, many threads may run it concurrently.
+  Index GetOrInsert(Key key);
+
+  template<bool return_value>
+  uint32_t LookupAll(ep::Stream* stream, uint32_t n_keys, const Key* keys, char* values,
+                     Key* missing_keys, uint32_t* missing_indices);
+  template<typename F>
+  void InsertAll(ep::Stream* stream, uint32_t n_keys, const Key* keys, const F& write_row);
+
+  bool if_dump_dirty_;
+  CacheOptions options_;
+  uint64_t num_groups_;
+  Key* table_keys_;
+  Index* table_indices_;
+  uint8_t* table_dirty_flags_{};
+  char* values_;
+  std::atomic<uint64_t> table_size_;
+  uint32_t max_query_length_;
+};
+
+template<typename Key, typename Index>
+Index HostFullCache<Key, Index>::Lookup(Key key) const {
+  const Key key_hi = (key | 0x1);
+  const Index key_lo = (key & 0x1);
+  uint64_t group = FirstGroup(key);
+  for (uint64_t count = 0; count < num_groups_; ++count) {
+    const Key* group_keys = table_keys_ + group * kGroupSize;
+    uint32_t hit_mask = MatchKeys<Key, kGroupSize>(group_keys, key_hi);
+    while (hit_mask != 0) {
+      const Index entry_index = table_indices_[group * kGroupSize + __builtin_ctz(hit_mask)];
+      if ((entry_index & 0x1) == key_lo) { return entry_index >> 1U; }
+      hit_mask &= hit_mask - 1;
+    }
+    if (MatchKeys<Key, kGroupSize>(group_keys, 0) != 0) { return 0; }
+    group = NextGroup(group);
+  }
+  return 0;
+}
+
+template<typename Key, typename Index>
+Index HostFullCache<Key, Index>::GetOrInsert(Key key) {
+  const Key key_hi = (key | 0x1);
+  const Index key_lo = (key & 0x1);
+  uint64_t group = FirstGroup(key);
+  for (uint64_t count = 0; count < num_groups_; ++count) {
+    for (uint64_t slot = group * kGroupSize; slot < (group + 1) * kGroupSize; ++slot) {
+      auto* entry_key = reinterpret_cast<std::atomic<Key>*>(table_keys_ + slot);
+      auto* entry_index = reinterpret_cast<std::atomic<Index>*>(table_indices_ + slot);
+      Key old_key = entry_key->load(std::memory_order_acquire);
+      if (old_key == 0 && entry_key->compare_exchange_strong(old_key, key_hi)) {
+        const Index row = table_size_.fetch_add(1, std::memory_order_relaxed) + 1;
+        CHECK_LE(row, options_.capacity) << "The full cache is out of capacity";
+        entry_index->store((row << 1U) | key_lo, std::memory_order_release);
+        if (if_dump_dirty_) { table_dirty_flags_[slot] = 1; }
+        return row;
+      }
+      if (old_key != key_hi) { continue; }
+      // The slot may have just been claimed by another thread that has not published its row.
+      Index entry_index_val = entry_index->load(std::memory_order_acquire);
+      while (entry_index_val == 0) {
+        CpuRelax();
+        entry_index_val = entry_index->load(std::memory_order_acquire);
+      }
+      if ((entry_index_val & 0x1) == key_lo) {
+        if (if_dump_dirty_) { table_dirty_flags_[slot] = 1; }
+        return entry_index_val >> 1U;
+      }
+    }
+    group = NextGroup(group);
+  }
+  LOG(FATAL) << "The full cache table is full";
+  return 0;
+}
+
+template<typename Key, typename Index>
+template<bool return_value>
+uint32_t HostFullCache<Key, Index>::LookupAll(ep::Stream* stream, uint32_t n_keys, const Key* keys,
+                                              char* values, Key* missing_keys,
+                                              uint32_t* missing_indices) {
+  std::atomic<uint32_t> n_missing(0);
+  const uint32_t value_size = ValueSize();
+  stream->As<ep::CpuStream>()->ParallelFor(
+      0, n_keys,
+      [&](int64_t begin, int64_t end) {
+        BufferedKeyWriter<Key> missing(&n_missing, missing_keys, missing_indices);
+        for (int64_t i = begin; i < end; ++i) {
+          const Index row = Lookup(keys[i]);
+          if (row == 0) {
+            missing.Append(keys[i], i);
+          } else if (return_value) {
+            std::memcpy(values + i * value_size, Row(row), value_size);
+          }
+        }
+      },
+      GetKeysPerChunk(value_size));
+  return n_missing.load();
+}
+
+template<typename Key, typename Index>
+template<typename F>
+void HostFullCache<Key, Index>::InsertAll(ep::Stream* stream, uint32_t n_keys, const Key* keys,
+                                          const F& write_row) {
+  stream->As<ep::CpuStream>()->ParallelFor(
+      0, n_keys,
+      [&](int64_t begin, int64_t end) {
+        for (int64_t i = begin; i < end; ++i) { write_row(i, Row(GetOrInsert(keys[i]))); }
+      },
+      GetKeysPerChunk(ValueSize()));
+}
+
+template<typename Key, typename Index>
+void HostFullCache<Key, Index>::Test(ep::Stream* stream, uint32_t n_keys, const void* keys,
+                                     uint32_t* n_missing, void* missing_keys,
+                                     uint32_t* missing_indices) {
+  *n_missing = 0;
+  if (n_keys == 0) { return; }
+  CHECK_LE(n_keys, max_query_length_);
+  *n_missing = LookupAll<false>(stream, n_keys, static_cast<const Key*>(keys), nullptr,
+                                static_cast<Key*>(missing_keys), missing_indices);
+}
+
+template<typename Key, typename Index>
+void HostFullCache<Key, Index>::Get(ep::Stream* stream, uint32_t n_keys, const void* keys,
+                                    void* values, uint32_t* n_missing, void* missing_keys,
+                                    uint32_t* missing_indices) {
+  *n_missing = 0;
+  if (n_keys == 0) { return; }
+  CHECK_LE(n_keys, max_query_length_);
+  *n_missing = LookupAll<true>(stream, n_keys, static_cast<const Key*>(keys),
+                               static_cast<char*>(values), static_cast<Key*>(missing_keys),
+                               missing_indices);
+}
+
+template<typename Key, typename Index>
+void HostFullCache<Key, Index>::Get(ep::Stream* stream, uint32_t n_keys, const void* keys,
+                                    void* values, uint8_t* mask) {
+  if (n_keys == 0) { return; }
+  CHECK_LE(n_keys, max_query_length_);
+  const Key* query_keys = static_cast<const Key*>(keys);
+  const uint32_t value_size = ValueSize();
+  stream->As<ep::CpuStream>()->ParallelFor(
+      0, n_keys,
+      [&](int64_t begin, int64_t end) {
+        for (int64_t i = begin; i < end; ++i) {
+          const Index row = Lookup(query_keys[i]);
+          mask[i] = row > 0;
+          if (row > 0) {
+            std::memcpy(static_cast<char*>(values) + i * value_size, Row(row), value_size);
+          }
+        }
+      },
+      GetKeysPerChunk(value_size));
+}
+
+template<typename Key, typename Index>
+void HostFullCache<Key, Index>::Put(ep::Stream* stream, uint32_t n_keys, const void* keys,
+                                    const void* values, uint32_t* n_evicted, void* evicted_keys,
+                                    void* evicted_values) {
+  // A full cache never evicts.
+  if (n_evicted != nullptr) { *n_evicted = 0; }
+  if (n_keys == 0) { return; }
+  CHECK_LE(n_keys, max_query_length_);
+  const char* put_values = static_cast<const char*>(values);
+  const uint32_t value_size = ValueSize();
+  InsertAll(stream, n_keys, static_cast<const Key*>(keys), [&](int64_t i, char* row) {
+    std::memcpy(row, put_values + i * value_size, value_size);
+  });
+}
+
+template<typename Key, typename Index>
+void HostFullCache<Key, Index>::FusedHalfUpdatePut(ep::Stream* stream, uint32_t n_keys,
+                                                   const void* keys, const void* values,
+                                                   const void* update, const float* lr,
+                                                   float scale, uint32_t* n_evicted,
+                                                   void* evicted_keys, void* evicted_values) {
+  CHECK_EQ(options_.value_type, DataType::kFloat);
+  if (n_evicted != nullptr) { *n_evicted = 0; }
+  if (n_keys == 0) { return; }
+  CHECK_LE(n_keys, max_query_length_);
+  const uint32_t num_elem_per_value = ValueSize() / sizeof(float);
+  const float* put_values = static_cast<const float*>(values);
+  const float16* put_update = static_cast<const float16*>(update);
+  const float alpha = -*lr * scale;
+  InsertAll(stream, n_keys, static_cast<const Key*>(keys), [&](int64_t i, char* row) {
+    float* row_values = reinterpret_cast<float*>(row);
+    const float* value = put_values + i * num_elem_per_value;
+    const float16* value_update = put_update + i * num_elem_per_value;
+    for (uint32_t j = 0; j < num_elem_per_value; ++j) {
+      row_values[j] = value[j] + static_cast<float>(value_update[j]) * alpha;
+    }
+  });
+}
+
+template<typename Key, typename Index>
+void HostFullCache<Key, Index>::Dump(ep::Stream* stream, uint64_t start_key_index,
+                                     uint64_t end_key_index, uint32_t* n_dumped, void* keys,
+                                     void* values) {
+  std::atomic<uint32_t> n_dump(0);
+  const uint32_t value_size = ValueSize();
+  const auto IsDumped = [&](uint64_t slot) {
+    return table_indices_[slot] != 0 && (!if_dump_dirty_ || table_dirty_flags_[slot] != 0);
+  };
+  stream->As<ep::CpuStream>()->ParallelFor(
+      start_key_index, end_key_index,
+      [&](int64_t begin, int64_t end) {
+        uint32_t n_valid = 0;
+        for (int64_t i = begin; i < end; ++i) { n_valid += IsDumped(i); }
+        if (n_valid == 0) { return; }
+        uint32_t offset = n_dump.fetch_add(n_valid, std::memory_order_relaxed);
+        for (int64_t i = begin; i < end; ++i) {
+          if (!IsDumped(i)) { continue; }
+          const Index entry_index = table_indices_[i];
+          static_cast<Key*>(keys)[offset] = (table_keys_[i] ^ 0x1) | (entry_index & 0x1);
+          std::memcpy(static_cast<char*>(values) + offset * value_size, Row(entry_index >> 1U),
+                      value_size);
+          offset += 1;
+        }
+      },
+      GetKeysPerChunk(value_size));
+  *n_dumped = n_dump.load();
+}
+
+template<typename Index>
+std::unique_ptr<Cache> DispatchKeyType(const CacheOptions& options) {
+  if (options.key_size == sizeof(uint32_t)) {
+    return std::unique_ptr<Cache>(new HostFullCache<uint32_t, Index>(options));
+  } else if (options.key_size == sizeof(uint64_t)) {
+    return std::unique_ptr<Cache>(new HostFullCache<uint64_t, Index>(options));
+  } else {
+    UNIMPLEMENTED();
+    return nullptr;
+  }
+}
+
+}  // namespace
+
+std::unique_ptr<Cache> NewHostFullCache(const CacheOptions& options) {
+  const int64_t table_capacity = static_cast<double>(options.capacity) / options.load_factor;
+  if (table_capacity >= (1ULL << 31ULL)) {
+    return DispatchKeyType<uint64_t>(options);
+  } else {
+    return DispatchKeyType<uint32_t>(options);
+  }
+}
+
+}  // namespace embedding
+
+}  // namespace oneflow
@@ -0,0 +1,302 @@
+/*
+Copyright 2020 The OneFlow Authors. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "oneflow/core/embedding/host_lru_cache.h"
+#include "oneflow/core/embedding/host_cache_util.h"
+#include "oneflow/core/embedding/hash_functions.cuh"
+#include "oneflow/core/ep/cpu/cpu_stream.h"
+
+namespace oneflow {
+
+namespace embedding {
+
+namespace {
+
+// The host counterpart of the warp-wide sets of lru_cache.cu. A set holds kNumWays lines, the
+// valid ones are packed at the front and ranked by ages in [1, kNumWays], 0 marks an empty way.
+constexpr uint32_t kNumWays = 16;
+constexpr int64_t kPrefetchDistance = 8;
+
+template<typename Key>
+class HostLruCache : public Cache {
+ public:
+  OF_DISALLOW_COPY_AND_MOVE(HostLruCache);
+  explicit HostLruCache(const CacheOptions& options)
+      : n_set_((options.capacity + kNumWays - 1) / kNumWays),
+        value_size_(options.value_size),
+        value_type_(options.value_type),
+        max_query_length_(0),
+        locks_(new SpinLock[n_set_]) {
+    CHECK_GT(n_set_, 0);
+    keys_ = static_cast<Key*>(AllocateHostCacheMemory(KeysSize()));
+    ages_ = static_cast<uint8_t*>(AllocateHostCacheMemory(AgesSize()));
+    lines_ = static_cast<char*>(AllocateHostCacheMemory(LinesSize()));
+  }
+  ~HostLruCache() override {
+    FreeHostCacheMemory(keys_, KeysSize());
+    FreeHostCacheMemory(ages_, AgesSize());
+    FreeHostCacheMemory(lines_, LinesSize());
+  }
+
+  uint32_t KeySize() const override { return sizeof(Key); }
+  uint32_t ValueSize() const override { return value_size_; }
+  DataType ValueType() const override { return value_type_; }
+  DeviceType device_type() const override { return DeviceType::kCPU; }
+  uint64_t Capacity() const override { return n_set_ * kNumWays; }
+  uint32_t MaxQueryLength() const override { return max_query_length_; }
+
+  void ReserveQueryLength(uint32_t query_length) override {
+    if (query_length <= max_query_length_) { return; }
+    pending_keys_.resize(query_length);
+    pending_indices_.resize(query_length);
+    max_query_length_ = query_length;
+  }
+
+  CacheOptions::Policy Policy() const override { return CacheOptions::Policy::kLRU; }
+
+  void Test(ep::Stream* stream, uint32_t n_keys, const void* keys, uint32_t* n_missing,
+            void* missing_keys, uint32_t* missing_indices) override {
+    CHECK_LE(n_keys, max_query_length_);
+    *n_missing = Lookup<true>(stream, n_keys, static_cast<const Key*>(keys), nullptr,
+                              static_cast<Key*>(missing_keys), missing_indices);
+  }
+
+  using Cache::Get;
+  void Get(ep::Stream* stream, uint32_t n_keys, const void* keys, void* values, uint32_t* n_missing,
+           void* missing_keys, uint32_t* missing_indices) override {
+    CHECK_LE(n_keys, max_query_length_);
+    *n_missing = Lookup<false>(stream, n_keys, static_cast<const Key*>(keys),
+                               static_cast<char*>(values), static_cast<Key*>(missing_keys),
+                               missing_indices);
+  }
+
+  void Put(ep::Stream* stream, uint32_t n_keys, const void* keys, const void* values,
+           uint32_t* n_evicted, void* evicted_keys, void* evicted_values) override;
+
+  void Dump(ep::Stream* stream, uint64_t start_key_index, uint64_t end_key_index,
+            uint32_t* n_dumped, void* keys, void* values) override;
+
+  void ClearDirtyFlags() override {
+    // do nothing.
+    return;
+  }
+
+  void Clear() override {
+    std::memset(keys_, 0, KeysSize());
+    std::memset(ages_, 0, AgesSize());
+  }
+
+ private:
+  size_t KeysSize() const { return n_set_ * kNumWays * sizeof(Key); }
+  size_t AgesSize() const { return n_set_ * kNumWays * sizeof(uint8_t); }
+  size_t LinesSize() const { return n_set_ * kNumWays * value_size_; }
+
+  uint64_t SetId(Key key) const { return LruCacheHash()(key) % n_set_; }
+  char* Line(uint64_t set_id, uint32_t way) const {
+    return lines_ + (set_id * kNumWays + way) * value_size_;
+  }
+
+  uint32_t ValidMask(uint64_t set_id) const {
+    const uint8_t* ages = ages_ + set_id * kNumWays;
+    uint32_t mask = 0;
+    for (uint32_t i = 0; i < kNumWays; ++i) { mask |= static_cast<uint32_t>(ages[i] != 0) << i; }
+    return mask;
+  }
+
+  int Find(uint64_t set_id, Key key) const {
+    const uint32_t hit_mask =
+        MatchKeys<Key, kNumWays>(keys_ + set_id * kNumWays, key) & ValidMask(set_id);
+    return hit_mask == 0 ? -1 : __builtin_ctz(hit_mask);
+  }
+
+  // Makes `way` the most recently used line of the set, every line that was more recent than it
+  // ages by one.
+  void Touch(uint64_t set_id, uint32_t way) {
+    uint8_t* ages = ages_ + set_id * kNumWays;
+    const uint8_t age = ages[way];
+    for (uint32_t i = 0; i < kNumWays; ++i) { ages[i] -= static_cast<uint8_t>(ages[i] > age); }
+    ages[way] = kNumWays;
+  }
+
+  int InsertWithoutEvicting(uint64_t set_id, Key key) {
+    const int hit_way = Find(set_id, key);
+    if (hit_way >= 0) {
+      Touch(set_id, hit_way);
+      return hit_way;
+    }
+    const uint32_t n_valid = __builtin_popcount(ValidMask(set_id));
+    if (n_valid == kNumWays) { return -1; }
+    keys_[set_id * kNumWays + n_valid] = key;
+    Touch(set_id, n_valid);
+    return n_valid;
+  }
+
+  uint32_t Evict(uint64_t set_id, Key key, Key* evicted_key) {
+    const uint8_t* ages = ages_ + set_id * kNumWays;
+    uint32_t way = 0;
+    while (ages[way] != 1) { way += 1; }
+    *evicted_key = keys_[set_id * kNumWays + way];
+    keys_[set_id * kNumWays + way] = key;
+    Touch(set_id, way);
+    return way;
+  }
+
+  template<bool test_only>
+  uint32_t Lookup(ep::Stream* stream, uint32_t n_keys, const Key* keys, char* values,
+                  Key* missing_keys, uint32_t* missing_indices);
+
+  uint64_t n_set_;
+  uint32_t value_size_;
+  DataType value_type_;
+  uint32_t max_query_length_;
+  Key* keys_;
+  uint8_t* ages_;
+  char* lines_;
+  std::unique_ptr<SpinLock[]> locks_;
+  std::vector<Key> pending_keys_;
+  std::vector<uint32_t> pending_indices_;
+};
+
+// Lookups read the sets without locking, like the cuda implementation they must not race with a
+// Put on the same cache.
+template<typename Key>
+template<bool test_only>
+uint32_t HostLruCache<Key>::Lookup(ep::Stream* stream, uint32_t n_keys, const Key* keys,
+                                   char* values, Key* missing_keys, uint32_t* missing_indices) {
+  std::atomic<uint32_t> n_missing(0);
+  stream->As<ep::CpuStream>()->ParallelFor(
+      0, n_keys,
+      [&](int64_t begin, int64_t end) {
+        BufferedKeyWriter<Key> missing(&n_missing, missing_keys, missing_indices);
+        for (int64_t i = begin; i < end; ++i) {
+          if (i + kPrefetchDistance < end) {
+            const uint64_t next_set_id = SetId(keys[i + kPrefetchDistance]);
+            __builtin_prefetch(keys_ + next_set_id * kNumWays);
+            __builtin_prefetch(ages_ + next_set_id * kNumWays);
+          }
+          const Key key = keys[i];
+          const uint64_t set_id = SetId(key);
+          const int way = Find(set_id, key);
+          if (way < 0) {
+            missing.Append(key, i);
+          } else if (!test_only) {
+            std::memcpy(values + i * value_size_, Line(set_id, way), value_size_);
+          }
+        }
+      },
+      GetKeysPerChunk(value_size_));
+  return n_missing.load();
+}
+
+template<typename Key>
+void HostLruCache<Key>::Put(ep::Stream* stream, uint32_t n_keys, const void* keys,
+                            const void* values, uint32_t* n_evicted, void* evicted_keys,
+                            void* evicted_values) {
+  *n_evicted = 0;
+  if (n_keys == 0) { return; }
+  CHECK_LE(n_keys, max_query_length_);
+  const Key* put_keys = static_cast<const Key*>(keys);
+  const char* put_values = static_cast<const char*>(values);
+  auto* cpu_stream = stream->As<ep::CpuStream>();
+  const int64_t keys_per_chunk = GetKeysPerChunk(value_size_);
+  // Fill hits and free ways first, so that no line is evicted while its set still has room.
+  std::atomic<uint32_t> n_pending(0);
+  cpu_stream->ParallelFor(
+      0, n_keys,
+      [&](int64_t begin, int64_t end) {
+        BufferedKeyWriter<Key> pending(&n_pending, pending_keys_.data(), pending_indices_.data());
+        for (int64_t i = begin; i < end; ++i) {
+          const Key key = put_keys[i];
+          const uint64_t set_id = SetId(key);
+          locks_[set_id].Lock();
+          const int way = InsertWithoutEvicting(set_id, key);
+          if (way >= 0) {
+            std::memcpy(Line(set_id, way), put_values + i * value_size_, value_size_);
+          } else {
+            pending.Append(key, i);
+          }
+          locks_[set_id].Unlock();
+        }
+      },
+      keys_per_chunk);
+  std::atomic<uint32_t> n_evict(0);
+  char* evicted_lines = static_cast<char*>(evicted_values);
+  cpu_stream->ParallelFor(
+      0, n_pending.load(),
+      [&](int64_t begin, int64_t end) {
+        for (int64_t i = begin; i < end; ++i) {
+          const Key key = pending_keys_[i];
+          const uint64_t set_id = SetId(key);
+          const char* value = put_values + pending_indices_[i] * value_size_;
+          locks_[set_id].Lock();
+          // A duplicated key of the same batch may have been inserted by the eviction of its twin.
+          int way = Find(set_id, key);
+          if (way >= 0) {
+            Touch(set_id, way);
+          } else {
+            Key evicted_key = 0;
+            way = Evict(set_id, key, &evicted_key);
+            const uint32_t evicted_idx = n_evict.fetch_add(1, std::memory_order_relaxed);
+            static_cast<Key*>(evicted_keys)[evicted_idx] = evicted_key;
+            std::memcpy(evicted_lines + evicted_idx * value_size_, Line(set_id, way), value_size_);
+          }
+          std::memcpy(Line(set_id, way), value, value_size_);
+          locks_[set_id].Unlock();
+        }
+      },
+      keys_per_chunk);
+  *n_evicted = n_evict.load();
+}
+
+template<typename Key>
+void HostLruCache<Key>::Dump(ep::Stream* stream, uint64_t start_key_index,
+                             uint64_t end_key_index, uint32_t* n_dumped, void* keys,
+                             void* values) {
+  std::atomic<uint32_t> n_dump(0);
+  stream->As<ep::CpuStream>()->ParallelFor(
+      start_key_index, end_key_index,
+      [&](int64_t begin, int64_t end) {
+        uint32_t n_valid = 0;
+        for (int64_t i = begin; i < end; ++i) { n_valid += (ages_[i] != 0); }
+        if (n_valid == 0) { return; }
+        uint32_t offset = n_dump.fetch_add(n_valid, std::memory_order_relaxed);
+        for (int64_t i = begin; i < end; ++i) {
+          if (ages_[i] == 0) { continue; }
+          static_cast<Key*>(keys)[offset] = keys_[i];
+          std::memcpy(static_cast<char*>(values) + offset * value_size_,
+                      lines_ + i * value_size_, value_size_);
+          offset += 1;
+        }
+      },
+      GetKeysPerChunk(value_size_));
+  *n_dumped = n_dump.load();
+}
+
+}  // namespace
+
+std::unique_ptr<Cache> NewHostLruCache(const CacheOptions& options) {
+  if (options.key_size == sizeof(uint32_t)) {
+    return std::unique_ptr<Cache>(new HostLruCache<uint32_t>(options));
+  } else if (options.key_size == sizeof(uint64_t)) {
+    return std::unique_ptr<Cache>(new HostLruCache<uint64_t>(options));
+  } else {
+    UNIMPLEMENTED();
+    return nullptr;
+  }
+}
+
+}  // namespace embedding
+
+}  // namespace oneflow
@@ -100,6 +100,18 @@ class KeyValueStoreOptions final {
     CHECK(json_object["storage_dim"].is_number());
     line_size_ = json_object["storage_dim"].get<int64_t>();
 
+    // The device running the embedding lookups, the caches run their queries on it.
+    device_type_ = DeviceType::kCUDA;
+    if (json_object.contains("device_type")) {
+      CHECK(json_object["device_type"].is_string());
+      const std::string device_type = json_object["device_type"].get<std::string>();
+      if (device_type == "cpu") {
+        device_type_ = DeviceType::kCPU;
+      } else if (device_type != "cuda") {
+        UNIMPLEMENTED() << "Unsupported embedding device_type " << device_type;
+      }
+    }
+
     CHECK(json_object.contains("kv_store"));
     auto kv_store = json_object["kv_store"];
 
@@ -111,6 +123,7 @@ class KeyValueStoreOptions final {
         cache_options_.at(i).key_size = key_type_size_;
         cache_options_.at(i).value_size = value_type_size_ * line_size_;
         cache_options_.at(i).value_type = value_type_;
+        cache_options_.at(i).device_type = device_type_;
         ParseCacheOptions(caches.at(i), &cache_options_.at(i));
       }
     }
@@ -154,6 +167,7 @@ class KeyValueStoreOptions final {
   DataType ValueType() const { return value_type_; }
   const std::string& Name() const { return name_; }
   int64_t LineSize() const { return line_size_; }
+  DeviceType GetDeviceType() const { return device_type_; }
   const std::vector<CacheOptions>& GetCachesOptions() const { return cache_options_; }
   const std::vector<std::string>& PersistentTablePaths() const { return persistent_table_paths_; }
   int64_t PersistentTablePhysicalBlockSize() const { return persistent_table_physical_block_size_; }
@@ -171,6 +185,7 @@ class KeyValueStoreOptions final {
   DataType value_type_;
   std::string name_;
   int64_t line_size_;
+  DeviceType device_type_;
   std::vector<std::string> persistent_table_paths_;
   int64_t persistent_table_physical_block_size_;
   int64_t persistent_table_capacity_hint_;
@@ -23,12 +23,18 @@ limitations under the License.
 #include "oneflow/core/embedding/posix_file.h"
 #include "oneflow/core/common/blocking_counter.h"
 #include <robin_hood.h>
+#include <condition_variable>
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <dirent.h>
 #include <sys/syscall.h>
 #include <linux/aio_abi.h>
 #include <unistd.h>
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+#define ONEFLOW_EMBEDDING_WITH_IO_URING
+#endif  // __has_include(<linux/io_uring.h>)
 
 #endif  // __linux__
 
@@ -43,6 +49,9 @@ namespace {
 constexpr uint32_t kDefaultNumWorkerThreads = 4;
 constexpr uint32_t kRingQueueDepth = 128;
 constexpr uint32_t kRingSubmitBatch = 32;
+constexpr uint32_t kRingNumFixedFiles = 1024;
+constexpr uint32_t kRingProbeNumOps = 256;
+constexpr uint32_t kRingSqThreadIdleMs = 1000;
 constexpr uint32_t kAioQueueDepth = 128;
 constexpr uint32_t kChunkNameSuffixLength = 12;
 constexpr char const* kKeyFileNamePrefix = "key-";
@@ -57,6 +66,9 @@ constexpr char const* kKeysDirName = "keys";
 constexpr char const* kValuesDirName = "values";
 constexpr char const* kSnapshotsDirName = "snapshots";
 constexpr char const* kSnapshotListFileName = "LIST";
+constexpr char const* kCompactionTmpSuffix = ".compaction";
+constexpr uint64_t kCompactionStepBlocks = 256;
+constexpr int64_t kCompactionBackoffMs = 1;
 constexpr size_t kParallelForStride = 256;
 
 template<typename T>
@@ -122,6 +134,27 @@ uint32_t GetLogicalBlockSize(uint32_t physical_block_size, uint32_t value_size)
                                            : RoundUp(value_size, physical_block_size);
 }
 
+std::vector<uint64_t> ReadIndexFile(const std::string& pathname) {
+  PosixFile file(pathname, O_RDONLY, 0644);
+  const size_t size = file.Size();
+  CHECK_EQ(size % sizeof(uint64_t), 0);
+  std::vector<uint64_t> indices(size / sizeof(uint64_t));
+  PCHECK(pread(file.fd(), indices.data(), size, 0) == size);
+  return indices;
+}
+
+void WriteIndexFile(const std::string& pathname, const std::vector<uint64_t>& indices) {
+  PosixFile file(pathname, O_CREAT | O_RDWR | O_TRUNC, 0644);
+  const size_t size = indices.size() * sizeof(uint64_t);
+  PCHECK(pwrite(file.fd(), indices.data(), size, 0) == size);
+  PCHECK(fdatasync(file.fd()) == 0);
+}
+
+bool HasSuffix(const std::string& str, const std::string& suffix) {
+  return str.size() >= suffix.size()
+         && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
 class AlignedBuffer final {
  public:
   OF_DISALLOW_COPY_AND_MOVE(AlignedBuffer);
@@ -137,10 +170,12 @@ class AlignedBuffer final {
 
   void* ptr() { return ptr_.get(); }
 
+  size_t size() const { return size_; }
+
  private:
   size_t alignment_;
   size_t size_;
-  std::unique_ptr<char> ptr_;
+  std::unique_ptr<char, decltype(&free)> ptr_{nullptr, &free};
 };
 
 template<typename Key>
@@ -210,10 +245,40 @@ class AioEngine final {
   }
 
   void AsyncPread(int fd, void* buf, size_t count, off_t offset) {
+    Submit(IOCB_CMD_PREAD, fd, buf, count, offset);
+  }
+
+  void AsyncPwrite(int fd, const void* buf, size_t count, off_t offset) {
+    Submit(IOCB_CMD_PWRITE, fd, const_cast<void*>(buf), count, offset);
+  }
+
+  void RegisterBuffer(void* buf, size_t size) {}
+
+  void ForgetFile(int fd) {}
+
+  void WaitUntilDone() {
+    if (num_readings_ != 0) {
+      PCHECK(syscall(__NR_io_getevents, ctx_, num_readings_, num_readings_, events_.data(), nullptr)
+             >= 0);
+      // A short read or write would leave a block partially transferred.
+      for (long i = 0; i < num_readings_; ++i) {
+        const struct io_event& event = events_.at(i);
+        const struct iocb* cb = reinterpret_cast<const struct iocb*>(event.obj);
+        CHECK_EQ(event.res, static_cast<int64_t>(cb->aio_nbytes))
+            << "aio " << (cb->aio_lio_opcode == IOCB_CMD_PWRITE ? "write" : "read") << " of "
+            << cb->aio_nbytes << " bytes at offset " << cb->aio_offset << " returned "
+            << event.res;
+      }
+      num_readings_ = 0;
+    }
+  }
+
+ private:
+  void Submit(uint16_t opcode, int fd, void* buf, size_t count, off_t offset) {
     if (num_readings_ == kAioQueueDepth) { WaitUntilDone(); }
     struct iocb* cb = &cbs_.at(num_readings_);
     cb->aio_fildes = fd;
-    cb->aio_lio_opcode = IOCB_CMD_PREAD;
+    cb->aio_lio_opcode = opcode;
     cb->aio_reqprio = 0;
     cb->aio_buf = reinterpret_cast<uintptr_t>(buf);
     cb->aio_nbytes = count;
@@ -223,16 +288,6 @@ class AioEngine final {
     num_readings_ += 1;
   }
 
-  void WaitUntilDone() {
-    if (num_readings_ != 0) {
-      PCHECK(syscall(__NR_io_getevents, ctx_, num_readings_, num_readings_, events_.data(), nullptr)
-             >= 0);
-      for (long i = 0; i < num_readings_; ++i) { CHECK_GT(events_.at(i).res, 0); }
-      num_readings_ = 0;
-    }
-  }
-
- private:
   aio_context_t ctx_;
   long num_readings_;
   std::vector<struct iocb> cbs_;
@@ -240,6 +295,355 @@ class AioEngine final {
   std::vector<struct io_event> events_;
 };
 
+#ifdef ONEFLOW_EMBEDDING_WITH_IO_URING
+
+// An io_uring based engine. Requests are only written into the submission queue by AsyncPread and
+// AsyncPwrite and handed to the kernel in batches of kRingSubmitBatch, so a whole GetBlocks or
+// PutBlocks call costs a handful of syscalls instead of one per block. Files are registered lazily
+// into a sparse fixed file table and one buffer can be registered for READ_FIXED/WRITE_FIXED.
+// With SQPOLL enabled a kernel thread polls the submission queue and no syscall is needed at all
+// while it is awake.
+class IoUringEngine final {
+ public:
+  OF_DISALLOW_COPY_AND_MOVE(IoUringEngine);
+  IoUringEngine()
+      : ring_fd_(-1),
+        sq_ring_ptr_(nullptr),
+        cq_ring_ptr_(nullptr),
+        sqes_(nullptr),
+        sq_ring_size_(0),
+        cq_ring_size_(0),
+        sqes_size_(0),
+        sq_entries_(0),
+        sq_tail_(0),
+        num_pending_(0),
+        num_inflight_(0),
+        sqpoll_(false),
+        fixed_files_enabled_(false),
+        num_fixed_files_(0),
+        registered_buf_(nullptr),
+        registered_size_(0) {
+    const bool sqpoll =
+        ParseBooleanFromEnv("ONEFLOW_ONE_EMBEDDING_PERSISTENT_TABLE_IO_URING_SQPOLL", false);
+    struct io_uring_params params {};
+    if (sqpoll) {
+      params.flags = IORING_SETUP_SQPOLL;
+      params.sq_thread_idle = kRingSqThreadIdleMs;
+      ring_fd_ = Setup(kRingQueueDepth, &params);
+      // SQPOLL requires privileges on older kernels, fall back to the interrupt driven mode.
+      if (ring_fd_ < 0) { params = {}; }
+    }
+    sqpoll_ = ring_fd_ >= 0;
+    if (ring_fd_ < 0) { ring_fd_ = Setup(kRingQueueDepth, &params); }
+    PCHECK(ring_fd_ >= 0) << "io_uring_setup";
+    sq_entries_ = params.sq_entries;
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    const bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) {
+      sq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+      cq_ring_size_ = sq_ring_size_;
+    }
+    sq_ring_ptr_ = Mmap(sq_ring_size_, IORING_OFF_SQ_RING);
+    cq_ring_ptr_ = single_mmap ? sq_ring_ptr_ : Mmap(cq_ring_size_, IORING_OFF_CQ_RING);
+    sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes_ = static_cast<struct io_uring_sqe*>(Mmap(sqes_size_, IORING_OFF_SQES));
+    sq_tail_ptr_ = RingField(sq_ring_ptr_, params.sq_off.tail);
+    sq_mask_ = *RingField(sq_ring_ptr_, params.sq_off.ring_mask);
+    sq_flags_ = RingField(sq_ring_ptr_, params.sq_off.flags);
+    sq_array_ = RingField(sq_ring_ptr_, params.sq_off.array);
+    cq_head_ = RingField(cq_ring_ptr_, params.cq_off.head);
+    cq_tail_ = RingField(cq_ring_ptr_, params.cq_off.tail);
+    cq_mask_ = *RingField(cq_ring_ptr_, params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<struct io_uring_cqe*>(static_cast<char*>(cq_ring_ptr_)
+                                                    + params.cq_off.cqes);
+    sq_tail_ = __atomic_load_n(sq_tail_ptr_, __ATOMIC_RELAXED);
+    requests_.resize(sq_entries_);
+    free_requests_.reserve(sq_entries_);
+    for (uint32_t i = sq_entries_; i > 0; --i) { free_requests_.push_back(i - 1); }
+    if (ParseBooleanFromEnv("ONEFLOW_ONE_EMBEDDING_PERSISTENT_TABLE_IO_URING_FIXED_FILES", true)) {
+      // A sparse table lets files be added one by one as they are first read.
+      std::vector<int> fds(kRingNumFixedFiles, -1);
+      fixed_files_enabled_ = Register(IORING_REGISTER_FILES, fds.data(), kRingNumFixedFiles) == 0;
+    }
+  }
+  ~IoUringEngine() {
+    WaitUntilDone();
+    PCHECK(munmap(sqes_, sqes_size_) == 0);
+    if (cq_ring_ptr_ != sq_ring_ptr_) { PCHECK(munmap(cq_ring_ptr_, cq_ring_size_) == 0); }
+    PCHECK(munmap(sq_ring_ptr_, sq_ring_size_) == 0);
+    PCHECK(close(ring_fd_) == 0);
+  }
+
+  // io_uring_setup exists since Linux 5.1, but IORING_OP_READ and IORING_OP_WRITE only since 5.6,
+  // so the opcodes themselves are probed. Kernels without IORING_REGISTER_PROBE lack them too.
+  static bool IsSupported() {
+    struct io_uring_params params {};
+    const int fd = Setup(1, &params);
+    if (fd < 0) { return false; }
+    const size_t probe_size =
+        sizeof(struct io_uring_probe) + kRingProbeNumOps * sizeof(struct io_uring_probe_op);
+    std::vector<char> probe_buf(probe_size, 0);
+    auto* probe = reinterpret_cast<struct io_uring_probe*>(probe_buf.data());
+    const bool probed = syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe,
+                                kRingProbeNumOps)
+                        == 0;
+    PCHECK(close(fd) == 0);
+    if (!probed) { return false; }
+    const auto op_supported = [&](uint8_t op) {
+      return op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED) != 0;
+    };
+    return op_supported(IORING_OP_READ) && op_supported(IORING_OP_WRITE)
+           && op_supported(IORING_OP_READ_FIXED) && op_supported(IORING_OP_WRITE_FIXED);
+  }
+
+  // Files read through the engine are registered as fixed files, so ForgetFile must be called
+  // before such a file is closed.
+  void AsyncPread(int fd, void* buf, size_t count, off_t offset) {
+    Prepare(IORING_OP_READ, IORING_OP_READ_FIXED, GetFixedFile(fd), fd, buf, count, offset);
+  }
+
+  void AsyncPwrite(int fd, const void* buf, size_t count, off_t offset) {
+    Prepare(IORING_OP_WRITE, IORING_OP_WRITE_FIXED, -1, fd, const_cast<void*>(buf), count, offset);
+  }
+
+  // Registers [buf, buf + size) so that requests falling into it skip the per-request page pinning.
+  // Registration is best effort, e.g. it fails when the buffer exceeds RLIMIT_MEMLOCK.
+  void RegisterBuffer(void* buf, size_t size) {
+    WaitUntilDone();
+    if (registered_buf_ != nullptr) {
+      PCHECK(Register(IORING_UNREGISTER_BUFFERS, nullptr, 0) == 0);
+      registered_buf_ = nullptr;
+      registered_size_ = 0;
+    }
+    if (buf == nullptr || size == 0) { return; }
+    struct iovec iov {};
+    iov.iov_base = buf;
+    iov.iov_len = size;
+    if (Register(IORING_REGISTER_BUFFERS, &iov, 1) == 0) {
+      registered_buf_ = static_cast<char*>(buf);
+      registered_size_ = size;
+    }
+  }
+
+  void ForgetFile(int fd) {
+    if (fd < 0 || fd >= static_cast<int>(fd2fixed_file_.size()) || fd2fixed_file_[fd] < 0) {
+      return;
+    }
+    WaitUntilDone();
+    int removed = -1;
+    struct io_uring_files_update update {};
+    update.offset = fd2fixed_file_[fd];
+    update.fds = reinterpret_cast<uintptr_t>(&removed);
+    PCHECK(Register(IORING_REGISTER_FILES_UPDATE, &update, 1) == 1);
+    free_fixed_files_.push_back(fd2fixed_file_[fd]);
+    fd2fixed_file_[fd] = -1;
+  }
+
+  void WaitUntilDone() {
+    // Reaping may queue the remainder of a short transfer again, so submit inside the loop.
+    while (num_pending_ + num_inflight_ != 0) {
+      Submit();
+      if (Reap() == 0) { Enter(0, 1, IORING_ENTER_GETEVENTS); }
+    }
+  }
+
+ private:
+  struct Request {
+    uint8_t opcode;
+    uint8_t flags;
+    int fd;
+    char* buf;
+    size_t count;
+    off_t offset;
+    size_t done;
+  };
+
+  static int Setup(uint32_t entries, struct io_uring_params* params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+  }
+
+  int Enter(uint32_t to_submit, uint32_t min_complete, uint32_t flags) {
+    int ret = 0;
+    do {
+      ret = static_cast<int>(
+          syscall(__NR_io_uring_enter, ring_fd_, to_submit, min_complete, flags, nullptr, 0));
+    } while (ret < 0 && errno == EINTR);
+    PCHECK(ret >= 0) << "io_uring_enter";
+    return ret;
+  }
+
+  int Register(uint32_t opcode, const void* arg, uint32_t nr_args) {
+    return static_cast<int>(syscall(__NR_io_uring_register, ring_fd_, opcode, arg, nr_args));
+  }
+
+  void* Mmap(size_t size, off_t offset) {
+    void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_,
+                     offset);
+    PCHECK(ptr != MAP_FAILED);
+    return ptr;
+  }
+
+  static uint32_t* RingField(void* ring, uint32_t offset) {
+    return reinterpret_cast<uint32_t*>(static_cast<char*>(ring) + offset);
+  }
+
+  int GetFixedFile(int fd) {
+    if (!fixed_files_enabled_) { return -1; }
+    if (fd < static_cast<int>(fd2fixed_file_.size()) && fd2fixed_file_[fd] >= 0) {
+      return fd2fixed_file_[fd];
+    }
+    int slot = -1;
+    if (!free_fixed_files_.empty()) {
+      slot = free_fixed_files_.back();
+    } else if (num_fixed_files_ < kRingNumFixedFiles) {
+      slot = num_fixed_files_;
+    } else {
+      return -1;
+    }
+    struct io_uring_files_update update {};
+    update.offset = slot;
+    update.fds = reinterpret_cast<uintptr_t>(&fd);
+    if (Register(IORING_REGISTER_FILES_UPDATE, &update, 1) != 1) { return -1; }
+    if (slot == static_cast<int>(num_fixed_files_)) {
+      num_fixed_files_ += 1;
+    } else {
+      free_fixed_files_.pop_back();
+    }
+    if (static_cast<int>(fd2fixed_file_.size()) <= fd) { fd2fixed_file_.resize(fd + 1, -1); }
+    fd2fixed_file_[fd] = slot;
+    return slot;
+  }
+
+  void Prepare(uint8_t opcode, uint8_t fixed_buf_opcode, int fixed_file, int fd, void* buf,
+               size_t count, off_t offset) {
+    // Keep the number of outstanding requests within the submission queue, so that a free slot
+    // always exists once a completion has been reaped and the completion queue never overflows.
+    while (num_pending_ + num_inflight_ == sq_entries_) {
+      Submit();
+      if (Reap() == 0) { Enter(0, 1, IORING_ENTER_GETEVENTS); }
+    }
+    const uint32_t index = free_requests_.back();
+    free_requests_.pop_back();
+    Request* request = &requests_[index];
+    if (fixed_file >= 0) {
+      request->fd = fixed_file;
+      request->flags = IOSQE_FIXED_FILE;
+    } else {
+      request->fd = fd;
+      request->flags = 0;
+    }
+    char* ptr = static_cast<char*>(buf);
+    if (registered_buf_ != nullptr && ptr >= registered_buf_
+        && ptr + count <= registered_buf_ + registered_size_) {
+      request->opcode = fixed_buf_opcode;
+    } else {
+      request->opcode = opcode;
+    }
+    request->buf = ptr;
+    request->count = count;
+    request->offset = offset;
+    request->done = 0;
+    Push(index);
+    if (num_pending_ == kRingSubmitBatch) { Submit(); }
+  }
+
+  // Writes the part of a request that has not been transferred yet into the submission queue.
+  void Push(uint32_t index) {
+    const Request& request = requests_[index];
+    struct io_uring_sqe* sqe = &sqes_[sq_tail_ & sq_mask_];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = request.opcode;
+    sqe->flags = request.flags;
+    sqe->fd = request.fd;
+    // The remainder stays inside the registered buffer, so buf_index 0 is valid for it as well.
+    sqe->buf_index = 0;
+    sqe->addr = reinterpret_cast<uintptr_t>(request.buf + request.done);
+    sqe->len = request.count - request.done;
+    sqe->off = request.offset + request.done;
+    sqe->user_data = index;
+    sq_array_[sq_tail_ & sq_mask_] = sq_tail_ & sq_mask_;
+    sq_tail_ += 1;
+    num_pending_ += 1;
+  }
+
+  void Submit() {
+    if (num_pending_ == 0) { return; }
+    __atomic_store_n(sq_tail_ptr_, sq_tail_, __ATOMIC_RELEASE);
+    if (sqpoll_) {
+      // Pairs with the kernel thread setting IORING_SQ_NEED_WAKEUP before it goes to sleep.
+      __atomic_thread_fence(__ATOMIC_SEQ_CST);
+      if (__atomic_load_n(sq_flags_, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP) {
+        Enter(0, 0, IORING_ENTER_SQ_WAKEUP);
+      }
+    } else {
+      uint32_t submitted = 0;
+      while (submitted < num_pending_) { submitted += Enter(num_pending_ - submitted, 0, 0); }
+    }
+    num_inflight_ += num_pending_;
+    num_pending_ = 0;
+  }
+
+  uint32_t Reap() {
+    uint32_t head = *cq_head_;
+    const uint32_t tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    const uint32_t num_completed = tail - head;
+    num_inflight_ -= num_completed;
+    for (; head != tail; ++head) {
+      const struct io_uring_cqe* cqe = &cqes_[head & cq_mask_];
+      const uint32_t index = static_cast<uint32_t>(cqe->user_data);
+      Request* request = &requests_[index];
+      if (cqe->res < 0) {
+        // Transient failures are retried, anything else is an IO error.
+        CHECK(cqe->res == -EAGAIN || cqe->res == -EINTR) << strerror(-cqe->res);
+      } else {
+        // A zero length transfer means the file ended before the request did.
+        CHECK_GT(cqe->res, 0);
+        request->done += cqe->res;
+      }
+      if (request->done < request->count) {
+        // Resubmitting reuses the slot of the completed request, so the queue cannot overflow.
+        Push(index);
+      } else {
+        free_requests_.push_back(index);
+      }
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    return num_completed;
+  }
+
+  int ring_fd_;
+  void* sq_ring_ptr_;
+  void* cq_ring_ptr_;
+  struct io_uring_sqe* sqes_;
+  size_t sq_ring_size_;
+  size_t cq_ring_size_;
+  size_t sqes_size_;
+  uint32_t sq_entries_;
+  uint32_t* sq_tail_ptr_;
+  uint32_t sq_mask_;
+  uint32_t* sq_flags_;
+  uint32_t* sq_array_;
+  uint32_t* cq_head_;
+  uint32_t* cq_tail_;
+  uint32_t cq_mask_;
+  struct io_uring_cqe* cqes_;
+  uint32_t sq_tail_;
+  uint32_t num_pending_;
+  uint32_t num_inflight_;
+  bool sqpoll_;
+  bool fixed_files_enabled_;
+  uint32_t num_fixed_files_;
+  std::vector<int> fd2fixed_file_;
+  std::vector<int> free_fixed_files_;
+  char* registered_buf_;
+  size_t registered_size_;
+  std::vector<Request> requests_;
+  std::vector<uint32_t> free_requests_;
+};
+
+#endif  // ONEFLOW_EMBEDDING_WITH_IO_URING
+
 constexpr size_t kCacheLineSize = 64;
 
 template<typename Engine>
@@ -303,6 +707,8 @@ class PersistentTableImpl : public PersistentTable {
                     const std::function<void(Iterator* iter)>& Hook) override;
   void SaveSnapshot(const std::string& name) override;
   Iterator* ReadSnapshot(const std::string& name) override;
+  void Compact() override;
+  void GetStats(PersistentTableStats* stats) override;
 
  private:
   friend class SnapshotIteratorImpl<Key, Engine>;
@@ -314,6 +720,22 @@ class PersistentTableImpl : public PersistentTable {
   void LoadSnapshotImpl(const std::string& name);
   void SaveSnapshotImpl(const std::string& name);
   void ParallelFor(size_t total, const ForRange<Engine>& for_range);
+  void ForEachEngine(const std::function<void(Engine* engine)>& fn);
+  void* ResizeBlocksBuffer(size_t size);
+  std::unique_lock<std::recursive_mutex> LockForeground();
+  uint64_t AppendBlocks(uint32_t num_keys, const void* keys, const void* blocks,
+                        const std::function<void(uint64_t start_index)>& OnScheduled);
+  void SetRowId(const Key& key, uint64_t row_id);
+  void AddLiveValues(uint64_t row_id, int64_t n);
+  void AddPinnedValue(uint64_t row_id, const std::vector<std::string>& snapshots);
+  std::vector<std::string> ListSnapshots();
+  void CompactionLoop();
+  void CompactImpl(bool background);
+  bool CompactChunk(uint64_t chunk_id, bool background);
+  bool RewriteSnapshotChunk(const std::string& name, uint64_t chunk_id,
+                            const std::vector<uint64_t>& live_rows,
+                            const std::vector<uint64_t>& new_indices);
+  void ThrottleCompaction(uint64_t bytes);
 
   std::string root_dir_;
   std::string keys_dir_;
@@ -331,6 +753,7 @@ class PersistentTableImpl : public PersistentTable {
 
   std::vector<uint32_t> offsets_buffer_;
   AlignedBuffer blocks_buffer_;
+  void* registered_blocks_buffer_;
 
   std::recursive_mutex mutex_;
   uint64_t physical_table_size_;
@@ -340,6 +763,36 @@ class PersistentTableImpl : public PersistentTable {
   uint64_t writable_key_file_chunk_id_;
   PosixFileLockGuard lock_;
   bool read_only_;
+
+  // Number of live values per chunk, i.e. values referenced by row_id_mapping_.
+  std::vector<uint64_t> chunk_live_values_;
+  std::atomic<int64_t> num_foreground_waiters_;
+  std::atomic<int64_t> num_snapshot_iterators_;
+  uint64_t snapshot_version_;
+  // Chunks that were found dense because of snapshot references. They are not scanned again until
+  // their live values or the snapshots change.
+  struct DenseChunk {
+    uint64_t num_live_values;
+    uint64_t snapshot_version;
+    std::vector<std::string> snapshots;
+  };
+  std::unordered_map<uint64_t, DenseChunk> dense_chunks_;
+  // Values that compaction moved into a chunk only because snapshots reference them. They are not
+  // in row_id_mapping_, so they are counted here and forgotten once the snapshots change.
+  struct PinnedValues {
+    uint64_t num_values;
+    std::vector<std::string> snapshots;
+  };
+  std::unordered_map<uint64_t, PinnedValues> pinned_values_;
+  PersistentTableStats compaction_stats_;
+  uint64_t compaction_max_live_percent_;
+  uint64_t compaction_max_bytes_per_sec_;
+  bool compaction_unsupported_;
+  std::mutex compaction_run_mutex_;
+  std::mutex compaction_mutex_;
+  std::condition_variable compaction_cond_;
+  std::atomic<bool> compaction_shutdown_;
+  std::thread compaction_thread_;
 };
 
 template<typename Key, typename Engine>
@@ -350,8 +803,14 @@ PersistentTableImpl<Key, Engine>::PersistentTableImpl(const PersistentTableOptio
       physical_block_size_(options.physical_block_size),
       logical_block_size_(GetLogicalBlockSize(options.physical_block_size, value_size_)),
       blocks_buffer_(options.physical_block_size),
+      registered_blocks_buffer_(nullptr),
       writable_key_file_chunk_id_(-1),
-      read_only_(options.read_only) {
+      read_only_(options.read_only),
+      num_foreground_waiters_(0),
+      num_snapshot_iterators_(0),
+      snapshot_version_(0),
+      compaction_unsupported_(false),
+      compaction_shutdown_(false) {
   const uint64_t capacity_hint = ParseIntegerFromEnv(
       "ONEFLOW_ONE_EMBEDDING_PERSISTENT_TABLE_CAPACITY_HINT", options.capacity_hint);
   if (capacity_hint > 0) { row_id_mapping_.reserve(capacity_hint); }
@@ -403,10 +862,26 @@ PersistentTableImpl<Key, Engine>::PersistentTableImpl(const PersistentTableOptio
   } else {
     physical_table_size_ = 0;
   }
+  chunk_live_values_.resize(value_files_.size(), 0);
+  compaction_max_live_percent_ = ParseIntegerFromEnv(
+      "ONEFLOW_ONE_EMBEDDING_PERSISTENT_TABLE_COMPACTION_MAX_LIVE_PERCENT", 50);
+  compaction_max_bytes_per_sec_ =
+      ParseIntegerFromEnv("ONEFLOW_ONE_EMBEDDING_PERSISTENT_TABLE_COMPACTION_MAX_MB_PER_SEC", 64)
+      * 1024 * 1024;
+  if (!read_only_
+      && ParseBooleanFromEnv("ONEFLOW_ONE_EMBEDDING_PERSISTENT_TABLE_ENABLE_COMPACTION", false)) {
+    compaction_thread_ = std::thread(&PersistentTableImpl<Key, Engine>::CompactionLoop, this);
+  }
 }
 
 template<typename Key, typename Engine>
 PersistentTableImpl<Key, Engine>::~PersistentTableImpl() {
+  {
+    std::unique_lock<std::mutex> lock(compaction_mutex_);
+    compaction_shutdown_ = true;
+    compaction_cond_.notify_all();
+  }
+  if (compaction_thread_.joinable()) { compaction_thread_.join(); }
   for (uint32_t tid = 0; tid < workers_.size(); ++tid) { workers_.at(tid)->Shutdown(); }
 }
 
@@ -418,7 +893,7 @@ uint32_t PersistentTableImpl<Key, Engine>::LogicalBlockSize() const {
 template<typename Key, typename Engine>
 void PersistentTableImpl<Key, Engine>::GetBlocks(uint32_t num_keys, const void* keys, void* blocks,
                                                  uint32_t* offsets) {
-  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  std::unique_lock<std::recursive_mutex> lock = LockForeground();
   ParallelFor(num_keys, [&](Engine* engine, size_t start, size_t end) {
     for (uint64_t i = start; i < end; ++i) {
       const Key key = static_cast<const Key*>(keys)[i];
@@ -445,15 +920,14 @@ void PersistentTableImpl<Key, Engine>::GetBlocks(uint32_t num_keys, const void*
 template<typename Key, typename Engine>
 void PersistentTableImpl<Key, Engine>::Get(uint32_t num_keys, const void* keys, void* values,
                                            uint32_t* n_missing, uint32_t* missing_indices) {
-  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  std::unique_lock<std::recursive_mutex> lock = LockForeground();
   offsets_buffer_.resize(num_keys);
   void* blocks_ptr = nullptr;
   if (value_size_ == logical_block_size_
       && reinterpret_cast<uintptr_t>(values) % physical_block_size_ == 0) {
     blocks_ptr = values;
   } else {
-    blocks_buffer_.Resize(num_keys * logical_block_size_);
-    blocks_ptr = blocks_buffer_.ptr();
+    blocks_ptr = ResizeBlocksBuffer(num_keys * logical_block_size_);
   }
   GetBlocks(num_keys, keys, blocks_ptr, offsets_buffer_.data());
   uint32_t missing_count = 0;
@@ -475,7 +949,18 @@ template<typename Key, typename Engine>
 void PersistentTableImpl<Key, Engine>::PutBlocks(uint32_t num_keys, const void* keys,
                                                  const void* blocks) {
   CHECK(!read_only_);
-  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  std::unique_lock<std::recursive_mutex> lock = LockForeground();
+  AppendBlocks(num_keys, keys, blocks, [&](uint64_t start_index) {
+    for (uint64_t i = 0; i < num_keys; ++i) {
+      SetRowId(static_cast<const Key*>(keys)[i], start_index + i);
+    }
+  });
+}
+
+template<typename Key, typename Engine>
+uint64_t PersistentTableImpl<Key, Engine>::AppendBlocks(
+    uint32_t num_keys, const void* keys, const void* blocks,
+    const std::function<void(uint64_t start_index)>& OnScheduled) {
   const uint32_t num_blocks = RoundUp(num_keys, num_values_per_block_) / num_values_per_block_;
   const uint32_t num_padded_keys = num_blocks * num_values_per_block_;
   const uint64_t start_index = physical_table_size_;
@@ -485,7 +970,7 @@ void PersistentTableImpl<Key, Engine>::PutBlocks(uint32_t num_keys, const void*
   uint64_t written_blocks = 0;
   const uint64_t block_keys_size = num_values_per_block_ * sizeof(Key);
   BlockingCounter bc(1);
-  workers_.at(0)->Schedule([&](Engine*) {
+  workers_.at(0)->Schedule([&](Engine* engine) {
     while (written_blocks < num_blocks) {
       const uint64_t batch_start_block_id = start_block_id + written_blocks;
       const uint64_t batch_chunk_id = batch_start_block_id / num_logical_blocks_per_chunk_;
@@ -495,7 +980,10 @@ void PersistentTableImpl<Key, Engine>::PutBlocks(uint32_t num_keys, const void*
         CHECK_LE(batch_chunk_id, value_files_.size());
       }
       if ((!writable_key_file_.IsOpen()) || writable_key_file_chunk_id_ != batch_chunk_id) {
+        // Writes to the previous key file may still be in flight.
+        engine->WaitUntilDone();
         writable_key_file_ = PosixFile(KeyFilePath(batch_chunk_id), O_CREAT | O_RDWR, 0644);
+        writable_key_file_chunk_id_ = batch_chunk_id;
       }
       PosixFile& value_file = value_files_.at(batch_chunk_id);
       const uint64_t block_id_in_chunk =
@@ -507,44 +995,82 @@ void PersistentTableImpl<Key, Engine>::PutBlocks(uint32_t num_keys, const void*
       const uint64_t values_offset_in_file = block_id_in_chunk * logical_block_size_;
       CHECK_LE(value_file.Size(), values_offset_in_file);
       value_file.Truncate(values_offset_in_file + values_bytes);
-      PCHECK(pwrite(value_file.fd(), BytesOffset(blocks, written_blocks * logical_block_size_),
-                    values_bytes, values_offset_in_file)
-             == values_bytes);
+      engine->AsyncPwrite(value_file.fd(),
+                          BytesOffset(blocks, written_blocks * logical_block_size_), values_bytes,
+                          values_offset_in_file);
       const uint64_t keys_offset_in_file = block_id_in_chunk * block_keys_size;
       writable_key_file_.Truncate(keys_offset_in_file + blocks_to_write * block_keys_size);
       const uint64_t keys_bytes = std::min(num_keys - written_blocks * num_values_per_block_,
                                            blocks_to_write * num_values_per_block_)
                                   * sizeof(Key);
-      PCHECK(pwrite(writable_key_file_.fd(), BytesOffset(keys, written_blocks * block_keys_size),
-                    keys_bytes, keys_offset_in_file)
-             == keys_bytes);
+      engine->AsyncPwrite(writable_key_file_.fd(),
+                          BytesOffset(keys, written_blocks * block_keys_size), keys_bytes,
+                          keys_offset_in_file);
       written_blocks += blocks_to_write;
     }
+    engine->WaitUntilDone();
     bc.Decrease();
   });
-  for (uint64_t i = 0; i < num_keys; ++i) {
-    row_id_mapping_[static_cast<const Key*>(keys)[i]] = start_index + i;
-  }
+  if (OnScheduled) { OnScheduled(start_index); }
   bc.WaitForeverUntilCntEqualZero();
+  if (chunk_live_values_.size() < value_files_.size()) {
+    chunk_live_values_.resize(value_files_.size(), 0);
+  }
+  return start_index;
+}
+
+template<typename Key, typename Engine>
+void PersistentTableImpl<Key, Engine>::SetRowId(const Key& key, uint64_t row_id) {
+  auto it = row_id_mapping_.emplace(key, row_id);
+  if (!it.second) {
+    AddLiveValues(it.first->second, -1);
+    it.first->second = row_id;
+  }
+  AddLiveValues(row_id, 1);
+}
+
+template<typename Key, typename Engine>
+void PersistentTableImpl<Key, Engine>::AddLiveValues(uint64_t row_id, int64_t n) {
+  const uint64_t chunk_id = row_id / num_values_per_chunk_;
+  if (chunk_id >= chunk_live_values_.size()) { chunk_live_values_.resize(chunk_id + 1, 0); }
+  chunk_live_values_[chunk_id] += n;
+}
+
+template<typename Key, typename Engine>
+void PersistentTableImpl<Key, Engine>::AddPinnedValue(uint64_t row_id,
+                                                      const std::vector<std::string>& snapshots) {
+  PinnedValues& pinned = pinned_values_[row_id / num_values_per_chunk_];
+  if (pinned.snapshots != snapshots) {
+    pinned.num_values = 0;
+    pinned.snapshots = snapshots;
+  }
+  pinned.num_values += 1;
+}
+
+template<typename Key, typename Engine>
+std::unique_lock<std::recursive_mutex> PersistentTableImpl<Key, Engine>::LockForeground() {
+  // Background compaction backs off while foreground calls are waiting for the table.
+  num_foreground_waiters_.fetch_add(1, std::memory_order_relaxed);
+  std::unique_lock<std::recursive_mutex> lock(mutex_);
+  num_foreground_waiters_.fetch_sub(1, std::memory_order_relaxed);
+  return lock;
 }
 
 template<typename Key, typename Engine>
 void PersistentTableImpl<Key, Engine>::Put(uint32_t num_keys, const void* keys,
                                            const void* values) {
   CHECK(!read_only_);
-  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  std::unique_lock<std::recursive_mutex> lock = LockForeground();
   const void* blocks_ptr = nullptr;
   if (value_size_ == logical_block_size_
       && reinterpret_cast<uintptr_t>(values) % physical_block_size_ == 0) {
     blocks_ptr = values;
   } else {
-    const uint32_t num_blocks = RoundUp(num_keys, num_values_per_block_);
-    blocks_buffer_.Resize(num_blocks * logical_block_size_);
+    const uint32_t num_blocks = RoundUp(num_keys, num_values_per_block_) / num_values_per_block_;
+    ResizeBlocksBuffer(num_blocks * logical_block_size_);
     for (uint32_t i = 0; i < num_keys; i += num_values_per_block_) {
       const uint32_t block_id = i / num_values_per_block_;
-      const uint32_t copy_size = (num_keys - i) < num_values_per_block_
-                                     ? (num_keys - i) * value_size_
-                                     : logical_block_size_;
+      const uint32_t copy_size = std::min(num_keys - i, num_values_per_block_) * value_size_;
       MemcpyOffset(blocks_buffer_.ptr(), block_id * logical_block_size_, values, i * value_size_,
                    copy_size);
     }
@@ -585,6 +1111,7 @@ void PersistentTableImpl<Key, Engine>::LoadSnapshotImpl(const std::string& name)
   const std::string snapshot_base = SnapshotDirPath(name);
   const std::string snapshot_list = SnapshotListFilePath(name);
   row_id_mapping_.clear();
+  chunk_live_values_.assign(value_files_.size(), 0);
   std::ifstream list_if(snapshot_list);
   std::string index_filename;
   while (std::getline(list_if, index_filename)) {
@@ -604,6 +1131,7 @@ void PersistentTableImpl<Key, Engine>::LoadSnapshotImpl(const std::string& name)
     for (size_t i = 0; i < n_entries; ++i) {
       CHECK(row_id_mapping_.emplace(keys[indices[i] - chunk_start_index], indices[i]).second);
     }
+    AddLiveValues(chunk_start_index, n_entries);
   }
 }
 
@@ -612,6 +1140,7 @@ void PersistentTableImpl<Key, Engine>::SaveSnapshotImpl(const std::string& name)
   CHECK(!read_only_);
   std::lock_guard<std::recursive_mutex> lock(mutex_);
   PosixFile::RecursiveCreateDirectory(SnapshotDirPath(name), 0755);
+  snapshot_version_ += 1;
   std::ofstream list_ofs(SnapshotListFilePath(name));
   if (row_id_mapping_.empty()) { return; }
   std::vector<PosixMappedFile> index_files(value_files_.size());
@@ -666,6 +1195,7 @@ void PersistentTableImpl<Key, Engine>::LoadSnapshot(
   const std::string snapshot_base = SnapshotDirPath(name);
   const std::string snapshot_list = SnapshotListFilePath(name);
   row_id_mapping_.clear();
+  chunk_live_values_.assign(value_files_.size(), 0);
   std::ifstream list_if(snapshot_list);
   std::string index_filename;
   while (std::getline(list_if, index_filename)) {
@@ -685,6 +1215,7 @@ void PersistentTableImpl<Key, Engine>::LoadSnapshot(
     for (size_t i = 0; i < n_entries; ++i) {
       CHECK(row_id_mapping_.emplace(keys[indices[i] - chunk_start_index], indices[i]).second);
     }
+    AddLiveValues(chunk_start_index, n_entries);
     if (Hook) {
       PosixFile value_file(ValueFilePath(chunk_id), O_RDONLY, 0644);
       PosixMappedFile mapped_value(std::move(value_file), value_file.Size(), PROT_READ, mmap_flags);
@@ -728,6 +1259,334 @@ void PersistentTableImpl<Key, Engine>::ParallelFor(size_t total,
   bc.WaitForeverUntilCntEqualZero();
 }
 
+template<typename Key, typename Engine>
+void* PersistentTableImpl<Key, Engine>::ResizeBlocksBuffer(size_t size) {
+  blocks_buffer_.Resize(size);
+  if (blocks_buffer_.ptr() != registered_blocks_buffer_) {
+    ForEachEngine([&](Engine* engine) {
+      engine->RegisterBuffer(blocks_buffer_.ptr(), blocks_buffer_.size());
+    });
+    registered_blocks_buffer_ = blocks_buffer_.ptr();
+  }
+  return blocks_buffer_.ptr();
+}
+
+template<typename Key, typename Engine>
+void PersistentTableImpl<Key, Engine>::ForEachEngine(
+    const std::function<void(Engine* engine)>& fn) {
+  BlockingCounter bc(workers_.size());
+  for (size_t i = 0; i < workers_.size(); ++i) {
+    workers_.at(i)->Schedule([&](Engine* engine) {
+      fn(engine);
+      bc.Decrease();
+    });
+  }
+  bc.WaitForeverUntilCntEqualZero();
+}
+
+template<typename Key, typename Engine>
+void PersistentTableImpl<Key, Engine>::Compact() {
+  CHECK(!read_only_);
+  CompactImpl(false);
+}
+
+template<typename Key, typename Engine>
+void PersistentTableImpl<Key, Engine>::GetStats(PersistentTableStats* stats) {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  *stats = compaction_stats_;
+  stats->num_live_values = row_id_mapping_.size();
+  stats->num_chunks = 0;
+  stats->num_physical_values = 0;
+  for (uint64_t chunk_id = 0; chunk_id < value_files_.size(); ++chunk_id) {
+    if (!value_files_.at(chunk_id).IsOpen()) { continue; }
+    stats->num_chunks += 1;
+    stats->num_physical_values +=
+        std::min(num_values_per_chunk_, physical_table_size_ - chunk_id * num_values_per_chunk_);
+  }
+}
+
+template<typename Key, typename Engine>
+std::vector<std::string> PersistentTableImpl<Key, Engine>::ListSnapshots() {
+  std::vector<std::string> names;
+  DIR* dir = opendir(snapshots_dir_.c_str());
+  if (dir == nullptr) {
+    PCHECK(errno == ENOENT);
+    return names;
+  }
+  struct dirent* ent = nullptr;
+  while ((ent = readdir(dir)) != nullptr) {
+    const std::string name = ent->d_name;
+    if (name == "." || name == "..") { continue; }
+    if (HasSuffix(name, kCompactionTmpSuffix)) {
+      // Left behind by an interrupted compaction, the snapshot itself is always intact.
+      PosixFile::RecursiveDelete(SnapshotDirPath(name));
+      continue;
+    }
+    if (PosixFile::FileExists(SnapshotListFilePath(name))) { names.push_back(name); }
+  }
+  PCHECK(closedir(dir) == 0);
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
+template<typename Key, typename Engine>
+void PersistentTableImpl<Key, Engine>::CompactionLoop() {
+  const std::chrono::milliseconds interval(
+      ParseIntegerFromEnv("ONEFLOW_ONE_EMBEDDING_PERSISTENT_TABLE_COMPACTION_INTERVAL_MS", 10000));
+  std::unique_lock<std::mutex> lock(compaction_mutex_);
+  const auto IsShutdown = [&]() { return compaction_shutdown_.load(); };
+  while (!compaction_cond_.wait_for(lock, interval, IsShutdown)) {
+    lock.unlock();
+    CompactImpl(true);
+    lock.lock();
+  }
+}
+
+template<typename Key, typename Engine>
+void PersistentTableImpl<Key, Engine>::CompactImpl(bool background) {
+  std::lock_guard<std::mutex> run_lock(compaction_run_mutex_);
+  std::vector<uint64_t> candidates;
+  {
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    if (compaction_unsupported_) { return; }
+    const std::vector<std::string> snapshots = ListSnapshots();
+    // Only full chunks are sealed, the last one is still being appended to.
+    const uint64_t num_sealed_chunks =
+        std::min<uint64_t>(physical_table_size_ / num_values_per_chunk_, value_files_.size());
+    for (uint64_t chunk_id = 0; chunk_id < num_sealed_chunks; ++chunk_id) {
+      if (!value_files_.at(chunk_id).IsOpen() || chunk_id == writable_key_file_chunk_id_) {
+        continue;
+      }
+      const uint64_t live = chunk_live_values_.at(chunk_id);
+      uint64_t pinned = 0;
+      auto pinned_it = pinned_values_.find(chunk_id);
+      if (pinned_it != pinned_values_.end()) {
+        if (pinned_it->second.snapshots == snapshots) {
+          pinned = pinned_it->second.num_values;
+        } else {
+          pinned_values_.erase(pinned_it);
+        }
+      }
+      if ((live + pinned) * 100 >= num_values_per_chunk_ * compaction_max_live_percent_) {
+        continue;
+      }
+      auto it = dense_chunks_.find(chunk_id);
+      if (it != dense_chunks_.end() && it->second.num_live_values == live
+          && it->second.snapshot_version == snapshot_version_
+          && it->second.snapshots == snapshots) {
+        continue;
+      }
+      candidates.push_back(chunk_id);
+    }
+  }
+  for (uint64_t chunk_id : candidates) {
+    if (compaction_shutdown_) { break; }
+    CompactChunk(chunk_id, background);
+  }
+}
+
+template<typename Key, typename Engine>
+bool PersistentTableImpl<Key, Engine>::CompactChunk(uint64_t chunk_id, bool background) {
+  const uint64_t chunk_start_index = chunk_id * num_values_per_chunk_;
+  // Rows of the chunk referenced by the key index or by any snapshot, in ascending order.
+  std::vector<uint64_t> live_rows;
+  std::vector<Key> live_keys;
+  {
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    robin_hood::unordered_flat_set<uint64_t> pinned;
+    const std::string index_filename = kIndexFileNamePrefix + GetChunkName(chunk_id);
+    const std::vector<std::string> snapshots = ListSnapshots();
+    for (const std::string& name : snapshots) {
+      const std::string pathname = PosixFile::JoinPath(SnapshotDirPath(name), index_filename);
+      if (!PosixFile::FileExists(pathname)) { continue; }
+      for (uint64_t index : ReadIndexFile(pathname)) { pinned.insert(index); }
+    }
+    PosixFile key_file(KeyFilePath(chunk_id), O_RDONLY, 0644);
+    const size_t key_file_size = key_file.Size();
+    PosixMappedFile mapped_key(std::move(key_file), key_file_size, PROT_READ);
+    const Key* keys = static_cast<const Key*>(mapped_key.ptr());
+    const uint64_t num_rows =
+        std::min<uint64_t>(key_file_size / sizeof(Key), num_values_per_chunk_);
+    for (uint64_t row = 0; row < num_rows; ++row) {
+      const uint64_t index = chunk_start_index + row;
+      auto it = row_id_mapping_.find(keys[row]);
+      if ((it != row_id_mapping_.end() && it->second == index) || pinned.count(index) != 0) {
+        live_rows.push_back(row);
+        live_keys.push_back(keys[row]);
+      }
+    }
+    if (live_rows.size() * 100 >= num_values_per_chunk_ * compaction_max_live_percent_) {
+      dense_chunks_[chunk_id] =
+          DenseChunk{chunk_live_values_.at(chunk_id), snapshot_version_, snapshots};
+      return false;
+    }
+  }
+  // Move the live values to the end of the table in small steps, so that foreground lookups, which
+  // still read the old copies, are only blocked for a short time.
+  std::vector<uint64_t> new_indices(live_rows.size());
+  AlignedBuffer read_buffer(physical_block_size_);
+  AlignedBuffer packed_buffer(physical_block_size_);
+  size_t pos = 0;
+  while (pos < live_rows.size()) {
+    if (compaction_shutdown_) { return false; }
+    const uint64_t first_block = live_rows.at(pos) / num_values_per_block_;
+    size_t end = pos;
+    while (end < live_rows.size()
+           && live_rows.at(end) / num_values_per_block_ < first_block + kCompactionStepBlocks) {
+      end += 1;
+    }
+    const uint64_t last_block = live_rows.at(end - 1) / num_values_per_block_;
+    const uint64_t read_bytes = (last_block - first_block + 1) * logical_block_size_;
+    const uint32_t num_values = end - pos;
+    const uint64_t num_blocks = RoundUp(num_values, num_values_per_block_) / num_values_per_block_;
+    read_buffer.Resize(read_bytes);
+    packed_buffer.Resize(num_blocks * logical_block_size_);
+    {
+      std::unique_lock<std::recursive_mutex> lock(mutex_);
+      PCHECK(pread(value_files_.at(chunk_id).fd(), read_buffer.ptr(), read_bytes,
+                   first_block * logical_block_size_)
+             == read_bytes);
+      for (uint32_t i = 0; i < num_values; ++i) {
+        const uint64_t row = live_rows.at(pos + i);
+        const uint64_t src_block = row / num_values_per_block_ - first_block;
+        const uint64_t src_offset =
+            src_block * logical_block_size_ + (row % num_values_per_block_) * value_size_;
+        const uint64_t dst_offset = (i / num_values_per_block_) * logical_block_size_
+                                    + (i % num_values_per_block_) * value_size_;
+        MemcpyOffset(packed_buffer.ptr(), dst_offset, read_buffer.ptr(), src_offset, value_size_);
+      }
+      const uint64_t start_index =
+          AppendBlocks(num_values, live_keys.data() + pos, packed_buffer.ptr(), nullptr);
+      for (uint32_t i = 0; i < num_values; ++i) { new_indices.at(pos + i) = start_index + i; }
+      compaction_stats_.num_compaction_moved_values += num_values;
+      compaction_stats_.compaction_read_bytes += read_bytes;
+      compaction_stats_.compaction_written_bytes +=
+          num_blocks * logical_block_size_ + num_values * sizeof(Key);
+    }
+    pos = end;
+    if (background) {
+      ThrottleCompaction(read_bytes + num_blocks * logical_block_size_ + num_values * sizeof(Key));
+    }
+  }
+  std::unique_lock<std::recursive_mutex> lock(mutex_);
+  if (compaction_shutdown_ || num_snapshot_iterators_ > 0) { return false; }
+  // The moved copies must be durable before snapshots point at them.
+  std::set<uint64_t> new_chunks;
+  for (uint64_t index : new_indices) { new_chunks.insert(index / num_values_per_chunk_); }
+  for (uint64_t new_chunk_id : new_chunks) {
+    PCHECK(fdatasync(value_files_.at(new_chunk_id).fd()) == 0);
+    PosixFile key_file(KeyFilePath(new_chunk_id), O_RDONLY, 0644);
+    PCHECK(fdatasync(key_file.fd()) == 0);
+  }
+  // Snapshots saved while moving can only reference rows that were live when the move started.
+  const std::vector<std::string> snapshots = ListSnapshots();
+  for (const std::string& name : snapshots) {
+    if (!RewriteSnapshotChunk(name, chunk_id, live_rows, new_indices)) { return false; }
+  }
+  for (size_t i = 0; i < live_rows.size(); ++i) {
+    auto it = row_id_mapping_.find(live_keys.at(i));
+    if (it != row_id_mapping_.end() && it->second == chunk_start_index + live_rows.at(i)) {
+      it->second = new_indices.at(i);
+      AddLiveValues(chunk_start_index, -1);
+      AddLiveValues(new_indices.at(i), 1);
+    } else {
+      // The moved copy is kept for the snapshots, count it so the destination does not look sparse.
+      AddPinnedValue(new_indices.at(i), snapshots);
+    }
+  }
+  CHECK_EQ(chunk_live_values_.at(chunk_id), 0);
+  PosixFile& value_file = value_files_.at(chunk_id);
+  const int fd = value_file.fd();
+  ForEachEngine([&](Engine* engine) { engine->ForgetFile(fd); });
+  compaction_stats_.compaction_reclaimed_bytes +=
+      value_file.Size() + num_values_per_chunk_ * sizeof(Key);
+  value_file.Close();
+  PCHECK(unlink(ValueFilePath(chunk_id).c_str()) == 0);
+  PCHECK(unlink(KeyFilePath(chunk_id).c_str()) == 0);
+  dense_chunks_.erase(chunk_id);
+  pinned_values_.erase(chunk_id);
+  compaction_stats_.num_compacted_chunks += 1;
+  return true;
+}
+
+template<typename Key, typename Engine>
+bool PersistentTableImpl<Key, Engine>::RewriteSnapshotChunk(
+    const std::string& name, uint64_t chunk_id, const std::vector<uint64_t>& live_rows,
+    const std::vector<uint64_t>& new_indices) {
+  const std::string snapshot_dir = SnapshotDirPath(name);
+  const std::string chunk_index_filename = kIndexFileNamePrefix + GetChunkName(chunk_id);
+  const std::string chunk_index_pathname = PosixFile::JoinPath(snapshot_dir, chunk_index_filename);
+  if (!PosixFile::FileExists(chunk_index_pathname)) { return true; }
+  const uint64_t chunk_start_index = chunk_id * num_values_per_chunk_;
+  std::map<uint64_t, std::vector<uint64_t>> moved_indices;
+  for (uint64_t index : ReadIndexFile(chunk_index_pathname)) {
+    const uint64_t row = index - chunk_start_index;
+    const auto it = std::lower_bound(live_rows.cbegin(), live_rows.cend(), row);
+    CHECK(it != live_rows.cend() && *it == row);
+    const uint64_t new_index = new_indices.at(it - live_rows.cbegin());
+    moved_indices[new_index / num_values_per_chunk_].push_back(new_index);
+  }
+  // Build the rewritten snapshot next to the original one and swap them atomically, unchanged
+  // index files are shared through hard links.
+  const std::string tmp_dir = snapshot_dir + kCompactionTmpSuffix;
+  PosixFile::RecursiveDelete(tmp_dir);
+  PosixFile::RecursiveCreateDirectory(tmp_dir, 0755);
+  {
+    std::ifstream list_ifs(SnapshotListFilePath(name));
+    std::ofstream list_ofs(PosixFile::JoinPath(tmp_dir, kSnapshotListFileName));
+    std::string index_filename;
+    while (std::getline(list_ifs, index_filename)) {
+      if (index_filename == chunk_index_filename) { continue; }
+      const std::string src = PosixFile::JoinPath(snapshot_dir, index_filename);
+      const std::string dst = PosixFile::JoinPath(tmp_dir, index_filename);
+      auto it = moved_indices.find(GetChunkId(index_filename, kIndexFileNamePrefix));
+      if (it == moved_indices.end()) {
+        PCHECK(link(src.c_str(), dst.c_str()) == 0);
+      } else {
+        std::vector<uint64_t> indices = ReadIndexFile(src);
+        indices.insert(indices.end(), it->second.cbegin(), it->second.cend());
+        WriteIndexFile(dst, indices);
+        moved_indices.erase(it);
+      }
+      list_ofs << index_filename << std::endl;
+    }
+    for (const auto& pair : moved_indices) {
+      const std::string index_filename = kIndexFileNamePrefix + GetChunkName(pair.first);
+      WriteIndexFile(PosixFile::JoinPath(tmp_dir, index_filename), pair.second);
+      list_ofs << index_filename << std::endl;
+    }
+    CHECK(list_ofs.flush());
+  }
+#if defined(SYS_renameat2) && defined(RENAME_EXCHANGE)
+  const int ret = syscall(SYS_renameat2, AT_FDCWD, tmp_dir.c_str(), AT_FDCWD,
+                          snapshot_dir.c_str(), RENAME_EXCHANGE);
+#else
+  const int ret = -1;
+  errno = ENOSYS;
+#endif  // defined(SYS_renameat2) && defined(RENAME_EXCHANGE)
+  if (ret != 0) {
+    PCHECK(errno == EINVAL || errno == ENOSYS);
+    LOG(WARNING) << "The file system of " << snapshots_dir_
+                 << " does not support RENAME_EXCHANGE, persistent table compaction is disabled";
+    PosixFile::RecursiveDelete(tmp_dir);
+    compaction_unsupported_ = true;
+    return false;
+  }
+  PosixFile::RecursiveDelete(tmp_dir);
+  return true;
+}
+
+template<typename Key, typename Engine>
+void PersistentTableImpl<Key, Engine>::ThrottleCompaction(uint64_t bytes) {
+  if (compaction_max_bytes_per_sec_ > 0) {
+    std::this_thread::sleep_for(std::chrono::microseconds(bytes * 1000000
+                                                          / compaction_max_bytes_per_sec_));
+  }
+  while (num_foreground_waiters_.load(std::memory_order_relaxed) > 0 && !compaction_shutdown_) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(kCompactionBackoffMs));
+  }
+}
+
 template<typename Key, typename Engine>
 class SnapshotIteratorImpl : public PersistentTable::Iterator {
  public:
@@ -742,12 +1601,14 @@ class SnapshotIteratorImpl : public PersistentTable::Iterator {
         num_values_per_block_(num_values_per_block),
         num_values_per_chunk_(num_values_per_chunk),
         current_chunk_(0) {
+    // Keeps compaction from deleting the chunk files this iterator is going to open.
+    table_->num_snapshot_iterators_.fetch_add(1);
     const std::string snapshot_list = table_->SnapshotListFilePath(snapshot_name);
     std::ifstream list_if(snapshot_list);
     std::string index_filename;
     while (std::getline(list_if, index_filename)) { indices_names_.push_back(index_filename); }
   }
-  ~SnapshotIteratorImpl() override = default;
+  ~SnapshotIteratorImpl() override { table_->num_snapshot_iterators_.fetch_sub(1); }
 
   void Next(uint32_t num_keys, uint32_t* return_keys, void* keys, void* values) override {
     *return_keys = 0;
@@ -819,6 +1680,16 @@ std::unique_ptr<PersistentTable> DispatchKeyType(const PersistentTableOptions& o
 }
 
 std::unique_ptr<PersistentTable> DispatchEngine(const PersistentTableOptions& options) {
+  const std::string engine =
+      GetStringFromEnv("ONEFLOW_ONE_EMBEDDING_PERSISTENT_TABLE_IO_ENGINE", "aio");
+  if (engine == "io_uring") {
+#ifdef ONEFLOW_EMBEDDING_WITH_IO_URING
+    if (IoUringEngine::IsSupported()) { return DispatchKeyType<IoUringEngine>(options); }
+#endif  // ONEFLOW_EMBEDDING_WITH_IO_URING
+    LOG(WARNING) << "io_uring is not available, fall back to the aio engine";
+  } else {
+    CHECK_EQ(engine, "aio") << "Unsupported persistent table io engine " << engine;
+  }
   return DispatchKeyType<AioEngine>(options);
 }
 
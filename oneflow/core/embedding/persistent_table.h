@@ -32,6 +32,24 @@ struct PersistentTableOptions {
   bool read_only = false;
 };
 
+struct PersistentTableStats {
+  // Values reachable through the current key index.
+  uint64_t num_live_values = 0;
+  // Value slots held by the value chunks on disk, including dead and padding slots.
+  uint64_t num_physical_values = 0;
+  uint64_t num_chunks = 0;
+  uint64_t num_compacted_chunks = 0;
+  uint64_t num_compaction_moved_values = 0;
+  uint64_t compaction_read_bytes = 0;
+  uint64_t compaction_written_bytes = 0;
+  uint64_t compaction_reclaimed_bytes = 0;
+
+  double LiveRatio() const {
+    return num_physical_values == 0 ? 1.0
+                                    : static_cast<double>(num_live_values) / num_physical_values;
+  }
+};
+
 class PersistentTable {
  public:
   OF_DISALLOW_COPY_AND_MOVE(PersistentTable);
@@ -62,6 +80,10 @@ class PersistentTable {
                             const std::function<void(Iterator* iter)>& Hook) = 0;
   virtual void SaveSnapshot(const std::string& name) = 0;
   virtual Iterator* ReadSnapshot(const std::string& name) = 0;
+  // Rewrites sealed value chunks whose live ratio is below the compaction threshold and deletes
+  // them once the live values, including the ones referenced by snapshots, have been moved.
+  virtual void Compact() = 0;
+  virtual void GetStats(PersistentTableStats* stats) = 0;
 };
 
 std::unique_ptr<PersistentTable> NewPersistentTable(const PersistentTableOptions& options);
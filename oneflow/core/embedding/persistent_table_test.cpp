@@ -0,0 +1,271 @@
+/*
+Copyright 2020 The OneFlow Authors. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "oneflow/core/embedding/persistent_table.h"
+#include <gtest/gtest.h>
+#include <chrono>
+#include <cstdlib>
+#include <random>
+#include <thread>
+#include "oneflow/core/embedding/posix_file.h"
+
+namespace oneflow {
+
+namespace embedding {
+
+namespace {
+
+#ifdef __linux__
+
+std::string CreateTempDirectory() {
+  const char* tmp_env = getenv("TMPDIR");
+  const char* tmp_dir = tmp_env == nullptr ? "/tmp" : tmp_env;
+  std::string tpl = std::string(tmp_dir) + "/test_persistent_table_XXXXXX";
+  char* path = mkdtemp(const_cast<char*>(tpl.c_str()));
+  PCHECK(path != nullptr);
+  return std::string(path);
+}
+
+class IoEngineGuard final {
+ public:
+  OF_DISALLOW_COPY_AND_MOVE(IoEngineGuard);
+  explicit IoEngineGuard(const std::string& engine) {
+    PCHECK(setenv(kEnvName, engine.c_str(), 1) == 0);
+  }
+  ~IoEngineGuard() { PCHECK(unsetenv(kEnvName) == 0); }
+
+ private:
+  static constexpr const char* kEnvName = "ONEFLOW_ONE_EMBEDDING_PERSISTENT_TABLE_IO_ENGINE";
+};
+
+std::unique_ptr<PersistentTable> NewTestTable(const std::string& path, uint32_t value_size) {
+  PersistentTableOptions options;
+  options.path = path;
+  options.key_size = sizeof(uint64_t);
+  options.value_size = value_size;
+  options.target_chunk_size_mb = 1;
+  return NewPersistentTable(options);
+}
+
+void TestPutGet(const std::string& engine, uint32_t embedding_vec_size) {
+  IoEngineGuard guard(engine);
+  const std::string path = CreateTempDirectory();
+  const uint32_t value_size = embedding_vec_size * sizeof(float);
+  const uint32_t num_embeddings = 8192;
+  const uint32_t batch_size = 1000;
+  std::vector<uint64_t> keys(num_embeddings);
+  std::vector<float> values(num_embeddings * embedding_vec_size);
+  for (uint32_t i = 0; i < num_embeddings; ++i) {
+    keys[i] = i + 1;
+    for (uint32_t j = 0; j < embedding_vec_size; ++j) {
+      values[i * embedding_vec_size + j] = static_cast<float>(keys[i] * 100 + j);
+    }
+  }
+  {
+    auto table = NewTestTable(path, value_size);
+    for (uint32_t offset = 0; offset < num_embeddings; offset += batch_size) {
+      const uint32_t n = std::min(batch_size, num_embeddings - offset);
+      table->Put(n, keys.data() + offset, values.data() + offset * embedding_vec_size);
+    }
+    table->SaveSnapshot("final");
+  }
+  auto table = NewTestTable(path, value_size);
+  table->LoadSnapshot("final");
+  std::vector<uint64_t> query(num_embeddings + 1);
+  std::vector<float> result(query.size() * embedding_vec_size);
+  std::vector<uint32_t> missing_indices(query.size());
+  // Query in reverse order with one missing key at the end.
+  for (uint32_t i = 0; i < num_embeddings; ++i) { query[i] = keys[num_embeddings - 1 - i]; }
+  query[num_embeddings] = num_embeddings + 100;
+  uint32_t n_missing = 0;
+  table->Get(query.size(), query.data(), result.data(), &n_missing, missing_indices.data());
+  ASSERT_EQ(n_missing, 1);
+  ASSERT_EQ(missing_indices[0], num_embeddings);
+  for (uint32_t i = 0; i < num_embeddings; ++i) {
+    for (uint32_t j = 0; j < embedding_vec_size; ++j) {
+      ASSERT_EQ(result[i * embedding_vec_size + j], static_cast<float>(query[i] * 100 + j));
+    }
+  }
+  table.reset();
+  PosixFile::RecursiveDelete(path);
+}
+
+float TestValue(uint64_t key, uint32_t version, uint32_t j) {
+  return static_cast<float>(key * 1000 + version * 100 + j);
+}
+
+void PutVersion(PersistentTable* table, uint64_t begin, uint64_t end, uint32_t version,
+                uint32_t embedding_vec_size) {
+  std::vector<uint64_t> keys(end - begin);
+  std::vector<float> values(keys.size() * embedding_vec_size);
+  for (uint64_t i = 0; i < keys.size(); ++i) {
+    keys[i] = begin + i;
+    for (uint32_t j = 0; j < embedding_vec_size; ++j) {
+      values[i * embedding_vec_size + j] = TestValue(keys[i], version, j);
+    }
+  }
+  table->Put(keys.size(), keys.data(), values.data());
+}
+
+void CheckVersions(PersistentTable* table, uint64_t num_keys,
+                   const std::function<uint32_t(uint64_t)>& Version, uint32_t embedding_vec_size) {
+  std::vector<uint64_t> keys(num_keys);
+  for (uint64_t i = 0; i < num_keys; ++i) { keys[i] = i; }
+  std::vector<float> values(num_keys * embedding_vec_size);
+  std::vector<uint32_t> missing_indices(num_keys);
+  uint32_t n_missing = 0;
+  table->Get(num_keys, keys.data(), values.data(), &n_missing, missing_indices.data());
+  ASSERT_EQ(n_missing, 0);
+  for (uint64_t i = 0; i < num_keys; ++i) {
+    for (uint32_t j = 0; j < embedding_vec_size; ++j) {
+      ASSERT_EQ(values[i * embedding_vec_size + j], TestValue(i, Version(i), j)) << i;
+    }
+  }
+}
+
+#endif  // __linux__
+
+}  // namespace
+
+#ifdef __linux__
+
+TEST(PersistentTable, PutGetAio) {
+  TestPutGet("aio", 128);
+  TestPutGet("aio", 1536);
+}
+
+TEST(PersistentTable, PutGetIoUring) {
+  TestPutGet("io_uring", 128);
+  TestPutGet("io_uring", 1536);
+}
+
+TEST(PersistentTable, IoEngineThroughput) {
+  const uint32_t embedding_vec_size = 128;
+  const uint32_t value_size = embedding_vec_size * sizeof(float);
+  const uint32_t num_embeddings = 1 << 17;
+  const uint32_t batch_size = 1 << 14;
+  const int64_t num_batches = 32;
+  std::vector<uint64_t> keys(num_embeddings);
+  std::vector<float> values(num_embeddings * embedding_vec_size, 1.f);
+  for (uint32_t i = 0; i < num_embeddings; ++i) { keys[i] = i; }
+  std::vector<uint64_t> query(batch_size);
+  std::vector<float> result(batch_size * embedding_vec_size);
+  std::vector<uint32_t> missing_indices(batch_size);
+  std::mt19937 gen(0);
+  std::uniform_int_distribution<uint64_t> dist(0, num_embeddings - 1);
+  for (const std::string engine : {"aio", "io_uring"}) {
+    IoEngineGuard guard(engine);
+    const std::string path = CreateTempDirectory();
+    auto table = NewTestTable(path, value_size);
+    auto start = std::chrono::steady_clock::now();
+    table->Put(num_embeddings, keys.data(), values.data());
+    const double put_s =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    for (int64_t b = 0; b < num_batches; ++b) {
+      for (auto& key : query) { key = dist(gen); }
+      uint32_t n_missing = 0;
+      table->Get(batch_size, query.data(), result.data(), &n_missing, missing_indices.data());
+      ASSERT_EQ(n_missing, 0);
+    }
+    const double get_s =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "engine " << engine << ", put " << num_embeddings / put_s << " keys/s, get "
+              << num_batches * batch_size / get_s << " keys/s" << std::endl;
+    table.reset();
+    PosixFile::RecursiveDelete(path);
+  }
+}
+
+TEST(PersistentTable, Compaction) {
+  // 512 bytes values in 1MB chunks, so a chunk holds 2048 values.
+  const uint32_t embedding_vec_size = 128;
+  const uint32_t value_size = embedding_vec_size * sizeof(float);
+  const uint64_t num_keys = 8192;
+  const std::string path = CreateTempDirectory();
+  const auto CurrentVersion = [](uint64_t key) -> uint32_t {
+    return key < 1536 ? 1 : (key < 1792 ? 2 : 0);
+  };
+  const auto SnapshotVersion = [](uint64_t key) -> uint32_t { return key < 1536 ? 1 : 0; };
+  {
+    auto table = NewTestTable(path, value_size);
+    PutVersion(table.get(), 0, num_keys, 0, embedding_vec_size);
+    table->SaveSnapshot("s0");
+    PutVersion(table.get(), 0, 1536, 1, embedding_vec_size);
+    table->SaveSnapshot("s1");
+    PutVersion(table.get(), 1536, 1792, 2, embedding_vec_size);
+    PersistentTableStats stats;
+    // Chunk 0 only holds 256 live values, but s0 still references all of them.
+    table->Compact();
+    table->GetStats(&stats);
+    ASSERT_EQ(stats.num_compacted_chunks, 0);
+    ASSERT_EQ(stats.num_live_values, num_keys);
+    ASSERT_EQ(stats.num_physical_values, num_keys + 1792);
+    PosixFile::RecursiveDelete(PosixFile::JoinPath(path, "snapshots/s0"));
+    // The 256 live values and the 256 values only referenced by s1 are moved.
+    table->Compact();
+    table->GetStats(&stats);
+    ASSERT_EQ(stats.num_compacted_chunks, 1);
+    ASSERT_EQ(stats.num_compaction_moved_values, 512);
+    ASSERT_EQ(stats.num_chunks, 5);
+    ASSERT_EQ(stats.num_physical_values, num_keys + 1792 + 512 - 2048);
+    ASSERT_GT(stats.compaction_reclaimed_bytes, 0);
+    ASSERT_FALSE(PosixFile::FileExists(PosixFile::JoinPath(path, "values/value-000000000000")));
+    CheckVersions(table.get(), num_keys, CurrentVersion, embedding_vec_size);
+    table->LoadSnapshot("s1");
+    CheckVersions(table.get(), num_keys, SnapshotVersion, embedding_vec_size);
+  }
+  auto table = NewTestTable(path, value_size);
+  table->LoadSnapshot("s1");
+  CheckVersions(table.get(), num_keys, SnapshotVersion, embedding_vec_size);
+  table.reset();
+  PosixFile::RecursiveDelete(path);
+}
+
+TEST(PersistentTable, BackgroundCompaction) {
+  const uint32_t embedding_vec_size = 128;
+  const uint32_t value_size = embedding_vec_size * sizeof(float);
+  const uint64_t num_keys = 8192;
+  const std::string path = CreateTempDirectory();
+  PCHECK(setenv("ONEFLOW_ONE_EMBEDDING_PERSISTENT_TABLE_ENABLE_COMPACTION", "1", 1) == 0);
+  PCHECK(setenv("ONEFLOW_ONE_EMBEDDING_PERSISTENT_TABLE_COMPACTION_INTERVAL_MS", "10", 1) == 0);
+  auto table = NewTestTable(path, value_size);
+  PCHECK(unsetenv("ONEFLOW_ONE_EMBEDDING_PERSISTENT_TABLE_ENABLE_COMPACTION") == 0);
+  PCHECK(unsetenv("ONEFLOW_ONE_EMBEDDING_PERSISTENT_TABLE_COMPACTION_INTERVAL_MS") == 0);
+  PutVersion(table.get(), 0, num_keys, 0, embedding_vec_size);
+  PutVersion(table.get(), 0, 3584, 1, embedding_vec_size);
+  PersistentTableStats stats;
+  for (int i = 0; i < 1000; ++i) {
+    CheckVersions(
+        table.get(), num_keys, [](uint64_t key) -> uint32_t { return key < 3584 ? 1 : 0; },
+        embedding_vec_size);
+    table->GetStats(&stats);
+    if (stats.num_compacted_chunks == 2) { break; }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  ASSERT_EQ(stats.num_compacted_chunks, 2);
+  std::cout << "live ratio " << stats.LiveRatio() << ", moved "
+            << stats.num_compaction_moved_values << " values, read "
+            << stats.compaction_read_bytes << " bytes, written " << stats.compaction_written_bytes
+            << " bytes, reclaimed " << stats.compaction_reclaimed_bytes << " bytes" << std::endl;
+  table.reset();
+  PosixFile::RecursiveDelete(path);
+}
+
+#endif  // __linux__
+
+}  // namespace embedding
+
+}  // namespace oneflow
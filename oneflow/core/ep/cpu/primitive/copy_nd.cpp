@@ -13,8 +13,11 @@ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 See the License for the specific language governing permissions and
 limitations under the License.
 */
+#include <algorithm>
+#include <cstring>
 #include "oneflow/core/ep/include/primitive/copy_nd.h"
 #include "oneflow/core/ep/common/primitive/copy_nd.h"
+#include "oneflow/core/ep/cpu/cpu_stream.h"
 
 namespace oneflow {
 
@@ -23,29 +26,42 @@ namespace primitive {
 
 namespace {
 
+// Elements handled by one task of the CPU stream.
+constexpr int64_t kParallelGrain = 32768;
+
+// The last dim of the simplified copy is contiguous in both src and dst, so the copy is done row
+// by row with memcpy, and the rows are copied in parallel.
 template<size_t num_dims, size_t movement_size, typename IndexType>
-void CopyNdKernel(CopyNdKernelParams<num_dims, IndexType> params) {
+void LaunchKernel(Stream* stream, CopyNdKernelParams<num_dims, IndexType> params) {
   using T = typename std::aligned_storage<movement_size, movement_size>::type;
   const T* src = reinterpret_cast<const T*>(params.src);
   T* dst = reinterpret_cast<T*>(params.dst);
-  for (IndexType i = 0; i < params.count; ++i) {
-    IndexType copy_index[num_dims];
-    IndexType src_index[num_dims];
-    IndexType dst_index[num_dims];
-    params.copy_index_helper.OffsetToNdIndex(i, copy_index);
-    for (size_t j = 0; j < num_dims; ++j) {
-      src_index[j] = params.src_pos[j] + copy_index[j];
-      dst_index[j] = params.dst_pos[j] + copy_index[j];
-    }
-    const IndexType src_offset = params.src_index_helper.NdIndexToOffset(src_index);
-    const IndexType dst_offset = params.dst_index_helper.NdIndexToOffset(dst_index);
-    dst[dst_offset] = src[src_offset];
-  }
-}
-
-template<size_t num_dims, size_t movement_size, typename IndexType>
-void LaunchKernel(Stream* stream, CopyNdKernelParams<num_dims, IndexType> params) {
-  CopyNdKernel<num_dims, movement_size, IndexType>(params);
+  if (params.count == 0) { return; }
+  IndexType extent[num_dims];
+  params.copy_index_helper.OffsetToNdIndex(params.count - 1, extent);
+  for (size_t i = 0; i < num_dims; ++i) { extent[i] += 1; }
+  const IndexType row_size = extent[num_dims - 1];
+  const IndexType row_num = params.count / row_size;
+  const int64_t grain = std::max<int64_t>(kParallelGrain / row_size, 1);
+  stream->As<CpuStream>()->ParallelFor(
+      0, row_num,
+      [&](int64_t begin, int64_t end) {
+        for (int64_t row = begin; row < end; ++row) {
+          IndexType copy_index[num_dims];
+          IndexType src_index[num_dims];
+          IndexType dst_index[num_dims];
+          params.copy_index_helper.OffsetToNdIndex(static_cast<IndexType>(row) * row_size,
+                                                   copy_index);
+          for (size_t j = 0; j < num_dims; ++j) {
+            src_index[j] = params.src_pos[j] + copy_index[j];
+            dst_index[j] = params.dst_pos[j] + copy_index[j];
+          }
+          const IndexType src_offset = params.src_index_helper.NdIndexToOffset(src_index);
+          const IndexType dst_offset = params.dst_index_helper.NdIndexToOffset(dst_index);
+          std::memcpy(dst + dst_offset, src + src_offset, row_size * sizeof(T));
+        }
+      },
+      grain);
 }
 
 class CopyNdImpl : public CopyNd {
@@ -13,11 +13,16 @@ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 See the License for the specific language governing permissions and
 limitations under the License.
 */
+#include <algorithm>
+#include <cstring>
 #include "oneflow/core/ep/include/primitive/permute.h"
 #include "oneflow/core/ep/common/primitive/permute_impl.h"
 #include "oneflow/core/ep/cpu/cpu_stream.h"
 #include "oneflow/core/ep/cpu/cpu_device.h"
 #include "oneflow/core/ep/common/onednn.h"
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
 
 namespace oneflow {
 
@@ -30,30 +35,147 @@ namespace internal {
 
 namespace {
 
-template<size_t num_dims, size_t movement_size, typename IndexType>
-void PermuteKernel(PermuteKernelParams<num_dims, IndexType> params) {
-  using T = typename std::aligned_storage<movement_size, movement_size>::type;
-  const T* src = reinterpret_cast<const T*>(params.src);
-  T* dst = reinterpret_cast<T*>(params.dst);
-  for (IndexType i = 0; i < params.count; ++i) {
-    IndexType src_index[num_dims];
-    IndexType dst_index[num_dims];
-    params.dst_index_helper.OffsetToNdIndex(i, dst_index);
-    for (size_t dim = 0; dim < num_dims; ++dim) {
-      src_index[params.permutation[dim]] = dst_index[dim];
+// Elements handled by one task of ParallelFor, as the default grain of CpuStream.
+constexpr int64_t kParallelGrain = 32768;
+
+// Transposes a tile of `rows` x `cols` elements: dst[i * dst_stride + j] = src[j * src_stride + i].
+template<typename T, typename IndexType>
+void TransposeTile(const T* src, IndexType src_stride, T* dst, IndexType dst_stride,
+                   IndexType rows, IndexType cols) {
+  IndexType i = 0;
+#if defined(__SSE__)
+  if constexpr (sizeof(T) == sizeof(float)) {
+    // 4x4 micro-transposes in registers, the remaining rows and columns are copied one by one.
+    const float* src_ptr = reinterpret_cast<const float*>(src);
+    float* dst_ptr = reinterpret_cast<float*>(dst);
+    for (; i + 4 <= rows; i += 4) {
+      IndexType j = 0;
+      for (; j + 4 <= cols; j += 4) {
+        __m128 row0 = _mm_loadu_ps(src_ptr + (j + 0) * src_stride + i);
+        __m128 row1 = _mm_loadu_ps(src_ptr + (j + 1) * src_stride + i);
+        __m128 row2 = _mm_loadu_ps(src_ptr + (j + 2) * src_stride + i);
+        __m128 row3 = _mm_loadu_ps(src_ptr + (j + 3) * src_stride + i);
+        _MM_TRANSPOSE4_PS(row0, row1, row2, row3);
+        _mm_storeu_ps(dst_ptr + (i + 0) * dst_stride + j, row0);
+        _mm_storeu_ps(dst_ptr + (i + 1) * dst_stride + j, row1);
+        _mm_storeu_ps(dst_ptr + (i + 2) * dst_stride + j, row2);
+        _mm_storeu_ps(dst_ptr + (i + 3) * dst_stride + j, row3);
+      }
+      for (IndexType ii = i; ii < i + 4; ++ii) {
+        for (IndexType jj = j; jj < cols; ++jj) {
+          dst[ii * dst_stride + jj] = src[jj * src_stride + ii];
+        }
+      }
     }
-    IndexType src_offset = params.src_index_helper.NdIndexToOffset(src_index);
-    dst[i] = src[src_offset];
+  }
+#endif  // defined(__SSE__)
+  for (; i < rows; ++i) {
+    for (IndexType j = 0; j < cols; ++j) { dst[i * dst_stride + j] = src[j * src_stride + i]; }
   }
 }
 
 template<size_t num_dims, size_t movement_size, typename IndexType>
 void LaunchKernel(Stream* stream, const int64_t* src_dims, const void* src, const int* permutation,
                   void* dst, size_t count) {
-  PermuteKernelParams<num_dims, IndexType> params =
-      MakePermuteParams<num_dims, IndexType>(src_dims, src, permutation, dst, count);
-  PermuteKernel<num_dims, movement_size, IndexType>(params);
+  // The row and tile counts below divide by the dims, which may be 0.
+  if (count == 0) { return; }
+  using T = typename std::aligned_storage<movement_size, movement_size>::type;
+  const T* src_ptr = reinterpret_cast<const T*>(src);
+  T* dst_ptr = reinterpret_cast<T*>(dst);
+  CpuStream* cpu_stream = stream->As<CpuStream>();
+  IndexType src_strides[num_dims];
+  IndexType dst_dims[num_dims];
+  IndexType dst_strides[num_dims];
+  // the source stride of each destination dim
+  IndexType permuted_src_strides[num_dims];
+  src_strides[num_dims - 1] = 1;
+  for (int i = static_cast<int>(num_dims) - 2; i >= 0; --i) {
+    src_strides[i] = src_strides[i + 1] * src_dims[i + 1];
+  }
+  for (size_t i = 0; i < num_dims; ++i) {
+    dst_dims[i] = src_dims[permutation[i]];
+    permuted_src_strides[i] = src_strides[permutation[i]];
+  }
+  dst_strides[num_dims - 1] = 1;
+  for (int i = static_cast<int>(num_dims) - 2; i >= 0; --i) {
+    dst_strides[i] = dst_strides[i + 1] * dst_dims[i + 1];
+  }
+  // Offsets of the first element of the `outer_dim_num` outer destination dims at `index`.
+  const auto& OuterOffsets = [&](IndexType index, const int* outer_dims, int outer_dim_num,
+                                 IndexType* src_offset, IndexType* dst_offset) {
+    *src_offset = 0;
+    *dst_offset = 0;
+    for (int k = outer_dim_num - 1; k >= 0; --k) {
+      const int dim = outer_dims[k];
+      const IndexType dim_index = index % dst_dims[dim];
+      index /= dst_dims[dim];
+      *src_offset += dim_index * permuted_src_strides[dim];
+      *dst_offset += dim_index * dst_strides[dim];
+    }
+  };
+  if (permutation[num_dims - 1] == num_dims - 1) {
+    // The last dim is contiguous in both the source and the destination, copy it row by row.
+    const IndexType row_size = dst_dims[num_dims - 1];
+    const IndexType row_num = count / row_size;
+    int outer_dims[num_dims];
+    for (size_t i = 0; i + 1 < num_dims; ++i) { outer_dims[i] = i; }
+    cpu_stream->ParallelFor(
+        0, row_num,
+        [&](int64_t begin, int64_t end) {
+          for (int64_t row = begin; row < end; ++row) {
+            IndexType src_offset = 0;
+            IndexType dst_offset = 0;
+            OuterOffsets(row, outer_dims, num_dims - 1, &src_offset, &dst_offset);
+            std::memcpy(dst_ptr + dst_offset, src_ptr + src_offset, row_size * sizeof(T));
+          }
+        },
+        std::max<int64_t>(kParallelGrain / row_size, 1));
+    return;
+  }
+  // Otherwise the destination dims `dst_col_dim` (the last one) and `dst_row_dim` (the last
+  // source dim) form a 2D transpose for each index of the other, outer, dims. The transposes are
+  // blocked into tiles which stay in cache while read by columns, and tiles are distributed to
+  // threads.
+  constexpr IndexType kTileSize = movement_size <= 4 ? 32 : 16;
+  const int dst_col_dim = num_dims - 1;
+  int dst_row_dim = 0;
+  int outer_dims[num_dims];
+  int outer_dim_num = 0;
+  for (size_t i = 0; i + 1 < num_dims; ++i) {
+    if (permutation[i] == num_dims - 1) {
+      dst_row_dim = i;
+    } else {
+      outer_dims[outer_dim_num++] = i;
+    }
+  }
+  const IndexType rows = dst_dims[dst_row_dim];
+  const IndexType cols = dst_dims[dst_col_dim];
+  const IndexType row_tile_num = (rows + kTileSize - 1) / kTileSize;
+  const IndexType col_tile_num = (cols + kTileSize - 1) / kTileSize;
+  const IndexType tile_num = row_tile_num * col_tile_num;
+  const IndexType src_stride = permuted_src_strides[dst_col_dim];
+  const IndexType dst_stride = dst_strides[dst_row_dim];
+  cpu_stream->ParallelFor(
+      0, count / (rows * cols) * tile_num,
+      [&](int64_t begin, int64_t end) {
+        for (int64_t task = begin; task < end; ++task) {
+          const IndexType outer_index = task / tile_num;
+          const IndexType row_tile = task % tile_num / col_tile_num;
+          const IndexType col_tile = task % col_tile_num;
+          IndexType src_offset = 0;
+          IndexType dst_offset = 0;
+          OuterOffsets(outer_index, outer_dims, outer_dim_num, &src_offset, &dst_offset);
+          const IndexType row_begin = row_tile * kTileSize;
+          const IndexType col_begin = col_tile * kTileSize;
+          TransposeTile<T, IndexType>(
+              src_ptr + src_offset + col_begin * src_stride + row_begin, src_stride,
+              dst_ptr + dst_offset + row_begin * dst_stride + col_begin, dst_stride,
+              std::min(kTileSize, rows - row_begin), std::min(kTileSize, cols - col_begin));
+        }
+      },
+      std::max<int64_t>(kParallelGrain / (kTileSize * kTileSize), 1));
 }
+
 class PermuteImpl : public Permute {
  public:
   OF_DISALLOW_COPY_AND_MOVE(PermuteImpl);
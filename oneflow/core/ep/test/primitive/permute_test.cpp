@@ -13,6 +13,10 @@ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 See the License for the specific language governing permissions and
 limitations under the License.
 */
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <numeric>
 #include <gtest/gtest.h>
 #include "oneflow/core/ep/test/primitive/primitive_test.h"
 #include "oneflow/core/ep/include/primitive/memcpy.h"
@@ -125,6 +129,8 @@ TEST_F(PrimitiveTest, TestBatchPermute) {
   const int32_t dims2[2] = {10, 3};
   const int32_t dims3[2] = {31, 4};
   const int32_t dims4[2] = {6, 8};
+  // larger than the tiles of the CPU kernel, not a multiple of the tile size
+  const int32_t dims5[2] = {67, 130};
 
   TestPermute2D<float, DataType::kFloat, 2>(&device_manager_registry_, available_device_types_,
                                             dims0, permutation_list);
@@ -136,6 +142,8 @@ TEST_F(PrimitiveTest, TestBatchPermute) {
                                               dims3, permutation_list);
   TestPermute2D<Eigen::half, DataType::kFloat16, 2>(
       &device_manager_registry_, available_device_types_, dims4, permutation_list);
+  TestPermute2D<float, DataType::kFloat, 2>(&device_manager_registry_, available_device_types_,
+                                            dims5, permutation_list);
 }
 
 TEST_F(PrimitiveTest, TestPermute) {
@@ -162,6 +170,72 @@ TEST_F(PrimitiveTest, TestPermute) {
       &device_manager_registry_, available_device_types_, dims4, permutation_list4);
 }
 
+TEST_F(PrimitiveTest, TestPermuteZeroSize) {
+  const int permutation_list0[2] = {1, 0};
+  const int permutation_list1[3] = {2, 0, 1};
+  const int permutation_list2[3] = {1, 0, 2};
+  const int64_t dims0[2] = {0, 7};
+  const int64_t dims1[3] = {4, 0, 3};
+  const int64_t dims2[3] = {5, 6, 0};
+  for (const auto& device_type : available_device_types_) {
+    auto device = device_manager_registry_.GetDevice(device_type, 0);
+    // nothing is read or written, the buffers only give valid pointers
+    ep::test::DeviceMemoryGuard device_src(device.get(), sizeof(float));
+    ep::test::DeviceMemoryGuard device_dst(device.get(), sizeof(float));
+    ep::test::StreamGuard stream(device.get());
+    std::unique_ptr<Permute> permute = NewPrimitive<PermuteFactory>(device_type, 3);
+    ASSERT_TRUE(permute.operator bool());
+    permute->Launch(stream.stream(), DataType::kFloat, 2, dims0, device_src.ptr<float>(),
+                    permutation_list0, device_dst.ptr<float>());
+    permute->Launch(stream.stream(), DataType::kFloat, 3, dims1, device_src.ptr<float>(),
+                    permutation_list1, device_dst.ptr<float>());
+    permute->Launch(stream.stream(), DataType::kFloat, 3, dims2, device_src.ptr<float>(),
+                    permutation_list2, device_dst.ptr<float>());
+    CHECK_JUST(stream.stream()->Sync());
+  }
+}
+
+TEST_F(PrimitiveTest, TestPermuteBenchmark) {
+  if (available_device_types_.count(DeviceType::kCPU) == 0) { return; }
+  auto device = device_manager_registry_.GetDevice(DeviceType::kCPU, 0);
+  std::unique_ptr<Permute> permute = NewPrimitive<PermuteFactory>(DeviceType::kCPU, 4);
+  ASSERT_TRUE(permute.operator bool());
+  ep::test::StreamGuard stream(device.get());
+  const std::vector<std::pair<std::vector<int64_t>, std::vector<int>>> cases = {
+      {{4096, 4096}, {1, 0}},
+      {{64, 256, 1024}, {0, 2, 1}},
+      {{64, 256, 1024}, {1, 0, 2}},
+      {{32, 64, 56, 56}, {0, 2, 3, 1}},
+  };
+  for (const auto& pair : cases) {
+    const auto& src_dims = pair.first;
+    const auto& permutation = pair.second;
+    const int64_t elem_cnt =
+        std::accumulate(src_dims.begin(), src_dims.end(), int64_t(1), std::multiplies<int64_t>());
+    std::vector<float> src(elem_cnt);
+    std::vector<float> dst(elem_cnt);
+    std::iota(src.begin(), src.end(), 0.F);
+    const int iter_num = 10;
+    permute->Launch(stream.stream(), DataType::kFloat, src_dims.size(), src_dims.data(),
+                    src.data(), permutation.data(), dst.data());
+    CHECK_JUST(stream.stream()->Sync());
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iter_num; ++i) {
+      permute->Launch(stream.stream(), DataType::kFloat, src_dims.size(), src_dims.data(),
+                      src.data(), permutation.data(), dst.data());
+    }
+    CHECK_JUST(stream.stream()->Sync());
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    const double seconds = std::chrono::duration<double>(elapsed).count() / iter_num;
+    std::cout << "cpu permute float " << elem_cnt << " elements, permutation (";
+    for (size_t i = 0; i < permutation.size(); ++i) {
+      std::cout << (i == 0 ? "" : ", ") << permutation[i];
+    }
+    std::cout << "): " << seconds * 1000 << " ms, "
+              << 2 * elem_cnt * sizeof(float) / seconds / 1e9 << " GB/s" << std::endl;
+  }
+}
+
 }  // namespace test
 
 }  // namespace primitive
@@ -356,9 +356,10 @@ Maybe<Scope> InstructionsBuilder::BuildScopeByProtoStrSetter(
 Maybe<void> InstructionsBuilder::Call(const std::shared_ptr<one::StatefulOpKernel>& opkernel,
                                       vm::EagerBlobObjectList&& input_eager_blob_objects,
                                       vm::EagerBlobObjectList&& output_eager_blob_objects,
-                                      const one::OpExprInterpContext& ctx, Symbol<Stream> stream) {
+                                      const one::OpExprInterpContext& ctx, Symbol<Stream> stream,
+                                      const std::shared_ptr<vm::OpCallKernelMemo>& kernel_memo) {
   return Call(opkernel, std::move(input_eager_blob_objects), std::move(output_eager_blob_objects),
-              nullptr, ctx, stream);
+              nullptr, ctx, stream, kernel_memo);
 }
 
 Maybe<void> InstructionsBuilder::AllocateTensors(const vm::EagerBlobObjectList& eager_blob_objects,
@@ -384,7 +385,8 @@ Maybe<void> InstructionsBuilder::Call(
     vm::EagerBlobObjectList&& input_eager_blob_objects,
     vm::EagerBlobObjectList&& output_eager_blob_objects,
     const std::shared_ptr<const one::GlobalTensorInferResult>& global_tensor_infer_result,
-    const one::OpExprInterpContext& ctx, Symbol<Stream> stream) {
+    const one::OpExprInterpContext& ctx, Symbol<Stream> stream,
+    const std::shared_ptr<vm::OpCallKernelMemo>& kernel_memo) {
   stream = JUST(StreamGuard::TryConvertStream(stream));
   Symbol<Stream> allocator_stream = JUST(GetAllocatorStream(stream));
   if (stream != allocator_stream) {
@@ -401,7 +403,7 @@ Maybe<void> InstructionsBuilder::Call(
       vm_stream, JUST(vm::OpCallInstructionPolicy::New(
                      vm_stream, opkernel, std::move(input_eager_blob_objects),
                      std::move(output_eager_blob_objects), global_tensor_infer_result, ctx,
-                     *one::CurrentDevVmDepObjectConsumeMode())));
+                     *one::CurrentDevVmDepObjectConsumeMode(), kernel_memo)));
   instruction_list_->EmplaceBack(std::move(instruction));
   return Maybe<void>::Ok();
 }
@@ -786,30 +788,56 @@ Maybe<vm::Instruction*> MutThreadLocalInstruction(Symbol<Stream> stream) {
   return instruction_ptr->Mutable();
 }
 
+std::atomic<int64_t>* MutConcurrentDispatchScopeNum() {
+  static std::atomic<int64_t> scope_num(0);
+  return &scope_num;
+}
+
+std::recursive_mutex* ConcurrentDispatchMutex() {
+  static std::recursive_mutex mutex;
+  return &mutex;
+}
+
 }  // namespace
 
+ConcurrentDispatchScope::ConcurrentDispatchScope() { ++*MutConcurrentDispatchScopeNum(); }
+
+ConcurrentDispatchScope::~ConcurrentDispatchScope() { --*MutConcurrentDispatchScopeNum(); }
+
+/*static*/ std::unique_lock<std::recursive_mutex> ConcurrentDispatchScope::LockIfConcurrent() {
+  // Only threads entering after a scope is created need the lock: the thread creating the scope
+  // starts the other dispatching threads and they are joined before the scope is destroyed.
+  if (likely(MutConcurrentDispatchScopeNum()->load(std::memory_order_acquire) == 0)) {
+    return std::unique_lock<std::recursive_mutex>();
+  }
+  return std::unique_lock<std::recursive_mutex>(*ConcurrentDispatchMutex());
+}
+
 template<typename T, typename InstructionPolicyT>
 Maybe<void> SyncAccessSmallMem(char* mem_ptr, size_t bytes, const T tensor) {
   static thread_local vm::InstructionList instruction_list;
   static thread_local InstructionsBuilder instructions_builder(&instruction_list);
   const std::shared_ptr<vm::EagerBlobObject>& eager_blob_object = JUST(tensor->eager_blob_object());
   const Symbol<Stream> stream = JUST(GetAccessStream(tensor));
-  if (eager_blob_object->last_used_stream().has_value()
-      && stream != JUST(eager_blob_object->last_used_stream())) {
-    // Synchronize stream.
-    JUST(instructions_builder.SoftSyncStream({eager_blob_object}, stream));
-  }
   InstructionPolicyT* instruction_policy = nullptr;
   {
-    // Construct instruction.
-    auto* instruction = JUST(MutThreadLocalInstruction<InstructionPolicyT>(stream));
-    instruction_policy =
-        static_cast<InstructionPolicyT*>(instruction->mut_instruction_policy());  // NOLINT
-    instruction_policy->Reset(mem_ptr, bytes, eager_blob_object.get());
-    instruction_list.PushBack(instruction);
+    const auto& lock = ConcurrentDispatchScope::LockIfConcurrent();
+    if (eager_blob_object->last_used_stream().has_value()
+        && stream != JUST(eager_blob_object->last_used_stream())) {
+      // Synchronize stream.
+      JUST(instructions_builder.SoftSyncStream({eager_blob_object}, stream));
+    }
+    {
+      // Construct instruction.
+      auto* instruction = JUST(MutThreadLocalInstruction<InstructionPolicyT>(stream));
+      instruction_policy =
+          static_cast<InstructionPolicyT*>(instruction->mut_instruction_policy());  // NOLINT
+      instruction_policy->Reset(mem_ptr, bytes, eager_blob_object.get());
+      instruction_list.PushBack(instruction);
+    }
+    // Dispatch instructions.
+    JUST(vm::Run(&instruction_list));
   }
-  // Dispatch instructions.
-  JUST(vm::Run(&instruction_list));
   {
     // This thread should blocking wait if and only if there is a lot of workload on worker thread.
     // When workload is small, we want better performance by skipping cond_.notify_xxx which costs
@@ -16,10 +16,12 @@ limitations under the License.
 #ifndef ONEFLOW_CORE_FRAMEWORK_INSTRUCTIONS_BUILDER_H_
 #define ONEFLOW_CORE_FRAMEWORK_INSTRUCTIONS_BUILDER_H_
 
+#include <mutex>
 #include "oneflow/core/eager/eager_blob_object.h"
 #include "oneflow/core/eager/local_dep_object.h"
 #include "oneflow/core/framework/op_interpreter.h"
 #include "oneflow/core/vm/instruction.h"
+#include "oneflow/core/vm/op_call_kernel_memo.h"
 #include "oneflow/core/job/job_desc.h"
 #include "oneflow/core/job/parallel_desc.h"
 #include "oneflow/core/job/scope.h"
@@ -128,14 +130,16 @@ class InstructionsBuilder : public std::enable_shared_from_this<InstructionsBuil
   Maybe<void> Call(const std::shared_ptr<one::StatefulOpKernel>& opkernel,
                    vm::EagerBlobObjectList&& input_eager_blob_objects,
                    vm::EagerBlobObjectList&& output_eager_blob_objects,
-                   const one::OpExprInterpContext& ctx, Symbol<Stream> stream);
+                   const one::OpExprInterpContext& ctx, Symbol<Stream> stream,
+                   const std::shared_ptr<vm::OpCallKernelMemo>& kernel_memo = nullptr);
 
   Maybe<void> Call(
       const std::shared_ptr<one::StatefulOpKernel>& opkernel,
       vm::EagerBlobObjectList&& input_eager_blob_objects,
       vm::EagerBlobObjectList&& output_eager_blob_objects,
       const std::shared_ptr<const one::GlobalTensorInferResult>& global_tensor_infer_result,
-      const one::OpExprInterpContext& ctx, Symbol<Stream> stream);
+      const one::OpExprInterpContext& ctx, Symbol<Stream> stream,
+      const std::shared_ptr<vm::OpCallKernelMemo>& kernel_memo = nullptr);
 
   Maybe<void> SoftSyncStream(const vm::EagerBlobObjectList& eager_blob_objects,
                              Symbol<Stream> stream);
@@ -158,9 +162,23 @@ class InstructionsBuilder : public std::enable_shared_from_this<InstructionsBuil
   vm::InstructionList* instruction_list_;
 };
 
+// Eager ops may be dispatched from several threads at once, e.g. by the backward workers of
+// autograd. While such a scope is alive, building and running instructions is serialized, because
+// the builder reads and updates the last used streams of eager blob objects shared by the threads.
+class ConcurrentDispatchScope final {
+ public:
+  OF_DISALLOW_COPY_AND_MOVE(ConcurrentDispatchScope);
+  ConcurrentDispatchScope();
+  ~ConcurrentDispatchScope();
+
+  // Owns the dispatch mutex if any scope is alive, otherwise owns nothing.
+  static std::unique_lock<std::recursive_mutex> LockIfConcurrent();
+};
+
 // Make VM instructions with instruction builder and run instructions with physical/local view.
 template<typename CallbackT>
 Maybe<void> PhysicalRun(const CallbackT& Build) {
+  const auto& lock = ConcurrentDispatchScope::LockIfConcurrent();
   vm::InstructionList instruction_list;
   InstructionsBuilder instructions_builder(&instruction_list);
   JUST(Build(&instructions_builder));
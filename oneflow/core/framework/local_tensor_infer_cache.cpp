@@ -195,6 +195,12 @@ Maybe<void> LocalTensorMetaInferArgs::InitInputLocalTensorMetas(const TensorTupl
 
 Maybe<const LocalTensorInferResult> LocalTensorInferCache::GetOrInfer(
     const LocalTensorMetaInferArgs& infer_args) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return UnlockedGetOrInfer(infer_args);
+}
+
+Maybe<const LocalTensorInferResult> LocalTensorInferCache::UnlockedGetOrInfer(
+    const LocalTensorMetaInferArgs& infer_args) {
   if (ThreadLocalEnvBool<ONEFLOW_EAGER_ENABLE_LOCAL_INFER_CACHE>()) {
     auto iter = cache_.find(infer_args);
     if (iter == cache_.end()) {
@@ -214,5 +220,46 @@ Maybe<const LocalTensorInferResult> LocalTensorInferCache::GetOrInfer(
   }
 }
 
+Maybe<const LocalOpCallEntry> LocalTensorInferCache::GetOrInferOpCall(
+    const AttrMap& attrs, Symbol<Device> default_device, const TensorTuple& inputs) {
+  // The inline cache sits in front of the infer cache and is turned off together with it.
+  if (!ThreadLocalEnvBool<ONEFLOW_EAGER_ENABLE_LOCAL_INFER_CACHE>()
+      || !ThreadLocalEnvBool<ONEFLOW_EAGER_ENABLE_OP_CALL_INLINE_CACHE>()) {
+    LocalTensorMetaInferArgs infer_args;
+    JUST(infer_args.Init(attrs, default_device, inputs));
+    auto entry = std::make_shared<LocalOpCallEntry>();
+    entry->result = JUST(GetOrInfer(infer_args));
+    return std::shared_ptr<const LocalOpCallEntry>(std::move(entry));
+  }
+  OpArgsVector<Symbol<LocalTensorMeta>> input_local_tensor_metas(inputs.size());
+  for (int i = 0; i < inputs.size(); ++i) {
+    input_local_tensor_metas[i] = JUST(inputs.at(i)->local_tensor_meta());
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (auto iter = op_call_entries_.begin(); iter != op_call_entries_.end(); ++iter) {
+    const LocalOpCallEntry& entry = **iter;
+    if (entry.default_device == default_device
+        && entry.input_local_tensor_metas == input_local_tensor_metas
+        && entry.attrs.hash_value() == attrs.hash_value() && entry.attrs == attrs) {
+      // move to front
+      std::rotate(op_call_entries_.begin(), iter, iter + 1);
+      return op_call_entries_.front();
+    }
+  }
+  LocalTensorMetaInferArgs infer_args;
+  JUST(infer_args.Init(attrs, default_device, inputs));
+  auto entry = std::make_shared<LocalOpCallEntry>();
+  entry->result = JUST(UnlockedGetOrInfer(infer_args));
+  entry->attrs = attrs;
+  entry->default_device = default_device;
+  entry->input_local_tensor_metas = std::move(input_local_tensor_metas);
+  entry->kernel_memo = std::make_shared<vm::OpCallKernelMemo>();
+  const size_t capacity =
+      std::max<int64_t>(ThreadLocalEnvInteger<ONEFLOW_EAGER_OP_CALL_INLINE_CACHE_SIZE>(), 1);
+  if (op_call_entries_.size() >= capacity) { op_call_entries_.resize(capacity - 1); }
+  op_call_entries_.insert(op_call_entries_.begin(), std::move(entry));
+  return op_call_entries_.front();
+}
+
 }  // namespace one
 }  // namespace oneflow
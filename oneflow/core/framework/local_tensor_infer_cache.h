@@ -16,6 +16,7 @@ limitations under the License.
 #ifndef ONEFLOW_CORE_FRAMEWORK_LOCAL_TENSOR_INFER_CACHE_H_
 #define ONEFLOW_CORE_FRAMEWORK_LOCAL_TENSOR_INFER_CACHE_H_
 
+#include <mutex>
 #include "oneflow/core/common/symbol.h"
 #include "oneflow/core/common/maybe.h"
 #include "oneflow/core/common/op_args_vector.h"
@@ -23,6 +24,7 @@ limitations under the License.
 #include "oneflow/core/framework/device.h"
 #include "oneflow/core/framework/stream.h"
 #include "oneflow/core/common/tensor_meta.h"
+#include "oneflow/core/vm/op_call_kernel_memo.h"
 
 namespace oneflow {
 
@@ -99,6 +101,16 @@ class LocalTensorInferResult final {
   Symbol<Stream> stream_;
 };
 
+// What the calls of an op with the same attrs, default device and input metas share.
+struct LocalOpCallEntry final {
+  AttrMap attrs;
+  Symbol<Device> default_device;
+  OpArgsVector<Symbol<LocalTensorMeta>> input_local_tensor_metas;
+  std::shared_ptr<const LocalTensorInferResult> result;
+  // nullptr if the inline cache or the infer cache is disabled
+  std::shared_ptr<vm::OpCallKernelMemo> kernel_memo;
+};
+
 class LocalTensorInferCache final {
  public:
   LocalTensorInferCache(const std::shared_ptr<const UserOpExpr>& user_op_expr)
@@ -106,12 +118,26 @@ class LocalTensorInferCache final {
 
   Maybe<const LocalTensorInferResult> GetOrInfer(const LocalTensorMetaInferArgs& infer_args);
 
+  // Like a polymorphic inline cache, a few recently used entries are probed by comparing the
+  // interned input metas and device pointers and the attrs, without building and hashing
+  // LocalTensorMetaInferArgs. Falls back to GetOrInfer on a miss.
+  Maybe<const LocalOpCallEntry> GetOrInferOpCall(const AttrMap& attrs,
+                                                 Symbol<Device> default_device,
+                                                 const TensorTuple& inputs);
+
  private:
   static Maybe<const LocalTensorInferResult> Infer(const UserOpExpr& user_op_expr,
                                                    const LocalTensorMetaInferArgs& infer_args);
+  // Requires `mutex_` held.
+  Maybe<const LocalTensorInferResult> UnlockedGetOrInfer(
+      const LocalTensorMetaInferArgs& infer_args);
 
   std::weak_ptr<const UserOpExpr> user_op_expr_;
+  // Ops are dispatched on multiple threads, e.g. by the parallel backward executor.
+  std::mutex mutex_;
   HashMap<LocalTensorMetaInferArgs, std::shared_ptr<const LocalTensorInferResult>> cache_;
+  // most recently used first
+  std::vector<std::shared_ptr<const LocalOpCallEntry>> op_call_entries_;
 };
 
 }  // namespace one
@@ -32,6 +32,7 @@ limitations under the License.
 #include "oneflow/core/functional/functional.h"
 #include "oneflow/core/graph/op_graph.h"
 #include "oneflow/core/job/compiler.h"
+#include "oneflow/core/job/compiled_plan_cache.h"
 #include "oneflow/core/job/job_build_and_infer_ctx_mgr.h"
 #include "oneflow/core/job/job_desc.h"
 #include "oneflow/core/job/job_instance.h"
@@ -343,6 +344,15 @@ Maybe<void> NNGraph::CompleteLogicalGraphForRuntime() {
   auto compile_tc = std::make_unique<CostCounter<std::chrono::seconds>>(true, true);
   // A global variable to get graph configurations.
   auto current_graph_config = std::make_unique<GlobalJobDescScope>(job_.job_conf(), job_id());
+  // Only the master compiles the plan, so only the master consults the plan cache.
+  if (GlobalProcessCtx::IsThisProcessMaster() && CompiledPlanCache::IsEnabled()) {
+    plan_cache_key_ = *JUST(CompiledPlanCache::MakeKey(job_, job_id(), variable_op_names_));
+    plan_cache_hit_ = JUST(CompiledPlanCache::TryLoad(name_, plan_cache_key_, &job_, &plan_));
+    if (plan_cache_hit_) {
+      compile_tc->Count("[GraphCompile]" + name_ + " LoadPlanCache", 0);
+      return Maybe<void>::Ok();
+    }
+  }
   // NOTE(chengcheng): do job compeleter for each rank.
   JUST(JobCompleter::Complete(&job_));
   compile_tc->Count("[GraphCompile]" + name_ + " CompleteJob", 0);
@@ -408,7 +418,7 @@ Maybe<void> NNGraph::CompilePlanForRuntime() {
   auto compile_tc = std::make_unique<CostCounter<std::chrono::seconds>>(true, true);
   // A global variable to get graph configurations.
   auto current_graph_config = std::make_unique<GlobalJobDescScope>(job_.job_conf(), job_id());
-  if (GlobalProcessCtx::IsThisProcessMaster()) {
+  if (GlobalProcessCtx::IsThisProcessMaster() && !plan_cache_hit_) {
     // TODO(chengcheng): new memory reused by chunk
     Compiler().Compile(&job_, &plan_);
     auto sub_compile_tc = std::make_unique<CostCounter<std::chrono::seconds>>(true, true);
@@ -431,6 +441,10 @@ Maybe<void> NNGraph::CompilePlanForRuntime() {
       PlanUtil::GenLightPlan(&plan_, name_);
     }
     sub_compile_tc->Count("[GraphCompile]" + name_ + " GenMemAndLightPlanLog", 1, true);
+    if (!plan_cache_key_.empty()) {
+      JUST(CompiledPlanCache::Store(name_, plan_cache_key_, job_, plan_));
+      sub_compile_tc->Count("[GraphCompile]" + name_ + " StorePlanCache", 1, true);
+    }
   }
   compile_tc->Count("[GraphCompile]" + name_ + " CompilePlan", 0);
   if (GlobalProcessCtx::WorldSize() > 1) {
@@ -40,6 +40,7 @@ class NNGraph final : public NNGraphIf {
         job_(job),
         job_id_(job_id),
         session_ctx_(session_ctx),
+        plan_cache_hit_(false),
         runtime_inited_(false),
         is_closed_(false) {}
   explicit NNGraph(const std::string& name, const Plan& plan, int64_t job_id,
@@ -48,6 +49,7 @@ class NNGraph final : public NNGraphIf {
         job_id_(job_id),
         session_ctx_(session_ctx),
         plan_(plan),
+        plan_cache_hit_(false),
         runtime_inited_(false),
         is_closed_(false) {}
   OF_DISALLOW_COPY_AND_MOVE(NNGraph);
@@ -133,6 +135,9 @@ class NNGraph final : public NNGraphIf {
   HashSet<std::string> variable_op_names_;
   std::shared_ptr<vm::EagerBlobObjectList> variable_op_blobs_;
   Plan plan_;
+  // Key of this job in the compiled plan cache, empty when the cache is not used.
+  std::string plan_cache_key_;
+  bool plan_cache_hit_;
   // TODO(chengcheng): temp impl using runtime now, need reimplement for dynamic multi nn.Graph.
   std::unique_ptr<Runtime> runtime_;
   bool runtime_inited_;
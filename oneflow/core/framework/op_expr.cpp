@@ -111,6 +111,7 @@ Maybe<void> BuiltinOpExprImpl<UserOpConf>::BuildOpConf(OperatorConf* op_conf,
 }
 
 Maybe<StatefulOpKernel> UserOpExpr::MutKernel4Stream(Symbol<Stream> stream) const {
+  std::unique_lock<std::mutex> lock(stream2kernel_mutex_);
   const auto& it = stream2kernel_.find(stream);
   if (it != stream2kernel_.end()) { return it->second; }
 
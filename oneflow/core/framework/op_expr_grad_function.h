@@ -37,6 +37,8 @@ class AutoGradCaptureState {
   void unpack();
 
   const TensorTuple& SavedTensors() const { return saved_tensors_; }
+  // Whether the saved tensors are packed by hooks and have not been unpacked yet.
+  bool HasSavedTensorHooks() const { return !hooks_.empty(); }
 
   size_t SaveTensorForBackward(const std::shared_ptr<Tensor>& tensor);
 
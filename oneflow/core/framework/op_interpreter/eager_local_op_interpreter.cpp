@@ -76,12 +76,10 @@ Maybe<void> NaiveInterpret(const UserOpExpr& user_op_expr, const TensorTuple& in
   OF_PROFILER_RANGE_GUARD("NaiveInterpret");
   CHECK_EQ_OR_RETURN(outputs->size(), user_op_expr.output_size());  // NOLINT
   Symbol<Device> default_device = JUST(GetDefaultDevice(inputs, ctx));
-  const std::shared_ptr<const LocalTensorInferResult> result =
-      JUST([&]() -> Maybe<const LocalTensorInferResult> {
-        LocalTensorMetaInferArgs infer_args;
-        JUST(infer_args.Init(ctx.attrs, default_device, inputs));
-        return JUST(user_op_expr.mut_local_tensor_infer_cache()->GetOrInfer(infer_args));
-      }());
+  const std::shared_ptr<const LocalOpCallEntry> op_call =
+      JUST(user_op_expr.mut_local_tensor_infer_cache()->GetOrInferOpCall(ctx.attrs, default_device,
+                                                                         inputs));
+  const std::shared_ptr<const LocalTensorInferResult>& result = op_call->result;
 
   vm::EagerBlobObjectList input_eager_blob_objects(inputs.size());
   for (int i = 0; i < inputs.size(); i++) {
@@ -93,6 +91,7 @@ Maybe<void> NaiveInterpret(const UserOpExpr& user_op_expr, const TensorTuple& in
 
   const auto& kernel = JUST(user_op_expr.MutKernel4Stream(result->stream()));
 
+  bool has_inplace_output = false;
   for (int i = 0; i < outputs->size(); i++) {
     if (!outputs->at(i)) {
       // NOTE: if op support stride(non-contiguous input), then output tensor's stride
@@ -127,6 +126,7 @@ Maybe<void> NaiveInterpret(const UserOpExpr& user_op_expr, const TensorTuple& in
           << Error::RuntimeError() << DataType_Name(tensor_impl->tensor_meta()->dtype())  // NOLINT
           << " .vs "                                                                      // NOLINT
           << DataType_Name(output_tensor_metas.at(i)->dtype());                           // NOLINT
+      has_inplace_output = true;
       bool has_eager_blob_object = JUST(outputs->at(i)->has_eager_blob_object());
       CHECK_OR_RETURN(has_eager_blob_object);  // NOLINT
       output_eager_blob_objects.at(i) = JUST(outputs->at(i)->eager_blob_object());
@@ -136,9 +136,16 @@ Maybe<void> NaiveInterpret(const UserOpExpr& user_op_expr, const TensorTuple& in
     }
   }
 
+  // NOTE: The kernel choice and the temp size only depend on the inline cache key if the output
+  // metas are the inferred ones, i.e. no output is inplaced or reshaped by the kernel.
+  std::shared_ptr<vm::OpCallKernelMemo> kernel_memo;
+  if (!has_inplace_output && kernel->output_tuple_indexes4mut2_obns().empty()) {
+    kernel_memo = op_call->kernel_memo;
+  }
   JUST(PhysicalRun([&](InstructionsBuilder* builder) -> Maybe<void> {
     return builder->Call(kernel, std::move(input_eager_blob_objects),
-                         std::move(output_eager_blob_objects), ctx, result->stream());
+                         std::move(output_eager_blob_objects), ctx, result->stream(),
+                         kernel_memo);
   }));
   for (int64_t index : kernel->output_tuple_indexes4mut2_obns()) {
     const auto* tensor_impl = JUST(TensorImpl4Tensor(outputs->at(index)));
@@ -108,6 +108,17 @@ Maybe<void> AutogradInterpreter::Apply(const OpExpr& op_expr, const TensorTuple&
       return Maybe<void>::Ok();
     };
     backward_fn->status = [=]() { return grad_closure->state()->SavedTensors().size() > 0; };
+    backward_fn->saved_tensor_num = [=]() { return grad_closure->state()->SavedTensors().size(); };
+    // The backward of a custom autograd function and the saved tensor hooks are python code. The
+    // backward of an op touching a global tensor, e.g. local_to_global, may launch collectives,
+    // which must be issued in the same order on all ranks.
+    const auto IsLocal = [](const std::shared_ptr<Tensor>& tensor) { return tensor->is_local(); };
+    const bool is_local_builtin_op = !dynamic_cast<const FunctionOpExpr*>(&op_expr)
+                                     && std::all_of(inputs.begin(), inputs.end(), IsLocal)
+                                     && std::all_of(outputs->begin(), outputs->end(), IsLocal);
+    backward_fn->thread_safe = [=]() {
+      return is_local_builtin_op && !grad_closure->state()->HasSavedTensorHooks();
+    };
     OF_PROFILER_RANGE_POP();
     OF_PROFILER_RANGE_PUSH("autograd.AddNode");
     JUST(GetThreadLocalAutogradEngine()->AddNode(op_expr.op_type_name() + "_backward", backward_fn,
@@ -53,6 +53,11 @@ class StreamGuard final {
     return JUST(Current())->TryConvertStream(stream);
   }
 
+  // nullptr if no StreamGuard is alive on this thread.
+  static std::shared_ptr<StreamConverter> CurrentStreamConverter() {
+    return Current().value_or(std::shared_ptr<StreamConverter>());
+  }
+
  private:
   static const Optional<StreamConverter>& Current() { return *MutCurrent(); }
   static Optional<StreamConverter>* MutCurrent();
@@ -49,4 +49,30 @@ StreamIndexGenerator::stream_index_t StreamIndexGenerator::GenerateNamedRoundRob
   return cur_stream_index;
 }
 
+void StreamIndexGenerator::DumpState(StreamIndexGeneratorStateProto* state) {
+  std::unique_lock<std::mutex> lck(mtx_);
+  state->set_next_stream_index(next_stream_index_);
+  std::map<std::string, const RoundRobinRange*> sorted_name2rr_range;
+  for (const auto& pair : name2rr_range_) {
+    sorted_name2rr_range.emplace(pair.first, &pair.second);
+  }
+  for (const auto& pair : sorted_name2rr_range) {
+    NamedStreamIndexRangeProto* range = state->add_named_range();
+    range->set_name(pair.first);
+    range->set_begin(pair.second->begin);
+    range->set_size(pair.second->size);
+    range->set_offset(pair.second->offset);
+  }
+}
+
+void StreamIndexGenerator::LoadState(const StreamIndexGeneratorStateProto& state) {
+  std::unique_lock<std::mutex> lck(mtx_);
+  next_stream_index_ = state.next_stream_index();
+  name2rr_range_.clear();
+  for (const auto& range : state.named_range()) {
+    auto it = name2rr_range_.emplace(range.name(), RoundRobinRange{range.begin(), range.size()});
+    it.first->second.offset = range.offset();
+  }
+}
+
 }  // namespace oneflow
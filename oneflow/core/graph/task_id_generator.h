@@ -17,6 +17,7 @@ limitations under the License.
 #define ONEFLOW_CORE_GRAPH_TASK_ID_GENERATOR_H_
 
 #include "oneflow/core/graph/task_id.h"
+#include "oneflow/core/job/id_state.pb.h"
 
 namespace oneflow {
 
@@ -30,6 +31,9 @@ class TaskIdGenerator final {
 
   TaskId Generate(const StreamId& stream_id);
 
+  void DumpState(IdStateProto* id_state) const;
+  void LoadState(const IdStateProto& id_state);
+
  private:
   HashMap<StreamId, task_index_t> stream_id2task_index_counter_;
 };
@@ -39,6 +43,26 @@ inline TaskId TaskIdGenerator::Generate(const StreamId& stream_id) {
   return TaskId{stream_id, task_index};
 }
 
+inline void TaskIdGenerator::DumpState(IdStateProto* id_state) const {
+  std::map<int64_t, int64_t> stream_id2task_index;
+  for (const auto& pair : stream_id2task_index_counter_) {
+    stream_id2task_index.emplace(EncodeStreamIdToInt64(pair.first), pair.second);
+  }
+  for (const auto& pair : stream_id2task_index) {
+    TaskIndexCounterProto* counter = id_state->add_task_index_counter();
+    counter->set_stream_id(pair.first);
+    counter->set_task_index(pair.second);
+  }
+}
+
+inline void TaskIdGenerator::LoadState(const IdStateProto& id_state) {
+  stream_id2task_index_counter_.clear();
+  for (const auto& counter : id_state.task_index_counter()) {
+    stream_id2task_index_counter_[DecodeStreamIdFromInt64(counter.stream_id())] =
+        counter.task_index();
+  }
+}
+
 }  // namespace oneflow
 
 #endif  // ONEFLOW_CORE_GRAPH_TASK_ID_GENERATOR_H_
@@ -48,6 +48,30 @@ TaskStreamIndexManager::stream_index_t TaskStreamIndexManager::GetNamedTaskStrea
   return generator->GenerateNamed(name);
 }
 
+void TaskStreamIndexManager::DumpState(IdStateProto* id_state) {
+  std::unique_lock<std::mutex> lck(mtx_);
+  std::map<int64_t, StreamIndexGenerator*> device_stream_id2generator;
+  for (const auto& pair : generators_) {
+    device_stream_id2generator.emplace(EncodeStreamIdToInt64(StreamId{pair.first, 0}),
+                                       pair.second.get());
+  }
+  for (const auto& pair : device_stream_id2generator) {
+    StreamIndexGeneratorStateProto* state = id_state->add_stream_index_generator();
+    state->set_device_stream_id(pair.first);
+    pair.second->DumpState(state);
+  }
+}
+
+void TaskStreamIndexManager::LoadState(const IdStateProto& id_state) {
+  std::unique_lock<std::mutex> lck(mtx_);
+  generators_.clear();
+  for (const auto& state : id_state.stream_index_generator()) {
+    const DeviceId device_id = DecodeStreamIdFromInt64(state.device_stream_id()).device_id();
+    auto it = generators_.emplace(device_id, std::make_unique<StreamIndexGenerator>()).first;
+    it->second->LoadState(state);
+  }
+}
+
 void TaskStreamIndexGetterRegistry::Register(const key_t& key, const stream_index_getter& getter) {
   bool insert_success = stream_index_getter_map_.emplace(key, getter).second;
   if (!insert_success) {
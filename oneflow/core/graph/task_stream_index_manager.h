@@ -34,6 +34,9 @@ class TaskStreamIndexManager final {
   stream_index_t GetComputeTaskStreamIndex(const DeviceId& device_id);
   stream_index_t GetNamedTaskStreamIndex(const DeviceId& device_id, const std::string& name);
 
+  void DumpState(IdStateProto* id_state);
+  void LoadState(const IdStateProto& id_state);
+
  private:
   HashMap<DeviceId, std::unique_ptr<StreamIndexGenerator>> generators_;
   std::mutex mtx_;
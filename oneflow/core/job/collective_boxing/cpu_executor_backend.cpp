@@ -0,0 +1,317 @@
+/*
+Copyright 2020 The OneFlow Authors. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "oneflow/core/job/collective_boxing/cpu_executor_backend.h"
+#include "oneflow/core/job/collective_boxing/request_store.h"
+#include "oneflow/core/graph/boxing/collective_boxing_util.h"
+#include "oneflow/core/job/resource_desc.h"
+#include "oneflow/core/job/global_for.h"
+#include "oneflow/core/job/parallel_desc.h"
+#include "oneflow/core/common/channel.h"
+#include "oneflow/core/common/data_type.h"
+#include "oneflow/core/thread/thread_global_id.h"
+#include "oneflow/core/ep/include/device_manager_registry.h"
+#include "oneflow/user/kernels/collective_communication/include/all_reduce.h"
+
+#include <cstring>
+#include <map>
+#include <memory>
+#include <thread>
+#include <utility>
+
+namespace oneflow {
+
+namespace boxing {
+
+namespace collective {
+
+namespace {
+
+constexpr int64_t kFusionAlignSize = 64;
+
+int64_t GetFusionAlignedSize(int64_t size) {
+  return ((size + kFusionAlignSize - 1) / kFusionAlignSize) * kFusionAlignSize;
+}
+
+ccl::ReduceType GetCclReduceType(ReduceMethod reduce_method) {
+  if (reduce_method == kReduceMethodSum) {
+    return ccl::kSum;
+  } else {
+    UNIMPLEMENTED();
+    return ccl::kInvalidReduceFunctorType;
+  }
+}
+
+Symbol<ParallelDesc> GetParallelDesc(const DeviceSet& device_set) {
+  ParallelConf parallel_conf;
+  parallel_conf.set_device_tag(*CHECK_JUST(DeviceTag4DeviceType(DeviceType::kCPU)));
+  for (const DeviceDesc& device : device_set.device()) {
+    CHECK_EQ(device.device_type(), DeviceType::kCPU);
+    parallel_conf.add_device_name(std::to_string(device.machine_id()) + ":"
+                                  + std::to_string(device.device_id()));
+  }
+  return SymbolOf(ParallelDesc(parallel_conf));
+}
+
+// All groups of a process run on one thread, in the order the coordinator hands them out, which
+// is the same on every rank. Transport tokens are bound to the id of the thread that created
+// them, so the thread gets its own global id and never races with eager collectives.
+class CommThread final {
+ public:
+  OF_DISALLOW_COPY_AND_MOVE(CommThread);
+  CommThread() : thread_(&CommThread::Loop, this) {}
+  ~CommThread() {
+    chan_.Close();
+    thread_.join();
+  }
+
+  void Enqueue(std::function<void()>&& task) {
+    CHECK_EQ(chan_.Send(std::move(task)), kChannelStatusSuccess);
+  }
+
+ private:
+  void Loop() {
+    ThreadGlobalIdGuard guard(kThreadGlobalIdCollectiveBoxing);
+    while (true) {
+      std::function<void()> task;
+      ChannelStatus status = chan_.Receive(&task);
+      if (status == kChannelStatusErrorClosed) { break; }
+      CHECK_EQ(status, kChannelStatusSuccess);
+      task();
+    }
+  }
+
+  Channel<std::function<void()>> chan_;
+  std::thread thread_;
+};
+
+struct CommGroup {
+  Symbol<ParallelDesc> parallel_desc;
+  std::shared_ptr<ccl::CommunicationContext> communication_ctx;
+};
+
+}  // namespace
+
+struct CpuExecutorBackend::Impl {
+  Impl(const CollectiveBoxingConf& conf, std::shared_ptr<RequestStore> request_store)
+      : conf(conf), request_store(std::move(request_store)) {
+    CHECK_GE(conf.cpu_fusion_threshold_mb(), 0);
+    CHECK_GT(conf.cpu_fusion_max_ops(), 0);
+    fusion_threshold = conf.cpu_fusion_threshold_mb() * 1024 * 1024;
+    device = Singleton<ep::DeviceManagerRegistry>::Get()->GetDevice(DeviceType::kCPU, 0);
+    stream = device->CreateStream();
+    comm_thread = std::make_unique<CommThread>();
+  }
+  ~Impl() {
+    comm_thread.reset();
+    device->DestroyStream(stream);
+  }
+
+  void InitCommGroup(int64_t job_id) {
+    request_store->ForEachMutRequestEntryInJob(
+        job_id, [&](RequestEntry* request_entry, int32_t i, const RequestId& request_id) {
+          const auto& request = request_entry->desc();
+          if (request.op_desc().backend() != Backend::kBackendCPU) { return; }
+          if (!request_entry->HasRankOnThisNode()) { return; }
+          CHECK_EQ(request_entry->LocalRankCount(), 1)
+              << "CPU collective boxing expects one rank per process";
+          CHECK_EQ(request.op_desc().op_type(), OpType::kOpTypeAllReduce)
+              << "CPU collective boxing only supports all-reduce";
+          const DeviceSet& device_set = request.device_set();
+          if (device_set2comm_group.count(device_set) > 0) { return; }
+          CommGroup& comm_group = device_set2comm_group[device_set];
+          comm_group.parallel_desc = GetParallelDesc(device_set);
+          comm_group.communication_ctx =
+              ccl::NewCommunicationContext(DeviceType::kCPU, comm_group.parallel_desc);
+        });
+  }
+
+  bool CanRequestEntryFuse(const RequestEntry* lhs, const RequestEntry* rhs) const {
+    if (lhs->device_set_symbol() != rhs->device_set_symbol()) { return false; }
+    const OpDesc& lhs_op_desc = lhs->desc().op_desc();
+    const OpDesc& rhs_op_desc = rhs->desc().op_desc();
+    return lhs_op_desc.op_type() == OpType::kOpTypeAllReduce
+           && rhs_op_desc.op_type() == OpType::kOpTypeAllReduce
+           && lhs_op_desc.reduce_method() == rhs_op_desc.reduce_method()
+           && lhs_op_desc.data_type() == rhs_op_desc.data_type();
+  }
+
+  void GroupRequests(const std::vector<RequestId>& request_ids,
+                     const std::function<void(std::vector<RequestId>&&, void*)>& Handler) {
+    std::vector<RequestId> group;
+    int64_t group_size = 0;
+    request_store->ForEachMutRequestEntryForIdsInJob(
+        request_ids, [&](RequestEntry* request_entry, int32_t i, const RequestId& request_id) {
+          const int64_t size = GetFusionAlignedSize(request_entry->size_in_bytes());
+          if (group.empty()
+              || !CanRequestEntryFuse(request_store->MutRequestEntry(group.back()), request_entry)
+              || group_size + size > fusion_threshold
+              || group.size() >= conf.cpu_fusion_max_ops()) {
+            if (!group.empty()) {
+              void* token = CreateGroupToken(group);
+              Handler(std::move(group), token);
+              group.clear();
+              group_size = 0;
+            }
+          }
+          group.emplace_back(request_id);
+          group_size += size;
+        });
+    if (!group.empty()) {
+      void* token = CreateGroupToken(group);
+      Handler(std::move(group), token);
+    }
+  }
+
+  struct GroupToken {
+    GroupToken(const std::vector<RequestId>& group, const CommGroup* comm_group)
+        : request_ids(group), comm_group(comm_group), fused_size(0) {}
+    std::vector<RequestId> request_ids;
+    const CommGroup* comm_group;
+    DataType data_type;
+    ReduceMethod reduce_method;
+    std::vector<int64_t> elem_cnt_vec;
+    // Offsets into the fusion buffer, only used by groups of more than one request.
+    std::vector<int64_t> offset_vec;
+    int64_t fused_size;
+  };
+
+  void* CreateGroupToken(const std::vector<RequestId>& group) {
+    CHECK_GT(group.size(), 0);
+    const RequestEntry* first_request_entry = request_store->MutRequestEntry(group.front());
+    const DeviceSet& first_device_set = first_request_entry->desc().device_set();
+    auto it = device_set2comm_group.find(first_device_set);
+    CHECK(it != device_set2comm_group.end());
+    auto* token = new GroupToken(group, &it->second);
+    token->data_type = first_request_entry->desc().op_desc().data_type();
+    token->reduce_method = first_request_entry->desc().op_desc().reduce_method();
+    request_store->ForEachMutRequestEntryForIdsInJob(
+        group, [&](RequestEntry* request_entry, int32_t i, const RequestId& request_id) {
+          CHECK(first_device_set == request_entry->desc().device_set());
+          token->elem_cnt_vec.emplace_back(request_entry->elem_cnt());
+          token->offset_vec.emplace_back(token->fused_size);
+          token->fused_size += GetFusionAlignedSize(request_entry->size_in_bytes());
+        });
+    return token;
+  }
+
+  void DestroyGroupToken(void* group_token) {
+    GroupToken* token = static_cast<GroupToken*>(group_token);
+    delete token;
+  }
+
+  ccl::AllReduce* GetAllReduce(DataType data_type, ReduceMethod reduce_method) {
+    auto& all_reduce = key2all_reduce[std::make_pair(data_type, reduce_method)];
+    if (!all_reduce) {
+      all_reduce = ccl::NewCollectiveCommunication<ccl::AllReduce>(
+          DeviceType::kCPU, data_type, GetCclReduceType(reduce_method));
+      CHECK(all_reduce);
+    }
+    return all_reduce.get();
+  }
+
+  // Runs on the communication thread.
+  void LaunchAllReduce(const GroupToken* token,
+                       const std::vector<std::shared_ptr<const RuntimeRequestInfo>>& requests) {
+    ccl::AllReduce* all_reduce = GetAllReduce(token->data_type, token->reduce_method);
+    const auto& communication_ctx = token->comm_group->communication_ctx;
+    if (requests.size() == 1) {
+      all_reduce->Launch(stream, requests.front()->send_buff, requests.front()->recv_buff,
+                         token->elem_cnt_vec.front(), communication_ctx);
+      return;
+    }
+    const int64_t size_of_data_type = GetSizeOfDataType(token->data_type);
+    if (fusion_buffer.size() < token->fused_size) { fusion_buffer.resize(token->fused_size); }
+    char* buffer = fusion_buffer.data();
+    for (size_t i = 0; i < requests.size(); ++i) {
+      const int64_t size = token->elem_cnt_vec.at(i) * size_of_data_type;
+      char* dst = buffer + token->offset_vec.at(i);
+      std::memcpy(dst, requests.at(i)->send_buff, size);
+      // Keeps the padding finite, it is reduced along with the payload.
+      std::memset(dst + size, 0, GetFusionAlignedSize(size) - size);
+    }
+    all_reduce->Launch(stream, buffer, buffer, token->fused_size / size_of_data_type,
+                       communication_ctx);
+    for (size_t i = 0; i < requests.size(); ++i) {
+      std::memcpy(requests.at(i)->recv_buff, buffer + token->offset_vec.at(i),
+                  token->elem_cnt_vec.at(i) * size_of_data_type);
+    }
+  }
+
+  void ExecuteGroup(void* group_token) {
+    const GroupToken* token = static_cast<const GroupToken*>(group_token);
+    if (token->request_ids.empty()) { return; }
+    auto requests = std::make_shared<std::vector<std::shared_ptr<const RuntimeRequestInfo>>>();
+    requests->reserve(token->request_ids.size());
+    request_store->ForEachMutRequestEntryForIdsInJob(
+        token->request_ids,
+        [&](RequestEntry* request_entry, int32_t i, const RequestId& request_id) {
+          requests->emplace_back(std::move(request_entry->ResetRuntimeRequest().front()));
+        });
+    // The token outlives the task, group tokens are only destroyed once the job has finished.
+    comm_thread->Enqueue([this, token, requests]() {
+      LaunchAllReduce(token, *requests);
+      for (const auto& runtime_request_info : *requests) {
+        runtime_request_info->callback(Maybe<void>::Ok());
+      }
+    });
+  }
+
+  CollectiveBoxingConf conf;
+  int64_t fusion_threshold;
+  std::shared_ptr<RequestStore> request_store;
+  HashMap<DeviceSet, CommGroup> device_set2comm_group;
+  std::shared_ptr<ep::Device> device;
+  ep::Stream* stream;
+  // Only touched by the communication thread.
+  std::map<std::pair<DataType, ReduceMethod>, std::unique_ptr<ccl::AllReduce>> key2all_reduce;
+  std::vector<char> fusion_buffer;
+  std::unique_ptr<CommThread> comm_thread;
+};
+
+CpuExecutorBackend::CpuExecutorBackend() = default;
+
+CpuExecutorBackend::~CpuExecutorBackend() = default;
+
+void CpuExecutorBackend::Init(std::shared_ptr<RequestStore> request_store) {
+  impl_ = std::make_unique<Impl>(
+      Singleton<ResourceDesc, ForSession>::Get()->collective_boxing_conf(), request_store);
+}
+
+void CpuExecutorBackend::InitJob(int64_t job_id) { impl_->InitCommGroup(job_id); }
+
+void CpuExecutorBackend::DeinitJob(int64_t job_id) {}
+
+void CpuExecutorBackend::GroupRequests(
+    const std::vector<RequestId>& request_ids,
+    const std::function<void(std::vector<RequestId>&&, void*)>& Handler) {
+  impl_->GroupRequests(request_ids, Handler);
+}
+
+void* CpuExecutorBackend::CreateGroupToken(const std::vector<RequestId>& group) {
+  return impl_->CreateGroupToken(group);
+}
+
+void CpuExecutorBackend::DestroyGroupToken(void* group_token) {
+  return impl_->DestroyGroupToken(group_token);
+}
+
+void CpuExecutorBackend::ExecuteGroup(void* group_token) { impl_->ExecuteGroup(group_token); }
+
+}  // namespace collective
+
+}  // namespace boxing
+
+}  // namespace oneflow
@@ -21,6 +21,7 @@ limitations under the License.
 #include "oneflow/core/graph/boxing/collective_boxing_util.h"
 #include "oneflow/core/job/global_for.h"
 #include "oneflow/core/job/collective_boxing/nccl_executor_backend.h"
+#include "oneflow/core/job/collective_boxing/cpu_executor_backend.h"
 #include "oneflow/core/job/plan.pb.h"
 #include "oneflow/core/job/resource_desc.h"
 #include "oneflow/core/device/cuda_util.h"
@@ -129,20 +130,25 @@ void ExecutorImpl::Init(std::shared_ptr<RequestStore> request_store) {
     backends_.at(Backend::kBackendNCCL) = std::move(nccl_backend);
   }
 #endif
+  const CollectiveBoxingConf conf =
+      Singleton<ResourceDesc, ForSession>::Get()->collective_boxing_conf();
+  if (conf.cpu_enable_collective_boxing()) {
+    std::unique_ptr<ExecutorBackend> cpu_backend = std::make_unique<CpuExecutorBackend>();
+    cpu_backend->Init(request_store_);
+    backends_.at(Backend::kBackendCPU) = std::move(cpu_backend);
+  }
 }
 
 void ExecutorImpl::InitJob(int64_t job_id) {
-#ifdef WITH_CUDA
-  if (backends_.at(Backend::kBackendNCCL)) { backends_.at(Backend::kBackendNCCL)->InitJob(job_id); }
-#endif
+  for (const auto& backend : backends_) {
+    if (backend) { backend->InitJob(job_id); }
+  }
 }
 
 void ExecutorImpl::DeinitJob(int64_t job_id) {
-#ifdef WITH_CUDA
-  if (backends_.at(Backend::kBackendNCCL)) {
-    backends_.at(Backend::kBackendNCCL)->DeinitJob(job_id);
+  for (const auto& backend : backends_) {
+    if (backend) { backend->DeinitJob(job_id); }
   }
-#endif
 }
 
 GroupToken* ExecutorImpl::CreateGroupToken(const std::vector<RequestId>& group,
@@ -151,7 +157,7 @@ GroupToken* ExecutorImpl::CreateGroupToken(const std::vector<RequestId>& group,
 }
 
 void ExecutorImpl::DestroyGroupToken(GroupToken* group_token) {
-  backends_.at(Backend::kBackendNCCL)->DestroyGroupToken(group_token->backend_group_token());
+  backends_.at(group_token->backend())->DestroyGroupToken(group_token->backend_group_token());
   delete group_token;
 }
 
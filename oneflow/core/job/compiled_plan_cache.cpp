@@ -0,0 +1,189 @@
+/*
+Copyright 2020 The OneFlow Authors. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "oneflow/core/job/compiled_plan_cache.h"
+#include "oneflow/core/job/compiled_plan_cache.pb.h"
+#include "oneflow/core/job/id_manager.h"
+#include "oneflow/core/job/resource_desc.h"
+#include "oneflow/core/job/global_for.h"
+#include "oneflow/core/job/version.h"
+#include "oneflow/core/graph/task_stream_index_manager.h"
+#include "oneflow/core/common/env_var/env_var.h"
+#include "oneflow/core/common/protobuf.h"
+#include "oneflow/core/common/str_util.h"
+#include "oneflow/core/control/global_process_ctx.h"
+#include "oneflow/core/persistence/file_system.h"
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+
+extern char** environ;
+
+namespace oneflow {
+
+DEFINE_ENV_BOOL(ONEFLOW_GRAPH_PLAN_CACHE_INVALIDATE, false);
+
+namespace {
+
+constexpr const char* kCacheDirEnvName = "ONEFLOW_GRAPH_PLAN_CACHE_DIR";
+constexpr const char* kEntrySuffix = ".plan";
+
+std::string GetCacheDir() { return GetStringFromEnv(kCacheDirEnvName, ""); }
+
+// Maps are serialized in a stable order, so equal keys always give equal bytes.
+std::string SerializeDeterministically(const PbMessage& message) {
+  std::string bytes;
+  {
+    google::protobuf::io::StringOutputStream string_stream(&bytes);
+    google::protobuf::io::CodedOutputStream coded_stream(&string_stream);
+    coded_stream.SetSerializationDeterministic(true);
+    CHECK(message.SerializeToCodedStream(&coded_stream));
+  }
+  return bytes;
+}
+
+std::string KeyDigest(const std::string& key) {
+  // FNV-1a, the key itself is stored in the entry and compared on load.
+  uint64_t hash = 14695981039346656037ULL;
+  for (const char c : key) {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= 1099511628211ULL;
+  }
+  char digest[17];
+  snprintf(digest, sizeof(digest), "%016llx", static_cast<unsigned long long>(hash));
+  return digest;
+}
+
+std::string EntryPath(const std::string& key) {
+  return JoinPath(GetCacheDir(), KeyDigest(key) + kEntrySuffix);
+}
+
+void DumpIdState(IdStateProto* id_state) {
+  Singleton<IDMgr>::Get()->DumpState(id_state);
+  Singleton<TaskStreamIndexManager>::Get()->DumpState(id_state);
+  id_state->set_unique_id_count(MutUniqueIdCounter()->load());
+}
+
+void LoadIdState(const IdStateProto& id_state) {
+  Singleton<IDMgr>::Get()->LoadState(id_state);
+  Singleton<TaskStreamIndexManager>::Get()->LoadState(id_state);
+  MutUniqueIdCounter()->store(id_state.unique_id_count());
+}
+
+std::vector<std::string> GetOneFlowEnvVars() {
+  std::vector<std::string> env_vars;
+  for (char** env = environ; *env != nullptr; ++env) {
+    const std::string env_var(*env);
+    if (env_var.rfind("ONEFLOW_", 0) != 0) { continue; }
+    // Settings of the cache itself do not change the plan.
+    if (env_var.rfind("ONEFLOW_GRAPH_PLAN_CACHE_", 0) == 0) { continue; }
+    env_vars.emplace_back(env_var);
+  }
+  std::sort(env_vars.begin(), env_vars.end());
+  return env_vars;
+}
+
+}  // namespace
+
+bool CompiledPlanCache::IsEnabled() { return !GetCacheDir().empty(); }
+
+Maybe<std::string> CompiledPlanCache::MakeKey(const Job& job, int64_t job_id,
+                                              const HashSet<std::string>& variable_op_names) {
+  CompiledPlanCacheKey key;
+  key.set_version(GetOneFlowGitVersion());
+  key.set_job_id(job_id);
+  key.set_world_size(GlobalProcessCtx::WorldSize());
+  key.set_num_process_per_node(GlobalProcessCtx::NumOfProcessPerNode());
+  *key.mutable_resource() = JUST(SingletonMaybe<ResourceDesc, ForSession>())->resource();
+  for (const auto& env_var : GetOneFlowEnvVars()) { key.add_env(env_var); }
+  std::vector<std::string> sorted_variable_op_names(variable_op_names.begin(),
+                                                    variable_op_names.end());
+  std::sort(sorted_variable_op_names.begin(), sorted_variable_op_names.end());
+  for (const auto& name : sorted_variable_op_names) { key.add_variable_op_name(name); }
+  DumpIdState(key.mutable_id_state());
+  *key.mutable_job() = job;
+  return SerializeDeterministically(key);
+}
+
+Maybe<bool> CompiledPlanCache::TryLoad(const std::string& graph_name, const std::string& key,
+                                       Job* job, Plan* plan) {
+  CHECK_OR_RETURN(IsEnabled());
+  const std::string path = EntryPath(key);
+  if (EnvBool<ONEFLOW_GRAPH_PLAN_CACHE_INVALIDATE>()) {
+    LOG(INFO) << "[GraphCompile]" << graph_name << " plan cache invalidated, entry " << path;
+    return false;
+  }
+  if (!LocalFS()->FileExists(path)) {
+    LOG(INFO) << "[GraphCompile]" << graph_name << " plan cache miss, entry " << path;
+    return false;
+  }
+  CompiledPlanCacheEntry entry;
+  if (!TryParseProtoFromPbFile(path, &entry)) {
+    LOG(WARNING) << "[GraphCompile]" << graph_name << " plan cache entry " << path
+                 << " is corrupted and will be rewritten";
+    return false;
+  }
+  if (SerializeDeterministically(entry.key()) != key) {
+    LOG(INFO) << "[GraphCompile]" << graph_name << " plan cache miss, entry " << path
+              << " belongs to another key";
+    return false;
+  }
+  *job = std::move(*entry.mutable_job());
+  *plan = std::move(*entry.mutable_plan());
+  LoadIdState(entry.id_state());
+  LOG(INFO) << "[GraphCompile]" << graph_name << " plan cache hit, entry " << path;
+  return true;
+}
+
+Maybe<void> CompiledPlanCache::Store(const std::string& graph_name, const std::string& key,
+                                     const Job& job, const Plan& plan) {
+  CHECK_OR_RETURN(IsEnabled());
+  CompiledPlanCacheEntry entry;
+  CHECK_OR_RETURN(entry.mutable_key()->ParseFromString(key));
+  *entry.mutable_job() = job;
+  *entry.mutable_plan() = plan;
+  DumpIdState(entry.mutable_id_state());
+  LocalFS()->RecursivelyCreateDirIfNotExist(GetCacheDir());
+  const std::string path = EntryPath(key);
+  // Written next to the entry and renamed, so concurrent readers never see a partial file.
+  const std::string tmp_path = path + ".tmp." + std::to_string(getpid());
+  {
+    std::ofstream out_stream(tmp_path, std::ofstream::out | std::ofstream::binary);
+    CHECK_OR_RETURN(entry.SerializeToOstream(&out_stream))
+        << "failed to write plan cache entry " << tmp_path;
+  }
+  LocalFS()->RenameFile(tmp_path, path);
+  LOG(INFO) << "[GraphCompile]" << graph_name << " plan cache stored, entry " << path;
+  return Maybe<void>::Ok();
+}
+
+Maybe<void> CompiledPlanCache::Clear() {
+  CHECK_OR_RETURN(IsEnabled());
+  const std::string cache_dir = GetCacheDir();
+  if (!LocalFS()->IsDirectory(cache_dir)) { return Maybe<void>::Ok(); }
+  const std::string suffix(kEntrySuffix);
+  for (const std::string& file_name : LocalFS()->ListDir(cache_dir)) {
+    if (file_name.size() < suffix.size()
+        || file_name.compare(file_name.size() - suffix.size(), suffix.size(), suffix) != 0) {
+      continue;
+    }
+    LocalFS()->DelFile(JoinPath(cache_dir, file_name));
+  }
+  return Maybe<void>::Ok();
+}
+
+}  // namespace oneflow
@@ -0,0 +1,59 @@
+/*
+Copyright 2020 The OneFlow Authors. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef ONEFLOW_CORE_JOB_COMPILED_PLAN_CACHE_H_
+#define ONEFLOW_CORE_JOB_COMPILED_PLAN_CACHE_H_
+
+#include "oneflow/core/common/maybe.h"
+#include "oneflow/core/common/util.h"
+#include "oneflow/core/job/job.pb.h"
+#include "oneflow/core/job/plan.pb.h"
+
+namespace oneflow {
+
+// A content addressed on-disk cache of compiled nn.Graph plans, enabled by setting
+// ONEFLOW_GRAPH_PLAN_CACHE_DIR.
+//
+// An entry is keyed by everything plan compilation depends on: the logical job, the job id, the
+// variable op names, the resource and process layout, the OneFlow version, the ONEFLOW_*
+// environment variables and the state of the process wide id generators. Besides the completed
+// job and the final plan (which carries the memory block and chunk layout), an entry stores the id
+// generator state after compilation, so a later graph compiled in the same process gets the same
+// ids as it would have without the cache.
+//
+// Set ONEFLOW_GRAPH_PLAN_CACHE_INVALIDATE=1 to ignore and overwrite existing entries, or call
+// Clear to drop all of them.
+class CompiledPlanCache final {
+ public:
+  OF_DISALLOW_COPY_AND_MOVE(CompiledPlanCache);
+  CompiledPlanCache() = delete;
+
+  static bool IsEnabled();
+
+  // Builds the key of a logical job before it is completed and compiled into a plan.
+  static Maybe<std::string> MakeKey(const Job& job, int64_t job_id,
+                                    const HashSet<std::string>& variable_op_names);
+
+  // On a hit fills the completed job and the plan, and fast forwards the id generators.
+  static Maybe<bool> TryLoad(const std::string& graph_name, const std::string& key, Job* job,
+                             Plan* plan);
+  static Maybe<void> Store(const std::string& graph_name, const std::string& key, const Job& job,
+                           const Plan& plan);
+  static Maybe<void> Clear();
+};
+
+}  // namespace oneflow
+
+#endif  // ONEFLOW_CORE_JOB_COMPILED_PLAN_CACHE_H_
@@ -74,30 +74,37 @@ void Compiler::Compile(Job* job, Plan* plan) const {
   compile_tc->Count("[GraphCompile]" + job_name + " BuildTaskGraph", 1, true);
 
   // Step3: put infomation from task_gph into plan.
-  const int64_t node_num = task_gph->node_num();
+  // NOTE: ToProto runs in parallel, but the tasks are appended in the graph order so that the
+  // generated plan does not depend on the thread scheduling.
+  std::vector<TaskNode*> task_nodes;
+  task_nodes.reserve(task_gph->node_num());
+  task_gph->ForEachNode([&](TaskNode* task_node) { task_nodes.emplace_back(task_node); });
+  const int64_t node_num = task_nodes.size();
   const int64_t cpu_num = std::thread::hardware_concurrency();
-  const int64_t thread_pool_size = std::min(node_num, cpu_num);
+  const int64_t thread_pool_size = std::max<int64_t>(std::min(node_num, cpu_num), 1);
+  std::vector<std::unique_ptr<TaskProto>> task_protos(node_num);
   BlockingCounter counter(node_num);
-  std::mutex mtx;
   ThreadPool thread_pool(thread_pool_size);
-  task_gph->ForEachNode([&](TaskNode* task_node) {
-    thread_pool.AddWork([task_node, plan, &job_desc, &counter, &mtx]() {
+  FOR_RANGE(int64_t, i, 0, node_num) {
+    thread_pool.AddWork([i, &task_nodes, &task_protos, &counter]() {
+      TaskNode* task_node = task_nodes.at(i);
       if (!task_node->IsMeaningLess()) {
-        TaskProto task_proto;
-        task_node->ToProto(&task_proto);
-        {
-          std::unique_lock<std::mutex> guard(mtx);
-          if (task_node->GetTaskType() == kNormalForward || task_node->GetTaskType() == kRepeat
-              || task_node->GetTaskType() == kAcc) {
-            CreateOpAttributeRef(plan, job_desc.job_id(), &task_proto);
-          }
-          plan->mutable_task()->Add(std::move(task_proto));
-        }  // guard(mtx)
+        task_protos.at(i).reset(new TaskProto());
+        task_node->ToProto(task_protos.at(i).get());
       }
       counter.Decrease();
     } /* thread_pool.AddWork */);
-  } /* task_gph->ForEachNode */);
+  }
   counter.WaitForeverUntilCntEqualZero();
+  FOR_RANGE(int64_t, i, 0, node_num) {
+    if (!task_protos.at(i)) { continue; }
+    const TaskType task_type = task_nodes.at(i)->GetTaskType();
+    if (task_type == kNormalForward || task_type == kRepeat || task_type == kAcc) {
+      CreateOpAttributeRef(plan, job_desc.job_id(), task_protos.at(i).get());
+    }
+    plan->mutable_task()->Add(std::move(*task_protos.at(i)));
+    task_protos.at(i).reset();
+  }
   // NOTE(levi): release task_gph here to decrise memory peak.
   task_gph.reset();
   compile_tc->Count("[GraphCompile]" + job_name + " AddTaskToPlan", 1, true);
@@ -23,4 +23,18 @@ IDMgr::IDMgr() {
   chunk_id_count_ = 0;
 }
 
+void IDMgr::DumpState(IdStateProto* id_state) const {
+  id_state->set_regst_desc_id_count(regst_desc_id_count_);
+  id_state->set_mem_block_id_count(mem_block_id_count_);
+  id_state->set_chunk_id_count(chunk_id_count_);
+  task_id_gen_.DumpState(id_state);
+}
+
+void IDMgr::LoadState(const IdStateProto& id_state) {
+  regst_desc_id_count_ = id_state.regst_desc_id_count();
+  mem_block_id_count_ = id_state.mem_block_id_count();
+  chunk_id_count_ = id_state.chunk_id_count();
+  task_id_gen_.LoadState(id_state);
+}
+
 }  // namespace oneflow
@@ -17,6 +17,7 @@ limitations under the License.
 #include "oneflow/core/control/global_process_ctx.h"
 #include "oneflow/core/job/id_manager.h"
 #include "oneflow/core/job/global_for.h"
+#include "oneflow/core/graph/task_stream_index_manager.h"
 
 namespace oneflow {
 
@@ -72,4 +73,50 @@ TEST(IDMgr, compile_regst_desc_id) {
   Delete();
 }
 
+TEST(IDMgr, dump_and_load_state) {
+  New();
+  Singleton<TaskStreamIndexManager>::New();
+  const DeviceId cpu{0, DeviceType::kCPU, 0};
+  const DeviceId cuda{0, DeviceType::kCUDA, 1};
+  auto* task_stream_index_mgr = Singleton<TaskStreamIndexManager>::Get();
+  const StreamId comm_net{cpu, task_stream_index_mgr->GetNamedTaskStreamIndex(cpu, "COMM_NET")};
+  task_stream_index_mgr->GetNamedTaskStreamIndex(cuda, "NCCL");
+  task_stream_index_mgr->GetGenerator(cpu)->GenerateNamedRoundRobin("CPU_COMPUTE", 3);
+  task_stream_index_mgr->GetGenerator(cpu)->GenerateNamedRoundRobin("CPU_COMPUTE", 3);
+  Singleton<IDMgr>::Get()->NewRegstDescId();
+  Singleton<IDMgr>::Get()->NewMemBlockId();
+  Singleton<IDMgr>::Get()->GetTaskIdGenerator()->Generate(comm_net);
+  IdStateProto state;
+  Singleton<IDMgr>::Get()->DumpState(&state);
+  task_stream_index_mgr->DumpState(&state);
+
+  // Keep allocating from the original generators to get the expected ids.
+  const int64_t regst_desc_id = Singleton<IDMgr>::Get()->NewRegstDescId();
+  const int64_t mem_block_id = Singleton<IDMgr>::Get()->NewMemBlockId();
+  const int64_t chunk_id = Singleton<IDMgr>::Get()->NewChunkId();
+  const TaskId task_id = Singleton<IDMgr>::Get()->GetTaskIdGenerator()->Generate(comm_net);
+  const auto cpu_compute = task_stream_index_mgr->GetGenerator(cpu)->GenerateNamedRoundRobin(
+      "CPU_COMPUTE", 3);
+  const auto cuda_anonymous = task_stream_index_mgr->GetGenerator(cuda)->GenerateAnonymous();
+  const auto cuda_nccl = task_stream_index_mgr->GetNamedTaskStreamIndex(cuda, "NCCL");
+
+  Singleton<TaskStreamIndexManager>::Delete();
+  Singleton<IDMgr>::Delete();
+  Singleton<IDMgr>::New();
+  Singleton<TaskStreamIndexManager>::New();
+  task_stream_index_mgr = Singleton<TaskStreamIndexManager>::Get();
+  Singleton<IDMgr>::Get()->LoadState(state);
+  task_stream_index_mgr->LoadState(state);
+  ASSERT_EQ(Singleton<IDMgr>::Get()->NewRegstDescId(), regst_desc_id);
+  ASSERT_EQ(Singleton<IDMgr>::Get()->NewMemBlockId(), mem_block_id);
+  ASSERT_EQ(Singleton<IDMgr>::Get()->NewChunkId(), chunk_id);
+  ASSERT_EQ(Singleton<IDMgr>::Get()->GetTaskIdGenerator()->Generate(comm_net), task_id);
+  ASSERT_EQ(task_stream_index_mgr->GetGenerator(cpu)->GenerateNamedRoundRobin("CPU_COMPUTE", 3),
+            cpu_compute);
+  ASSERT_EQ(task_stream_index_mgr->GetGenerator(cuda)->GenerateAnonymous(), cuda_anonymous);
+  ASSERT_EQ(task_stream_index_mgr->GetNamedTaskStreamIndex(cuda, "NCCL"), cuda_nccl);
+  Singleton<TaskStreamIndexManager>::Delete();
+  Delete();
+}
+
 }  // namespace oneflow
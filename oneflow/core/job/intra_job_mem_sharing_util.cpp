@@ -26,7 +26,7 @@ limitations under the License.
 #include "oneflow/core/job/job_desc.h"
 #include "oneflow/core/job/memory_share_strategy.h"
 #include "oneflow/core/register/runtime_register_desc.h"
-#include "oneflow/core/thread/thread_pool.h"
+#include "oneflow/core/thread/thread_manager.h"
 #include "oneflow/core/graph/task_node.h"
 #include "oneflow/core/job/plan_util.h"
 
@@ -562,73 +562,103 @@ void IntraJobMemSharingUtil::InferMemBlockId4MemReusedRegst(
                             &mem_chain2mem_reused_regsts, &mem_chain2regst_desc_id2reuse_regst_desc,
                             &mem_reused_regst2size);
   if (mem_chain2mem_reused_regsts.empty()) { return; }
-  HashSet<int64_t> mem_chains;
-  for (const auto& pair : mem_chain2mem_reused_regsts) { mem_chains.insert(pair.first); }
+  // NOTE: Mem chains are visited in ascending id order so that the mem block ids are independent
+  // of the hash order and of the thread scheduling.
+  std::vector<int64_t> mem_chains;
+  mem_chains.reserve(mem_chain2mem_reused_regsts.size());
+  for (const auto& pair : mem_chain2mem_reused_regsts) { mem_chains.emplace_back(pair.first); }
+  std::sort(mem_chains.begin(), mem_chains.end());
   // register lifetime
   HashMap<int64_t, HashMap<RegstDescProto*, std::pair<int32_t, int32_t>>> mem_chain2regst2lifetime;
   // info for inplace
   HashMap<int64_t, HashMap<RegstDescProto*, RegstDescProto*>> mem_chain2consumer2inplaced_regst;
   // info for straighten
   HashMap<int64_t, size_t> mem_chain2peak_memory;
+  // The containers are filled before running the threads, which only touch their own mem chain.
+  for (int64_t mem_chain_id : mem_chains) {
+    mem_chain2regst2lifetime[mem_chain_id];
+    mem_chain2consumer2inplaced_regst[mem_chain_id];
+    mem_chain2peak_memory[mem_chain_id] = 0;
+  }
 
-  // step 1: generate regst alloc/free queue AND regst lifetimes
-  for (const auto& pair : mem_chain2mem_reused_regsts) {
+  // step 1: multi-thread generate regst alloc/free queue AND regst lifetimes for each mem chain
+  MultiThreadLoop(mem_chains.size(), [&](size_t i) {
+    const int64_t mem_chain_id = mem_chains.at(i);
     GenRegstAllocFreeTimeLineAndRegstLifetimes(
-        mem_chain2sorted_tasks.at(pair.first), pair.second,
-        mem_chain2regst_desc_id2reuse_regst_desc.at(pair.first), mem_reused_regst2size,
-        &mem_chain2regst2lifetime[pair.first], &mem_chain2consumer2inplaced_regst[pair.first],
-        &mem_chain2peak_memory[pair.first]);
-  }
+        mem_chain2sorted_tasks.at(mem_chain_id), mem_chain2mem_reused_regsts.at(mem_chain_id),
+        mem_chain2regst_desc_id2reuse_regst_desc.at(mem_chain_id), mem_reused_regst2size,
+        &mem_chain2regst2lifetime.at(mem_chain_id),
+        &mem_chain2consumer2inplaced_regst.at(mem_chain_id),
+        &mem_chain2peak_memory.at(mem_chain_id));
+  });
 
   // step 2: multi-thread run several algorithm for each mem chain
   HashMap<int64_t, HashMap<std::pair<MemAllocAlgoType, bool>, MemBlockResultInfo<RegstDescProto*>>>
       mem_chain2algo2result;
   {
-    int64_t work_size = mem_chain2mem_reused_regsts.size() * CountMemAllocAlgoNum();
-    int64_t thread_pool_size = std::min<int64_t>(work_size, std::thread::hardware_concurrency());
-    BlockingCounter counter(work_size);
-    ThreadPool thread_pool(thread_pool_size);
+    struct AlgoWork {
+      int64_t mem_chain_id;
+      MemAllocAlgoType algo_id;
+      bool compact_insert;
+      MemBlockResultInfo<RegstDescProto*>* result;
+    };
+    std::vector<AlgoWork> works;
+    works.reserve(mem_chains.size() * CountMemAllocAlgoNum());
     for (int64_t mem_chain_id : mem_chains) {
       InitAlgo2Result(&mem_chain2algo2result[mem_chain_id]);
+    }
+    for (int64_t mem_chain_id : mem_chains) {
       for (auto& pair : mem_chain2algo2result.at(mem_chain_id)) {
-        MemAllocAlgoType algo_id = pair.first.first;
-        bool compact_insert = pair.first.second;
-        MemBlockResultInfo<RegstDescProto*>* result = &pair.second;
-        thread_pool.AddWork([algo_id, compact_insert, mem_chain_id, &mem_chain2regst2lifetime,
-                             &mem_reused_regst2size, result, &counter]() {
-          SelectAlgorithmGenMemBlockOffset4Regsts(algo_id, compact_insert,
-                                                  mem_chain2regst2lifetime.at(mem_chain_id),
-                                                  mem_reused_regst2size, result);
-          counter.Decrease();
-        });
+        works.emplace_back(AlgoWork{mem_chain_id, pair.first.first, pair.first.second,
+                                    &pair.second});
       }
     }
-    counter.WaitForeverUntilCntEqualZero();
+    MultiThreadLoop(works.size(), [&](size_t i) {
+      const AlgoWork& work = works.at(i);
+      SelectAlgorithmGenMemBlockOffset4Regsts(work.algo_id, work.compact_insert,
+                                              mem_chain2regst2lifetime.at(work.mem_chain_id),
+                                              mem_reused_regst2size, work.result);
+    });
   }
 
-  // step 3: choose best one for each mem chain and set offset for inplace consumer regst
-  for (auto& pair : mem_chain2algo2result) {
+  // step 3: multi-thread choose best one for each mem chain and compress it
+  HashMap<int64_t, MemBlockResultInfo<RegstDescProto*>*> mem_chain2best_result;
+  for (int64_t mem_chain_id : mem_chains) { mem_chain2best_result[mem_chain_id] = nullptr; }
+  const bool enable_compress_memory = GlobalJobDesc().job_conf().enable_compress_memory();
+  MultiThreadLoop(mem_chains.size(), [&](size_t i) {
+    const int64_t mem_chain_id = mem_chains.at(i);
     MemBlockResultInfo<RegstDescProto*>* best_result = nullptr;
-    for (auto& algo_result_pair : pair.second) {
-      if (!best_result || algo_result_pair.second.mem_block_size < best_result->mem_block_size) {
-        best_result = &algo_result_pair.second;
+    std::pair<MemAllocAlgoType, bool> best_algo;
+    for (auto& algo_result_pair : mem_chain2algo2result.at(mem_chain_id)) {
+      MemBlockResultInfo<RegstDescProto*>* result = &algo_result_pair.second;
+      // Ties are broken by the algorithm instead of by the hash order.
+      if (!best_result || result->mem_block_size < best_result->mem_block_size
+          || (result->mem_block_size == best_result->mem_block_size
+              && algo_result_pair.first < best_algo)) {
+        best_result = result;
+        best_algo = algo_result_pair.first;
       }
     }
     CHECK(best_result != nullptr);
 
     // Update the offset with a smaller total memory size if the current size is greater than the
     // lower bound
-    if (GlobalJobDesc().job_conf().enable_compress_memory()) {
+    if (enable_compress_memory) {
       MemoryShareStrategy mss;
-      mss.AdaptivelyUpdateOffset(mem_reused_regst2size, mem_chain2regst2lifetime.at(pair.first),
-                                 mem_chain2peak_memory[pair.first], &best_result->mem_block_size,
-                                 &best_result->regst_desc2offset);
+      mss.AdaptivelyUpdateOffset(mem_reused_regst2size, mem_chain2regst2lifetime.at(mem_chain_id),
+                                 mem_chain2peak_memory.at(mem_chain_id),
+                                 &best_result->mem_block_size, &best_result->regst_desc2offset);
     }
+    mem_chain2best_result.at(mem_chain_id) = best_result;
+  });
 
+  // step 4: set mem block and offset for each mem chain and set offset for inplace consumer regst
+  for (int64_t mem_chain_id : mem_chains) {
+    MemBlockResultInfo<RegstDescProto*>* best_result = mem_chain2best_result.at(mem_chain_id);
     int64_t mem_block_id = Singleton<IDMgr>::Get()->NewMemBlockId();
-    CHECK_EQ(mem_chain2mem_reused_regsts.at(pair.first).size(),
+    CHECK_EQ(mem_chain2mem_reused_regsts.at(mem_chain_id).size(),
              (best_result->regst_desc2offset.size()
-              + mem_chain2consumer2inplaced_regst.at(pair.first).size()));
+              + mem_chain2consumer2inplaced_regst.at(mem_chain_id).size()));
     for (const auto& regst_offset_pair : best_result->regst_desc2offset) {
       RegstDescProto* regst_desc = regst_offset_pair.first;
       CHECK_EQ(regst_desc->mem_block_id(), -1);
@@ -636,7 +666,7 @@ void IntraJobMemSharingUtil::InferMemBlockId4MemReusedRegst(
       regst_desc->set_mem_block_offset(regst_offset_pair.second);
     }
     // set inplace
-    for (auto& consumer_inplace_pair : mem_chain2consumer2inplaced_regst.at(pair.first)) {
+    for (auto& consumer_inplace_pair : mem_chain2consumer2inplaced_regst.at(mem_chain_id)) {
       RegstDescProto* consumer_regst_desc = consumer_inplace_pair.first;
       CHECK_EQ(consumer_regst_desc->mem_block_id(), -1);
       RegstDescProto* inplaced_regst_desc = consumer_inplace_pair.second;
@@ -648,8 +678,8 @@ void IntraJobMemSharingUtil::InferMemBlockId4MemReusedRegst(
 
     // set inplace hint and check
     const auto& regst_desc_id2reuse_regst_desc =
-        mem_chain2regst_desc_id2reuse_regst_desc.at(pair.first);
-    for (auto& consumer_inplace_pair : mem_chain2consumer2inplaced_regst.at(pair.first)) {
+        mem_chain2regst_desc_id2reuse_regst_desc.at(mem_chain_id);
+    for (auto& consumer_inplace_pair : mem_chain2consumer2inplaced_regst.at(mem_chain_id)) {
       RegstDescProto* consumer_regst_desc = consumer_inplace_pair.first;
       RegstDescProto* inplaced_regst_desc = consumer_inplace_pair.second;
       CHECK(consumer_regst_desc->has_inplace_consumed_regst_desc_id() == false);
@@ -0,0 +1,180 @@
+/*
+Copyright 2020 The OneFlow Authors. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include <chrono>
+#include <iostream>
+#include "gtest/gtest.h"
+#include "oneflow/core/control/global_process_ctx.h"
+#include "oneflow/core/graph/stream_id.h"
+#include "oneflow/core/job/global_for.h"
+#include "oneflow/core/job/id_manager.h"
+#include "oneflow/core/job/intra_job_mem_sharing_util.h"
+#include "oneflow/core/job/job_desc.h"
+#include "oneflow/core/job/resource_desc.h"
+
+namespace oneflow {
+
+namespace {
+
+EnvProto GetEnvProto() {
+  EnvProto ret;
+  auto* machine = ret.add_machine();
+  machine->set_id(0);
+  machine->set_addr("127.0.0.1");
+  ret.set_ctrl_port(9527);
+  return ret;
+}
+
+void New(bool enable_compress_memory) {
+  Singleton<EnvDesc>::New(GetEnvProto());
+  Singleton<ProcessCtx>::New();
+  Singleton<ProcessCtx>::Get()->mutable_ctrl_addr()->Add();
+  Singleton<ProcessCtx>::Get()->set_rank(0);
+  Singleton<ProcessCtx>::Get()->set_node_size(1);
+  Resource resource;
+  resource.set_machine_num(1);
+  resource.set_cpu_device_num(1);
+  Singleton<ResourceDesc, ForSession>::New(resource, GlobalProcessCtx::NumOfProcessPerNode());
+  Singleton<IDMgr>::New();
+  JobConfigProto job_conf;
+  job_conf.set_job_name("mem_sharing_test");
+  job_conf.mutable_predict_conf();
+  job_conf.set_enable_compress_memory(enable_compress_memory);
+  auto* algo_conf = job_conf.mutable_memory_allocation_algorithm_conf();
+  algo_conf->set_use_mem_size_first_algo(true);
+  algo_conf->set_use_lifetime_first_algo(true);
+  algo_conf->set_use_time_line_algo(true);
+  algo_conf->set_use_mem_volume_first_algo(true);
+  job_conf.mutable_memory_compact_insert_conf()->set_use_compact_insert(true);
+  Singleton<JobDesc>::New(job_conf, 0);
+}
+
+void Delete() {
+  Singleton<JobDesc>::Delete();
+  Singleton<IDMgr>::Delete();
+  Singleton<ResourceDesc, ForSession>::Delete();
+  Singleton<ProcessCtx>::Delete();
+  Singleton<EnvDesc>::Delete();
+}
+
+// A synthetic plan with device_num cuda devices, each device has chain_num mem chains and each
+// chain has task_num tasks. The data regst of a task is consumed by the next two tasks.
+Plan GenSyntheticPlan(int64_t device_num, int64_t chain_num, int64_t task_num) {
+  Plan plan;
+  int64_t task_id = 0;
+  int64_t regst_desc_id = 0;
+  for (int64_t device_id = 0; device_id < device_num; ++device_id) {
+    const int64_t thrd_id = EncodeStreamIdToInt64(StreamId(0, DeviceType::kCUDA, device_id, 0));
+    int64_t order_in_graph = 0;
+    for (int64_t chain_id = 0; chain_id < chain_num; ++chain_id) {
+      const int64_t first_task_id = task_id;
+      for (int64_t i = 0; i < task_num; ++i) {
+        TaskProto* task = plan.add_task();
+        task->set_task_type(TaskType::kNormalForward);
+        task->set_machine_id(0);
+        task->set_thrd_id(thrd_id);
+        task->set_task_id(task_id);
+        task->set_job_id(0);
+        task->mutable_task_set_info()->set_chain_id(chain_id);
+        task->mutable_task_set_info()->set_order_in_graph(order_in_graph++);
+        RegstDescProto* regst = &(*task->mutable_produced_regst_desc())["out"];
+        regst->set_regst_desc_id(regst_desc_id++);
+        regst->set_producer_task_id(task_id);
+        for (int64_t consumer = i + 1; consumer < std::min(i + 3, task_num); ++consumer) {
+          regst->add_consumer_task_id(first_task_id + consumer);
+        }
+        regst->set_min_register_num(1);
+        regst->set_max_register_num(1);
+        regst->set_register_num(1);
+        regst->mutable_mem_case()->set_device_type(DeviceType::kCUDA);
+        regst->mutable_mem_case()->set_device_id(device_id);
+        regst->set_enable_reuse_mem(true);
+        regst->set_mem_block_id(-1);
+        regst->set_mem_block_offset(-1);
+        DataRegstDesc* data_regst_desc = regst->mutable_regst_desc_type()->mutable_data_regst_desc();
+        data_regst_desc->mutable_time_shape()->add_dim(1);
+        data_regst_desc->mutable_time_shape()->add_dim(1);
+        LbiBlobDescPair* pair = data_regst_desc->add_lbi2blob_desc();
+        pair->mutable_lbi()->set_op_name("op_" + std::to_string(task_id));
+        pair->mutable_lbi()->set_blob_name("out");
+        BlobDescProto* blob_desc = pair->mutable_blob_desc();
+        // Sizes vary so that the algorithms do not agree on every chain.
+        blob_desc->mutable_shape()->add_dim(1024 * (1 + (task_id * 7 + chain_id) % 13));
+        blob_desc->mutable_stride()->add_dim(1);
+        blob_desc->set_data_type(DataType::kFloat);
+        blob_desc->set_is_dynamic(false);
+        ++task_id;
+      }
+    }
+  }
+  return plan;
+}
+
+Plan InferMemBlockId(const Plan& synthetic_plan, bool enable_compress_memory, double* seconds) {
+  New(enable_compress_memory);
+  Plan plan = synthetic_plan;
+  auto start = std::chrono::steady_clock::now();
+  IntraJobMemSharingUtil::InferMemBlockId4MemReusedRegst(
+      &plan, [](const std::string&, const std::string&) { return false; });
+  *seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  Delete();
+  return plan;
+}
+
+void CheckSamePlan(const Plan& lhs, const Plan& rhs) {
+  ASSERT_EQ(lhs.task_size(), rhs.task_size());
+  for (int64_t i = 0; i < lhs.task_size(); ++i) {
+    const RegstDescProto& lhs_regst = lhs.task(i).produced_regst_desc().at("out");
+    const RegstDescProto& rhs_regst = rhs.task(i).produced_regst_desc().at("out");
+    ASSERT_NE(lhs_regst.mem_block_id(), -1);
+    ASSERT_NE(lhs_regst.mem_block_offset(), -1);
+    ASSERT_EQ(lhs_regst.mem_block_id(), rhs_regst.mem_block_id());
+    ASSERT_EQ(lhs_regst.mem_block_offset(), rhs_regst.mem_block_offset());
+  }
+}
+
+}  // namespace
+
+TEST(IntraJobMemSharingUtil, deterministic_mem_block) {
+  const Plan plan = GenSyntheticPlan(4, 8, 64);
+  double seconds = 0;
+  const Plan first = InferMemBlockId(plan, false, &seconds);
+  for (int i = 0; i < 3; ++i) { CheckSamePlan(first, InferMemBlockId(plan, false, &seconds)); }
+  // One mem block per mem chain and the ids follow the mem chain order.
+  HashSet<int64_t> mem_block_ids;
+  for (const auto& task : first.task()) {
+    mem_block_ids.insert(task.produced_regst_desc().at("out").mem_block_id());
+  }
+  ASSERT_EQ(mem_block_ids.size(), 4 * 8);
+}
+
+TEST(IntraJobMemSharingUtil, deterministic_compressed_mem_block) {
+  const Plan plan = GenSyntheticPlan(2, 4, 32);
+  double seconds = 0;
+  const Plan first = InferMemBlockId(plan, true, &seconds);
+  CheckSamePlan(first, InferMemBlockId(plan, true, &seconds));
+}
+
+TEST(IntraJobMemSharingUtil, benchmark) {
+  for (int64_t chain_num : {8, 32, 128}) {
+    const Plan plan = GenSyntheticPlan(8, chain_num, 128);
+    double seconds = 0;
+    InferMemBlockId(plan, false, &seconds);
+    std::cout << "InferMemBlockId4MemReusedRegst devices: 8, chains per device: " << chain_num
+              << ", tasks per chain: 128, time: " << seconds * 1000 << " ms" << std::endl;
+  }
+}
+
+}  // namespace oneflow
@@ -28,6 +28,7 @@ limitations under the License.
 #include "oneflow/core/ep/include/device_manager_registry.h"
 #include "oneflow/core/operator/operator.h"
 #include "oneflow/core/graph/task_node.h"
+#include "oneflow/core/thread/thread_manager.h"
 
 namespace oneflow {
 
@@ -1008,7 +1009,9 @@ void PlanUtil::GenRegisterHint(Plan* plan) {
       }
     }
   }
-  for (TaskProto& task : *(plan->mutable_task())) {
+  // NOTE: Every task only writes its own hint, so the tasks are handled in parallel.
+  MultiThreadLoop(plan->task_size(), [&](size_t i) {
+    TaskProto& task = *plan->mutable_task(i);
     bool all_register_num_eq_one = true;
     for (const auto& pair : task.produced_regst_desc()) {
       if (pair.second.register_num() != 1) {
@@ -1026,7 +1029,7 @@ void PlanUtil::GenRegisterHint(Plan* plan) {
       }
     }
     task.set_all_register_num_eq_one_hint(all_register_num_eq_one);
-  }
+  });
 }
 
 namespace {
@@ -1356,7 +1359,10 @@ const oneflow::OpAttribute& PlanUtil::GetOpAttribute(const Plan* plan, int64_t j
 void PlanUtil::PopulateOpAttribute(
     Plan* plan,
     const PbMap<int64_t, ::oneflow::OpAttributeRefTable>& job_id2op_attribute_ref_table) {
-  for (auto& task : *plan->mutable_task()) {
+  // NOTE: Copying the op attributes dominates the plan loading on every rank and the tasks are
+  // independent of each other.
+  MultiThreadLoop(plan->task_size(), [&](size_t i) {
+    TaskProto& task = *plan->mutable_task(i);
     if (task.exec_sequence().exec_node_size() == 1
         && task.exec_sequence().exec_node(0).kernel_conf().has_op_attribute_ref()) {
       auto* kernel_conf = task.mutable_exec_sequence()->mutable_exec_node(0)->mutable_kernel_conf();
@@ -1374,7 +1380,7 @@ void PlanUtil::PopulateOpAttribute(
             << "op_attribute absent, exec_node: " << exec_node.DebugString();
       }
     }
-  }
+  });
 }
 
 /*static*/ StreamId PlanUtil::GetStreamId(const TaskProto& task) {
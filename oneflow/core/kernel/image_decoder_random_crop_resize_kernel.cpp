@@ -153,12 +153,16 @@ bool CpuJpegDecodeRandomCropResize(const unsigned char* data, size_t length,
                                    RandomCropGenerator* crop_generator, unsigned char* workspace,
                                    size_t workspace_size, unsigned char* dst, int target_width,
                                    int target_height) {
-  cv::Mat image_mat;
-  if (JpegPartialDecodeRandomCropImage(data, length, crop_generator, workspace, workspace_size,
-                                       &image_mat)) {
+  // The scaled IDCT does most of the downscaling, the crop left to resize is at most twice the
+  // target size unless it is already smaller.
+  TensorBuffer image;
+  if (!JpegDecodeRandomCropImage(data, length, crop_generator, "RGB", target_width, target_height,
+                                 workspace, workspace_size, &image)) {
     return false;
   }
 
+  cv::Mat image_mat(image.shape().At(0), image.shape().At(1), CV_8UC3,
+                    image.mut_data<unsigned char>(), cv::Mat::AUTO_STEP);
   cv::Mat dst_mat(target_height, target_width, CV_8UC3, dst, cv::Mat::AUTO_STEP);
   cv::resize(image_mat, dst_mat, cv::Size(target_width, target_height), 0, 0, cv::INTER_LINEAR);
   return true;
@@ -17,6 +17,7 @@ limitations under the License.
 #include "oneflow/core/kernel/runtime_blob_shape_infer_helper.h"
 #include "oneflow/core/kernel/kernel_observer.h"
 #include "oneflow/core/vm/sync_vm_mode_guard.h"
+#include "oneflow/core/profiler/trace_recorder.h"
 
 namespace oneflow {
 
@@ -32,13 +33,14 @@ bool IsAllBlobEmpty(const PbRpf<std::string>& bns, KernelContext* ctx) {
 
 }  // namespace
 
-Kernel::Kernel() = default;
+Kernel::Kernel() : trace_name_id_(0) {}
 
 Kernel::~Kernel() = default;
 
 void Kernel::InitBase(const KernelConf& kernel_conf) {
   if (shape_infer_helper_) { return; }
   kernel_conf_ = kernel_conf;
+  trace_name_id_ = profiler::TraceRecorder::Get()->InternName(op_conf().name());
   shape_infer_helper_.reset(
       new RuntimeBlobShapeInferHelper(this->op_conf(), this->kernel_conf(), this));
 }
@@ -51,6 +53,7 @@ void Kernel::Init(const KernelConf& kernel_conf, KernelContext* ctx) {
 
 void Kernel::Launch(KernelContext* ctx) const {
   SyncVmModeGuard guard(SyncVmMode::kEnable);
+  profiler::TraceScope trace_scope(trace_name_id_);
   ctx->WillForward(ctx, this);
   Forward(ctx);
   ctx->DidForward(ctx, this);
@@ -63,6 +63,7 @@ class Kernel {
  private:
   std::unique_ptr<RuntimeBlobShapeInferHelper> shape_infer_helper_;
   KernelConf kernel_conf_;
+  uint32_t trace_name_id_;
 };
 
 #define REGISTER_KERNEL(k, KernelType) \
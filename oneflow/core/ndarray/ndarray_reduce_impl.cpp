@@ -13,30 +13,264 @@ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 See the License for the specific language governing permissions and
 limitations under the License.
 */
+#include <algorithm>
+#include <memory>
 #include "oneflow/core/common/data_type.h"
 #include "oneflow/core/common/preprocessor.h"
 #include "oneflow/core/ndarray/ndarray_reduce_impl.h"
 #include "oneflow/core/ndarray/binary_func.h"
+#include "oneflow/core/ep/cpu/cpu_stream.h"
 
 namespace oneflow {
 
-#define SPECIALIZE_CPU_NDARRAY_REDUCE_IMPL(struct_name)                                        \
-  template<typename T, template<typename> class binary_func>                                   \
-  struct struct_name<DeviceType::kCPU, T, binary_func> final {                                 \
-    using RetT = typename BinaryFuncTrait<binary_func, T>::return_type;                        \
-    static bool Matched(const XpuVarNdarray<RetT>& y, const XpuVarNdarray<const T>& x) {       \
-      return false;                                                                            \
-    }                                                                                          \
-    static void Reduce(ep::Stream* stream, const XpuVarNdarray<RetT>& y,                       \
-                       const XpuVarNdarray<const T>& x, const XpuVarNdarray<T>& tmp_storage) { \
-      UNIMPLEMENTED();                                                                         \
-    }                                                                                          \
-  }
-SPECIALIZE_CPU_NDARRAY_REDUCE_IMPL(NdarrayScalarReduce);
-SPECIALIZE_CPU_NDARRAY_REDUCE_IMPL(NdarrayMatrixRowReduce);
-SPECIALIZE_CPU_NDARRAY_REDUCE_IMPL(NdarrayMatrixColReduce);
-SPECIALIZE_CPU_NDARRAY_REDUCE_IMPL(NdarrayXYZCubeXZReduce);
-#undef SPECIALIZE_CPU_NDARRAY_REDUCE_IMPL
+namespace {
+
+// Elements reduced by one task of the CPU stream.
+constexpr int64_t kParallelGrain = 32768;
+// Independent accumulators of a contiguous reduction, they let the compiler vectorize the loop.
+constexpr int64_t kNumAccumulators = 8;
+// Floating point sums are split in halves down to blocks of this size, which bounds the rounding
+// error by O(log(n)) instead of O(n) of a sequential sum.
+constexpr int64_t kPairwiseBlockSize = 128;
+// Columns reduced together by a column reduction.
+constexpr int64_t kColBlockSize = 256;
+
+int64_t DivUp(int64_t n, int64_t val) { return (n + val - 1) / val; }
+
+template<typename T, template<typename> class binary_func>
+struct IsPairwiseReduce {
+  static constexpr bool value =
+      !std::is_integral<T>::value
+      && (std::is_same<binary_func<T>, BinaryFuncSum<T>>::value
+          || std::is_same<binary_func<T>, BinaryFuncNanSum<T>>::value);
+};
+
+template<typename T, template<typename> class binary_func>
+T ReduceBlock(const T* x, int64_t n) {
+  T acc[kNumAccumulators];
+  std::fill(acc, acc + kNumAccumulators, UnitOfBinaryFunc<T, binary_func>::Val());
+  int64_t i = 0;
+  for (; i + kNumAccumulators <= n; i += kNumAccumulators) {
+    for (int64_t j = 0; j < kNumAccumulators; ++j) {
+      acc[j] = binary_func<T>::Invoke(acc[j], x[i + j]);
+    }
+  }
+  T reduced = UnitOfBinaryFunc<T, binary_func>::Val();
+  for (; i < n; ++i) { reduced = binary_func<T>::Invoke(reduced, x[i]); }
+  for (int64_t j = 0; j < kNumAccumulators; ++j) {
+    reduced = binary_func<T>::Invoke(reduced, acc[j]);
+  }
+  return reduced;
+}
+
+template<typename T, template<typename> class binary_func>
+T ReduceContiguous(const T* x, int64_t n) {
+  if (!IsPairwiseReduce<T, binary_func>::value || n <= kPairwiseBlockSize) {
+    return ReduceBlock<T, binary_func>(x, n);
+  }
+  const int64_t half = n / 2 / kNumAccumulators * kNumAccumulators;
+  return binary_func<T>::Invoke(ReduceContiguous<T, binary_func>(x, half),
+                                ReduceContiguous<T, binary_func>(x + half, n - half));
+}
+
+// Reduces `num_rows` segments of `size` contiguous elements which are `stride` elements apart.
+template<typename T, template<typename> class binary_func>
+T ReduceSegments(const T* x, int64_t num_rows, int64_t size, int64_t stride) {
+  if (IsPairwiseReduce<T, binary_func>::value && num_rows > 1) {
+    const int64_t half = num_rows / 2;
+    return binary_func<T>::Invoke(
+        ReduceSegments<T, binary_func>(x, half, size, stride),
+        ReduceSegments<T, binary_func>(x + half * stride, num_rows - half, size, stride));
+  }
+  T reduced = UnitOfBinaryFunc<T, binary_func>::Val();
+  for (int64_t i = 0; i < num_rows; ++i) {
+    reduced =
+        binary_func<T>::Invoke(reduced, ReduceContiguous<T, binary_func>(x + i * stride, size));
+  }
+  return reduced;
+}
+
+// Reduces x of shape (X, Y, Z) to y of shape (1, Y, 1), which also covers the scalar reduction
+// (1, 1, Z) and the matrix row reduction (1, Y, Z). The elements of one y are reduced by chunks of
+// about kParallelGrain elements in parallel, then the partial results of the chunks are reduced.
+// The chunks only depend on the shape, so do the results.
+template<typename T, template<typename> class binary_func, typename RetT>
+void XYZCubeXZReduce(ep::CpuStream* cpu_stream, int64_t dim_x, int64_t dim_y, int64_t dim_z,
+                     const T* x, RetT* y) {
+  if (dim_x == 0 || dim_z == 0) {
+    std::fill(y, y + dim_y, static_cast<RetT>(UnitOfBinaryFunc<T, binary_func>::Val()));
+    return;
+  }
+  // a chunk is either a part of one row, or whole rows
+  const int64_t chunk_cols = std::min(dim_z, kParallelGrain);
+  const int64_t chunk_rows = std::max(kParallelGrain / dim_z, int64_t(1));
+  const int64_t num_col_chunks = DivUp(dim_z, chunk_cols);
+  const int64_t num_row_chunks = DivUp(dim_x, chunk_rows);
+  const int64_t num_chunks = num_col_chunks * num_row_chunks;
+  const int64_t row_stride = dim_y * dim_z;
+  const auto ReduceChunk = [&](int64_t i, int64_t chunk) -> T {
+    const int64_t row_begin = chunk / num_col_chunks * chunk_rows;
+    const int64_t col_begin = chunk % num_col_chunks * chunk_cols;
+    return ReduceSegments<T, binary_func>(x + row_begin * row_stride + i * dim_z + col_begin,
+                                          std::min(dim_x - row_begin, chunk_rows),
+                                          std::min(dim_z - col_begin, chunk_cols), row_stride);
+  };
+  if (num_chunks == 1) {
+    cpu_stream->ParallelFor(
+        0, dim_y,
+        [&](int64_t begin, int64_t end) {
+          for (int64_t i = begin; i < end; ++i) { y[i] = static_cast<RetT>(ReduceChunk(i, 0)); }
+        },
+        std::max(kParallelGrain / (dim_x * dim_z), int64_t(1)));
+    return;
+  }
+  std::unique_ptr<T[]> partials(new T[dim_y * num_chunks]);
+  cpu_stream->ParallelFor(
+      0, dim_y * num_chunks,
+      [&](int64_t begin, int64_t end) {
+        for (int64_t i = begin; i < end; ++i) {
+          partials[i] = ReduceChunk(i / num_chunks, i % num_chunks);
+        }
+      },
+      1);
+  cpu_stream->ParallelFor(
+      0, dim_y,
+      [&](int64_t begin, int64_t end) {
+        for (int64_t i = begin; i < end; ++i) {
+          y[i] = static_cast<RetT>(
+              ReduceContiguous<T, binary_func>(partials.get() + i * num_chunks, num_chunks));
+        }
+      },
+      std::max(kParallelGrain / num_chunks, int64_t(1)));
+}
+
+// Reduces the `num_rows` x `num_cols` block, whose rows are `row_stride` elements apart, along the
+// rows. The inner loop runs over contiguous columns.
+template<typename T, template<typename> class binary_func>
+void ReduceColumns(const T* x, int64_t num_rows, int64_t num_cols, int64_t row_stride, T* y) {
+  if (IsPairwiseReduce<T, binary_func>::value && num_rows > kPairwiseBlockSize) {
+    const int64_t half = num_rows / 2;
+    T second_half[kColBlockSize];
+    ReduceColumns<T, binary_func>(x, half, num_cols, row_stride, y);
+    ReduceColumns<T, binary_func>(x + half * row_stride, num_rows - half, num_cols, row_stride,
+                                  second_half);
+    for (int64_t j = 0; j < num_cols; ++j) { y[j] = binary_func<T>::Invoke(y[j], second_half[j]); }
+    return;
+  }
+  std::fill(y, y + num_cols, UnitOfBinaryFunc<T, binary_func>::Val());
+  for (int64_t i = 0; i < num_rows; ++i) {
+    const T* row = x + i * row_stride;
+    for (int64_t j = 0; j < num_cols; ++j) { y[j] = binary_func<T>::Invoke(y[j], row[j]); }
+  }
+}
+
+// Reduces x of shape (num_rows, num_cols) to y of shape (1, num_cols) by tasks of column blocks
+// and chunks of rows. The partial results of the row chunks are reduced the same way.
+template<typename T, template<typename> class binary_func, typename RetT>
+void MatrixColReduce(ep::CpuStream* cpu_stream, int64_t num_rows, int64_t num_cols, const T* x,
+                     RetT* y) {
+  if (num_rows == 0 || num_cols == 0) {
+    std::fill(y, y + num_cols, static_cast<RetT>(UnitOfBinaryFunc<T, binary_func>::Val()));
+    return;
+  }
+  const int64_t block_cols = std::min(num_cols, kColBlockSize);
+  const int64_t num_col_blocks = DivUp(num_cols, kColBlockSize);
+  const int64_t chunk_rows = std::max(kParallelGrain / block_cols, kPairwiseBlockSize);
+  const int64_t num_row_chunks = DivUp(num_rows, chunk_rows);
+  std::unique_ptr<T[]> partials;
+  if (num_row_chunks > 1) { partials.reset(new T[num_row_chunks * num_cols]); }
+  cpu_stream->ParallelFor(
+      0, num_row_chunks * num_col_blocks,
+      [&](int64_t begin, int64_t end) {
+        T reduced[kColBlockSize];
+        for (int64_t i = begin; i < end; ++i) {
+          const int64_t row_begin = i / num_col_blocks * chunk_rows;
+          const int64_t col_begin = i % num_col_blocks * kColBlockSize;
+          const int64_t cols = std::min(num_cols - col_begin, kColBlockSize);
+          ReduceColumns<T, binary_func>(x + row_begin * num_cols + col_begin,
+                                        std::min(num_rows - row_begin, chunk_rows), cols, num_cols,
+                                        reduced);
+          if (partials) {
+            std::copy(reduced, reduced + cols,
+                      partials.get() + i / num_col_blocks * num_cols + col_begin);
+          } else {
+            for (int64_t j = 0; j < cols; ++j) { y[col_begin + j] = static_cast<RetT>(reduced[j]); }
+          }
+        }
+      },
+      std::max(kParallelGrain / (std::min(num_rows, chunk_rows) * block_cols), int64_t(1)));
+  if (partials) {
+    MatrixColReduce<T, binary_func, RetT>(cpu_stream, num_row_chunks, num_cols, partials.get(), y);
+  }
+}
+
+}  // namespace
+
+template<typename T, template<typename> class binary_func>
+struct NdarrayScalarReduce<DeviceType::kCPU, T, binary_func> final {
+  using RetT = typename BinaryFuncTrait<binary_func, T>::return_type;
+  static bool Matched(const XpuVarNdarray<RetT>& y, const XpuVarNdarray<const T>& x) {
+    return y.shape().ElemNum() == 1;
+  }
+
+  static void Reduce(ep::Stream* stream, const XpuVarNdarray<RetT>& y,
+                     const XpuVarNdarray<const T>& x, const XpuVarNdarray<T>& tmp_storage) {
+    CHECK(Matched(y, x));
+    XYZCubeXZReduce<T, binary_func, RetT>(stream->As<ep::CpuStream>(), 1, 1,
+                                          x.shape().ElemNum(), x.ptr(), y.ptr());
+  }
+};
+
+template<typename T, template<typename> class binary_func>
+struct NdarrayMatrixRowReduce<DeviceType::kCPU, T, binary_func> final {
+  using RetT = typename BinaryFuncTrait<binary_func, T>::return_type;
+  static bool Matched(const XpuVarNdarray<RetT>& y, const XpuVarNdarray<const T>& x) {
+    if (x.shape().NumAxes() != 2) { return false; }
+    if (y.shape().NumAxes() != 2) { return false; }
+    return x.shape().At(0) == y.shape().At(0) && y.shape().At(1) == 1;
+  }
+
+  static void Reduce(ep::Stream* stream, const XpuVarNdarray<RetT>& y,
+                     const XpuVarNdarray<const T>& x, const XpuVarNdarray<T>& tmp_storage) {
+    CHECK(Matched(y, x));
+    XYZCubeXZReduce<T, binary_func, RetT>(stream->As<ep::CpuStream>(), 1, x.shape().At(0),
+                                          x.shape().At(1), x.ptr(), y.ptr());
+  }
+};
+
+template<typename T, template<typename> class binary_func>
+struct NdarrayMatrixColReduce<DeviceType::kCPU, T, binary_func> final {
+  using RetT = typename BinaryFuncTrait<binary_func, T>::return_type;
+  static bool Matched(const XpuVarNdarray<RetT>& y, const XpuVarNdarray<const T>& x) {
+    if (x.shape().NumAxes() != 2) { return false; }
+    if (y.shape().NumAxes() != 2) { return false; }
+    return y.shape().At(0) == 1 && x.shape().At(1) == y.shape().At(1);
+  }
+
+  static void Reduce(ep::Stream* stream, const XpuVarNdarray<RetT>& y,
+                     const XpuVarNdarray<const T>& x, const XpuVarNdarray<T>& tmp_storage) {
+    CHECK(Matched(y, x));
+    MatrixColReduce<T, binary_func, RetT>(stream->As<ep::CpuStream>(), x.shape().At(0),
+                                          x.shape().At(1), x.ptr(), y.ptr());
+  }
+};
+
+template<typename T, template<typename> class binary_func>
+struct NdarrayXYZCubeXZReduce<DeviceType::kCPU, T, binary_func> final {
+  using RetT = typename BinaryFuncTrait<binary_func, T>::return_type;
+  static bool Matched(const XpuVarNdarray<RetT>& y, const XpuVarNdarray<const T>& x) {
+    if (x.shape().NumAxes() != 3) { return false; }
+    if (y.shape().NumAxes() != 3) { return false; }
+    return y.shape().At(0) == 1 && x.shape().At(1) == y.shape().At(1) && y.shape().At(2) == 1;
+  }
+
+  static void Reduce(ep::Stream* stream, const XpuVarNdarray<RetT>& y,
+                     const XpuVarNdarray<const T>& x, const XpuVarNdarray<T>& tmp_storage) {
+    CHECK(Matched(y, x));
+    XYZCubeXZReduce<T, binary_func, RetT>(stream->As<ep::CpuStream>(), x.shape().At(0),
+                                          x.shape().At(1), x.shape().At(2), x.ptr(), y.ptr());
+  }
+};
 
 #define INSTANTIATE_NDARRAY_REDUCE_IMPL(dtype, binary_func)                                       \
   template struct NdarrayScalarReduce<DeviceType::kCPU, OF_PP_PAIR_FIRST(dtype), binary_func>;    \
@@ -0,0 +1,183 @@
+/*
+Copyright 2020 The OneFlow Authors. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <gtest/gtest.h>
+#include "oneflow/core/ep/include/device_manager_registry.h"
+#include "oneflow/core/ep/cpu/cpu_device.h"
+#include "oneflow/core/ndarray/ndarray_reduce.h"
+
+namespace oneflow {
+
+namespace test {
+
+namespace {
+
+// Reduces `x` of `x_shape` to `y_shape` in double precision.
+std::vector<double> NaiveReduceSum(const std::vector<float>& x, const Shape& x_shape,
+                                   const Shape& y_shape) {
+  std::vector<double> y(y_shape.elem_cnt(), 0);
+  const int64_t num_axes = x_shape.NumAxes();
+  std::vector<int64_t> index(num_axes, 0);
+  for (int64_t i = 0; i < x_shape.elem_cnt(); ++i) {
+    int64_t offset = i;
+    for (int64_t axis = num_axes - 1; axis >= 0; --axis) {
+      index[axis] = offset % x_shape.At(axis);
+      offset /= x_shape.At(axis);
+    }
+    int64_t y_offset = 0;
+    for (int64_t axis = 0; axis < num_axes; ++axis) {
+      y_offset = y_offset * y_shape.At(axis) + (y_shape.At(axis) == 1 ? 0 : index[axis]);
+    }
+    y[y_offset] += x[i];
+  }
+  return y;
+}
+
+std::vector<float> RandomData(int64_t n) {
+  std::mt19937 generator(n);
+  std::uniform_real_distribution<float> distribution(0, 1);
+  std::vector<float> data(n);
+  for (auto& value : data) { value = distribution(generator); }
+  return data;
+}
+
+class CpuStreamGuard final {
+ public:
+  CpuStreamGuard() : device_manager_registry_(new ep::DeviceManagerRegistry()) {
+    device_ = device_manager_registry_->GetDevice(DeviceType::kCPU, 0);
+    std::dynamic_pointer_cast<ep::CpuDevice>(device_)->SetNumThreads(
+        std::max<size_t>(std::thread::hardware_concurrency(), 2));
+    stream_ = device_->CreateStream();
+  }
+  ~CpuStreamGuard() { device_->DestroyStream(stream_); }
+
+  ep::Stream* stream() { return stream_; }
+
+ private:
+  std::unique_ptr<ep::DeviceManagerRegistry> device_manager_registry_;
+  std::shared_ptr<ep::Device> device_;
+  ep::Stream* stream_;
+};
+
+template<template<typename> class binary_func>
+void Reduce(ep::Stream* stream, const Shape& x_shape, const float* x, const Shape& y_shape,
+            float* y, std::vector<float>* tmp) {
+  NdarrayReduce<DeviceType::kCPU, float, binary_func>::Reduce(
+      stream, XpuVarNdarray<float>(y_shape, y), XpuVarNdarray<const float>(x_shape, x),
+      XpuVarNdarray<float>(x_shape, tmp->data()));
+}
+
+const std::vector<std::pair<Shape, Shape>>& ReduceCases() {
+  static const std::vector<std::pair<Shape, Shape>> cases = {
+      {Shape({1 << 20}), Shape({1})},                          // scalar
+      {Shape({7}), Shape({1})},                                // small scalar
+      {Shape({512, 1000}), Shape({512, 1})},                   // matrix row
+      {Shape({3, 300000}), Shape({3, 1})},                     // a few long rows
+      {Shape({1000, 512}), Shape({1, 512})},                   // matrix col
+      {Shape({100000, 3}), Shape({1, 3})},                     // a few long columns
+      {Shape({32, 64, 56, 56}), Shape({1, 64, 1, 1})},         // xyz cube xz
+      {Shape({4, 5, 6, 7}), Shape({1, 5, 1, 7})},              // default
+  };
+  return cases;
+}
+
+}  // namespace
+
+TEST(NdarrayReduce, cpu_reduce) {
+  CpuStreamGuard stream;
+  for (const auto& pair : ReduceCases()) {
+    const Shape& x_shape = pair.first;
+    const Shape& y_shape = pair.second;
+    const auto& x = RandomData(x_shape.elem_cnt());
+    std::vector<float> tmp(x.size());
+    std::vector<float> sum(y_shape.elem_cnt());
+    std::vector<float> max(y_shape.elem_cnt());
+    Reduce<BinaryFuncSum>(stream.stream(), x_shape, x.data(), y_shape, sum.data(), &tmp);
+    Reduce<BinaryFuncMax>(stream.stream(), x_shape, x.data(), y_shape, max.data(), &tmp);
+    const auto& expected_sum = NaiveReduceSum(x, x_shape, y_shape);
+    const int64_t reduce_size = x_shape.elem_cnt() / y_shape.elem_cnt();
+    for (int64_t i = 0; i < y_shape.elem_cnt(); ++i) {
+      // far below the error of a sequential float sum, which grows with the reduce size
+      ASSERT_NEAR(sum[i], expected_sum[i], 1e-6 * expected_sum[i] + 1e-6)
+          << x_shape.ToString() << " -> " << y_shape.ToString();
+      ASSERT_LE(max[i], 1);
+      ASSERT_GT(max[i], reduce_size > 100 ? 0.9 : 0);
+    }
+  }
+}
+
+TEST(NdarrayReduce, cpu_reduce_empty) {
+  CpuStreamGuard stream;
+  const std::vector<std::pair<Shape, Shape>> cases = {
+      {Shape({0}), Shape({1})},              // scalar
+      {Shape({4, 0}), Shape({4, 1})},        // matrix row
+      {Shape({0, 5}), Shape({1, 5})},        // matrix col
+      {Shape({0, 3, 4}), Shape({1, 3, 1})},  // xyz cube xz
+      {Shape({2, 3, 0}), Shape({1, 3, 1})},  // xyz cube xz
+  };
+  for (const auto& pair : cases) {
+    const Shape& x_shape = pair.first;
+    const Shape& y_shape = pair.second;
+    // valid pointers, nothing is read
+    std::vector<float> x(1);
+    std::vector<float> tmp(1);
+    std::vector<float> sum(y_shape.elem_cnt(), 1);
+    std::vector<float> max(y_shape.elem_cnt(), 1);
+    Reduce<BinaryFuncSum>(stream.stream(), x_shape, x.data(), y_shape, sum.data(), &tmp);
+    Reduce<BinaryFuncMax>(stream.stream(), x_shape, x.data(), y_shape, max.data(), &tmp);
+    for (int64_t i = 0; i < y_shape.elem_cnt(); ++i) {
+      ASSERT_EQ(sum[i], 0) << x_shape.ToString() << " -> " << y_shape.ToString();
+      ASSERT_EQ(max[i], GetMinVal<float>()) << x_shape.ToString() << " -> " << y_shape.ToString();
+    }
+  }
+}
+
+TEST(NdarrayReduce, cpu_reduce_benchmark) {
+  CpuStreamGuard stream;
+  const std::vector<std::pair<Shape, Shape>> cases = {
+      {Shape({1 << 24}), Shape({1})},
+      {Shape({8192, 2048}), Shape({8192, 1})},
+      {Shape({8192, 2048}), Shape({1, 2048})},
+      {Shape({32, 64, 112, 112}), Shape({1, 64, 1, 1})},
+  };
+  for (const auto& pair : cases) {
+    const Shape& x_shape = pair.first;
+    const Shape& y_shape = pair.second;
+    const auto& x = RandomData(x_shape.elem_cnt());
+    std::vector<float> tmp(x.size());
+    std::vector<float> y(y_shape.elem_cnt());
+    const int iter_num = 10;
+    Reduce<BinaryFuncSum>(stream.stream(), x_shape, x.data(), y_shape, y.data(), &tmp);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iter_num; ++i) {
+      Reduce<BinaryFuncSum>(stream.stream(), x_shape, x.data(), y_shape, y.data(), &tmp);
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    const double seconds = std::chrono::duration<double>(elapsed).count() / iter_num;
+    std::cout << "cpu reduce sum " << x_shape.ToString() << " -> " << y_shape.ToString() << ": "
+              << seconds * 1000 << " ms, " << x.size() * sizeof(float) / seconds / 1e9 << " GB/s"
+              << std::endl;
+  }
+}
+
+}  // namespace test
+
+}  // namespace oneflow
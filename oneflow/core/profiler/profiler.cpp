@@ -18,6 +18,7 @@ limitations under the License.
 #include "oneflow/core/profiler/profile_manager.h"
 #include "oneflow/core/profiler/kineto_shim.h"
 #include "oneflow/core/profiler/event_recorder.h"
+#include "oneflow/core/profiler/trace_recorder.h"
 #include "oneflow/core/vm/vm_util.h"
 #ifdef WITH_CUDA
 #include "oneflow/core/device/cuda_util.h"
@@ -32,6 +33,7 @@ namespace oneflow {
 namespace profiler {
 
 void NameThisHostThread(const std::string& name) {
+  TraceRecorder::Get()->SetThreadName(name);
 #ifdef WITH_CUDA
   static thread_local std::unique_ptr<std::string> thread_name_prefix;
   if (!thread_name_prefix) {
@@ -127,6 +129,17 @@ Maybe<void> EndRecord(const std::string& event_recorder_key) {
   return Maybe<void>::Ok();
 }
 
+Maybe<void> StartTrace(const std::string& path, int64_t sample_period) {
+  return TraceRecorder::Get()->Start(path, sample_period);
+}
+
+Maybe<void> StopTrace() {
+  JUST(vm::ClusterSync());
+  return TraceRecorder::Get()->Stop();
+}
+
+void TraceStep() { TraceRecorder::Get()->Step(); }
+
 }  // namespace profiler
 
 }  // namespace oneflow
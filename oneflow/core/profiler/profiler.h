@@ -73,6 +73,14 @@ Maybe<std::string> StartRecord(const std::string& name);
 
 Maybe<void> EndRecord(const std::string& event_recorder_key);
 
+// Streams the kernels of every `sample_period`-th step to a Chrome trace file at `path`, see
+// TraceRecorder.
+Maybe<void> StartTrace(const std::string& path, int64_t sample_period);
+
+Maybe<void> StopTrace();
+
+void TraceStep();
+
 }  // namespace profiler
 
 }  // namespace oneflow
@@ -0,0 +1,330 @@
+/*
+Copyright 2020 The OneFlow Authors. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "oneflow/core/profiler/trace_recorder.h"
+#include <unistd.h>
+
+namespace oneflow {
+namespace profiler {
+
+namespace {
+
+const char* CategoryName(TraceCategory category) {
+  switch (category) {
+    case TraceCategory::kKernel: return "kernel";
+    case TraceCategory::kRange: return "range";
+    case TraceCategory::kStep: return "step";
+    default: return "unknown";
+  }
+}
+
+std::string EscapeJson(const std::string& str) {
+  std::string escaped;
+  escaped.reserve(str.size());
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      escaped.push_back('\\');
+      escaped.push_back(c);
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      escaped.append(buf);
+    } else {
+      escaped.push_back(c);
+    }
+  }
+  return escaped;
+}
+
+}  // namespace
+
+// Single-producer single-consumer ring of trace records, the producer being the owning thread
+// and the consumer whoever holds TraceRecorder::flush_mutex_.
+class TraceRecorder::ThreadBuffer final {
+ public:
+  OF_DISALLOW_COPY_AND_MOVE(ThreadBuffer);
+  ThreadBuffer(size_t capacity, int64_t tid)
+      : name_emitted(false),
+        records_(new TraceRecord[capacity]),
+        mask_(capacity - 1),
+        tid_(tid),
+        head_(0),
+        tail_(0) {}
+  ~ThreadBuffer() = default;
+
+  bool Push(const TraceRecord& record) {
+    const uint64_t head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) > mask_) { return false; }
+    records_[head & mask_] = record;
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  template<typename Visitor>
+  void Consume(const Visitor& Visit) {
+    const uint64_t tail = tail_.load(std::memory_order_relaxed);
+    const uint64_t head = head_.load(std::memory_order_acquire);
+    for (uint64_t i = tail; i < head; ++i) { Visit(records_[i & mask_]); }
+    tail_.store(head, std::memory_order_release);
+  }
+
+  bool Empty() const {
+    return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_relaxed);
+  }
+
+  int64_t tid() const { return tid_; }
+
+  // Guarded by TraceRecorder::buffers_mutex_.
+  std::string name;
+  bool name_emitted;
+
+ private:
+  std::unique_ptr<TraceRecord[]> records_;
+  uint64_t mask_;
+  int64_t tid_;
+  alignas(64) std::atomic<uint64_t> head_;
+  alignas(64) std::atomic<uint64_t> tail_;
+};
+
+std::atomic<bool> TraceRecorder::recording_(false);
+
+TraceRecorder::TraceRecorder()
+    : next_tid_(0),
+      active_(false),
+      sample_period_(1),
+      step_(0),
+      file_(nullptr),
+      first_event_(true),
+      pid_(getpid()),
+      session_start_ns_(0),
+      num_dropped_(0),
+      num_written_(0) {
+  const int64_t capacity = ParseIntegerFromEnv("ONEFLOW_PROFILER_TRACE_BUFFER_RECORDS", 1 << 14);
+  CHECK_GT(capacity, 0);
+  buffer_capacity_ = 1;
+  while (buffer_capacity_ < capacity) { buffer_capacity_ <<= 1; }
+  flush_interval_ms_ = ParseIntegerFromEnv("ONEFLOW_PROFILER_TRACE_FLUSH_INTERVAL_MS", 100);
+  step_name_id_ = InternName("step");
+}
+
+TraceRecorder::~TraceRecorder() {
+  bool active = false;
+  {
+    std::unique_lock<std::mutex> lock(session_mutex_);
+    active = active_;
+  }
+  if (active) { CHECK_JUST(Stop()); }
+}
+
+TraceRecorder* TraceRecorder::Get() {
+  static TraceRecorder* recorder = []() {
+    static TraceRecorder instance;
+    const std::string path = GetStringFromEnv("ONEFLOW_PROFILER_TRACE_FILE", "");
+    if (!path.empty()) {
+      CHECK_JUST(
+          instance.Start(path, ParseIntegerFromEnv("ONEFLOW_PROFILER_TRACE_SAMPLE_PERIOD", 1)));
+    }
+    return &instance;
+  }();
+  return recorder;
+}
+
+uint32_t TraceRecorder::InternName(const std::string& name) {
+  std::unique_lock<std::mutex> lock(name_mutex_);
+  auto it = name2id_.find(name);
+  if (it != name2id_.end()) { return it->second; }
+  const uint32_t id = names_.size();
+  names_.emplace_back(name);
+  name2id_.emplace(name, id);
+  return id;
+}
+
+TraceRecorder::ThreadBuffer* TraceRecorder::GetThreadBuffer() {
+  // Buffers are shared with the registry so records outlive the thread that produced them.
+  static thread_local std::shared_ptr<ThreadBuffer> buffer;
+  if (!buffer) {
+    std::unique_lock<std::mutex> lock(buffers_mutex_);
+    buffer = std::make_shared<ThreadBuffer>(buffer_capacity_, next_tid_++);
+    buffers_.emplace_back(buffer);
+  }
+  return buffer.get();
+}
+
+void TraceRecorder::Record(uint32_t name_id, TraceCategory category, int64_t start_ns,
+                           int64_t end_ns, int64_t arg) {
+  if (!GetThreadBuffer()->Push(TraceRecord{start_ns, end_ns, name_id, category, arg})) {
+    num_dropped_.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void TraceRecorder::SetThreadName(const std::string& name) {
+  ThreadBuffer* buffer = GetThreadBuffer();
+  std::unique_lock<std::mutex> lock(buffers_mutex_);
+  buffer->name = name;
+  buffer->name_emitted = false;
+}
+
+Maybe<void> TraceRecorder::Start(const std::string& path, int64_t sample_period) {
+  CHECK_GT_OR_RETURN(sample_period, 0) << "sample period of trace must be positive";
+  std::unique_lock<std::mutex> session_lock(session_mutex_);
+  CHECK_OR_RETURN(!active_) << "trace has already been started";
+  {
+    std::unique_lock<std::mutex> flush_lock(flush_mutex_);
+    file_ = fopen(path.c_str(), "w");
+    CHECK_NOTNULL_OR_RETURN(file_) << "failed to open trace file " << path;
+    // Spans that finished after the previous session stopped are not part of this one.
+    {
+      std::unique_lock<std::mutex> buffers_lock(buffers_mutex_);
+      for (const auto& buffer : buffers_) {
+        buffer->Consume([](const TraceRecord&) {});
+        buffer->name_emitted = false;
+      }
+    }
+    first_event_ = true;
+    session_start_ns_ = GetTimeNow(true);
+    fputs("[\n", file_);
+    fprintf(file_, R"({"name":"process_name","ph":"M","pid":%ld,"args":{"name":"oneflow"}})",
+            static_cast<long>(pid_));
+    first_event_ = false;
+  }
+  num_dropped_.store(0);
+  num_written_.store(0);
+  sample_period_ = sample_period;
+  step_ = 0;
+  active_ = true;
+  Record(step_name_id_, TraceCategory::kStep, GetTimeNow(true), 0, step_);
+  recording_.store(true);
+  flusher_ = std::thread(&TraceRecorder::FlushLoop, this);
+  return Maybe<void>::Ok();
+}
+
+Maybe<void> TraceRecorder::Stop() {
+  {
+    std::unique_lock<std::mutex> lock(session_mutex_);
+    CHECK_OR_RETURN(active_) << "trace has not been started";
+    recording_.store(false);
+    active_ = false;
+    flush_cond_.notify_all();
+  }
+  flusher_.join();
+  Drain();
+  std::unique_lock<std::mutex> lock(flush_mutex_);
+  fputs("\n]\n", file_);
+  fclose(file_);
+  file_ = nullptr;
+  const int64_t num_dropped = num_dropped_.load();
+  if (num_dropped > 0) {
+    LOG(WARNING) << "profiler trace dropped " << num_dropped << " records on full buffers, "
+                 << "consider raising ONEFLOW_PROFILER_TRACE_BUFFER_RECORDS";
+  }
+  return Maybe<void>::Ok();
+}
+
+void TraceRecorder::Step() {
+  std::unique_lock<std::mutex> lock(session_mutex_);
+  if (!active_) { return; }
+  step_ += 1;
+  const bool sampled = step_ % sample_period_ == 0;
+  if (sampled) { Record(step_name_id_, TraceCategory::kStep, GetTimeNow(true), 0, step_); }
+  recording_.store(sampled, std::memory_order_relaxed);
+}
+
+void TraceRecorder::FlushLoop() {
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(session_mutex_);
+      flush_cond_.wait_for(lock, std::chrono::milliseconds(flush_interval_ms_),
+                           [this]() { return !active_; });
+      if (!active_) { return; }
+    }
+    Drain();
+  }
+}
+
+void TraceRecorder::Drain() {
+  std::unique_lock<std::mutex> flush_lock(flush_mutex_);
+  if (file_ == nullptr) { return; }
+  {
+    std::unique_lock<std::mutex> lock(name_mutex_);
+    for (size_t i = flushed_names_.size(); i < names_.size(); ++i) {
+      flushed_names_.emplace_back(EscapeJson(names_.at(i)));
+    }
+  }
+  std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+  {
+    std::unique_lock<std::mutex> lock(buffers_mutex_);
+    // A buffer only referenced by the registry belongs to an exited thread, forget it once empty.
+    buffers_.erase(std::remove_if(buffers_.begin(), buffers_.end(),
+                                  [](const std::shared_ptr<ThreadBuffer>& buffer) {
+                                    return buffer.use_count() == 1 && buffer->Empty();
+                                  }),
+                   buffers_.end());
+    for (const auto& buffer : buffers_) {
+      if (!buffer->name_emitted && !buffer->name.empty()) {
+        WriteThreadName(buffer->name, buffer->tid());
+        buffer->name_emitted = true;
+      }
+    }
+    buffers = buffers_;
+  }
+  int64_t num_written = 0;
+  for (const auto& buffer : buffers) {
+    buffer->Consume([&](const TraceRecord& record) {
+      WriteEvent(record, buffer->tid());
+      num_written += 1;
+    });
+  }
+  num_written_.fetch_add(num_written);
+  fflush(file_);
+}
+
+const char* TraceRecorder::NextSeparator() {
+  if (first_event_) {
+    first_event_ = false;
+    return "";
+  }
+  return ",\n";
+}
+
+void TraceRecorder::WriteEvent(const TraceRecord& record, int64_t tid) {
+  // Chrome traces are in microseconds, print them with nanosecond precision.
+  const int64_t ts = std::max<int64_t>(record.start_ns - session_start_ns_, 0);
+  const char* name = flushed_names_.at(record.name_id).c_str();
+  if (record.category == TraceCategory::kStep) {
+    fprintf(file_,
+            R"(%s{"name":"%s","cat":"step","ph":"i","s":"p","pid":%ld,"tid":%ld,)"
+            R"("ts":%ld.%03ld,"args":{"step":%ld}})",
+            NextSeparator(), name, static_cast<long>(pid_), static_cast<long>(tid),
+            static_cast<long>(ts / 1000), static_cast<long>(ts % 1000),
+            static_cast<long>(record.arg));
+  } else {
+    const int64_t dur = std::max<int64_t>(record.end_ns - record.start_ns, 0);
+    fprintf(file_,
+            R"(%s{"name":"%s","cat":"%s","ph":"X","pid":%ld,"tid":%ld,)"
+            R"("ts":%ld.%03ld,"dur":%ld.%03ld})",
+            NextSeparator(), name, CategoryName(record.category), static_cast<long>(pid_),
+            static_cast<long>(tid), static_cast<long>(ts / 1000), static_cast<long>(ts % 1000),
+            static_cast<long>(dur / 1000), static_cast<long>(dur % 1000));
+  }
+}
+
+void TraceRecorder::WriteThreadName(const std::string& name, int64_t tid) {
+  fprintf(file_, R"(%s{"name":"thread_name","ph":"M","pid":%ld,"tid":%ld,"args":{"name":"%s"}})",
+          NextSeparator(), static_cast<long>(pid_), static_cast<long>(tid),
+          EscapeJson(name).c_str());
+}
+
+}  // namespace profiler
+}  // namespace oneflow
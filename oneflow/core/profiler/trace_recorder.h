@@ -0,0 +1,157 @@
+/*
+Copyright 2020 The OneFlow Authors. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef ONEFLOW_CORE_PROFILER_TRACE_RECORDER_H_
+#define ONEFLOW_CORE_PROFILER_TRACE_RECORDER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include "oneflow/core/common/util.h"
+#include "oneflow/core/common/maybe.h"
+#include "oneflow/core/profiler/util.h"
+
+namespace oneflow {
+namespace profiler {
+
+enum class TraceCategory : uint32_t {
+  kKernel = 0,
+  kRange = 1,
+  kStep = 2,
+};
+
+// One completed span. Records are plain values so that the hot path never allocates.
+struct TraceRecord {
+  int64_t start_ns;
+  int64_t end_ns;
+  uint32_t name_id;
+  TraceCategory category;
+  int64_t arg;
+};
+
+static_assert(sizeof(TraceRecord) == 32, "");
+
+// Streaming trace backend.
+//
+// Every thread appends fixed-size records to its own single-producer ring buffer and a background
+// thread drains all rings into a Chrome trace (JSON array format, also loaded by Perfetto) on
+// disk, so memory stays bounded however long the run is. Names are interned once and referred to
+// by id. When a ring is full the record is dropped and counted instead of blocking the producer.
+//
+// Sampling works on steps: with a sample period of N only the spans issued while the step counter
+// is a multiple of N are recorded. Kernels run asynchronously to the thread calling Step(), so a
+// sampled window is aligned to steps only approximately.
+//
+// Overhead budget: a disabled TraceScope costs one relaxed atomic load, a recorded one two
+// monotonic clock reads and a ring append, which must stay below kTraceOverheadBudgetNs.
+class TraceRecorder final {
+ public:
+  OF_DISALLOW_COPY_AND_MOVE(TraceRecorder);
+  ~TraceRecorder();
+
+  static constexpr int64_t kTraceOverheadBudgetNs = 200;
+
+  static TraceRecorder* Get();
+
+  static bool IsRecording() { return recording_.load(std::memory_order_relaxed); }
+
+  // Returns a stable id for `name`, ids stay valid for the lifetime of the process.
+  uint32_t InternName(const std::string& name);
+
+  void Record(uint32_t name_id, TraceCategory category, int64_t start_ns, int64_t end_ns,
+              int64_t arg = 0);
+
+  Maybe<void> Start(const std::string& path, int64_t sample_period);
+  Maybe<void> Stop();
+  void Step();
+
+  void SetThreadName(const std::string& name);
+
+  int64_t num_dropped() const { return num_dropped_.load(); }
+  int64_t num_written() const { return num_written_.load(); }
+
+ private:
+  class ThreadBuffer;
+
+  TraceRecorder();
+
+  ThreadBuffer* GetThreadBuffer();
+  void FlushLoop();
+  void Drain();
+  void WriteEvent(const TraceRecord& record, int64_t tid);
+  void WriteThreadName(const std::string& name, int64_t tid);
+  const char* NextSeparator();
+
+  static std::atomic<bool> recording_;
+
+  size_t buffer_capacity_;
+  int64_t flush_interval_ms_;
+  uint32_t step_name_id_;
+
+  std::mutex name_mutex_;
+  HashMap<std::string, uint32_t> name2id_;
+  std::vector<std::string> names_;
+
+  std::mutex buffers_mutex_;
+  std::vector<std::shared_ptr<ThreadBuffer>> buffers_;
+  int64_t next_tid_;
+
+  // Guards the session state: whether tracing is on and the step counter used for sampling.
+  std::mutex session_mutex_;
+  std::condition_variable flush_cond_;
+  std::thread flusher_;
+  bool active_;
+  int64_t sample_period_;
+  int64_t step_;
+
+  // Guards the output file and the ring consumers, which are only touched while draining.
+  std::mutex flush_mutex_;
+  FILE* file_;
+  bool first_event_;
+  int64_t pid_;
+  int64_t session_start_ns_;
+  std::vector<std::string> flushed_names_;
+
+  std::atomic<int64_t> num_dropped_;
+  std::atomic<int64_t> num_written_;
+};
+
+// Records the enclosing scope as a span named `name_id`, see TraceRecorder::InternName.
+class TraceScope final {
+ public:
+  OF_DISALLOW_COPY_AND_MOVE(TraceScope);
+  explicit TraceScope(uint32_t name_id, TraceCategory category = TraceCategory::kKernel)
+      : recording_(TraceRecorder::IsRecording()), name_id_(name_id), category_(category) {
+    if (recording_) { start_ns_ = GetTimeNow(true); }
+  }
+  ~TraceScope() {
+    if (recording_) {
+      TraceRecorder::Get()->Record(name_id_, category_, start_ns_, GetTimeNow(true));
+    }
+  }
+
+ private:
+  bool recording_;
+  uint32_t name_id_;
+  TraceCategory category_;
+  int64_t start_ns_;
+};
+
+}  // namespace profiler
+}  // namespace oneflow
+
+#endif  // ONEFLOW_CORE_PROFILER_TRACE_RECORDER_H_
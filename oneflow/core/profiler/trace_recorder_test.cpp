@@ -0,0 +1,129 @@
+/*
+Copyright 2020 The OneFlow Authors. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include <gtest/gtest.h>
+#include <chrono>
+#include <fstream>
+#include "nlohmann/json.hpp"
+#include "oneflow/core/profiler/trace_recorder.h"
+
+namespace oneflow {
+namespace profiler {
+namespace test {
+
+namespace {
+
+std::string TracePath(const std::string& name) {
+  return "/tmp/oneflow_trace_recorder_test_" + name + ".json";
+}
+
+nlohmann::json LoadTrace(const std::string& path) {
+  std::ifstream ifs(path);
+  return nlohmann::json::parse(ifs);
+}
+
+int64_t CountEvents(const nlohmann::json& trace, const std::string& name) {
+  int64_t count = 0;
+  for (const auto& event : trace) {
+    if (event.value("name", "") == name) { count += 1; }
+  }
+  return count;
+}
+
+}  // namespace
+
+TEST(TraceRecorder, StreamFromThreads) {
+  auto* recorder = TraceRecorder::Get();
+  const uint32_t name_id = recorder->InternName("trace_test_kernel");
+  ASSERT_EQ(recorder->InternName("trace_test_kernel"), name_id);
+  const std::string path = TracePath("threads");
+  CHECK_JUST(recorder->Start(path, 1));
+  const int64_t num_threads = 4;
+  const int64_t num_spans = 1000;
+  std::vector<std::thread> threads;
+  for (int64_t i = 0; i < num_threads; ++i) {
+    threads.emplace_back([&, i]() {
+      recorder->SetThreadName("trace_test_thread_" + std::to_string(i));
+      for (int64_t j = 0; j < num_spans; ++j) { TraceScope scope(name_id); }
+    });
+  }
+  for (auto& thread : threads) { thread.join(); }
+  CHECK_JUST(recorder->Stop());
+  ASSERT_EQ(recorder->num_dropped(), 0);
+  const auto trace = LoadTrace(path);
+  ASSERT_EQ(CountEvents(trace, "trace_test_kernel"), num_threads * num_spans);
+  ASSERT_EQ(CountEvents(trace, "thread_name"), num_threads);
+  for (const auto& event : trace) {
+    if (event.value("name", "") != "trace_test_kernel") { continue; }
+    ASSERT_EQ(event.at("ph"), "X");
+    ASSERT_GE(event.at("dur").get<double>(), 0);
+  }
+  std::remove(path.c_str());
+}
+
+TEST(TraceRecorder, SampleSteps) {
+  auto* recorder = TraceRecorder::Get();
+  const uint32_t name_id = recorder->InternName("trace_test_sampled");
+  const std::string path = TracePath("sampled");
+  const int64_t sample_period = 3;
+  const int64_t num_steps = 10;
+  CHECK_JUST(recorder->Start(path, sample_period));
+  for (int64_t i = 0; i < num_steps; ++i) {
+    { TraceScope scope(name_id); }
+    recorder->Step();
+  }
+  CHECK_JUST(recorder->Stop());
+  // Steps 0, 3, 6 and 9 are sampled.
+  const auto trace = LoadTrace(path);
+  ASSERT_EQ(CountEvents(trace, "trace_test_sampled"), 4);
+  ASSERT_EQ(CountEvents(trace, "step"), 4);
+  // A stopped recorder is disabled for all scopes.
+  ASSERT_FALSE(TraceRecorder::IsRecording());
+  std::remove(path.c_str());
+}
+
+TEST(TraceRecorder, Benchmark) {
+  auto* recorder = TraceRecorder::Get();
+  const uint32_t name_id = recorder->InternName("trace_test_benchmark");
+  const int64_t burst = 4096;
+  const int64_t num_bursts = 16;
+  const auto MeasureNs = [&]() {
+    std::chrono::steady_clock::duration elapsed{};
+    for (int64_t i = 0; i < num_bursts; ++i) {
+      const int64_t expected = recorder->num_written() + burst;
+      const auto start = std::chrono::steady_clock::now();
+      for (int64_t j = 0; j < burst; ++j) { TraceScope scope(name_id); }
+      elapsed += std::chrono::steady_clock::now() - start;
+      // Keep the ring from overflowing so every span takes the recording path.
+      while (TraceRecorder::IsRecording() && recorder->num_written() < expected) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    }
+    return std::chrono::duration<double, std::nano>(elapsed).count() / (burst * num_bursts);
+  };
+  const double disabled_ns = MeasureNs();
+  const std::string path = TracePath("benchmark");
+  CHECK_JUST(recorder->Start(path, 1));
+  const double recorded_ns = MeasureNs();
+  CHECK_JUST(recorder->Stop());
+  std::cout << "trace scope overhead, disabled " << disabled_ns << " ns, recorded " << recorded_ns
+            << " ns (budget " << TraceRecorder::kTraceOverheadBudgetNs << " ns), dropped "
+            << recorder->num_dropped() << std::endl;
+  std::remove(path.c_str());
+}
+
+}  // namespace test
+}  // namespace profiler
+}  // namespace oneflow
@@ -26,7 +26,9 @@ limitations under the License.
 
 namespace oneflow {
 
-Thread::Thread(const StreamId& stream_id) : thrd_id_(EncodeStreamIdToInt64(stream_id)) {
+Thread::Thread(const StreamId& stream_id)
+    : msg_channel_(ParseIntegerFromEnv("ONEFLOW_THREAD_MESSAGE_CHANNEL_CAPACITY", 4096)),
+      thrd_id_(EncodeStreamIdToInt64(stream_id)) {
   local_msg_queue_enabled_ = ParseBooleanFromEnv("ONEFLOW_THREAD_ENABLE_LOCAL_MESSAGE_QUEUE", true);
   light_actor_enabled_ = ParseBooleanFromEnv("ONEFLOW_ACTOR_ENABLE_LIGHT_ACTOR", true);
   if (IsClassRegistered<int, StreamContext, const StreamId&>(stream_id.device_id().device_type(),
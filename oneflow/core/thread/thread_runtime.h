@@ -21,6 +21,7 @@ limitations under the License.
 #include "oneflow/core/common/balanced_splitter.h"
 #include "oneflow/core/thread/thread.h"
 #include "oneflow/core/thread/thread_pool.h"
+#include "oneflow/core/thread/work_stealing_thread_pool.h"
 #include "oneflow/core/platform/include/pthread_fork.h"
 
 #ifdef WITH_TBB
@@ -93,6 +94,21 @@ class OfRuntime final : public RuntimeBase {
   }
 };
 
+class WsRuntime final : public RuntimeBase {
+ private:
+  // Each thread gets several chunks so that stealing can rebalance uneven iterations.
+  static constexpr size_t kChunksPerThread = 4;
+
+  void ParallelForImpl(int64_t begin, int64_t end, const CallableT& func, size_t num_threads,
+                       size_t grain_size) override {
+    if (unlikely(pthread_fork::IsForkedSubProcess())) { return SeqFor(begin, end, func); }
+    const size_t num_elements = end - begin;
+    const size_t chunk_size = std::max(DivUp(num_elements, num_threads * kChunksPerThread),
+                                       std::max<size_t>(grain_size, 1));
+    WorkStealingThreadPool::Get()->ParallelFor(begin, end, func, num_threads, chunk_size);
+  }
+};
+
 #if WITH_TBB
 class TbbRuntime final : public RuntimeBase {
  private:
@@ -33,6 +33,7 @@ std::shared_ptr<thread::RuntimeBase> CreateRuntime() {
 
 Maybe<thread::RuntimeBase> RuntimeFactory::Create(RuntimeType type) {
   if (type == RuntimeType::kOf) { return CreateRuntime<thread::OfRuntime>(); }
+  if (type == RuntimeType::kWs) { return CreateRuntime<thread::WsRuntime>(); }
   const auto format_error_msg = [](const auto& name, const auto& option) {
     return fmt::format("{} is not enabled, you should compile oneflow with "
                        "`-DCPU_THREADING_RUNTIMES={}`",
@@ -60,6 +61,7 @@ Maybe<thread::RuntimeBase> RuntimeFactory::Create(const std::string& type) {
       {"OF", RuntimeType::kOf},
       {"TBB", RuntimeType::kTbb},
       {"OMP", RuntimeType::kOmp},
+      {"WS", RuntimeType::kWs},
   };
   if (types.find(type) == types.end()) {
     return Error::RuntimeError() << fmt::format("Not supportted cpu threading runtime: {}", type);
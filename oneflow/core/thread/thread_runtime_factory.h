@@ -42,6 +42,7 @@ enum class RuntimeType {
   kOf,
   kTbb,
   kOmp,
+  kWs,
 };
 
 class RuntimeFactory {
@@ -0,0 +1,147 @@
+/*
+Copyright 2020 The OneFlow Authors. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include <gtest/gtest.h>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+#include "oneflow/core/thread/thread_runtime_factory.h"
+
+namespace oneflow {
+namespace test {
+
+namespace {
+
+size_t NumThreads() { return std::max<size_t>(std::thread::hardware_concurrency(), 2); }
+
+void TestVisitEachIndexOnce(thread::RuntimeBase* runtime, int64_t num_elements,
+                            size_t grain_size) {
+  std::vector<std::atomic<int32_t>> visited(num_elements);
+  for (auto& v : visited) { v.store(0); }
+  runtime->ParallelFor(
+      0, num_elements,
+      [&](int64_t begin, int64_t end) {
+        for (int64_t i = begin; i < end; ++i) { visited[i].fetch_add(1); }
+      },
+      NumThreads(), grain_size);
+  for (int64_t i = 0; i < num_elements; ++i) { ASSERT_EQ(visited[i].load(), 1) << i; }
+}
+
+double BenchmarkMs(thread::RuntimeBase* runtime, int64_t num_elements, bool uneven,
+                   size_t grain_size, int64_t repeat) {
+  std::vector<float> x(num_elements, 1.f);
+  std::vector<float> y(num_elements, 0.f);
+  const auto func = [&](int64_t begin, int64_t end) {
+    for (int64_t i = begin; i < end; ++i) {
+      float v = x[i];
+      // Later iterations are more expensive, like batches of variable-size images.
+      const int64_t rounds = uneven ? 1 + (i * 64 / num_elements) : 1;
+      for (int64_t r = 0; r < rounds; ++r) { v = std::sqrt(v + 1.f); }
+      y[i] = v;
+    }
+  };
+  runtime->ParallelFor(0, num_elements, func, NumThreads(), grain_size);
+  const auto start = std::chrono::steady_clock::now();
+  for (int64_t i = 0; i < repeat; ++i) {
+    runtime->ParallelFor(0, num_elements, func, NumThreads(), grain_size);
+  }
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  return std::chrono::duration<double, std::milli>(elapsed).count() / repeat;
+}
+
+}  // namespace
+
+TEST(WsRuntime, VisitEachIndexOnce) {
+  auto runtime = CHECK_JUST(thread::RuntimeFactory::Create(thread::RuntimeType::kWs));
+  for (int64_t num_elements : {1, 7, 1000, 100003}) {
+    for (size_t grain_size : {1, 16, 32768}) {
+      TestVisitEachIndexOnce(runtime.get(), num_elements, grain_size);
+    }
+  }
+}
+
+TEST(WsRuntime, NestedParallelFor) {
+  auto runtime = CHECK_JUST(thread::RuntimeFactory::Create(thread::RuntimeType::kWs));
+  const int64_t rows = 64;
+  const int64_t cols = 1000;
+  std::vector<std::atomic<int32_t>> visited(rows * cols);
+  for (auto& v : visited) { v.store(0); }
+  runtime->ParallelFor(
+      0, rows,
+      [&](int64_t row_begin, int64_t row_end) {
+        for (int64_t row = row_begin; row < row_end; ++row) {
+          runtime->ParallelFor(
+              0, cols,
+              [&](int64_t begin, int64_t end) {
+                for (int64_t i = begin; i < end; ++i) { visited[row * cols + i].fetch_add(1); }
+              },
+              NumThreads(), 1);
+        }
+      },
+      NumThreads(), 1);
+  for (const auto& v : visited) { ASSERT_EQ(v.load(), 1); }
+}
+
+TEST(WsRuntime, ConcurrentCallers) {
+  auto runtime = CHECK_JUST(thread::RuntimeFactory::Create(thread::RuntimeType::kWs));
+  std::vector<std::thread> callers;
+  for (int i = 0; i < 4; ++i) {
+    callers.emplace_back([&]() {
+      for (int j = 0; j < 100; ++j) { TestVisitEachIndexOnce(runtime.get(), 4099, 8); }
+    });
+  }
+  for (auto& caller : callers) { caller.join(); }
+}
+
+TEST(WsRuntime, ExceptionInLoopBody) {
+  auto runtime = CHECK_JUST(thread::RuntimeFactory::Create(thread::RuntimeType::kWs));
+  for (int repeat = 0; repeat < 100; ++repeat) {
+    std::atomic<int64_t> num_visited(0);
+    // every chunk throws, including the ones run by the calling thread
+    ASSERT_THROW(runtime->ParallelFor(
+                     0, 4096,
+                     [&](int64_t begin, int64_t end) {
+                       num_visited.fetch_add(end - begin);
+                       throw std::runtime_error("loop body failed");
+                     },
+                     NumThreads(), 1),
+                 std::runtime_error);
+    ASSERT_GT(num_visited.load(), 0);
+    // the pool is still usable
+    TestVisitEachIndexOnce(runtime.get(), 1000, 1);
+  }
+}
+
+TEST(ThreadRuntime, Benchmark) {
+  std::vector<std::string> runtime_names{"SEQ", "OF", "WS"};
+  if (thread::IsTbbEnabled()) { runtime_names.emplace_back("TBB"); }
+  if (thread::IsOmpEnabled()) { runtime_names.emplace_back("OMP"); }
+  const bool has_thread_pool = Singleton<ThreadPool>::Get() != nullptr;
+  if (!has_thread_pool) { Singleton<ThreadPool>::New(NumThreads()); }
+  for (const auto& name : runtime_names) {
+    auto runtime = CHECK_JUST(thread::RuntimeFactory::Create(name));
+    for (int64_t num_elements : {1 << 10, 1 << 14, 1 << 18, 1 << 22}) {
+      const int64_t repeat = std::max<int64_t>((1 << 24) / num_elements, 4);
+      const double even_ms = BenchmarkMs(runtime.get(), num_elements, false, 1024, repeat);
+      const double uneven_ms = BenchmarkMs(runtime.get(), num_elements, true, 1024, repeat / 4);
+      std::cout << "runtime " << name << ", elements " << num_elements << ", elementwise "
+                << even_ms << " ms, uneven " << uneven_ms << " ms" << std::endl;
+    }
+  }
+  if (!has_thread_pool) { Singleton<ThreadPool>::Delete(); }
+}
+
+}  // namespace test
+}  // namespace oneflow
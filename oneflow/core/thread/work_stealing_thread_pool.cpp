@@ -0,0 +1,254 @@
+/*
+Copyright 2020 The OneFlow Authors. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "oneflow/core/thread/work_stealing_thread_pool.h"
+#include "oneflow/core/common/spin_wait.h"
+#include "oneflow/core/vm/sync_vm_mode_guard.h"
+
+namespace oneflow {
+namespace thread {
+
+namespace {
+
+constexpr size_t kSpinCountBeforeSleep = 1 << 14;
+constexpr size_t kSpinCountBeforeYield = 1 << 10;
+constexpr uint64_t kNumParticipantsMask = 0xFFFF;
+constexpr uint64_t kJobClosedBit = 1ULL << 31;
+constexpr uint64_t kJobActiveMask = kJobClosedBit - 1;
+
+thread_local bool in_parallel_region = false;
+
+inline uint64_t PackRange(uint64_t lo, uint64_t hi) { return (hi << 32) | lo; }
+inline uint64_t RangeLo(uint64_t range) { return range & 0xFFFFFFFF; }
+inline uint64_t RangeHi(uint64_t range) { return range >> 32; }
+
+inline uint64_t TicketEpoch(uint64_t ticket) { return ticket >> 16; }
+inline size_t TicketNumParticipants(uint64_t ticket) { return ticket & kNumParticipantsMask; }
+
+inline uint64_t JobStateEpoch(uint64_t state) { return state >> 32; }
+
+class ParallelRegionGuard final {
+ public:
+  ParallelRegionGuard() : prev_(in_parallel_region) { in_parallel_region = true; }
+  ~ParallelRegionGuard() { in_parallel_region = prev_; }
+
+ private:
+  bool prev_;
+};
+
+size_t GetDefaultNumWorkers() {
+  const int64_t hardware_threads = std::max<int64_t>(std::thread::hardware_concurrency(), 1);
+  const int64_t num_workers =
+      ParseIntegerFromEnv("ONEFLOW_WORK_STEALING_RUNTIME_NUM_WORKERS", hardware_threads - 1);
+  return std::max<int64_t>(num_workers, 0);
+}
+
+}  // namespace
+
+struct WorkStealingThreadPool::Job {
+  Job(int64_t begin, int64_t end, int64_t chunk_size, size_t num_participants,
+      const std::function<void(int64_t, int64_t)>* func)
+      : begin(begin),
+        end(end),
+        chunk_size(chunk_size),
+        num_participants(num_participants),
+        func(func),
+        cancelled(false) {}
+
+  int64_t begin;
+  int64_t end;
+  int64_t chunk_size;
+  size_t num_participants;
+  const std::function<void(int64_t, int64_t)>* func;
+  // Set once `func` throws, the participants stop claiming chunks.
+  std::atomic<bool> cancelled;
+  std::mutex error_mutex;
+  // The first exception thrown by `func`, rethrown by the submitter after all workers left.
+  std::exception_ptr error;
+};
+
+WorkStealingThreadPool::WorkStealingThreadPool(size_t num_workers)
+    : slots_(new RangeSlot[std::min<size_t>(num_workers + 1, kNumParticipantsMask)]),
+      job_(nullptr),
+      ticket_(0),
+      job_state_(0),
+      num_sleeping_(0),
+      shutdown_(false) {
+  num_workers = std::min<size_t>(num_workers, kNumParticipantsMask - 1);
+  FOR_RANGE(size_t, i, 0, num_workers + 1) { slots_[i].range.store(0, std::memory_order_relaxed); }
+  workers_.reserve(num_workers);
+  FOR_RANGE(size_t, i, 0, num_workers) {
+    workers_.emplace_back([this, i]() { WorkerLoop(i + 1); });
+  }
+}
+
+WorkStealingThreadPool::~WorkStealingThreadPool() {
+  shutdown_.store(true);
+  {
+    std::unique_lock<std::mutex> lock(sleep_mutex_);
+    sleep_cond_.notify_all();
+  }
+  for (auto& worker : workers_) { worker.join(); }
+}
+
+bool WorkStealingThreadPool::InParallelRegion() { return in_parallel_region; }
+
+WorkStealingThreadPool* WorkStealingThreadPool::Get() {
+  static WorkStealingThreadPool pool(GetDefaultNumWorkers());
+  return &pool;
+}
+
+void WorkStealingThreadPool::ParallelFor(int64_t begin, int64_t end,
+                                         const std::function<void(int64_t, int64_t)>& func,
+                                         size_t num_threads, size_t chunk_size) {
+  if (begin >= end) { return; }
+  const uint64_t num_elements = end - begin;
+  chunk_size = std::max<uint64_t>(chunk_size, 1);
+  // chunk ids must fit into one half of a packed range.
+  chunk_size = std::max<uint64_t>(chunk_size, (num_elements + 0xFFFFFFFE) / 0xFFFFFFFF);
+  const uint64_t num_chunks = (num_elements + chunk_size - 1) / chunk_size;
+  const size_t num_participants =
+      std::min<uint64_t>({num_threads, num_chunks, workers_.size() + 1});
+  if (num_participants <= 1 || in_parallel_region) { return func(begin, end); }
+  std::unique_lock<std::mutex> submit_lock(submit_mutex_, std::try_to_lock);
+  // Another stream owns the workers, doing the work here is cheaper than waiting for them.
+  if (!submit_lock.owns_lock()) { return func(begin, end); }
+
+  Job job(begin, end, static_cast<int64_t>(chunk_size), num_participants, &func);
+  FOR_RANGE(size_t, i, 0, num_participants) {
+    const uint64_t lo = num_chunks * i / num_participants;
+    const uint64_t hi = num_chunks * (i + 1) / num_participants;
+    slots_[i].range.store(PackRange(lo, hi), std::memory_order_relaxed);
+  }
+  job_ = &job;
+  const uint64_t epoch = TicketEpoch(ticket_.load(std::memory_order_relaxed)) + 1;
+  job_state_.store((epoch & 0xFFFFFFFF) << 32, std::memory_order_relaxed);
+  ticket_.store((epoch << 16) | num_participants);
+  if (num_sleeping_.load() > 0) {
+    std::unique_lock<std::mutex> lock(sleep_mutex_);
+    sleep_cond_.notify_all();
+  }
+  {
+    ParallelRegionGuard guard;
+    // Never throws, so the workers referencing `job` are always waited for below.
+    RunSlot(&job, 0);
+  }
+  // All chunks have been claimed, keep late workers out and wait for the ones still running.
+  uint64_t state = job_state_.fetch_or(kJobClosedBit, std::memory_order_acq_rel);
+  for (size_t i = 1; (state & kJobActiveMask) != 0; ++i) {
+    if (i % kSpinCountBeforeYield == 0) {
+      std::this_thread::yield();
+    } else {
+      CpuRelax();
+    }
+    state = job_state_.load(std::memory_order_acquire);
+  }
+  job_ = nullptr;
+  if (job.error) { std::rethrow_exception(job.error); }
+}
+
+void WorkStealingThreadPool::WorkerLoop(size_t slot_id) {
+  SyncVmModeGuard guard(SyncVmMode::kEnable);
+  in_parallel_region = true;
+  uint64_t seen_epoch = 0;
+  while (true) {
+    uint64_t ticket = ticket_.load(std::memory_order_acquire);
+    for (size_t i = 0; i < kSpinCountBeforeSleep && TicketEpoch(ticket) == seen_epoch; ++i) {
+      if (shutdown_.load(std::memory_order_relaxed)) { return; }
+      CpuRelax();
+      ticket = ticket_.load(std::memory_order_acquire);
+    }
+    if (TicketEpoch(ticket) == seen_epoch) {
+      std::unique_lock<std::mutex> lock(sleep_mutex_);
+      num_sleeping_.fetch_add(1);
+      sleep_cond_.wait(lock, [&]() {
+        ticket = ticket_.load();
+        return shutdown_.load() || TicketEpoch(ticket) != seen_epoch;
+      });
+      num_sleeping_.fetch_sub(1);
+      if (TicketEpoch(ticket) == seen_epoch) { return; }
+    }
+    seen_epoch = TicketEpoch(ticket);
+    if (slot_id >= TicketNumParticipants(ticket)) { continue; }
+    uint64_t state = job_state_.load(std::memory_order_acquire);
+    bool joined = false;
+    while (JobStateEpoch(state) == (seen_epoch & 0xFFFFFFFF) && (state & kJobClosedBit) == 0) {
+      if (job_state_.compare_exchange_weak(state, state + 1, std::memory_order_acq_rel,
+                                           std::memory_order_acquire)) {
+        joined = true;
+        break;
+      }
+    }
+    if (!joined) { continue; }
+    // The submitter waits for every joined worker before publishing the next loop, so `job_` is
+    // stable here.
+    RunSlot(job_, slot_id);
+    job_state_.fetch_sub(1, std::memory_order_release);
+  }
+}
+
+void WorkStealingThreadPool::RunSlot(Job* job, size_t slot_id) {
+  const auto Cancelled = [job]() { return job->cancelled.load(std::memory_order_relaxed); };
+  try {
+    int64_t chunk_id = 0;
+    do {
+      while (!Cancelled() && PopFront(slot_id, &chunk_id)) {
+        const int64_t chunk_begin = job->begin + chunk_id * job->chunk_size;
+        const int64_t chunk_end = std::min(job->end, chunk_begin + job->chunk_size);
+        (*job->func)(chunk_begin, chunk_end);
+      }
+    } while (!Cancelled() && StealHalf(slot_id, job->num_participants));
+  } catch (...) {
+    std::lock_guard<std::mutex> lock(job->error_mutex);
+    if (!job->error) { job->error = std::current_exception(); }
+    job->cancelled.store(true, std::memory_order_relaxed);
+  }
+}
+
+bool WorkStealingThreadPool::PopFront(size_t slot_id, int64_t* chunk_id) {
+  std::atomic<uint64_t>* range = &slots_[slot_id].range;
+  uint64_t cur = range->load(std::memory_order_acquire);
+  while (RangeLo(cur) < RangeHi(cur)) {
+    if (range->compare_exchange_weak(cur, PackRange(RangeLo(cur) + 1, RangeHi(cur)),
+                                     std::memory_order_acq_rel, std::memory_order_acquire)) {
+      *chunk_id = RangeLo(cur);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool WorkStealingThreadPool::StealHalf(size_t thief_id, size_t num_participants) {
+  FOR_RANGE(size_t, i, 1, num_participants) {
+    const size_t victim_id = (thief_id + i) % num_participants;
+    std::atomic<uint64_t>* range = &slots_[victim_id].range;
+    uint64_t cur = range->load(std::memory_order_acquire);
+    while (RangeLo(cur) < RangeHi(cur)) {
+      const uint64_t lo = RangeLo(cur);
+      const uint64_t hi = RangeHi(cur);
+      const uint64_t mid = lo + (hi - lo) / 2;
+      if (range->compare_exchange_weak(cur, PackRange(lo, mid), std::memory_order_acq_rel,
+                                       std::memory_order_acquire)) {
+        // The thief's own range is empty, so no other thread can be racing on it.
+        slots_[thief_id].range.store(PackRange(mid, hi), std::memory_order_release);
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+}  // namespace thread
+}  // namespace oneflow
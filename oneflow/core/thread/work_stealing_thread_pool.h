@@ -0,0 +1,90 @@
+/*
+Copyright 2020 The OneFlow Authors. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef ONEFLOW_CORE_THREAD_WORK_STEALING_THREAD_POOL_H_
+#define ONEFLOW_CORE_THREAD_WORK_STEALING_THREAD_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "oneflow/core/common/util.h"
+
+namespace oneflow {
+namespace thread {
+
+// A thread pool dedicated to fork-join loops.
+//
+// Every participant of a ParallelFor owns a lock-free range deque of chunk indices packed into a
+// single 64-bit word. The owner pops chunks from the front and idle participants steal the back
+// half of a victim's range, so unevenly loaded iterations are rebalanced without any per-chunk
+// allocation. The calling thread always participates as slot 0.
+class WorkStealingThreadPool final {
+ public:
+  OF_DISALLOW_COPY_AND_MOVE(WorkStealingThreadPool);
+  explicit WorkStealingThreadPool(size_t num_workers);
+  ~WorkStealingThreadPool();
+
+  size_t num_workers() const { return workers_.size(); }
+
+  // Runs func over [begin, end) in chunks of `chunk_size` using at most `num_threads` threads
+  // (including the calling one). Nested calls and calls racing with another in-flight loop run
+  // sequentially on the calling thread. If `func` throws, the remaining chunks are skipped and the
+  // first exception is rethrown on the calling thread once all workers have left the loop.
+  void ParallelFor(int64_t begin, int64_t end, const std::function<void(int64_t, int64_t)>& func,
+                   size_t num_threads, size_t chunk_size);
+
+  // True if the current thread is executing inside a work-stealing parallel region.
+  static bool InParallelRegion();
+
+  static WorkStealingThreadPool* Get();
+
+ private:
+  struct Job;
+  struct alignas(64) RangeSlot {
+    std::atomic<uint64_t> range;
+  };
+
+  void WorkerLoop(size_t slot_id);
+  void RunSlot(Job* job, size_t slot_id);
+  bool PopFront(size_t slot_id, int64_t* chunk_id);
+  bool StealHalf(size_t thief_id, size_t num_participants);
+
+  std::vector<std::thread> workers_;
+  std::unique_ptr<RangeSlot[]> slots_;
+
+  std::mutex submit_mutex_;
+  Job* job_;
+  // (epoch << 16) | num_participants, wakes up the workers of a newly published loop.
+  std::atomic<uint64_t> ticket_;
+  // (epoch << 32) | closed bit | number of active workers. A worker joins a loop by incrementing
+  // the active count of the matching epoch, and the submitter closes the loop once it has run out
+  // of chunks, so it only waits for workers that actually started instead of sleeping ones.
+  std::atomic<uint64_t> job_state_;
+
+  std::mutex sleep_mutex_;
+  std::condition_variable sleep_cond_;
+  std::atomic<size_t> num_sleeping_;
+  std::atomic<bool> shutdown_;
+};
+
+}  // namespace thread
+}  // namespace oneflow
+
+#endif  // ONEFLOW_CORE_THREAD_WORK_STEALING_THREAD_POOL_H_
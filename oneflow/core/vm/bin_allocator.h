@@ -16,14 +16,52 @@ limitations under the License.
 #ifndef ONEFLOW_CORE_VM_BIN_ALLOCATOR_H_
 #define ONEFLOW_CORE_VM_BIN_ALLOCATOR_H_
 
+#include <array>
 #include <cstdint>
+#include <map>
 #include "oneflow/core/vm/allocator.h"
 #include "oneflow/core/vm/caching_allocator.h"
 #include "oneflow/core/common/util.h"
+#include "oneflow/core/common/spin_wait.h"
+#include "oneflow/core/common/env_var/env_var.h"
 
 namespace oneflow {
+
+DEFINE_ENV_BOOL(ONEFLOW_VM_BIN_ALLOCATOR_ENABLE_SIZE_CLASS_CACHE, true);
+
 namespace vm {
 
+// Counters of the size-class cache which serves small requests in front of the bins.
+struct SizeClassCacheStats {
+  // bytes of slabs carved out of the bins
+  size_t reserved_bytes = 0;
+  // bytes of size-class objects currently handed out
+  size_t used_bytes = 0;
+  // bytes requested by the callers of the handed out objects
+  size_t requested_bytes = 0;
+  // allocations served by the magazine of the owner thread, without any lock
+  uint64_t magazine_hits = 0;
+  // allocations served by the locked per-class depot
+  uint64_t depot_hits = 0;
+  // allocations which had to carve a new slab out of the bins
+  uint64_t slab_misses = 0;
+  // allocations too large for the cache
+  uint64_t bin_allocations = 0;
+
+  double HitRate() const {
+    const uint64_t total = magazine_hits + depot_hits + slab_misses;
+    return total == 0 ? 0 : static_cast<double>(magazine_hits + depot_hits) / total;
+  }
+  // Padding wasted by rounding requests up to their size class.
+  double InternalFragmentation() const {
+    return used_bytes == 0 ? 0 : 1 - static_cast<double>(requested_bytes) / used_bytes;
+  }
+  // Slab bytes which are cached but not handed out.
+  double SlabFragmentation() const {
+    return reserved_bytes == 0 ? 0 : 1 - static_cast<double>(used_bytes) / reserved_bytes;
+  }
+};
+
 template<typename ThreadLock>
 class BinAllocator final : public CachingAllocator {
  public:
@@ -37,10 +75,14 @@ class BinAllocator final : public CachingAllocator {
     backend_->DeviceReset();
   }
   void Shrink() override {
+    MagazineGuard magazine_guard(this);
     typename ThreadLock::RAIIGuard guard(thread_lock_);
+    ReleaseFreeSlabs(/*flush_magazines=*/true);
     DeallocateFreeBlockForGarbageCollection();
   }
 
+  SizeClassCacheStats GetSizeClassCacheStats() const;
+
  private:
   static constexpr int32_t kInvalidBinNum = -1;
   static constexpr int32_t kBinNumSize = 20;
@@ -123,6 +165,75 @@ class BinAllocator final : public CachingAllocator {
   Maybe<bool> AllocateBlockToExtendTotalMem(size_t aligned_size);
   bool DeallocateFreeBlockForGarbageCollection();
 
+  // Both require thread_lock_ to be held. `magazine_guarded` tells whether the caller also holds
+  // the magazine guard.
+  Maybe<void> AllocateFromBins(char** mem_ptr, size_t aligned_size, size_t size,
+                               bool magazine_guarded);
+  void DeallocateToBins(char* mem_ptr, size_t size);
+
+  // Requests no larger than kSizeClassMaxBytes are rounded up to one of a few size classes (four
+  // per power of two) and served from slabs, i.e. runs of equal-sized objects carved out of the
+  // bins in one go. Free objects are kept in plain pointer stacks outside of the memory itself,
+  // which may live on the device:
+  //   - the magazines, owned by the first thread allocating from this allocator (the worker
+  //     thread of the stream in practice), are accessed without taking thread_lock_;
+  //   - the depots are shared by all threads and guarded by thread_lock_.
+  // Magazines exchange half of their capacity with the depots when they run empty or full, and
+  // depots carve a new slab when they run empty. Shrink() returns fully free slabs to the bins.
+  static constexpr size_t kSizeClassMaxBytes = 64 << 10;
+  static constexpr size_t kSlabBytes = 512 << 10;
+  static constexpr size_t kMinObjectsPerSlab = 8;
+  static constexpr size_t kMagazineCapacity = 64;
+
+  struct SizeClass {
+    size_t size = 0;
+    size_t objects_per_slab = 0;
+    std::vector<char*> depot;
+  };
+
+  struct Magazine {
+    size_t count = 0;
+    std::array<char*, kMagazineCapacity> ptrs;
+  };
+
+  struct Slab {
+    size_t size = 0;
+    int32_t size_class = 0;
+  };
+
+  // Guards the magazines against Shrink(), which may run on another thread. It is never
+  // contended on the allocation path.
+  class MagazineGuard final {
+   public:
+    explicit MagazineGuard(BinAllocator* allocator) : allocator_(allocator) {
+      while (allocator_->magazine_busy_.exchange(true, std::memory_order_acquire)) { CpuRelax(); }
+    }
+    ~MagazineGuard() { allocator_->magazine_busy_.store(false, std::memory_order_release); }
+
+   private:
+    BinAllocator* allocator_;
+  };
+
+  void InitSizeClasses();
+  bool IsSizeClassSize(size_t aligned_size) const {
+    return !size_classes_.empty() && aligned_size <= kSizeClassMaxBytes;
+  }
+  int32_t SizeClass4AlignedSize(size_t aligned_size) const {
+    return size_class4aligned_units_.at(aligned_size / alignment_ - 1);
+  }
+  bool IsMagazineOwner();
+  Maybe<void> AllocateFromSizeClass(char** mem_ptr, size_t aligned_size, size_t size);
+  void DeallocateToSizeClass(char* mem_ptr, size_t aligned_size, size_t size);
+  // Pop an object from the depot, carving a new slab if the depot is empty.
+  // Requires thread_lock_ to be held.
+  Maybe<char*> PopFromDepot(int32_t size_class, bool magazine_guarded);
+  // Requires thread_lock_ to be held, and the magazine guard as well if `flush_magazines`. Without
+  // flushing, slabs with objects cached in the magazines are kept.
+  void ReleaseFreeSlabs(bool flush_magazines);
+  // Returns the free slabs to the bins before retrying an allocation which ran out of memory.
+  // Requires thread_lock_ to be held.
+  void ReleaseFreeSlabsForRetry(bool magazine_guarded);
+
   const size_t alignment_;
   const std::unique_ptr<Allocator> backend_;
   ThreadLock thread_lock_;
@@ -133,6 +244,21 @@ class BinAllocator final : public CachingAllocator {
   std::vector<std::unique_ptr<Piece>> pieces_;
   HashMap<char*, Piece*> ptr2piece_;
   Piece* recycle_piece_list_;
+
+  std::vector<SizeClass> size_classes_;
+  std::vector<uint8_t> size_class4aligned_units_;
+  std::vector<Magazine> magazines_;
+  std::atomic<std::thread::id> magazine_owner_;
+  std::atomic<bool> magazine_busy_;
+  std::map<char*, Slab> ptr2slab_;
+
+  std::atomic<size_t> slab_reserved_bytes_;
+  std::atomic<size_t> slab_used_bytes_;
+  std::atomic<size_t> slab_requested_bytes_;
+  std::atomic<uint64_t> magazine_hits_;
+  std::atomic<uint64_t> depot_hits_;
+  std::atomic<uint64_t> slab_misses_;
+  std::atomic<uint64_t> bin_allocations_;
 };
 
 namespace {
@@ -151,7 +277,16 @@ BinAllocator<ThreadLock>::BinAllocator(size_t alignment, std::unique_ptr<Allocat
       alignment_(alignment),
       backend_(std::move(backend)),
       total_memory_bytes_(0),
-      recycle_piece_list_(nullptr) {
+      recycle_piece_list_(nullptr),
+      magazine_owner_(std::thread::id()),
+      magazine_busy_(false),
+      slab_reserved_bytes_(0),
+      slab_used_bytes_(0),
+      slab_requested_bytes_(0),
+      magazine_hits_(0),
+      depot_hits_(0),
+      slab_misses_(0),
+      bin_allocations_(0) {
   CHECK_GE(alignment, 1);
   CHECK_EQ(1 << static_cast<int>(std::log2(alignment)), alignment);
   bins_.resize(kBinNumSize);
@@ -163,6 +298,34 @@ BinAllocator<ThreadLock>::BinAllocator(size_t alignment, std::unique_ptr<Allocat
     CHECK_EQ(BinNum4BinSize(bin_size * 2 - 1), i);
     CHECK_EQ(BinNum4BinSize(bin_size * 2), i == (kBinNumSize - 1) ? i : i + 1);
   }
+  if (EnvBool<ONEFLOW_VM_BIN_ALLOCATOR_ENABLE_SIZE_CLASS_CACHE>()) { InitSizeClasses(); }
+}
+
+template<typename ThreadLock>
+void BinAllocator<ThreadLock>::InitSizeClasses() {
+  if (alignment_ > kSizeClassMaxBytes) { return; }
+  const size_t num_units = kSizeClassMaxBytes / alignment_;
+  size_class4aligned_units_.resize(num_units);
+  // Four classes per power of two, e.g. 512, 1024, 1536, 2048, 2560, 3072, 3584, 4096, 5120, ...
+  // bounds the padding to 25% of the request.
+  for (size_t units = 1; units <= num_units; ++units) {
+    const size_t aligned_size = units * alignment_;
+    size_t class_size = aligned_size;
+    if (aligned_size > 4 * alignment_) {
+      const size_t floor_pow2 = size_t{1} << (63 ^ __builtin_clzll(aligned_size - 1));
+      const size_t step = std::max(alignment_, floor_pow2 / 4);
+      class_size = RoundUp(aligned_size, step);
+    }
+    if (size_classes_.empty() || size_classes_.back().size < class_size) {
+      CHECK_LT(size_classes_.size(), 256);
+      SizeClass size_class;
+      size_class.size = class_size;
+      size_class.objects_per_slab = std::max(kMinObjectsPerSlab, kSlabBytes / class_size);
+      size_classes_.emplace_back(std::move(size_class));
+    }
+    size_class4aligned_units_.at(units - 1) = size_classes_.size() - 1;
+  }
+  magazines_.resize(size_classes_.size());
 }
 
 template<typename ThreadLock>
@@ -379,17 +542,35 @@ bool BinAllocator<ThreadLock>::DeallocateFreeBlockForGarbageCollection() {
 
 template<typename ThreadLock>
 Maybe<void> BinAllocator<ThreadLock>::Allocate(char** mem_ptr, std::size_t size) {
-  typename ThreadLock::RAIIGuard guard(thread_lock_);
   if (size == 0) {
     *mem_ptr = nullptr;
     return Maybe<void>::Ok();
   }
   size_t aligned_size = MemAlignedBytes(size, alignment_);
+  if (IsSizeClassSize(aligned_size)) { return AllocateFromSizeClass(mem_ptr, aligned_size, size); }
+  typename ThreadLock::RAIIGuard guard(thread_lock_);
+  bin_allocations_.fetch_add(1, std::memory_order_relaxed);
+  return AllocateFromBins(mem_ptr, aligned_size, size, /*magazine_guarded=*/false);
+}
 
+template<typename ThreadLock>
+Maybe<void> BinAllocator<ThreadLock>::AllocateFromBins(char** mem_ptr, size_t aligned_size,
+                                                       size_t size, bool magazine_guarded) {
   Piece* piece = FindPiece(aligned_size);
 
   if (piece == nullptr) {
-    if (JUST(AllocateBlockToExtendTotalMem(aligned_size))) { piece = FindPiece(aligned_size); }
+    const auto& extended = TRY(AllocateBlockToExtendTotalMem(aligned_size));
+    if (extended.IsOk() && CHECK_JUST(extended)) { piece = FindPiece(aligned_size); }
+  }
+
+  if (piece == nullptr) {
+    // Free slabs of the size class cache and free blocks may make room, give them back and retry.
+    ReleaseFreeSlabsForRetry(magazine_guarded);
+    piece = FindPiece(aligned_size);
+    if (piece == nullptr && DeallocateFreeBlockForGarbageCollection()
+        && JUST(AllocateBlockToExtendTotalMem(aligned_size))) {
+      piece = FindPiece(aligned_size);
+    }
   }
 
   CHECK_NOTNULL_OR_RETURN(piece)
@@ -411,8 +592,15 @@ Maybe<void> BinAllocator<ThreadLock>::Allocate(char** mem_ptr, std::size_t size)
 template<typename ThreadLock>
 void BinAllocator<ThreadLock>::Deallocate(char* mem_ptr, std::size_t size) {
   if (mem_ptr == nullptr) { return; }
+  // NOTE: `size` must be the one passed to Allocate, it tells which path the memory came from.
+  size_t aligned_size = MemAlignedBytes(size, alignment_);
+  if (IsSizeClassSize(aligned_size)) { return DeallocateToSizeClass(mem_ptr, aligned_size, size); }
   typename ThreadLock::RAIIGuard guard(thread_lock_);
+  DeallocateToBins(mem_ptr, size);
+}
 
+template<typename ThreadLock>
+void BinAllocator<ThreadLock>::DeallocateToBins(char* mem_ptr, std::size_t size) {
   auto it = ptr2piece_.find(mem_ptr);
   CHECK(it != ptr2piece_.end()) << "Error! : Try deallocate mem_ptr non-existent. mem ptr = "
                                 << mem_ptr << " size = " << size;
@@ -442,6 +630,161 @@ void BinAllocator<ThreadLock>::Deallocate(char* mem_ptr, std::size_t size) {
   InsertPiece2Bin(last_piece_insert_to_bin);
 }
 
+template<typename ThreadLock>
+bool BinAllocator<ThreadLock>::IsMagazineOwner() {
+  const std::thread::id this_id = std::this_thread::get_id();
+  std::thread::id owner = magazine_owner_.load(std::memory_order_relaxed);
+  if (owner == this_id) { return true; }
+  if (owner != std::thread::id()) { return false; }
+  return magazine_owner_.compare_exchange_strong(owner, this_id, std::memory_order_relaxed);
+}
+
+template<typename ThreadLock>
+Maybe<char*> BinAllocator<ThreadLock>::PopFromDepot(int32_t size_class, bool magazine_guarded) {
+  SizeClass* cls = &size_classes_.at(size_class);
+  if (cls->depot.empty()) {
+    const size_t slab_size = cls->size * cls->objects_per_slab;
+    char* slab_ptr = nullptr;
+    JUST(AllocateFromBins(&slab_ptr, slab_size, slab_size, magazine_guarded));
+    CHECK_OR_RETURN(ptr2slab_.emplace(slab_ptr, Slab{slab_size, size_class}).second)
+        << "existed slab ptr";
+    slab_reserved_bytes_.fetch_add(slab_size, std::memory_order_relaxed);
+    slab_misses_.fetch_add(1, std::memory_order_relaxed);
+    // Push in reverse order so that lower addresses are handed out first.
+    for (size_t i = cls->objects_per_slab; i > 0; --i) {
+      cls->depot.emplace_back(slab_ptr + (i - 1) * cls->size);
+    }
+  } else {
+    depot_hits_.fetch_add(1, std::memory_order_relaxed);
+  }
+  char* ptr = cls->depot.back();
+  cls->depot.pop_back();
+  return ptr;
+}
+
+template<typename ThreadLock>
+Maybe<void> BinAllocator<ThreadLock>::AllocateFromSizeClass(char** mem_ptr, size_t aligned_size,
+                                                            size_t size) {
+  const int32_t size_class = SizeClass4AlignedSize(aligned_size);
+  if (IsMagazineOwner()) {
+    MagazineGuard magazine_guard(this);
+    Magazine* magazine = &magazines_.at(size_class);
+    if (magazine->count == 0) {
+      typename ThreadLock::RAIIGuard guard(thread_lock_);
+      *mem_ptr = JUST(PopFromDepot(size_class, /*magazine_guarded=*/true));
+      std::vector<char*>* depot = &size_classes_.at(size_class).depot;
+      while (magazine->count < kMagazineCapacity / 2 && !depot->empty()) {
+        magazine->ptrs[magazine->count++] = depot->back();
+        depot->pop_back();
+      }
+    } else {
+      *mem_ptr = magazine->ptrs[--magazine->count];
+      magazine_hits_.fetch_add(1, std::memory_order_relaxed);
+    }
+  } else {
+    typename ThreadLock::RAIIGuard guard(thread_lock_);
+    *mem_ptr = JUST(PopFromDepot(size_class, /*magazine_guarded=*/false));
+  }
+  slab_used_bytes_.fetch_add(size_classes_.at(size_class).size, std::memory_order_relaxed);
+  slab_requested_bytes_.fetch_add(size, std::memory_order_relaxed);
+  return Maybe<void>::Ok();
+}
+
+template<typename ThreadLock>
+void BinAllocator<ThreadLock>::DeallocateToSizeClass(char* mem_ptr, size_t aligned_size,
+                                                     size_t size) {
+  const int32_t size_class = SizeClass4AlignedSize(aligned_size);
+  slab_used_bytes_.fetch_sub(size_classes_.at(size_class).size, std::memory_order_relaxed);
+  slab_requested_bytes_.fetch_sub(size, std::memory_order_relaxed);
+  if (IsMagazineOwner()) {
+    MagazineGuard magazine_guard(this);
+    Magazine* magazine = &magazines_.at(size_class);
+    if (magazine->count == kMagazineCapacity) {
+      typename ThreadLock::RAIIGuard guard(thread_lock_);
+      std::vector<char*>* depot = &size_classes_.at(size_class).depot;
+      while (magazine->count > kMagazineCapacity / 2) {
+        depot->emplace_back(magazine->ptrs[--magazine->count]);
+      }
+    }
+    magazine->ptrs[magazine->count++] = mem_ptr;
+  } else {
+    typename ThreadLock::RAIIGuard guard(thread_lock_);
+    size_classes_.at(size_class).depot.emplace_back(mem_ptr);
+  }
+}
+
+template<typename ThreadLock>
+void BinAllocator<ThreadLock>::ReleaseFreeSlabsForRetry(bool magazine_guarded) {
+  if (magazine_guarded) { return ReleaseFreeSlabs(/*flush_magazines=*/true); }
+  // Waiting for the magazine guard while holding thread_lock_ could deadlock with its owner.
+  if (!magazine_busy_.exchange(true, std::memory_order_acquire)) {
+    ReleaseFreeSlabs(/*flush_magazines=*/true);
+    magazine_busy_.store(false, std::memory_order_release);
+  } else {
+    ReleaseFreeSlabs(/*flush_magazines=*/false);
+  }
+}
+
+template<typename ThreadLock>
+void BinAllocator<ThreadLock>::ReleaseFreeSlabs(bool flush_magazines) {
+  if (ptr2slab_.empty()) { return; }
+  const auto Slab4Ptr = [&](char* ptr) {
+    auto it = ptr2slab_.upper_bound(ptr);
+    CHECK(it != ptr2slab_.begin());
+    --it;
+    CHECK_LT(ptr, it->first + it->second.size);
+    return it;
+  };
+  if (flush_magazines) {
+    FOR_RANGE(size_t, i, 0, size_classes_.size()) {
+      Magazine* magazine = &magazines_.at(i);
+      std::vector<char*>* depot = &size_classes_.at(i).depot;
+      while (magazine->count > 0) { depot->emplace_back(magazine->ptrs[--magazine->count]); }
+    }
+  }
+  HashMap<char*, size_t> slab_ptr2free_cnt;
+  for (const auto& size_class : size_classes_) {
+    for (char* ptr : size_class.depot) { slab_ptr2free_cnt[Slab4Ptr(ptr)->first] += 1; }
+  }
+  HashSet<char*> free_slab_ptrs;
+  for (const auto& pair : slab_ptr2free_cnt) {
+    const SizeClass& size_class = size_classes_.at(ptr2slab_.at(pair.first).size_class);
+    if (pair.second == size_class.objects_per_slab) { free_slab_ptrs.insert(pair.first); }
+  }
+  if (free_slab_ptrs.empty()) { return; }
+  for (auto& size_class : size_classes_) {
+    auto* depot = &size_class.depot;
+    depot->erase(std::remove_if(depot->begin(), depot->end(),
+                                [&](char* ptr) {
+                                  return free_slab_ptrs.count(Slab4Ptr(ptr)->first) > 0;
+                                }),
+                 depot->end());
+  }
+  size_t released_bytes = 0;
+  for (char* slab_ptr : free_slab_ptrs) {
+    auto it = ptr2slab_.find(slab_ptr);
+    released_bytes += it->second.size;
+    DeallocateToBins(slab_ptr, it->second.size);
+    ptr2slab_.erase(it);
+  }
+  slab_reserved_bytes_.fetch_sub(released_bytes, std::memory_order_relaxed);
+  VLOG(3) << "BinAllocator release " << free_slab_ptrs.size() << " free slabs, "
+          << released_bytes << " bytes";
+}
+
+template<typename ThreadLock>
+SizeClassCacheStats BinAllocator<ThreadLock>::GetSizeClassCacheStats() const {
+  SizeClassCacheStats stats;
+  stats.reserved_bytes = slab_reserved_bytes_.load(std::memory_order_relaxed);
+  stats.used_bytes = slab_used_bytes_.load(std::memory_order_relaxed);
+  stats.requested_bytes = slab_requested_bytes_.load(std::memory_order_relaxed);
+  stats.magazine_hits = magazine_hits_.load(std::memory_order_relaxed);
+  stats.depot_hits = depot_hits_.load(std::memory_order_relaxed);
+  stats.slab_misses = slab_misses_.load(std::memory_order_relaxed);
+  stats.bin_allocations = bin_allocations_.load(std::memory_order_relaxed);
+  return stats;
+}
+
 }  // namespace vm
 }  // namespace oneflow
 
@@ -13,16 +13,164 @@ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 See the License for the specific language governing permissions and
 limitations under the License.
 */
+#include <chrono>
+#include <cstdlib>
 #include <memory>
-#ifdef WITH_CUDA
 #include "gtest/gtest.h"
 #include "oneflow/core/vm/bin_allocator.h"
 #include "oneflow/core/vm/thread_safe_guard.h"
+#ifdef WITH_CUDA
 #include "oneflow/core/device/cuda_util.h"
+#endif
 
 namespace oneflow {
 namespace vm {
 
+class HostBackendAllocator final : public CachingAllocator {
+ public:
+  HostBackendAllocator() : allocated_bytes_(0), limit_bytes_(SIZE_MAX) {}
+  ~HostBackendAllocator() override = default;
+
+  Maybe<void> Allocate(char** mem_ptr, std::size_t size) override {
+    if (allocated_bytes_ + size > limit_bytes_) {
+      return Error::OutOfMemoryError() << "host backend limit exceeded";
+    }
+    *mem_ptr = static_cast<char*>(aligned_alloc(kCudaMemAllocAlignSize, size));
+    allocated_bytes_ += size;
+    return Maybe<void>::Ok();
+  }
+  void Deallocate(char* mem_ptr, std::size_t size) override {
+    free(mem_ptr);
+    allocated_bytes_ -= size;
+  }
+  void DeviceReset() override {}
+  void Shrink() override{};
+
+  size_t allocated_bytes() const { return allocated_bytes_; }
+  void set_limit_bytes(size_t limit_bytes) { limit_bytes_ = limit_bytes; }
+
+ private:
+  std::atomic<size_t> allocated_bytes_;
+  size_t limit_bytes_;
+};
+
+std::unique_ptr<BinAllocator<ThreadSafeLock>> NewHostBinAllocator(bool enable_size_class_cache,
+                                                                 HostBackendAllocator** backend) {
+  setenv("ONEFLOW_VM_BIN_ALLOCATOR_ENABLE_SIZE_CLASS_CACHE",
+         enable_size_class_cache ? "1" : "0", 1);
+  auto host_backend = std::make_unique<HostBackendAllocator>();
+  if (backend != nullptr) { *backend = host_backend.get(); }
+  auto allocator = std::make_unique<BinAllocator<ThreadSafeLock>>(kCudaMemAllocAlignSize,
+                                                                  std::move(host_backend));
+  unsetenv("ONEFLOW_VM_BIN_ALLOCATOR_ENABLE_SIZE_CLASS_CACHE");
+  return allocator;
+}
+
+void CheckDisjoint(std::vector<std::pair<char*, size_t>> ptrs) {
+  std::sort(ptrs.begin(), ptrs.end());
+  for (size_t i = 1; i < ptrs.size(); ++i) {
+    ASSERT_TRUE(ptrs.at(i - 1).first + ptrs.at(i - 1).second <= ptrs.at(i).first);
+  }
+}
+
+TEST(HostBinAllocator, size_class_cache) {
+  HostBackendAllocator* backend = nullptr;
+  auto allocator = NewHostBinAllocator(true, &backend);
+  std::vector<std::pair<char*, size_t>> ptrs;
+  for (int round = 0; round < 2; ++round) {
+    for (size_t size : {1, 4, 511, 512, 513, 1000, 4096, 5000, 65535, 65536, 65537, 1 << 20}) {
+      for (int i = 0; i < 100; ++i) {
+        char* ptr = nullptr;
+        CHECK_JUST(allocator->Allocate(&ptr, size));
+        ASSERT_TRUE(ptr != nullptr);
+        // the memory must be usable for the whole request
+        memset(ptr, i, size);
+        ptrs.emplace_back(ptr, size);
+      }
+    }
+    CheckDisjoint(ptrs);
+    for (const auto& pair : ptrs) { allocator->Deallocate(pair.first, pair.second); }
+    ptrs.clear();
+  }
+  const SizeClassCacheStats stats = allocator->GetSizeClassCacheStats();
+  ASSERT_EQ(stats.used_bytes, 0);
+  ASSERT_EQ(stats.requested_bytes, 0);
+  ASSERT_GT(stats.reserved_bytes, 0);
+  ASSERT_EQ(stats.bin_allocations, 400);
+  ASSERT_GT(stats.HitRate(), 0.5);
+
+  allocator->Shrink();
+  ASSERT_EQ(allocator->GetSizeClassCacheStats().reserved_bytes, 0);
+  ASSERT_EQ(backend->allocated_bytes(), 0);
+}
+
+TEST(HostBinAllocator, deallocate_from_other_thread) {
+  auto allocator = NewHostBinAllocator(true, nullptr);
+  std::vector<char*> ptrs(10000);
+  for (auto& ptr : ptrs) { CHECK_JUST(allocator->Allocate(&ptr, 64)); }
+  const uint64_t slab_misses = allocator->GetSizeClassCacheStats().slab_misses;
+  std::thread releaser([&]() {
+    for (char* ptr : ptrs) { allocator->Deallocate(ptr, 64); }
+  });
+  releaser.join();
+  std::vector<std::pair<char*, size_t>> new_ptrs;
+  for (int i = 0; i < 10000; ++i) {
+    char* ptr = nullptr;
+    CHECK_JUST(allocator->Allocate(&ptr, 64));
+    new_ptrs.emplace_back(ptr, 64);
+  }
+  CheckDisjoint(new_ptrs);
+  for (const auto& pair : new_ptrs) { allocator->Deallocate(pair.first, pair.second); }
+  const SizeClassCacheStats stats = allocator->GetSizeClassCacheStats();
+  ASSERT_EQ(stats.used_bytes, 0);
+  // the objects freed by the other thread are reused instead of carving new slabs
+  ASSERT_EQ(stats.slab_misses, slab_misses);
+}
+
+TEST(HostBinAllocator, release_free_slabs_when_out_of_memory) {
+  HostBackendAllocator* backend = nullptr;
+  auto allocator = NewHostBinAllocator(true, &backend);
+  // the first block of the bins is 2MB, i.e. four slabs of 512 bytes objects
+  backend->set_limit_bytes(2 << 20);
+  std::vector<char*> ptrs(4 * (512 << 10) / 512);
+  for (auto& ptr : ptrs) { CHECK_JUST(allocator->Allocate(&ptr, 512)); }
+  ASSERT_EQ(backend->allocated_bytes(), 2 << 20);
+  for (char* ptr : ptrs) { allocator->Deallocate(ptr, 512); }
+  // all of the block is cached by free slabs, which must be given back instead of failing
+  char* ptr = nullptr;
+  CHECK_JUST(allocator->Allocate(&ptr, 1 << 20));
+  ASSERT_TRUE(ptr != nullptr);
+  ASSERT_EQ(backend->allocated_bytes(), 2 << 20);
+  allocator->Deallocate(ptr, 1 << 20);
+  // the slabs are carved again when needed
+  for (auto& ptr : ptrs) { CHECK_JUST(allocator->Allocate(&ptr, 512)); }
+  for (char* ptr : ptrs) { allocator->Deallocate(ptr, 512); }
+}
+
+TEST(HostBinAllocator, small_allocation_benchmark) {
+  for (bool enable_size_class_cache : {false, true}) {
+    auto allocator = NewHostBinAllocator(enable_size_class_cache, nullptr);
+    std::vector<char*> ptrs(64);
+    const auto start = std::chrono::steady_clock::now();
+    const int64_t num_rounds = 20000;
+    for (int64_t round = 0; round < num_rounds; ++round) {
+      for (size_t i = 0; i < ptrs.size(); ++i) {
+        CHECK_JUST(allocator->Allocate(&ptrs.at(i), 4 + i * 256));
+      }
+      for (size_t i = 0; i < ptrs.size(); ++i) { allocator->Deallocate(ptrs.at(i), 4 + i * 256); }
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    const double ns_per_op = std::chrono::duration<double, std::nano>(elapsed).count()
+                             / (num_rounds * ptrs.size() * 2);
+    const SizeClassCacheStats stats = allocator->GetSizeClassCacheStats();
+    std::cout << "size class cache " << (enable_size_class_cache ? "on" : "off") << ": "
+              << ns_per_op << " ns per allocate/deallocate, hit rate " << stats.HitRate()
+              << std::endl;
+  }
+}
+
+#ifdef WITH_CUDA
+
 class CudaBackendAllocator final : public CachingAllocator {
  public:
   explicit CudaBackendAllocator(int64_t device_id) : device_id_(device_id) {}
@@ -126,7 +274,7 @@ TEST(CudaBinAllocator, cuda_allocator) {
   a->Deallocate(data_ptr_1, 2048 * sizeof(float));
 }
 
+#endif  // WITH_CUDA
+
 }  // namespace vm
 }  // namespace oneflow
-
-#endif  // WITH_CUDA
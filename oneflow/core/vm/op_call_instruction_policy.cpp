@@ -58,8 +58,14 @@ struct OpCallInstructionUtil final {
  private:
   static inline void InferTempStorageSize(OpCallInstructionPolicy* op_call_instruction_policy) {
     auto* tmp_tensor = op_call_instruction_policy->mut_call_ctx()->mut_tmp_tensor();
-    size_t temp_size = op_call_instruction_policy->opkernel().InferTmpSize(
-        op_call_instruction_policy->mut_call_ctx(), op_call_instruction_policy->user_opkernel());
+    auto* kernel_memo = op_call_instruction_policy->mut_kernel_memo();
+    int64_t temp_size =
+        kernel_memo ? kernel_memo->tmp_buffer_size.load(std::memory_order_relaxed) : -1;
+    if (temp_size < 0) {
+      temp_size = op_call_instruction_policy->opkernel().InferTmpSize(
+          op_call_instruction_policy->mut_call_ctx(), op_call_instruction_policy->user_opkernel());
+      if (kernel_memo) { kernel_memo->tmp_buffer_size.store(temp_size, std::memory_order_relaxed); }
+    }
     tmp_tensor->set_tmp_buffer_size(temp_size);
   }
 
@@ -127,7 +133,8 @@ OpCallInstructionPolicy::OpCallInstructionPolicy(
     EagerBlobObjectList&& inputs, EagerBlobObjectList&& outputs,
     const std::shared_ptr<const one::GlobalTensorInferResult>& global_tensor_infer_result,
     const one::OpExprInterpContext& op_interp_ctx,
-    const one::DevVmDepObjectConsumeMode dev_vm_dep_object_consume_mode)
+    const one::DevVmDepObjectConsumeMode dev_vm_dep_object_consume_mode,
+    const std::shared_ptr<OpCallKernelMemo>& kernel_memo)
     : vm_stream_(vm_stream),
       call_ctx_(ComposedAttrMap(op_interp_ctx.attrs, opkernel->base_attrs()), std::move(inputs),
                 std::move(outputs), global_tensor_infer_result, op_interp_ctx,
@@ -136,6 +143,7 @@ OpCallInstructionPolicy::OpCallInstructionPolicy(
       user_opkernel_(nullptr),
       infer_tmp_size_fn_(nullptr),
       need_temp_storage_(false),
+      kernel_memo_(kernel_memo),
       dev_vm_dep_object_consume_mode_(dev_vm_dep_object_consume_mode),
       input_dependences_(),
       output_dependences_() {
@@ -146,7 +154,20 @@ OpCallInstructionPolicy::OpCallInstructionPolicy(
 }
 
 Maybe<void> OpCallInstructionPolicy::Init() {
-  return mut_opkernel()->ChooseOpKernel(&call_ctx_, &user_opkernel_, &need_temp_storage_);
+  if (kernel_memo_) {
+    const auto* user_opkernel = kernel_memo_->user_opkernel.load(std::memory_order_acquire);
+    if (user_opkernel != nullptr) {
+      user_opkernel_ = user_opkernel;
+      need_temp_storage_ = kernel_memo_->need_temp_storage.load(std::memory_order_relaxed);
+      return Maybe<void>::Ok();
+    }
+  }
+  JUST(mut_opkernel()->ChooseOpKernel(&call_ctx_, &user_opkernel_, &need_temp_storage_));
+  if (kernel_memo_) {
+    kernel_memo_->need_temp_storage.store(need_temp_storage_, std::memory_order_relaxed);
+    kernel_memo_->user_opkernel.store(user_opkernel_, std::memory_order_release);
+  }
+  return Maybe<void>::Ok();
 }
 
 template<typename DoEachT>
@@ -21,6 +21,7 @@ limitations under the License.
 #include "oneflow/core/eager/dev_vm_dep_object_consume_mode.h"
 #include "oneflow/core/framework/user_op_kernel_registry.h"
 #include "oneflow/core/vm/instruction_policy.h"
+#include "oneflow/core/vm/op_call_kernel_memo.h"
 #include "oneflow/core/vm/stream.h"
 #include "oneflow/user/kernels/stateful_opkernel.h"
 
@@ -80,6 +81,7 @@ class OpCallInstructionPolicy final : public InstructionPolicy {
   bool need_temp_storage() const { return need_temp_storage_; }
   const user_op::OpKernel* user_opkernel() const { return user_opkernel_; }
   const user_op::InferTmpSizeFn& infer_tmp_size_fn() const { return *infer_tmp_size_fn_; }
+  OpCallKernelMemo* mut_kernel_memo() const { return kernel_memo_.get(); }
 
   const std::shared_ptr<const one::GlobalTensorInferResult>& global_tensor_infer_result() const {
     return call_ctx_.global_tensor_infer_result();
@@ -99,7 +101,8 @@ class OpCallInstructionPolicy final : public InstructionPolicy {
       EagerBlobObjectList&& inputs, EagerBlobObjectList&& outputs,
       const std::shared_ptr<const one::GlobalTensorInferResult>& global_tensor_infer_result,
       const one::OpExprInterpContext& op_interp_ctx,
-      const one::DevVmDepObjectConsumeMode dev_vm_dep_object_consume_mode);
+      const one::DevVmDepObjectConsumeMode dev_vm_dep_object_consume_mode,
+      const std::shared_ptr<OpCallKernelMemo>& kernel_memo);
   Maybe<void> Init();
   void InitStreamSequentialDependence();
   Maybe<void> Prepare(Instruction* instruction) override;
@@ -112,6 +115,7 @@ class OpCallInstructionPolicy final : public InstructionPolicy {
   const user_op::OpKernel* user_opkernel_;
   const user_op::InferTmpSizeFn* infer_tmp_size_fn_;
   bool need_temp_storage_;
+  std::shared_ptr<OpCallKernelMemo> kernel_memo_;
   const one::DevVmDepObjectConsumeMode dev_vm_dep_object_consume_mode_;
   DependenceVector input_dependences_;
   DependenceVector output_dependences_;
@@ -0,0 +1,46 @@
+/*
+Copyright 2020 The OneFlow Authors. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef ONEFLOW_CORE_VM_OP_CALL_KERNEL_MEMO_H_
+#define ONEFLOW_CORE_VM_OP_CALL_KERNEL_MEMO_H_
+
+#include <atomic>
+#include <cstdint>
+
+namespace oneflow {
+
+namespace user_op {
+
+class OpKernel;
+
+}  // namespace user_op
+
+namespace vm {
+
+// The kernel chosen for an op call and its temp storage size. They only depend on the attrs and
+// the tensor metas of the call, so calls of the same op with the same interned input metas share
+// one memo and skip ChooseOpKernel and InferTmpSize after the first one.
+// The kernel is chosen in the main thread and the temp size is inferred in the vm worker thread.
+struct OpCallKernelMemo final {
+  std::atomic<const user_op::OpKernel*> user_opkernel{nullptr};
+  std::atomic<bool> need_temp_storage{false};
+  // -1 means not inferred yet
+  std::atomic<int64_t> tmp_buffer_size{-1};
+};
+
+}  // namespace vm
+}  // namespace oneflow
+
+#endif  // ONEFLOW_CORE_VM_OP_CALL_KERNEL_MEMO_H_
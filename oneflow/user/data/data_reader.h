@@ -18,7 +18,7 @@ limitations under the License.
 
 #include "oneflow/user/data/dataset.h"
 #include "oneflow/user/data/parser.h"
-#include "oneflow/core/common/buffer.h"
+#include "oneflow/user/data/pipeline_metrics.h"
 
 namespace oneflow {
 
@@ -26,6 +26,12 @@ namespace data {
 
 static const int32_t kDataReaderBatchBufferSize = 4;
 
+// Number of batches the load thread prepares ahead of the kernel.
+inline int64_t GetDataReaderPrefetchDepth() {
+  return std::max<int64_t>(
+      ParseIntegerFromEnv("ONEFLOW_DATA_READER_PREFETCH_DEPTH", kDataReaderBatchBufferSize), 1);
+}
+
 template<typename LoadTarget>
 class DataReader {
  public:
@@ -33,7 +39,10 @@ class DataReader {
   using BatchType = std::vector<SampleType>;
 
   DataReader(user_op::KernelInitContext* ctx)
-      : is_closed_(false), batch_buffer_(kDataReaderBatchBufferSize) {}
+      : is_closed_(false),
+        num_read_batches_(0),
+        batch_buffer_metrics_("batch", GetDataReaderPrefetchDepth()),
+        batch_buffer_(GetDataReaderPrefetchDepth(), &batch_buffer_metrics_) {}
 
   virtual ~DataReader() {
     Close();
@@ -44,6 +53,9 @@ class DataReader {
     CHECK(load_thrd_.joinable()) << "You should call StartLoadThread before read data";
     auto batch = FetchBatchData();
     parser_->Parse(batch, ctx);
+    num_read_batches_ += 1;
+    const int64_t metrics_period = GetPipelineMetricsPeriod();
+    if (metrics_period > 0 && num_read_batches_ % metrics_period == 0) { LogPipelineMetrics(); }
   }
 
   void Close() {
@@ -77,7 +89,9 @@ class DataReader {
   }
 
   std::atomic<bool> is_closed_;
-  Buffer<BatchType> batch_buffer_;
+  int64_t num_read_batches_;
+  QueueMetrics batch_buffer_metrics_;
+  MeteredBuffer<BatchType> batch_buffer_;
   std::thread load_thrd_;
 };
 
@@ -24,10 +24,55 @@ limitations under the License.
 #include "oneflow/core/rpc/include/global_process_ctx.h"
 #include "oneflow/core/job/env_desc.h"
 #include "oneflow/user/data/dataset.h"
+#include "oneflow/user/data/pipeline_metrics.h"
 
 namespace oneflow {
 namespace data {
 
+inline std::vector<std::string> GetOFRecordPartPaths(user_op::KernelInitContext* ctx) {
+  int32_t data_part_num = ctx->Attr<int32_t>("data_part_num");
+  std::string data_dir = ctx->Attr<std::string>("data_dir");
+  std::string part_name_prefix = ctx->Attr<std::string>("part_name_prefix");
+  int32_t part_name_suffix_length = ctx->Attr<int32_t>("part_name_suffix_length");
+
+  std::vector<std::string> data_file_paths;
+  for (int i = 0; i < data_part_num; ++i) {
+    std::string num = std::to_string(i);
+    int32_t zero_count = std::max(part_name_suffix_length - static_cast<int32_t>(num.length()), 0);
+    data_file_paths.emplace_back(
+        JoinPath(data_dir, part_name_prefix + std::string(zero_count, '0') + num));
+  }
+  return data_file_paths;
+}
+
+// The parts read by this rank, as a range of the indices of GetOFRecordPartPaths().
+inline Range GetOFRecordLocalPartRange(user_op::KernelInitContext* ctx, int32_t data_part_num) {
+  int32_t parallel_id = 0;
+  int32_t parallel_num = 0;
+  bool is_local = false;
+  // NOTE(zwx): OFRecordDataset is used by OFRecordDataReader and
+  // OFRecordImageClassificationDataReader both, the latter has no attr nd_sbp,
+  // so it couldn't work in DDP for now. The If condition here could be removed when
+  // OFRecordImageClassificationDataReader had supported DDP (add attr nd_sbp)
+  // or been deprecated.
+  if (ctx->op_type_name() == "OFRecordReader") {
+    auto nd_sbp_str_vec = ctx->Attr<std::vector<std::string>>("nd_sbp");
+    // NOTE(zwx): OFRecordDataset is not global since attr nd_sbp is empty,
+    // we assume that it works in DDP
+    if (nd_sbp_str_vec.empty()) { is_local = true; }
+  }
+  if (is_local) {
+    parallel_id = GlobalProcessCtx::Rank();
+    parallel_num = GlobalProcessCtx::WorldSize();
+  } else {
+    parallel_id = ctx->parallel_ctx().parallel_id();
+    parallel_num = ctx->parallel_ctx().parallel_num();
+  }
+  CHECK_LE(parallel_num, data_part_num);
+  BalancedSplitter bs(data_part_num, parallel_num);
+  return bs.At(parallel_id);
+}
+
 class OFRecordDataset final : public Dataset<TensorBuffer> {
  public:
   using Base = Dataset<TensorBuffer>;
@@ -37,97 +82,121 @@ class OFRecordDataset final : public Dataset<TensorBuffer> {
   OF_DISALLOW_COPY_AND_MOVE(OFRecordDataset);
 
   OFRecordDataset(user_op::KernelInitContext* ctx) {
-    current_epoch_ = 0;
     shuffle_after_epoch_ = ctx->Attr<bool>("shuffle_after_epoch");
 
     // in stream
-    data_part_num_ = ctx->Attr<int32_t>("data_part_num");
-    std::string data_dir = ctx->Attr<std::string>("data_dir");
-    std::string part_name_prefix = ctx->Attr<std::string>("part_name_prefix");
-    int32_t part_name_suffix_length = ctx->Attr<int32_t>("part_name_suffix_length");
-
-    for (int i = 0; i < data_part_num_; ++i) {
-      std::string num = std::to_string(i);
-      int32_t zero_count =
-          std::max(part_name_suffix_length - static_cast<int32_t>(num.length()), 0);
-      data_file_paths_.emplace_back(
-          JoinPath(data_dir, part_name_prefix + std::string(zero_count, '0') + num));
+    data_file_paths_ = GetOFRecordPartPaths(ctx);
+    range_ = GetOFRecordLocalPartRange(ctx, data_file_paths_.size());
+    const int64_t num_local_parts = range_.size();
+    const int64_t num_readers = std::min<int64_t>(
+        std::max<int64_t>(ParseIntegerFromEnv("ONEFLOW_OFRECORD_READER_NUM_THREADS", 1), 1),
+        std::max<int64_t>(num_local_parts, 1));
+    FOR_RANGE(int64_t, i, 0, num_readers) {
+      part_readers_.emplace_back(new PartReader);
+      PartReader* reader = part_readers_.back().get();
+      reader->epoch = 0;
+      reader->file_paths = data_file_paths_;
+      reader->in_stream.reset(new PersistentInStream(
+          DataFS(), GetLocalFilePaths(*reader, i, num_readers), !shuffle_after_epoch_, false));
     }
-
-    bool is_local = false;
-    // NOTE(zwx): OFRecordDataset is used by OFRecordDataReader and
-    // OFRecordImageClassificationDataReader both, the latter has no attr nd_sbp,
-    // so it couldn't work in DDP for now. The If condition here could be removed when
-    // OFRecordImageClassificationDataReader had supported DDP (add attr nd_sbp)
-    // or been deprecated.
-    if (ctx->op_type_name() == "OFRecordReader") {
-      auto nd_sbp_str_vec = ctx->Attr<std::vector<std::string>>("nd_sbp");
-      // NOTE(zwx): OFRecordDataset is not global since attr nd_sbp is empty,
-      // we assume that it works in DDP
-      if (nd_sbp_str_vec.empty()) { is_local = true; }
+    next_reader_id_ = 0;
+    if (num_readers > 1) {
+      const int64_t readahead = std::max<int64_t>(
+          ParseIntegerFromEnv("ONEFLOW_OFRECORD_READER_READAHEAD", kDefaultReadahead), 1);
+      const int64_t readahead_per_reader = std::max<int64_t>(readahead / num_readers, 1);
+      reader_metrics_.reset(new QueueMetrics("ofrecord_reader", readahead_per_reader));
+      FOR_RANGE(int64_t, i, 0, num_readers) {
+        PartReader* reader = part_readers_.at(i).get();
+        reader->buffer.reset(
+            new MeteredBuffer<TensorBuffer>(readahead_per_reader, reader_metrics_.get()));
+        reader->thread = std::thread([this, reader, i, num_readers]() {
+          while (true) {
+            TensorBuffer tensor;
+            ReadSample(reader, i, num_readers, tensor);
+            if (reader->buffer->Push(std::move(tensor)) != kBufferStatusSuccess) { break; }
+          }
+        });
+      }
     }
-    if (is_local) {
-      parallel_id_ = GlobalProcessCtx::Rank();
-      parallel_num_ = GlobalProcessCtx::WorldSize();
-    } else {
-      parallel_id_ = ctx->parallel_ctx().parallel_id();
-      parallel_num_ = ctx->parallel_ctx().parallel_num();
+  }
+  ~OFRecordDataset() {
+    for (auto& reader : part_readers_) {
+      if (reader->buffer) { reader->buffer->Close(); }
+    }
+    for (auto& reader : part_readers_) {
+      if (reader->thread.joinable()) { reader->thread.join(); }
     }
-    CHECK_LE(parallel_num_, data_part_num_);
-    BalancedSplitter bs(data_part_num_, parallel_num_);
-    range_ = bs.At(parallel_id_);
-    std::vector<std::string> local_file_paths = GetLocalFilePaths();
-    in_stream_.reset(
-        new PersistentInStream(DataFS(), local_file_paths, !shuffle_after_epoch_, false));
   }
-  ~OFRecordDataset() = default;
 
   BatchType Next() override {
     BatchType batch;
     batch.push_back(TensorBuffer());
-    ReadSample(batch.back());
+    if (part_readers_.size() == 1) {
+      ReadSample(part_readers_.front().get(), 0, 1, batch.back());
+    } else {
+      // Pull from the part readers in turn, so every part contributes the same number of records
+      // no matter which reader thread happens to run ahead.
+      PartReader* reader = part_readers_.at(next_reader_id_).get();
+      next_reader_id_ = (next_reader_id_ + 1) % part_readers_.size();
+      CHECK_EQ(reader->buffer->Pull(&batch.back()), kBufferStatusSuccess);
+    }
     return batch;
   }
 
  private:
-  void ReadSample(TensorBuffer& tensor) {
+  static constexpr int64_t kDefaultReadahead = 256;
+
+  // Reads the local parts assigned to one reader, i.e. those whose local index modulo the number
+  // of readers is the reader id. With more than one reader, each one runs on its own thread and
+  // prefetches records into its buffer.
+  struct PartReader {
+    int32_t epoch;
+    std::vector<std::string> file_paths;
+    std::unique_ptr<PersistentInStream> in_stream;
+    std::unique_ptr<MeteredBuffer<TensorBuffer>> buffer;
+    std::thread thread;
+  };
+
+  void ReadSample(PartReader* reader, int64_t reader_id, int64_t num_readers,
+                  TensorBuffer& tensor) {
     int64_t OFRecord_size = -1;
     char* size_ptr = reinterpret_cast<char*>(&OFRecord_size);
-    if (in_stream_->ReadFully(size_ptr, sizeof(int64_t)) != 0) {
-      ShuffleAfterEpoch();
-      CHECK_EQ(in_stream_->ReadFully(size_ptr, sizeof(int64_t)), 0);
+    if (reader->in_stream->ReadFully(size_ptr, sizeof(int64_t)) != 0) {
+      ShuffleAfterEpoch(reader, reader_id, num_readers);
+      CHECK_EQ(reader->in_stream->ReadFully(size_ptr, sizeof(int64_t)), 0);
     }
     CHECK_GT(OFRecord_size, 0);
     tensor.Resize(Shape({OFRecord_size}), DataType::kChar);
-    CHECK_EQ(in_stream_->ReadFully(tensor.mut_data<char>(), OFRecord_size), 0);
+    CHECK_EQ(reader->in_stream->ReadFully(tensor.mut_data<char>(), OFRecord_size), 0);
   }
 
-  void ShuffleAfterEpoch() {
+  void ShuffleAfterEpoch(PartReader* reader, int64_t reader_id, int64_t num_readers) {
     CHECK(shuffle_after_epoch_);
-    current_epoch_++;  // move to next epoch
-    std::mt19937 g(kOneflowDatasetSeed + current_epoch_);
-    std::shuffle(data_file_paths_.begin(), data_file_paths_.end(), g);
-    std::vector<std::string> local_file_paths = GetLocalFilePaths();
-    in_stream_.reset(new PersistentInStream(DataFS(), local_file_paths, false, false));
+    reader->epoch++;  // move to next epoch
+    // Every reader replays the same sequence of shuffles, so the readers of an epoch still
+    // partition the parts of this rank.
+    std::mt19937 g(kOneflowDatasetSeed + reader->epoch);
+    std::shuffle(reader->file_paths.begin(), reader->file_paths.end(), g);
+    std::vector<std::string> local_file_paths = GetLocalFilePaths(*reader, reader_id, num_readers);
+    reader->in_stream.reset(new PersistentInStream(DataFS(), local_file_paths, false, false));
   }
 
-  std::vector<std::string> GetLocalFilePaths() {
+  std::vector<std::string> GetLocalFilePaths(const PartReader& reader, int64_t reader_id,
+                                             int64_t num_readers) {
     std::vector<std::string> ret;
-    for (int i = range_.begin(); i < range_.end(); ++i) {
-      ret.emplace_back(data_file_paths_.at(i));
+    for (int i = range_.begin() + reader_id; i < range_.end(); i += num_readers) {
+      ret.emplace_back(reader.file_paths.at(i));
     }
     return ret;
   }
 
-  int32_t current_epoch_;
   bool shuffle_after_epoch_;
 
-  int32_t data_part_num_;
-  int32_t parallel_id_;
-  int32_t parallel_num_;
   Range range_;
   std::vector<std::string> data_file_paths_;
-  std::unique_ptr<PersistentInStream> in_stream_;
+  std::vector<std::unique_ptr<PartReader>> part_readers_;
+  size_t next_reader_id_;
+  std::unique_ptr<QueueMetrics> reader_metrics_;
 };
 
 }  // namespace data
@@ -18,6 +18,7 @@ limitations under the License.
 
 #include "oneflow/user/data/data_reader.h"
 #include "oneflow/user/data/ofrecord_dataset.h"
+#include "oneflow/user/data/ofrecord_mmap_dataset.h"
 #include "oneflow/user/data/ofrecord_parser.h"
 #include "oneflow/user/data/random_shuffle_dataset.h"
 #include "oneflow/user/data/batch_dataset.h"
@@ -35,9 +36,14 @@ class OFRecordImageClassificationDataReader final
       : DataReader<ImageClassificationDataInstance>(ctx) {
     batch_size_ = ctx->TensorDesc4ArgNameAndIndex("image", 0)->shape().elem_cnt();
     if (auto* pool = TensorBufferPool::TryGet()) { pool->IncreasePoolSizeByBase(batch_size_); }
-    std::unique_ptr<Dataset<TensorBuffer>> base(new OFRecordDataset(ctx));
-    if (ctx->Attr<bool>("random_shuffle")) {
-      base.reset(new RandomShuffleDataset<TensorBuffer>(ctx, std::move(base)));
+    std::unique_ptr<Dataset<TensorBuffer>> base;
+    if (IsOFRecordMMapEnabled()) {
+      base = NewOFRecordMMapDataset(ctx);
+    } else {
+      base.reset(new OFRecordDataset(ctx));
+      if (ctx->Attr<bool>("random_shuffle")) {
+        base.reset(new RandomShuffleDataset<TensorBuffer>(ctx, std::move(base)));
+      }
     }
     loader_.reset(new OFRecordImageClassificationDataset(ctx, std::move(base)));
 
@@ -16,6 +16,7 @@ limitations under the License.
 #include "oneflow/user/data/ofrecord_image_classification_dataset.h"
 #include "oneflow/core/common/tensor_buffer.h"
 #include "oneflow/user/image/image_util.h"
+#include "oneflow/user/image/jpeg_decoder.h"
 #include "oneflow/core/job/resource_desc.h"
 #include "oneflow/core/job/global_for.h"
 
@@ -37,6 +38,10 @@ void DecodeImageFromOFRecord(const OFRecord& record, const std::string& feature_
   CHECK(image_feature.has_bytes_list());
   CHECK(image_feature.bytes_list().value_size() == 1);
   const std::string& src_data = image_feature.bytes_list().value(0);
+  if (JpegDecodeRandomCropImage(reinterpret_cast<const unsigned char*>(src_data.data()),
+                                src_data.size(), nullptr, color_space, 0, 0, nullptr, 0, out)) {
+    return;
+  }
   cv::Mat image = cv::imdecode(cv::Mat(1, src_data.size(), CV_8UC1, (void*)(src_data.data())),
                                cv::IMREAD_COLOR);
   int W = image.cols;
@@ -75,7 +80,7 @@ void DecodeLabelFromFromOFRecord(const OFRecord& record, const std::string& feat
 }
 
 void LoadWorker(Dataset<TensorBuffer>* record_dataset,
-                std::vector<std::unique_ptr<Buffer<TensorBuffer>>>* decode_in_buffers) {
+                std::vector<std::unique_ptr<MeteredBuffer<TensorBuffer>>>* decode_in_buffers) {
   int64_t thread_idx = 0;
   bool shutdown = false;
   while (!shutdown) {
@@ -94,8 +99,8 @@ void LoadWorker(Dataset<TensorBuffer>* record_dataset,
 }
 
 void DecodeWorker(const std::string& image_feature_name, const std::string& label_feature_name,
-                  const std::string& color_space, Buffer<TensorBuffer>* in_buffer,
-                  Buffer<ImageClassificationDataInstance>* out_buffer) {
+                  const std::string& color_space, MeteredBuffer<TensorBuffer>* in_buffer,
+                  MeteredBuffer<ImageClassificationDataInstance>* out_buffer) {
   while (true) {
     TensorBuffer serialized_record;
     auto receive_status = in_buffer->Pull(&serialized_record);
@@ -137,13 +142,16 @@ OFRecordImageClassificationDataset::OFRecordImageClassificationDataset(
   auto decode_buffer_size_per_thread = ctx->Attr<int32_t>("decode_buffer_size_per_thread");
   auto num_local_decode_threads = GetNumLocalDecodeThreads(
       num_decode_threads_per_machine, ctx->parallel_desc(), ctx->parallel_ctx());
+  decode_in_metrics_.reset(new QueueMetrics("decode_in", decode_buffer_size_per_thread));
+  decode_out_metrics_.reset(new QueueMetrics("decode_out", decode_buffer_size_per_thread));
   decode_in_buffers_.reserve(num_local_decode_threads);
   decode_out_buffers_.reserve(num_local_decode_threads);
   for (int64_t i = 0; i < num_local_decode_threads; ++i) {
     decode_in_buffers_.emplace_back(
-        std::make_unique<Buffer<NestedSampleType>>(decode_buffer_size_per_thread));
-    decode_out_buffers_.emplace_back(
-        std::make_unique<Buffer<SampleType>>(decode_buffer_size_per_thread));
+        std::make_unique<MeteredBuffer<NestedSampleType>>(decode_buffer_size_per_thread,
+                                                          decode_in_metrics_.get()));
+    decode_out_buffers_.emplace_back(std::make_unique<MeteredBuffer<SampleType>>(
+        decode_buffer_size_per_thread, decode_out_metrics_.get()));
     decode_threads_.emplace_back(DecodeWorker, image_feature_name, label_feature_name, color_space,
                                  decode_in_buffers_.back().get(), decode_out_buffers_.back().get());
   }
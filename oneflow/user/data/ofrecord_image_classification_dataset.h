@@ -17,7 +17,7 @@ limitations under the License.
 #define ONEFLOW_USER_DATA_OFRECORD_IMAGE_CLASSIFICATION_DATASET_H_
 
 #include "oneflow/user/data/dataset.h"
-#include "oneflow/core/common/buffer.h"
+#include "oneflow/user/data/pipeline_metrics.h"
 #include "oneflow/core/framework/op_kernel.h"
 
 namespace oneflow {
@@ -60,8 +60,10 @@ class OFRecordImageClassificationDataset final : public Dataset<ImageClassificat
   std::unique_ptr<NestedDS> nested_ds_;
   std::thread load_thread_;
   std::vector<std::thread> decode_threads_;
-  std::vector<std::unique_ptr<Buffer<NestedSampleType>>> decode_in_buffers_;
-  std::vector<std::unique_ptr<Buffer<SampleType>>> decode_out_buffers_;
+  std::unique_ptr<QueueMetrics> decode_in_metrics_;
+  std::unique_ptr<QueueMetrics> decode_out_metrics_;
+  std::vector<std::unique_ptr<MeteredBuffer<NestedSampleType>>> decode_in_buffers_;
+  std::vector<std::unique_ptr<MeteredBuffer<SampleType>>> decode_out_buffers_;
   std::atomic<size_t> out_thread_idx_;
 };
 
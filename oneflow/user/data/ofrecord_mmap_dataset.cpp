@@ -0,0 +1,187 @@
+/*
+Copyright 2020 The OneFlow Authors. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "oneflow/user/data/ofrecord_mmap_dataset.h"
+#include "oneflow/user/data/ofrecord_dataset.h"
+#include "oneflow/user/data/distributed_training_dataset.h"
+#include "oneflow/core/persistence/posix/posix_file_system.h"
+
+#ifdef __linux__
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace oneflow {
+namespace data {
+
+namespace {
+
+constexpr char kIndexMagicCode[] = "OFRIDX01";
+constexpr size_t kIndexMagicCodeLen = sizeof(kIndexMagicCode) - 1;
+
+struct IndexHeader {
+  char magic[kIndexMagicCodeLen];
+  uint64_t file_size;
+  int64_t file_mtime_ns;
+  uint64_t num_records;
+};
+
+int64_t ReadRecordSize(const MappedBuffer& part, int64_t offset) {
+  int64_t record_size = -1;
+  std::memcpy(&record_size, static_cast<const char*>(part.ptr()) + offset, sizeof(int64_t));
+  return record_size;
+}
+
+std::string GetIndexCachePath(const std::string& part_path) {
+  const std::string index_dir = GetStringFromEnv("ONEFLOW_OFRECORD_MMAP_INDEX_DIR", "");
+  if (index_dir.empty()) { return part_path + ".ofidx"; }
+  // Parts of different datasets usually share their names, tell them apart by the full path.
+  const size_t path_hash = std::hash<std::string>()(part_path);
+  return JoinPath(index_dir, Basename(part_path) + "." + std::to_string(path_hash) + ".ofidx");
+}
+
+bool GetFileStat(const std::string& path, IndexHeader* header) {
+#ifdef __linux__
+  struct stat s {};
+  if (stat(path.c_str(), &s) != 0) { return false; }
+  std::memcpy(header->magic, kIndexMagicCode, kIndexMagicCodeLen);
+  header->file_size = s.st_size;
+  header->file_mtime_ns = static_cast<int64_t>(s.st_mtim.tv_sec) * 1000000000 + s.st_mtim.tv_nsec;
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool LoadIndexCache(const std::string& index_path, const IndexHeader& expected,
+                    std::vector<int64_t>* record_offsets) {
+  std::ifstream stream(index_path, std::ios::binary);
+  if (!stream.is_open()) { return false; }
+  IndexHeader header{};
+  if (!stream.read(reinterpret_cast<char*>(&header), sizeof(header))) { return false; }
+  if (std::memcmp(header.magic, expected.magic, kIndexMagicCodeLen) != 0
+      || header.file_size != expected.file_size
+      || header.file_mtime_ns != expected.file_mtime_ns) {
+    return false;
+  }
+  record_offsets->resize(header.num_records);
+  return static_cast<bool>(stream.read(reinterpret_cast<char*>(record_offsets->data()),
+                                       header.num_records * sizeof(int64_t)));
+}
+
+void SaveIndexCache(const std::string& index_path, const IndexHeader& header,
+                    const std::vector<int64_t>& record_offsets) {
+  // Ranks sharing a dataset may build the same index at the same time, publish it atomically.
+  const std::string tmp_path = index_path + ".tmp." + std::to_string(getpid());
+  {
+    std::ofstream stream(tmp_path, std::ios::binary | std::ios::trunc);
+    if (stream.is_open()) {
+      stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+      stream.write(reinterpret_cast<const char*>(record_offsets.data()),
+                   record_offsets.size() * sizeof(int64_t));
+    }
+    if (!stream.is_open() || !stream.good()) {
+      LOG(WARNING) << "failed to cache OFRecord index to " << index_path;
+      std::remove(tmp_path.c_str());
+      return;
+    }
+  }
+  if (std::rename(tmp_path.c_str(), index_path.c_str()) != 0) {
+    LOG(WARNING) << "failed to cache OFRecord index to " << index_path;
+    std::remove(tmp_path.c_str());
+  }
+}
+
+}  // namespace
+
+bool IsOFRecordMMapEnabled() { return ParseBooleanFromEnv("ONEFLOW_OFRECORD_READER_MMAP", false); }
+
+void BuildOFRecordIndex(const MappedBuffer& part, std::vector<int64_t>* record_offsets) {
+  record_offsets->clear();
+  const int64_t part_size = part.size();
+  int64_t offset = 0;
+  while (offset < part_size) {
+    CHECK_LE(offset + static_cast<int64_t>(sizeof(int64_t)), part_size) << "truncated OFRecord";
+    const int64_t record_size = ReadRecordSize(part, offset);
+    offset += sizeof(int64_t);
+    CHECK_GT(record_size, 0);
+    CHECK_LE(record_size, part_size - offset) << "truncated OFRecord";
+    record_offsets->emplace_back(offset);
+    offset += record_size;
+  }
+}
+
+void LoadOrBuildOFRecordIndex(const std::string& part_path, const MappedBuffer& part,
+                              std::vector<int64_t>* record_offsets) {
+  IndexHeader header{};
+  const bool cacheable = GetFileStat(part_path, &header) && header.file_size == part.size();
+  const std::string index_path = GetIndexCachePath(part_path);
+  if (cacheable && LoadIndexCache(index_path, header, record_offsets)) { return; }
+  BuildOFRecordIndex(part, record_offsets);
+  if (cacheable) {
+    header.num_records = record_offsets->size();
+    SaveIndexCache(index_path, header, *record_offsets);
+  }
+}
+
+OFRecordMMapDataset::OFRecordMMapDataset(const std::vector<std::string>& part_paths) {
+  std::vector<int64_t> record_offsets;
+  for (const auto& part_path : part_paths) {
+    parts_.emplace_back(std::make_shared<MappedBuffer>(part_path, /*copy_on_write=*/true));
+    LoadOrBuildOFRecordIndex(part_path, *parts_.back(), &record_offsets);
+    const int64_t part_id = parts_.size() - 1;
+    for (int64_t offset : record_offsets) {
+      records_.emplace_back(RecordLocation{part_id, offset});
+    }
+  }
+  CHECK(!records_.empty()) << "no OFRecord found in the parts of this rank";
+}
+
+OFRecordMMapDataset::BatchType OFRecordMMapDataset::At(int64_t index) const {
+  const RecordLocation& location = records_.at(index);
+  const std::shared_ptr<MappedBuffer>& part = parts_.at(location.part_id);
+  const int64_t record_size = ReadRecordSize(*part, location.offset - sizeof(int64_t));
+  BatchType batch(1);
+  batch.back().ResetExternal(Shape({record_size}), DataType::kChar,
+                             static_cast<char*>(part->mut_ptr()) + location.offset, part);
+  return batch;
+}
+
+std::unique_ptr<Dataset<TensorBuffer>> NewOFRecordMMapDataset(user_op::KernelInitContext* ctx) {
+#ifdef OF_PLATFORM_POSIX
+  CHECK(dynamic_cast<fs::PosixFileSystem*>(DataFS()) != nullptr)
+      << "ONEFLOW_OFRECORD_READER_MMAP requires a local data file system";
+#else
+  UNIMPLEMENTED() << "ONEFLOW_OFRECORD_READER_MMAP requires a local data file system";
+#endif
+  const std::vector<std::string> data_file_paths = GetOFRecordPartPaths(ctx);
+  const Range range = GetOFRecordLocalPartRange(ctx, data_file_paths.size());
+  std::unique_ptr<RandomAccessDataset<TensorBuffer>> dataset(new OFRecordMMapDataset(
+      std::vector<std::string>(data_file_paths.begin() + range.begin(),
+                               data_file_paths.begin() + range.end())));
+  const bool random_shuffle = ctx->Attr<bool>("random_shuffle");
+  const bool shuffle = random_shuffle || ctx->Attr<bool>("shuffle_after_epoch");
+  int64_t seed = kOneflowDatasetSeed;
+  if (random_shuffle) {
+    seed = ctx->Attr<int64_t>("seed");
+    if (seed == -1) { seed = NewRandomSeed(); }
+  }
+  // Parts are already split between ranks, so every rank owns the single shard of its dataset.
+  return std::unique_ptr<Dataset<TensorBuffer>>(new DistributedTrainingDataset<TensorBuffer>(
+      1, 0, false, shuffle, seed, std::move(dataset)));
+}
+
+}  // namespace data
+}  // namespace oneflow
@@ -0,0 +1,72 @@
+/*
+Copyright 2020 The OneFlow Authors. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef ONEFLOW_USER_DATA_OFRECORD_MMAP_DATASET_H_
+#define ONEFLOW_USER_DATA_OFRECORD_MMAP_DATASET_H_
+
+#include "oneflow/core/framework/op_kernel.h"
+#include "oneflow/user/data/dataset.h"
+#include "oneflow/user/data/mapped_buffer.h"
+
+namespace oneflow {
+namespace data {
+
+// Whether OFRecord readers map the local part files into memory instead of streaming them, set by
+// ONEFLOW_OFRECORD_READER_MMAP.
+bool IsOFRecordMMapEnabled();
+
+// Offsets of the serialized records in an OFRecord part file, each one following its int64 size.
+void BuildOFRecordIndex(const MappedBuffer& part, std::vector<int64_t>* record_offsets);
+
+// Same as BuildOFRecordIndex, but reuses the index cached on disk by a previous run if the part
+// file has not been modified since, and caches a newly built one.
+void LoadOrBuildOFRecordIndex(const std::string& part_path, const MappedBuffer& part,
+                              std::vector<int64_t>* record_offsets);
+
+// The records of the parts read by this rank. Parts are mapped copy-on-write and every sample is
+// a TensorBuffer referring to the mapping, so records are never copied before being parsed.
+class OFRecordMMapDataset final : public RandomAccessDataset<TensorBuffer> {
+ public:
+  using Base = RandomAccessDataset<TensorBuffer>;
+  using SampleType = typename Base::SampleType;
+  using BatchType = typename Base::BatchType;
+
+  OF_DISALLOW_COPY_AND_MOVE(OFRecordMMapDataset);
+  explicit OFRecordMMapDataset(const std::vector<std::string>& part_paths);
+  ~OFRecordMMapDataset() = default;
+
+  BatchType At(int64_t index) const override;
+  size_t Size() const override { return records_.size(); }
+
+ private:
+  struct RecordLocation {
+    int64_t part_id;
+    int64_t offset;
+  };
+
+  std::vector<std::shared_ptr<MappedBuffer>> parts_;
+  std::vector<RecordLocation> records_;
+};
+
+// Reads the OFRecord parts of this rank through an OFRecordMMapDataset. Records are served in
+// order, or in a random permutation of all the records of the rank that is redrawn every epoch
+// when `random_shuffle` or `shuffle_after_epoch` is set, which replaces RandomShuffleDataset's
+// bounded shuffle buffer.
+std::unique_ptr<Dataset<TensorBuffer>> NewOFRecordMMapDataset(user_op::KernelInitContext* ctx);
+
+}  // namespace data
+}  // namespace oneflow
+
+#endif  // ONEFLOW_USER_DATA_OFRECORD_MMAP_DATASET_H_
@@ -0,0 +1,87 @@
+/*
+Copyright 2020 The OneFlow Authors. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "oneflow/user/data/pipeline_metrics.h"
+
+namespace oneflow {
+namespace data {
+
+namespace {
+
+struct MetricsRegistry {
+  std::mutex mutex;
+  std::vector<const QueueMetrics*> metrics;
+};
+
+MetricsRegistry* GetMetricsRegistry() {
+  static MetricsRegistry registry;
+  return &registry;
+}
+
+}  // namespace
+
+QueueMetrics::QueueMetrics(const std::string& name, size_t capacity)
+    : name_(name),
+      capacity_(capacity),
+      num_pushes_(0),
+      num_full_pushes_(0),
+      num_pulls_(0),
+      num_empty_pulls_(0),
+      occupancy_sum_(0) {
+  MetricsRegistry* registry = GetMetricsRegistry();
+  std::lock_guard<std::mutex> lock(registry->mutex);
+  registry->metrics.push_back(this);
+}
+
+QueueMetrics::~QueueMetrics() {
+  MetricsRegistry* registry = GetMetricsRegistry();
+  std::lock_guard<std::mutex> lock(registry->mutex);
+  auto it = std::find(registry->metrics.begin(), registry->metrics.end(), this);
+  CHECK(it != registry->metrics.end());
+  registry->metrics.erase(it);
+}
+
+std::string QueueMetrics::ToString() const {
+  const uint64_t num_pushes = num_pushes_.load(std::memory_order_relaxed);
+  const uint64_t num_pulls = num_pulls_.load(std::memory_order_relaxed);
+  const auto Percent = [](uint64_t n, uint64_t total) {
+    return total == 0 ? 0.0 : 100.0 * static_cast<double>(n) / static_cast<double>(total);
+  };
+  const double avg_occupancy =
+      num_pulls == 0 ? 0.0
+                     : static_cast<double>(occupancy_sum_.load(std::memory_order_relaxed))
+                           / static_cast<double>(num_pulls);
+  return fmt::format(
+      "{}: avg occupancy {:.2f}/{}, {:.1f}% of {} pulls found it empty, {:.1f}% of {} pushes "
+      "found it full",
+      name_, avg_occupancy, capacity_, Percent(num_empty_pulls_.load(), num_pulls), num_pulls,
+      Percent(num_full_pushes_.load(), num_pushes), num_pushes);
+}
+
+int64_t GetPipelineMetricsPeriod() {
+  static const int64_t period = ParseIntegerFromEnv("ONEFLOW_DATA_PIPELINE_METRICS_PERIOD", 0);
+  return period;
+}
+
+void LogPipelineMetrics() {
+  MetricsRegistry* registry = GetMetricsRegistry();
+  std::lock_guard<std::mutex> lock(registry->mutex);
+  std::string report = "data pipeline queues:";
+  for (const QueueMetrics* metrics : registry->metrics) { report += "\n  " + metrics->ToString(); }
+  LOG(INFO) << report;
+}
+
+}  // namespace data
+}  // namespace oneflow
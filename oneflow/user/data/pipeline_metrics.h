@@ -0,0 +1,94 @@
+/*
+Copyright 2020 The OneFlow Authors. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef ONEFLOW_USER_DATA_PIPELINE_METRICS_H_
+#define ONEFLOW_USER_DATA_PIPELINE_METRICS_H_
+
+#include "oneflow/core/common/util.h"
+#include "oneflow/core/common/buffer.h"
+
+namespace oneflow {
+namespace data {
+
+// Occupancy statistics of the queue between two stages of a data pipeline. A queue that is mostly
+// empty when pulled means the producing stage is the bottleneck, a queue that is mostly full when
+// pushed means the consuming stage is.
+//
+// Every live QueueMetrics is listed by LogPipelineMetrics().
+class QueueMetrics final {
+ public:
+  OF_DISALLOW_COPY_AND_MOVE(QueueMetrics);
+  QueueMetrics(const std::string& name, size_t capacity);
+  ~QueueMetrics();
+
+  void RecordPush(size_t occupancy) {
+    num_pushes_.fetch_add(1, std::memory_order_relaxed);
+    if (occupancy >= capacity_) { num_full_pushes_.fetch_add(1, std::memory_order_relaxed); }
+  }
+
+  void RecordPull(size_t occupancy) {
+    num_pulls_.fetch_add(1, std::memory_order_relaxed);
+    occupancy_sum_.fetch_add(occupancy, std::memory_order_relaxed);
+    if (occupancy == 0) { num_empty_pulls_.fetch_add(1, std::memory_order_relaxed); }
+  }
+
+  std::string ToString() const;
+
+ private:
+  std::string name_;
+  size_t capacity_;
+  std::atomic<uint64_t> num_pushes_;
+  std::atomic<uint64_t> num_full_pushes_;
+  std::atomic<uint64_t> num_pulls_;
+  std::atomic<uint64_t> num_empty_pulls_;
+  std::atomic<uint64_t> occupancy_sum_;
+};
+
+// A Buffer that reports its occupancy to a QueueMetrics, which may be shared by the buffers of
+// all the workers of a stage.
+template<typename T>
+class MeteredBuffer final {
+ public:
+  OF_DISALLOW_COPY_AND_MOVE(MeteredBuffer);
+  MeteredBuffer(size_t max_len, QueueMetrics* metrics) : buffer_(max_len), metrics_(metrics) {}
+  ~MeteredBuffer() = default;
+
+  template<typename U>
+  BufferStatus Push(U&& item) {
+    metrics_->RecordPush(buffer_.Size());
+    return buffer_.Push(std::forward<U>(item));
+  }
+
+  BufferStatus Pull(T* item) {
+    metrics_->RecordPull(buffer_.Size());
+    return buffer_.Pull(item);
+  }
+
+  void Close() { buffer_.Close(); }
+
+ private:
+  Buffer<T> buffer_;
+  QueueMetrics* metrics_;
+};
+
+// Number of batches between two reports of LogPipelineMetrics() by a DataReader, 0 disables them.
+int64_t GetPipelineMetricsPeriod();
+
+void LogPipelineMetrics();
+
+}  // namespace data
+}  // namespace oneflow
+
+#endif  // ONEFLOW_USER_DATA_PIPELINE_METRICS_H_
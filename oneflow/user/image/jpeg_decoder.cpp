@@ -13,7 +13,9 @@ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 See the License for the specific language governing permissions and
 limitations under the License.
 */
+#include <csetjmp>
 #include <cstddef>
+#include <cstring>
 #include <iostream>
 
 #include "oneflow/user/image/jpeg_decoder.h"
@@ -35,70 +37,210 @@ class LibjpegCtx {
   struct jpeg_decompress_struct* compress_info_;
 };
 
-bool JpegPartialDecodeRandomCropImage(const unsigned char* data, size_t length,
-                                      RandomCropGenerator* random_crop_gen,
-                                      unsigned char* workspace, size_t workspace_size,
-                                      cv::Mat* out_mat) {
-  struct jpeg_decompress_struct compress_info {};
-  struct jpeg_error_mgr jpeg_err {};
-  compress_info.err = jpeg_std_error(&jpeg_err);
-  jpeg_create_decompress(&compress_info);
-  if (compress_info.err->msg_code != 0) { return false; }
+namespace {
 
-  LibjpegCtx ctx_guard(&compress_info);
+struct JpegErrorManager {
+  struct jpeg_error_mgr pub;
+  jmp_buf jmp;
+};
+
+void JpegErrorExit(j_common_ptr compress_info) {
+  longjmp(reinterpret_cast<JpegErrorManager*>(compress_info->err)->jmp, 1);
+}
 
-  jpeg_mem_src(ctx_guard.compress_info(), data, length);
-  if (ctx_guard.compress_info()->err->msg_code != 0) { return false; }
+// Corrupted images fall back to OpenCV, don't spam the log with libjpeg's warnings about them.
+void JpegOutputMessage(j_common_ptr compress_info) {}
+
+J_COLOR_SPACE GetJpegColorSpace(const std::string& color_space) {
+  if (color_space == "RGB") {
+    return JCS_RGB;
+  } else if (color_space == "BGR") {
+    return JCS_EXT_BGR;
+  } else if (color_space == "GRAY") {
+    return JCS_GRAYSCALE;
+  } else {
+    UNIMPLEMENTED();
+    return JCS_UNKNOWN;
+  }
+}
+
+// The EXIF orientation saved in the APP1 markers, 1 (upright) if there is none.
+int GetExifOrientation(const struct jpeg_decompress_struct& compress_info) {
+  constexpr unsigned int kOrientationTag = 0x0112;
+  constexpr size_t kIfdEntrySize = 12;
+  for (jpeg_saved_marker_ptr marker = compress_info.marker_list; marker != nullptr;
+       marker = marker->next) {
+    // "Exif\0\0", then a TIFF header of 8 bytes
+    if (marker->marker != JPEG_APP0 + 1 || marker->data_length < 14
+        || memcmp(marker->data, "Exif\0\0", 6) != 0) {
+      continue;
+    }
+    const unsigned char* tiff = marker->data + 6;
+    const size_t tiff_length = marker->data_length - 6;
+    bool little_endian = false;
+    if (tiff[0] == 'I' && tiff[1] == 'I') {
+      little_endian = true;
+    } else if (tiff[0] != 'M' || tiff[1] != 'M') {
+      continue;
+    }
+    const auto Read16 = [&](size_t offset) -> uint32_t {
+      return little_endian ? tiff[offset] | (tiff[offset + 1] << 8)
+                           : (tiff[offset] << 8) | tiff[offset + 1];
+    };
+    const auto Read32 = [&](size_t offset) -> uint32_t {
+      return little_endian ? Read16(offset) | (Read16(offset + 2) << 16)
+                           : (Read16(offset) << 16) | Read16(offset + 2);
+    };
+    const size_t ifd_offset = Read32(4);
+    if (ifd_offset + 2 > tiff_length) { continue; }
+    const uint32_t num_entries = Read16(ifd_offset);
+    for (uint32_t i = 0; i < num_entries; ++i) {
+      const size_t entry_offset = ifd_offset + 2 + i * kIfdEntrySize;
+      if (entry_offset + kIfdEntrySize > tiff_length) { break; }
+      // a SHORT, left-justified in the value field
+      if (Read16(entry_offset) == kOrientationTag) { return Read16(entry_offset + 8); }
+    }
+  }
+  return 1;
+}
+
+// Numerator of the smallest IDCT scale, out of 8, that keeps a crop as large as the target.
+unsigned int GetIdctScaleNum(unsigned int crop_width, unsigned int crop_height, int target_width,
+                             int target_height) {
+  if (target_width <= 0 || target_height <= 0) { return 8; }
+  for (unsigned int scale_num : {1, 2, 4}) {
+    if (crop_width * scale_num >= target_width * 8U
+        && crop_height * scale_num >= target_height * 8U) {
+      return scale_num;
+    }
+  }
+  return 8;
+}
 
-  int rc = jpeg_read_header(ctx_guard.compress_info(), TRUE);
-  if (rc != JPEG_HEADER_OK) { return false; }
+// `AllocOutput(height, width, channels)` returns the buffer the crop is decoded into, rows are
+// packed.
+bool JpegDecodeRandomCropImageImpl(
+    const unsigned char* data, size_t length, RandomCropGenerator* random_crop_gen,
+    J_COLOR_SPACE out_color_space, int target_width, int target_height, unsigned char* workspace,
+    size_t workspace_size,
+    const std::function<unsigned char*(int height, int width, int channels)>& AllocOutput) {
+  struct jpeg_decompress_struct compress_info {};
+  JpegErrorManager jpeg_err{};
+  compress_info.err = jpeg_std_error(&jpeg_err.pub);
+  jpeg_err.pub.error_exit = JpegErrorExit;
+  jpeg_err.pub.output_message = JpegOutputMessage;
+  jpeg_create_decompress(&compress_info);
+  LibjpegCtx ctx_guard(&compress_info);
+  // Objects with destructors must be constructed before setjmp, longjmp skips them.
+  CropWindow crop;
+  std::vector<unsigned char> decode_output_buf;
+  std::vector<JSAMPROW> rows;
+  if (setjmp(jpeg_err.jmp)) { return false; }
 
-  jpeg_start_decompress(ctx_guard.compress_info());
-  int width = ctx_guard.compress_info()->output_width;
-  int height = ctx_guard.compress_info()->output_height;
-  int pixel_size = ctx_guard.compress_info()->output_components;
+  jpeg_mem_src(&compress_info, data, length);
+  jpeg_save_markers(&compress_info, JPEG_APP0 + 1, 0xFFFF);
+  if (jpeg_read_header(&compress_info, TRUE) != JPEG_HEADER_OK) { return false; }
+  // cv::imdecode rotates and flips the image by its EXIF orientation, leave these to OpenCV.
+  const int orientation = GetExifOrientation(compress_info);
+  if (orientation >= 2 && orientation <= 8) { return false; }
+  const unsigned int width = compress_info.image_width;
+  const unsigned int height = compress_info.image_height;
 
-  unsigned int u_crop_x = 0, u_crop_y = 0, u_crop_w = width, u_crop_h = height;
+  // The crop window is drawn on the full resolution image whatever the decoding scale.
+  unsigned int crop_x = 0, crop_y = 0, crop_w = width, crop_h = height;
   if (random_crop_gen) {
-    CropWindow crop;
     random_crop_gen->GenerateCropWindow({height, width}, &crop);
-    u_crop_y = crop.anchor.At(0);
-    u_crop_x = crop.anchor.At(1);
-    u_crop_h = crop.shape.At(0);
-    u_crop_w = crop.shape.At(1);
+    crop_y = crop.anchor.At(0);
+    crop_x = crop.anchor.At(1);
+    crop_h = crop.shape.At(0);
+    crop_w = crop.shape.At(1);
   }
 
-  unsigned int tmp_w = u_crop_w;
-  jpeg_crop_scanline(ctx_guard.compress_info(), &u_crop_x, &tmp_w);
-  if (jpeg_skip_scanlines(ctx_guard.compress_info(), u_crop_y) != u_crop_y) { return false; }
+  const unsigned int scale_num = GetIdctScaleNum(crop_w, crop_h, target_width, target_height);
+  compress_info.scale_num = scale_num;
+  compress_info.scale_denom = 8;
+  compress_info.out_color_space = out_color_space;
+  jpeg_start_decompress(&compress_info);
+  const unsigned int scaled_width = compress_info.output_width;
+  const unsigned int scaled_height = compress_info.output_height;
+  const int pixel_size = compress_info.output_components;
 
-  int row_offset = (tmp_w - u_crop_w) * pixel_size;
-  int out_row_stride = u_crop_w * pixel_size;
-  std::vector<unsigned char> decode_output_buf;
-  unsigned char* decode_output_pointer = nullptr;
-  size_t image_space_size = width * pixel_size;
+  const unsigned int scaled_x = crop_x * scale_num / 8;
+  const unsigned int scaled_y = crop_y * scale_num / 8;
+  const unsigned int scaled_w =
+      std::min(std::max((crop_x + crop_w) * scale_num / 8, scaled_x + 1), scaled_width) - scaled_x;
+  const unsigned int scaled_h =
+      std::min(std::max((crop_y + crop_h) * scale_num / 8, scaled_y + 1), scaled_height)
+      - scaled_y;
+
+  // jpeg_crop_scanline moves the left edge to an iMCU boundary and widens the decoded rows. Fancy
+  // upsampling takes the right edge of the decoded rows for the image edge, so one more column is
+  // decoded when there is one.
+  unsigned int decode_x = scaled_x;
+  unsigned int decode_w = std::min(scaled_w + 1, scaled_width - scaled_x);
+  jpeg_crop_scanline(&compress_info, &decode_x, &decode_w);
+  if (jpeg_skip_scanlines(&compress_info, scaled_y) != scaled_y) { return false; }
 
-  if (image_space_size > workspace_size) {
-    decode_output_buf.resize(image_space_size);
+  unsigned char* out_ptr = AllocOutput(scaled_h, scaled_w, pixel_size);
+  const size_t out_row_stride = scaled_w * pixel_size;
+  const size_t row_offset = (scaled_x - decode_x) * pixel_size;
+  // Rows covering exactly the crop are decoded in place, others go through the workspace.
+  const bool decode_in_place = row_offset == 0 && decode_w == scaled_w;
+  const int max_rows = std::max(compress_info.rec_outbuf_height, 1);
+  const size_t decode_row_stride = decode_w * pixel_size;
+  unsigned char* decode_output_pointer = workspace;
+  if (!decode_in_place && decode_row_stride * max_rows > workspace_size) {
+    decode_output_buf.resize(decode_row_stride * max_rows);
     decode_output_pointer = decode_output_buf.data();
-  } else {
-    decode_output_pointer = workspace;
   }
-  out_mat->create(u_crop_h, u_crop_w, CV_8UC3);
-
-  while (ctx_guard.compress_info()->output_scanline < u_crop_y + u_crop_h) {
-    unsigned char* buffer_array[1];
-    buffer_array[0] = decode_output_pointer;
-    unsigned int read_line_index = ctx_guard.compress_info()->output_scanline;
-    jpeg_read_scanlines(ctx_guard.compress_info(), buffer_array, 1);
-    memcpy(out_mat->data + (read_line_index - u_crop_y) * out_row_stride,
-           decode_output_pointer + row_offset, out_row_stride);
+  rows.resize(max_rows);
+
+  while (compress_info.output_scanline < scaled_y + scaled_h) {
+    const unsigned int row = compress_info.output_scanline - scaled_y;
+    const int num_rows = std::min<unsigned int>(max_rows, scaled_h - row);
+    for (int i = 0; i < num_rows; ++i) {
+      rows[i] = decode_in_place ? out_ptr + (row + i) * out_row_stride
+                                : decode_output_pointer + i * decode_row_stride;
+    }
+    const int num_read = jpeg_read_scanlines(&compress_info, rows.data(), num_rows);
+    if (num_read <= 0) { return false; }
+    if (!decode_in_place) {
+      for (int i = 0; i < num_read; ++i) {
+        memcpy(out_ptr + (row + i) * out_row_stride, rows[i] + row_offset, out_row_stride);
+      }
+    }
   }
+  // The rows below the crop are never needed, abort instead of decoding them.
+  jpeg_abort_decompress(&compress_info);
+  return true;
+}
 
-  jpeg_skip_scanlines(ctx_guard.compress_info(), height - u_crop_y - u_crop_h);
-  jpeg_finish_decompress(ctx_guard.compress_info());
+}  // namespace
 
-  return true;
+bool JpegPartialDecodeRandomCropImage(const unsigned char* data, size_t length,
+                                      RandomCropGenerator* random_crop_gen,
+                                      unsigned char* workspace, size_t workspace_size,
+                                      cv::Mat* out_mat) {
+  return JpegDecodeRandomCropImageImpl(
+      data, length, random_crop_gen, JCS_RGB, 0, 0, workspace, workspace_size,
+      [&](int height, int width, int channels) {
+        CHECK_EQ(channels, 3);
+        out_mat->create(height, width, CV_8UC3);
+        return out_mat->data;
+      });
+}
+
+bool JpegDecodeRandomCropImage(const unsigned char* data, size_t length,
+                               RandomCropGenerator* random_crop_gen,
+                               const std::string& color_space, int target_width,
+                               int target_height, unsigned char* workspace, size_t workspace_size,
+                               TensorBuffer* out) {
+  return JpegDecodeRandomCropImageImpl(
+      data, length, random_crop_gen, GetJpegColorSpace(color_space), target_width, target_height,
+      workspace, workspace_size, [&](int height, int width, int channels) {
+        out->Resize(Shape({height, width, channels}), DataType::kUInt8);
+        return out->mut_data<unsigned char>();
+      });
 }
 
 void OpenCvPartialDecodeRandomCropImage(const unsigned char* data, size_t length,
@@ -18,6 +18,7 @@ limitations under the License.
 #include <jpeglib.h>
 #include <opencv2/core/mat.hpp>
 #include <opencv2/opencv.hpp>
+#include "oneflow/core/common/tensor_buffer.h"
 #include "oneflow/user/image/random_crop_generator.h"
 
 namespace oneflow {
@@ -27,6 +28,18 @@ bool JpegPartialDecodeRandomCropImage(const unsigned char* data, size_t length,
                                       unsigned char* workspace, size_t workspace_size,
                                       cv::Mat* out_mat);
 
+// Decodes a JPEG image straight into `out` as an HWC uint8 image in `color_space` ("RGB", "BGR"
+// or "GRAY"). Only the rows and iMCU columns covering the crop drawn by `random_crop_gen` (if any)
+// are decoded. When the target size is positive, the crop is decoded by the scaled IDCT at the
+// smallest of 1/8, 1/4, 1/2 and 1 that keeps it at least as large as the target, so the caller
+// has less to resize. Returns false if the data can not be decoded by libjpeg, or if its EXIF
+// orientation asks for a rotation or a flip, which only the OpenCV path applies.
+bool JpegDecodeRandomCropImage(const unsigned char* data, size_t length,
+                               RandomCropGenerator* random_crop_gen,
+                               const std::string& color_space, int target_width,
+                               int target_height, unsigned char* workspace, size_t workspace_size,
+                               TensorBuffer* out);
+
 void OpenCvPartialDecodeRandomCropImage(const unsigned char* data, size_t length,
                                         RandomCropGenerator* random_crop_gen,
                                         const std::string& color_space, cv::Mat& out_mat);
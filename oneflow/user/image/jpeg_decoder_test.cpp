@@ -15,6 +15,7 @@ limitations under the License.
 */
 
 #include <gtest/gtest.h>
+#include <chrono>
 #include <cstddef>
 #include <iostream>
 #include <sys/stat.h>
@@ -61,6 +62,25 @@ void GenerateImage(std::vector<uint8_t>& jpg, int w, int h) {
   cv::imencode(".jpg", raw, jpg);
 }
 
+// Inserts an EXIF APP1 segment with `orientation` after the JFIF APP0 segment of `jpg`.
+std::vector<unsigned char> WithExifOrientation(const std::vector<unsigned char>& jpg,
+                                               uint16_t orientation) {
+  // a big endian TIFF header, then IFD0 holding only the orientation, a SHORT
+  const std::vector<unsigned char> exif = {
+      'E', 'x', 'i', 'f', 0, 0, 'M', 'M', 0, 42, 0, 0, 0, 8, 0, 1, 0x01, 0x12, 0, 3, 0, 0, 0, 1,
+      static_cast<unsigned char>(orientation >> 8), static_cast<unsigned char>(orientation & 0xFF),
+      0, 0, 0, 0, 0, 0};
+  const size_t segment_length = exif.size() + 2;
+  size_t pos = 2;
+  if (jpg[2] == 0xFF && jpg[3] == 0xE0) { pos = 4 + ((jpg[4] << 8) | jpg[5]); }
+  std::vector<unsigned char> out(jpg.begin(), jpg.begin() + pos);
+  out.insert(out.end(), {0xFF, 0xE1, static_cast<unsigned char>(segment_length >> 8),
+                         static_cast<unsigned char>(segment_length & 0xFF)});
+  out.insert(out.end(), exif.begin(), exif.end());
+  out.insert(out.end(), jpg.begin() + pos, jpg.end());
+  return out;
+}
+
 TEST(JPEG, decoder) {
   constexpr size_t test_num = 3;
   std::vector<unsigned char> jpg;
@@ -93,4 +113,120 @@ TEST(JPEG, decoder) {
   }
 }
 
+TEST(JPEG, decode_into_tensor_buffer) {
+  constexpr size_t test_num = 3;
+  std::vector<unsigned char> jpg;
+  GenerateImage(jpg, 192, 192);
+  std::seed_seq seq{4, 5, 6};
+  std::vector<int64_t> seeds(test_num);
+  seq.generate(seeds.begin(), seeds.end());
+
+  for (int i = 0; i < test_num; i++) {
+    for (const std::string color_space : {"RGB", "BGR", "GRAY"}) {
+      RandomCropGenerator libjpeg_random_crop_gen({0.1, 0.9}, {0.4, 0.6}, seeds[i], 1);
+      RandomCropGenerator opencv_random_crop_gen({0.1, 0.9}, {0.4, 0.6}, seeds[i], 1);
+      TensorBuffer libjpeg_image;
+      ASSERT_TRUE(JpegDecodeRandomCropImage(jpg.data(), jpg.size(), &libjpeg_random_crop_gen,
+                                            color_space, 0, 0, nullptr, 0, &libjpeg_image));
+
+      cv::Mat opencv_image_mat;
+      OpenCvPartialDecodeRandomCropImage(jpg.data(), jpg.size(), &opencv_random_crop_gen,
+                                         color_space, opencv_image_mat);
+      if (color_space == "RGB") {
+        ImageUtil::ConvertColor("BGR", opencv_image_mat, color_space, opencv_image_mat);
+      }
+      ASSERT_EQ(libjpeg_image.shape(), Shape({opencv_image_mat.rows, opencv_image_mat.cols,
+                                              opencv_image_mat.channels()}));
+      cv::Mat checkout = GenCvMat4ImageBuffer(libjpeg_image) - opencv_image_mat;
+      auto sum = cv::sum(cv::sum(checkout));
+      ASSERT_EQ(sum[0], 0);
+    }
+  }
+}
+
+TEST(JPEG, scaled_decode) {
+  std::vector<unsigned char> jpg;
+  GenerateImage(jpg, 192, 192);
+  for (int target_size : {16, 24, 48, 96, 160}) {
+    TensorBuffer image;
+    ASSERT_TRUE(JpegDecodeRandomCropImage(jpg.data(), jpg.size(), nullptr, "RGB", target_size,
+                                          target_size, nullptr, 0, &image));
+    // The smallest power of two downscale that is still at least as large as the target.
+    int64_t expected_size = 192;
+    while (expected_size / 2 >= target_size && expected_size > 192 / 8) { expected_size /= 2; }
+    ASSERT_EQ(image.shape(), Shape({expected_size, expected_size, 3}));
+    // The quadrants of the generated image are pure colors, check them away from the borders.
+    const uint8_t* pixel = image.data<uint8_t>() + (expected_size / 4 * expected_size + 1) * 3;
+    ASSERT_GT(pixel[0], 200);
+    ASSERT_LT(pixel[1], 50);
+    ASSERT_LT(pixel[2], 50);
+  }
+}
+
+TEST(JPEG, exif_orientation) {
+  // 64 wide and 32 high
+  cv::Mat raw(32, 64, CV_8UC3, cv::Scalar(0, 0, 255));
+  raw(cv::Rect(0, 0, 32, 32)).setTo(cv::Scalar(255, 0, 0));
+  std::vector<unsigned char> jpg;
+  cv::imencode(".jpg", raw, jpg);
+
+  TensorBuffer upright;
+  const auto& upright_jpg = WithExifOrientation(jpg, 1);
+  ASSERT_TRUE(JpegDecodeRandomCropImage(upright_jpg.data(), upright_jpg.size(), nullptr, "RGB", 0,
+                                        0, nullptr, 0, &upright));
+  ASSERT_EQ(upright.shape(), Shape({32, 64, 3}));
+
+  // rotated 90 degrees clockwise
+  const auto& rotated_jpg = WithExifOrientation(jpg, 6);
+  TensorBuffer rotated;
+  ASSERT_FALSE(JpegDecodeRandomCropImage(rotated_jpg.data(), rotated_jpg.size(), nullptr, "RGB",
+                                         0, 0, nullptr, 0, &rotated));
+  cv::Mat opencv_image_mat;
+  OpenCvPartialDecodeRandomCropImage(rotated_jpg.data(), rotated_jpg.size(), nullptr, "BGR",
+                                     opencv_image_mat);
+  ASSERT_EQ(opencv_image_mat.rows, 64);
+  ASSERT_EQ(opencv_image_mat.cols, 32);
+  // the blue left half of the image is now on top
+  const cv::Vec3b top = opencv_image_mat.at<cv::Vec3b>(8, 16);
+  ASSERT_GT(top[0], 200);
+  ASSERT_LT(top[2], 50);
+}
+
+TEST(JPEG, decode_random_crop_resize_benchmark) {
+  constexpr int kImageSize = 768;
+  constexpr int kTargetSize = 224;
+  constexpr int kRepeat = 50;
+  std::vector<unsigned char> jpg;
+  GenerateImage(jpg, kImageSize, kImageSize);
+  cv::Mat dst(kTargetSize, kTargetSize, CV_8UC3);
+
+  RandomCropGenerator opencv_random_crop_gen({0.75, 1.33}, {0.08, 1.0}, 1, 10);
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kRepeat; ++i) {
+    cv::Mat image;
+    OpenCvPartialDecodeRandomCropImage(jpg.data(), jpg.size(), &opencv_random_crop_gen, "BGR",
+                                       image);
+    cv::resize(image, dst, cv::Size(kTargetSize, kTargetSize), 0, 0, cv::INTER_LINEAR);
+  }
+  const double opencv_ms =
+      std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+  RandomCropGenerator libjpeg_random_crop_gen({0.75, 1.33}, {0.08, 1.0}, 1, 10);
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kRepeat; ++i) {
+    TensorBuffer image;
+    ASSERT_TRUE(JpegDecodeRandomCropImage(jpg.data(), jpg.size(), &libjpeg_random_crop_gen, "BGR",
+                                          kTargetSize, kTargetSize, nullptr, 0, &image));
+    cv::resize(GenCvMat4ImageBuffer(image), dst, cv::Size(kTargetSize, kTargetSize), 0, 0,
+               cv::INTER_LINEAR);
+  }
+  const double libjpeg_ms =
+      std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+  std::cout << "decode random crop resize " << kImageSize << "x" << kImageSize << " to "
+            << kTargetSize << "x" << kTargetSize << ": opencv " << kRepeat * 1000 / opencv_ms
+            << " images/s, libjpeg scaled " << kRepeat * 1000 / libjpeg_ms << " images/s"
+            << std::endl;
+}
+
 }  // namespace oneflow
@@ -19,6 +19,7 @@ limitations under the License.
 #include "oneflow/user/kernels/collective_communication/cpu/cpu_communication_context.h"
 #include "oneflow/user/kernels/collective_communication/include/all_gather.h"
 #include "oneflow/user/kernels/collective_communication/cpu/cpu_collective_communication_util.h"
+#include "oneflow/user/kernels/collective_communication/cpu/cpu_latency_collective.h"
 
 namespace oneflow {
 
@@ -35,6 +36,13 @@ Maybe<void> AllGatherImpl(const void* in, void* out, size_t elem_cnt, DataType d
   }
   char* char_out = reinterpret_cast<char*>(out);
   size_t chunk_size = elem_cnt * GetSizeOfDataType(dtype);
+  if (JUST(UseLatencyOptimizedAlgorithm(CpuCollectiveType::kAllGather, parallel_desc,
+                                        chunk_size * parallel_num))) {
+    TransportPeerComm comm;
+    JUST(comm.Init(parallel_desc,
+                   JUST(TransportToken::NewTransportToken(kTransportTokenTypeData))));
+    return BruckAllGather(&comm, in, out, chunk_size);
+  }
   BalancedSplitter bs(chunk_size * parallel_num, parallel_num);
   const auto& opt_parallel_id = JUST(GetParallelId4CurrentProcessCtx(parallel_desc));
   CHECK_OR_RETURN(opt_parallel_id->has_value()) << kOfBugIssueUploadPrompt;
@@ -19,6 +19,9 @@ limitations under the License.
 #include "oneflow/user/kernels/collective_communication/cpu/cpu_communication_context.h"
 #include "oneflow/user/kernels/collective_communication/include/all_reduce.h"
 #include "oneflow/user/kernels/collective_communication/cpu/cpu_collective_communication_util.h"
+#include "oneflow/user/kernels/collective_communication/cpu/cpu_latency_collective.h"
+#include "oneflow/user/kernels/collective_communication/cpu/cpu_shm_all_reduce.h"
+#include "oneflow/core/ep/cpu/cpu_stream.h"
 
 namespace oneflow {
 
@@ -26,9 +29,148 @@ namespace ccl {
 
 namespace {
 
+constexpr size_t kReduceGrainSize = 16384;
+
+size_t RingChunkSize() {
+  static const size_t chunk_size =
+      std::max<int64_t>(ParseIntegerFromEnv("ONEFLOW_CPU_ALL_REDUCE_CHUNK_SIZE", 1 << 20), 1);
+  return chunk_size;
+}
+
+ParallelForFn GetParallelForFn(ep::Stream* stream) {
+  auto* cpu_stream = stream->As<ep::CpuStream>();
+  return [cpu_stream](int64_t begin, int64_t end,
+                      const std::function<void(int64_t, int64_t)>& func) {
+    cpu_stream->ParallelFor(begin, end, func, kReduceGrainSize);
+  };
+}
+
+// Ring reduce-scatter followed by ring all-gather. Every partition is cut into chunks which are
+// pipelined through the ring: as soon as chunk k of a step has arrived it is reduced and forwarded
+// while the chunks after it are still on the wire, and the receive of the same chunk two steps
+// ahead is posted into the double-buffered receive buffer it just released. Both neighbours post
+// their messages in (step, chunk) order, which keeps the auto-incremented transport sequence ids
+// of the two sides matched.
+template<typename T, ReduceType reduce_type>
+Maybe<void> RingAllReduce(const T* in, T* out, size_t elem_cnt, Symbol<ParallelDesc> parallel_desc,
+                          const ParallelForFn& parallel_for) {
+  const int64_t parallel_num = parallel_desc->parallel_num();
+  BalancedSplitter bs(elem_cnt, parallel_num);
+  const int64_t max_part_size = bs.At(0).size();
+  const int64_t chunk_elem_cnt = std::max<int64_t>(RingChunkSize() / sizeof(T), 1);
+  const int64_t num_chunks =
+      std::max<int64_t>((max_part_size + chunk_elem_cnt - 1) / chunk_elem_cnt, 1);
+  const auto& ChunkRange = [&](int64_t part_id, int64_t chunk_id) -> Range {
+    const Range part = bs.At(part_id);
+    const Range chunk = BalancedSplitter(part.size(), num_chunks).At(chunk_id);
+    return Range(part.begin() + chunk.begin(), part.begin() + chunk.end());
+  };
+  Optional<int64_t> opt_parallel_id;
+  JUST(GetTensorDevice4CurrentProcessCtx(parallel_desc, &opt_parallel_id));
+  const int64_t parallel_id = JUST(opt_parallel_id);
+  const auto& rank_group = JUST(RankGroup::New(parallel_desc));
+  const int64_t next_rank = JUST(rank_group->GetNextRankInRing());
+  const int64_t prev_rank = JUST(rank_group->GetPrevRankInRing());
+  const int64_t num_steps = parallel_num - 1;
+  // At step s, the part sent in reduce-scatter is parallel_id - s, the one received is
+  // parallel_id - s - 1. In all-gather both are shifted by one.
+  const auto& RsSendPart = [&](int64_t step) {
+    return (parallel_id - step + 2 * parallel_num) % parallel_num;
+  };
+  const auto& RsRecvPart = [&](int64_t step) { return RsSendPart(step + 1); };
+  const auto& AgSendPart = [&](int64_t step) { return RsSendPart(step - 1); };
+  const auto& AgRecvPart = [&](int64_t step) { return RsSendPart(step); };
+
+  TransportToken rs_token = JUST(TransportToken::NewTransportToken(kTransportTokenTypeData));
+  TransportToken ag_token = JUST(TransportToken::NewTransportToken(kTransportTokenTypeData));
+  // Every chunk message owns its context so that it can be waited for on its own.
+  using CtxPtr = std::unique_ptr<NaiveAsyncTransportCtx>;
+  std::vector<CtxPtr> rs_send_ctxs(num_steps * num_chunks);
+  std::vector<CtxPtr> rs_recv_ctxs(num_steps * num_chunks);
+  std::vector<CtxPtr> ag_send_ctxs(num_steps * num_chunks);
+  std::vector<CtxPtr> ag_recv_ctxs(num_steps * num_chunks);
+  const auto& Slot = [&](int64_t step, int64_t chunk_id) { return step * num_chunks + chunk_id; };
+  const auto& Post = [&](bool send, const TransportToken& token, T* ptr, const Range& range,
+                         CtxPtr* ctx) -> Maybe<void> {
+    if (range.size() == 0) { return Maybe<void>::Ok(); }
+    *ctx = NewBufferTransportCtx(token, ptr, range.size() * sizeof(T));
+    if (send) {
+      JUST(TransportUtil::SendDataToRank(next_rank, token, ctx->get()));
+    } else {
+      JUST(TransportUtil::ReceiveDataFromRank(prev_rank, token, ctx->get()));
+    }
+    return Maybe<void>::Ok();
+  };
+  const auto& Wait = [](const CtxPtr& ctx) -> Maybe<void> {
+    if (ctx) { JUST(ctx->WaitDone()); }
+    return Maybe<void>::Ok();
+  };
+
+  const int64_t recv_buffer_size = max_part_size;
+  auto recv_buffer = std::make_unique<T[]>(2 * recv_buffer_size);
+  const auto& RsRecvPtr = [&](int64_t step, int64_t chunk_id) {
+    const Range range = ChunkRange(RsRecvPart(step), chunk_id);
+    return recv_buffer.get() + (step % 2) * recv_buffer_size
+           + (range.begin() - bs.At(RsRecvPart(step)).begin());
+  };
+  const auto& PostRsRecv = [&](int64_t step, int64_t chunk_id) -> Maybe<void> {
+    return Post(false, rs_token, RsRecvPtr(step, chunk_id), ChunkRange(RsRecvPart(step), chunk_id),
+                &rs_recv_ctxs.at(Slot(step, chunk_id)));
+  };
+  const auto& PostAgSend = [&](int64_t step, int64_t chunk_id) -> Maybe<void> {
+    const Range range = ChunkRange(AgSendPart(step), chunk_id);
+    return Post(true, ag_token, out + range.begin(), range, &ag_send_ctxs.at(Slot(step, chunk_id)));
+  };
+
+  for (int64_t k = 0; k < num_chunks; ++k) {
+    const Range range = ChunkRange(RsSendPart(0), k);
+    JUST(Post(true, rs_token, const_cast<T*>(in) + range.begin(), range,
+              &rs_send_ctxs.at(Slot(0, k))));
+  }
+  for (int64_t s = 0; s < std::min<int64_t>(num_steps, 2); ++s) {
+    for (int64_t k = 0; k < num_chunks; ++k) { JUST(PostRsRecv(s, k)); }
+  }
+  for (int64_t s = 0; s < num_steps; ++s) {
+    for (int64_t k = 0; k < num_chunks; ++k) {
+      JUST(Wait(rs_recv_ctxs.at(Slot(s, k))));
+      const Range range = ChunkRange(RsRecvPart(s), k);
+      const T* recv_ptr = RsRecvPtr(s, k);
+      parallel_for(range.begin(), range.end(), [&](int64_t begin, int64_t end) {
+        ReduceChunk<T, reduce_type>(end - begin, out + begin, in + begin,
+                                    recv_ptr + (begin - range.begin()));
+      });
+      if (s + 1 < num_steps) {
+        JUST(Post(true, rs_token, out + range.begin(), range, &rs_send_ctxs.at(Slot(s + 1, k))));
+      } else {
+        // The chunk is fully reduced, start circulating it right away.
+        JUST(PostAgSend(0, k));
+      }
+      if (s + 2 < num_steps) { JUST(PostRsRecv(s + 2, k)); }
+    }
+  }
+
+  // All-gather receives land in `out` directly. A part is only overwritten once this rank is done
+  // sending its reduce-scatter chunks, which read from the same place.
+  for (int64_t s = 0; s < num_steps; ++s) {
+    for (int64_t k = 0; k < num_chunks; ++k) {
+      JUST(Wait(rs_send_ctxs.at(Slot(s, k))));
+      const Range range = ChunkRange(AgRecvPart(s), k);
+      JUST(Post(false, ag_token, out + range.begin(), range, &ag_recv_ctxs.at(Slot(s, k))));
+    }
+  }
+  for (int64_t s = 0; s < num_steps; ++s) {
+    for (int64_t k = 0; k < num_chunks; ++k) {
+      JUST(Wait(ag_recv_ctxs.at(Slot(s, k))));
+      if (s + 1 < num_steps) { JUST(PostAgSend(s + 1, k)); }
+    }
+  }
+  for (const auto& ctx : ag_send_ctxs) { JUST(Wait(ctx)); }
+  return Maybe<void>::Ok();
+}
+
 template<typename T, ReduceType reduce_type>
 struct AllReduceImpl final {
-  static Maybe<void> Call(const void* void_in, void* void_out, size_t elem_cnt,
+  static Maybe<void> Call(ep::Stream* stream, const void* void_in, void* void_out, size_t elem_cnt,
                           Symbol<ParallelDesc> parallel_desc) {
     int64_t parallel_num = parallel_desc->parallel_num();
     if (parallel_num == 1) {
@@ -37,84 +179,20 @@ struct AllReduceImpl final {
     }
     const T* in = reinterpret_cast<const T*>(void_in);
     T* out = reinterpret_cast<T*>(void_out);
-    BalancedSplitter bs(elem_cnt, parallel_num);
-    auto recv_buffer = std::make_unique<T[]>(bs.At(0).size());
-    Optional<int64_t> parallel_id;
-    JUST(GetTensorDevice4CurrentProcessCtx(parallel_desc, &parallel_id));
-    const auto& rank_group = JUST(RankGroup::New(parallel_desc));
-    TransportToken transport_token =
-        JUST(TransportToken::NewTransportToken(kTransportTokenTypeData));
-    for (int64_t i = 0, part_id = JUST(parallel_id); i < parallel_num - 1;
-         ++i, part_id = RingDecrease(part_id, parallel_num)) {
-      int64_t send_part_id = part_id;
-      const T* send_ptr = nullptr;
-      if (i == 0) {
-        send_ptr = &in[bs.At(send_part_id).begin()];
-      } else {
-        send_ptr = &out[bs.At(send_part_id).begin()];
-      }
-      size_t send_size = bs.At(send_part_id).size();
-      int64_t recv_part_id = RingDecrease(part_id, parallel_num);
-      T* recv_ptr = recv_buffer.get();
-      size_t recv_size = bs.At(recv_part_id).size();
-      NaiveAsyncTransportCtx ctx(
-          transport_token,
-          [&](void** buffer, std::size_t* size, std::function<void()>* Cb) -> Maybe<void> {
-            *buffer = const_cast<T*>(send_ptr);
-            *size = send_size * sizeof(T);
-            *Cb = [] {};
-            return Maybe<void>::Ok();
-          },
-          [&](void** buffer, std::size_t* size, std::function<void()>* Cb) -> Maybe<void> {
-            *buffer = recv_ptr;
-            *size = recv_size * sizeof(T);
-            *Cb = [] {};
-            return Maybe<void>::Ok();
-          });
-      if (send_size > 0) {
-        JUST(TransportUtil::SendToNextRankInRing(rank_group, transport_token, &ctx));
-      }
-      if (recv_size > 0) {
-        JUST(TransportUtil::ReceiveFromPrevRankInRing(rank_group, transport_token, &ctx));
-      }
-      JUST(ctx.WaitDone());
-      const T* cur_in = &in[bs.At(recv_part_id).begin()];
-      T* cur_out = &out[bs.At(recv_part_id).begin()];
-      if (recv_size > 0) {
-        ReduceFunctor<T, reduce_type>::Call(recv_size, cur_out, cur_in, recv_ptr);
-      }
+    const ParallelForFn parallel_for = GetParallelForFn(stream);
+    ShmAllReduceEngine* shm_engine = JUST(GetShmAllReduceEngine(parallel_desc));
+    if (shm_engine != nullptr) {
+      shm_engine->AllReduce<T, reduce_type>(in, out, elem_cnt, parallel_for);
+      return Maybe<void>::Ok();
     }
-    for (int64_t i = 0, part_id = RingIncrease(JUST(parallel_id), parallel_num);
-         i < parallel_num - 1; ++i, part_id = RingDecrease(part_id, parallel_num)) {
-      int64_t send_part_id = part_id;
-      const T* send_ptr = &out[bs.At(send_part_id).begin()];
-      size_t send_size = bs.At(send_part_id).size();
-      int64_t recv_part_id = RingDecrease(part_id, parallel_num);
-      T* recv_ptr = &out[bs.At(recv_part_id).begin()];
-      size_t recv_size = bs.At(recv_part_id).size();
-      NaiveAsyncTransportCtx ctx(
-          transport_token,
-          [&](void** buffer, std::size_t* size, std::function<void()>* Cb) -> Maybe<void> {
-            *buffer = const_cast<T*>(send_ptr);
-            *size = send_size * sizeof(T);
-            *Cb = [] {};
-            return Maybe<void>::Ok();
-          },
-          [&](void** buffer, std::size_t* size, std::function<void()>* Cb) -> Maybe<void> {
-            *buffer = recv_ptr;
-            *size = recv_size * sizeof(T);
-            *Cb = [] {};
-            return Maybe<void>::Ok();
-          });
-      if (send_size > 0) {
-        JUST(TransportUtil::SendToNextRankInRing(rank_group, transport_token, &ctx));
-      }
-      if (recv_size > 0) {
-        JUST(TransportUtil::ReceiveFromPrevRankInRing(rank_group, transport_token, &ctx));
-      }
-      JUST(ctx.WaitDone());
+    if (JUST(UseLatencyOptimizedAlgorithm(CpuCollectiveType::kAllReduce, parallel_desc,
+                                          elem_cnt * sizeof(T)))) {
+      TransportPeerComm comm;
+      JUST(comm.Init(parallel_desc,
+                     JUST(TransportToken::NewTransportToken(kTransportTokenTypeData))));
+      return RecursiveDoublingAllReduce<T, reduce_type>(&comm, in, out, elem_cnt);
     }
-    return Maybe<void>::Ok();
+    return RingAllReduce<T, reduce_type>(in, out, elem_cnt, parallel_desc, parallel_for);
   }
 };
 
@@ -144,7 +222,7 @@ class CpuAllReduce final : public AllReduce {
     const auto& cpu_communication_ctx =
         std::dynamic_pointer_cast<CpuCommunicationContext>(communication_ctx);
     CHECK(cpu_communication_ctx) << kOfBugIssueUploadPrompt;
-    CHECK_JUST(SwitchAllReduceImpl(SwitchCase(datatype_, reduce_type_), in, out, elem_cnt,
+    CHECK_JUST(SwitchAllReduceImpl(SwitchCase(datatype_, reduce_type_), stream, in, out, elem_cnt,
                                    cpu_communication_ctx->parallel_desc()));
   }
 
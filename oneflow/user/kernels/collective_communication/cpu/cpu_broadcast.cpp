@@ -19,6 +19,7 @@ limitations under the License.
 #include "oneflow/core/framework/transport_util.h"
 #include "oneflow/user/kernels/collective_communication/cpu/cpu_communication_context.h"
 #include "oneflow/user/kernels/collective_communication/include/broadcast.h"
+#include "oneflow/user/kernels/collective_communication/cpu/cpu_latency_collective.h"
 
 namespace oneflow {
 
@@ -42,10 +43,18 @@ class CpuBroadcastImpl final : public Broadcast {
         std::dynamic_pointer_cast<CpuCommunicationContext>(communication_ctx);
     CHECK(cpu_communication_ctx);
     size_t buffer_size = elem_cnt * size_of_dtype_;
+    const auto& parallel_desc = cpu_communication_ctx->parallel_desc();
     const auto& transport_token =
         CHECK_JUST(TransportToken::NewTransportToken(kTransportTokenTypeData));
-    CHECK_JUST(CpuBroadcast(in, out, buffer_size, root, cpu_communication_ctx->parallel_desc(),
-                            transport_token));
+    if (CHECK_JUST(UseLatencyOptimizedAlgorithm(CpuCollectiveType::kBroadcast, parallel_desc,
+                                                buffer_size))) {
+      TransportPeerComm comm;
+      CHECK_JUST(comm.Init(parallel_desc, transport_token));
+      CHECK_JUST(BinomialTreeBroadcast(&comm, in, out, buffer_size,
+                                       CHECK_JUST(comm.PeerOfProcessRank(root))));
+    } else {
+      CHECK_JUST(CpuBroadcast(in, out, buffer_size, root, parallel_desc, transport_token));
+    }
   }
 
  private:
@@ -56,6 +56,28 @@ struct ReduceFunctor<T, kMax> {
   }
 };
 
+template<typename T, ReduceType reduce_type>
+struct BinaryReduceOp;
+
+template<typename T>
+struct BinaryReduceOp<T, kSum> {
+  static T Apply(T a, T b) { return a + b; }
+};
+
+template<typename T>
+struct BinaryReduceOp<T, kMax> {
+  static T Apply(T a, T b) { return std::max(a, b); }
+};
+
+// Single-threaded elementwise reduction of one chunk, written so that the compiler vectorizes it.
+// `out` may alias `in0`.
+template<typename T, ReduceType reduce_type>
+void ReduceChunk(size_t size, T* out, const T* in0, const T* __restrict in1) {
+  for (size_t i = 0; i < size; ++i) {
+    out[i] = BinaryReduceOp<T, reduce_type>::Apply(in0[i], in1[i]);
+  }
+}
+
 }  // namespace ccl
 
 }  // namespace oneflow
@@ -0,0 +1,197 @@
+/*
+Copyright 2020 The OneFlow Authors. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "oneflow/user/kernels/collective_communication/cpu/cpu_latency_collective.h"
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdlib>
+#include "oneflow/core/common/str_util.h"
+#include "oneflow/core/job/parallel_desc.h"
+#include "oneflow/core/rpc/include/global_process_ctx.h"
+
+namespace oneflow {
+
+namespace ccl {
+
+namespace {
+
+constexpr int kNumCpuCollectiveTypes = 3;
+
+struct LatencyThreshold {
+  int64_t max_ranks;
+  size_t max_bytes;
+};
+
+// Entries sorted by max_ranks, the first one covering the group size wins.
+using LatencyThresholdTable = std::array<std::vector<LatencyThreshold>, kNumCpuCollectiveTypes>;
+
+// Tuned with the sweep of cpu_latency_collective_test.cpp, which models 20us sockets at 10Gb/s.
+// Recursive doubling wins by 2-3x up to a few KiB and breaks even around 64KiB, Bruck stays ahead
+// of the ring while the final rotation is cheap, and the binomial tree never loses to the heap.
+LatencyThresholdTable DefaultLatencyThresholdTable() {
+  LatencyThresholdTable table;
+  table.at(static_cast<int>(CpuCollectiveType::kAllReduce)) = {{2, 64 << 10},
+                                                               {GetMaxVal<int64_t>(), 32 << 10}};
+  table.at(static_cast<int>(CpuCollectiveType::kAllGather)) = {{GetMaxVal<int64_t>(), 256 << 10}};
+  table.at(static_cast<int>(CpuCollectiveType::kBroadcast)) = {{GetMaxVal<int64_t>(), 1 << 20}};
+  return table;
+}
+
+Maybe<CpuCollectiveType> ParseCpuCollectiveType(const std::string& name) {
+  if (name == "all_reduce") { return CpuCollectiveType::kAllReduce; }
+  if (name == "all_gather") { return CpuCollectiveType::kAllGather; }
+  if (name == "broadcast") { return CpuCollectiveType::kBroadcast; }
+  return Error::InvalidValueError() << "unknown cpu collective " << name
+                                    << " in ONEFLOW_CPU_CCL_LATENCY_THRESHOLDS";
+}
+
+// Parses a whole decimal integer of `entry`, std::stoll would throw on malformed values.
+Maybe<int64_t> ParseThresholdInteger(const std::string& text, const std::string& entry) {
+  errno = 0;
+  char* end = nullptr;
+  const long long value = std::strtoll(text.c_str(), &end, 10);
+  if (text.empty() || *end != '\0' || errno == ERANGE) {
+    return Error::InvalidValueError() << "invalid integer " << text << " of entry " << entry
+                                      << " in ONEFLOW_CPU_CCL_LATENCY_THRESHOLDS";
+  }
+  return static_cast<int64_t>(value);
+}
+
+Maybe<LatencyThresholdTable> ParseLatencyThresholdTable(const std::string& text) {
+  LatencyThresholdTable table = DefaultLatencyThresholdTable();
+  std::array<bool, kNumCpuCollectiveTypes> overridden{};
+  std::vector<std::string> entries;
+  Split(text, ",", [&](std::string&& entry) {
+    if (!entry.empty()) { entries.emplace_back(std::move(entry)); }
+  });
+  for (const std::string& entry : entries) {
+    const size_t eq_pos = entry.find('=');
+    if (eq_pos == std::string::npos) {
+      return Error::InvalidValueError()
+             << "invalid entry " << entry << " in ONEFLOW_CPU_CCL_LATENCY_THRESHOLDS";
+    }
+    std::string name = entry.substr(0, eq_pos);
+    int64_t max_ranks = GetMaxVal<int64_t>();
+    const size_t at_pos = name.find('@');
+    if (at_pos != std::string::npos) {
+      max_ranks = JUST(ParseThresholdInteger(name.substr(at_pos + 1), entry));
+      name = name.substr(0, at_pos);
+    }
+    const int64_t max_bytes = JUST(ParseThresholdInteger(entry.substr(eq_pos + 1), entry));
+    if (max_ranks <= 0 || max_bytes < 0) {
+      return Error::InvalidValueError()
+             << "invalid entry " << entry << " in ONEFLOW_CPU_CCL_LATENCY_THRESHOLDS";
+    }
+    const int type = static_cast<int>(JUST(ParseCpuCollectiveType(name)));
+    if (!overridden.at(type)) {
+      table.at(type).clear();
+      overridden.at(type) = true;
+    }
+    table.at(type).emplace_back(LatencyThreshold{max_ranks, static_cast<size_t>(max_bytes)});
+  }
+  for (auto& thresholds : table) {
+    std::sort(thresholds.begin(), thresholds.end(),
+              [](const LatencyThreshold& lhs, const LatencyThreshold& rhs) {
+                return lhs.max_ranks < rhs.max_ranks;
+              });
+  }
+  return table;
+}
+
+Maybe<const LatencyThresholdTable&> GetLatencyThresholdTable() {
+  static const Maybe<LatencyThresholdTable> table =
+      ParseLatencyThresholdTable(GetStringFromEnv("ONEFLOW_CPU_CCL_LATENCY_THRESHOLDS", ""));
+  return *JUST(table);
+}
+
+}  // namespace
+
+Maybe<bool> UseLatencyOptimizedAlgorithm(CpuCollectiveType type, int64_t num_ranks, size_t bytes) {
+  if (num_ranks <= 1) { return false; }
+  const auto& table = JUST(GetLatencyThresholdTable());
+  for (const auto& threshold : table.at(static_cast<int>(type))) {
+    if (num_ranks <= threshold.max_ranks) { return bytes <= threshold.max_bytes; }
+  }
+  return false;
+}
+
+Maybe<bool> UseLatencyOptimizedAlgorithm(CpuCollectiveType type,
+                                         Symbol<ParallelDesc> parallel_desc, size_t bytes) {
+  // TransportPeerComm addresses the peers by process.
+  if (static_cast<size_t>(parallel_desc->parallel_num())
+      != parallel_desc->sorted_machine_ids().size()) {
+    return false;
+  }
+  return UseLatencyOptimizedAlgorithm(type, parallel_desc->parallel_num(), bytes);
+}
+
+std::unique_ptr<NaiveAsyncTransportCtx> NewBufferTransportCtx(const TransportToken& token,
+                                                              void* ptr, size_t size) {
+  const auto& Prepare = [ptr, size](void** buffer, std::size_t* buffer_size,
+                                    std::function<void()>* Cb) -> Maybe<void> {
+    *buffer = ptr;
+    *buffer_size = size;
+    *Cb = [] {};
+    return Maybe<void>::Ok();
+  };
+  return std::make_unique<NaiveAsyncTransportCtx>(token, Prepare, Prepare);
+}
+
+Maybe<void> TransportPeerComm::Init(Symbol<ParallelDesc> parallel_desc,
+                                    const TransportToken& token) {
+  CHECK_EQ_OR_RETURN(parallel_desc->parallel_num(), parallel_desc->sorted_machine_ids().size())
+      << "cpu collectives expect one device per process";
+  token_ = token;
+  process_ranks_.resize(parallel_desc->parallel_num());
+  rank_ = -1;
+  for (int64_t parallel_id = 0; parallel_id < parallel_desc->parallel_num(); ++parallel_id) {
+    process_ranks_.at(parallel_id) = JUST(parallel_desc->MachineId4ParallelId(parallel_id));
+    if (process_ranks_.at(parallel_id) == GlobalProcessCtx::Rank()) { rank_ = parallel_id; }
+  }
+  CHECK_GE_OR_RETURN(rank_, 0) << "current process is not in the placement";
+  return Maybe<void>::Ok();
+}
+
+Maybe<int64_t> TransportPeerComm::PeerOfProcessRank(int64_t process_rank) const {
+  const auto it = std::find(process_ranks_.begin(), process_ranks_.end(), process_rank);
+  CHECK_OR_RETURN(it != process_ranks_.end())
+      << "process " << process_rank << " is not in the placement";
+  return static_cast<int64_t>(it - process_ranks_.begin());
+}
+
+Maybe<void> TransportPeerComm::Send(int64_t peer, const void* buf, size_t size) {
+  if (size == 0) { return Maybe<void>::Ok(); }
+  ctxs_.emplace_back(NewBufferTransportCtx(token_, const_cast<void*>(buf), size));
+  JUST(TransportUtil::SendDataToRank(process_ranks_.at(peer), token_, ctxs_.back().get()));
+  return Maybe<void>::Ok();
+}
+
+Maybe<void> TransportPeerComm::Recv(int64_t peer, void* buf, size_t size) {
+  if (size == 0) { return Maybe<void>::Ok(); }
+  ctxs_.emplace_back(NewBufferTransportCtx(token_, buf, size));
+  JUST(TransportUtil::ReceiveDataFromRank(process_ranks_.at(peer), token_, ctxs_.back().get()));
+  return Maybe<void>::Ok();
+}
+
+Maybe<void> TransportPeerComm::Wait() {
+  for (const auto& ctx : ctxs_) { JUST(ctx->WaitDone()); }
+  ctxs_.clear();
+  return Maybe<void>::Ok();
+}
+
+}  // namespace ccl
+
+}  // namespace oneflow
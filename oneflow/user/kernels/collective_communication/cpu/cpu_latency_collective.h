@@ -0,0 +1,198 @@
+/*
+Copyright 2020 The OneFlow Authors. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef ONEFLOW_USER_KERNELS_COLLECTIVE_COMMUNICATION_CPU_CPU_LATENCY_COLLECTIVE_H_
+#define ONEFLOW_USER_KERNELS_COLLECTIVE_COMMUNICATION_CPU_CPU_LATENCY_COLLECTIVE_H_
+
+#include <memory>
+#include <vector>
+#include "oneflow/core/common/maybe.h"
+#include "oneflow/core/common/symbol.h"
+#include "oneflow/core/framework/transport_util.h"
+#include "oneflow/user/kernels/collective_communication/include/collective_communication.h"
+#include "oneflow/user/kernels/collective_communication/cpu/cpu_collective_communication_util.h"
+
+namespace oneflow {
+
+class ParallelDesc;
+
+namespace ccl {
+
+// Latency-optimized collectives for small messages. Ring algorithms need 2(p-1) (all-reduce) or
+// p-1 (all-gather) dependent hops, which dominates when the payload is a loss scalar or a norm.
+// The algorithms below finish in ceil(log2(p)) rounds instead.
+//
+// They are written against a peer communicator `Comm` that addresses peers by parallel id:
+//   int64_t rank() const; int64_t size() const;
+//   Maybe<void> Send(int64_t peer, const void* buf, size_t size);  // posts a send
+//   Maybe<void> Recv(int64_t peer, void* buf, size_t size);        // posts a receive
+//   Maybe<void> Wait();  // waits for every posted send and receive
+// Messages between two peers are matched in posting order.
+
+enum class CpuCollectiveType {
+  kAllReduce = 0,
+  kAllGather,
+  kBroadcast,
+};
+
+// Whether a collective producing `bytes` bytes on each of `num_ranks` ranks should use the
+// latency-optimized algorithm. The thresholds default to a built-in table and can be overridden
+// with ONEFLOW_CPU_CCL_LATENCY_THRESHOLDS, a comma-separated list of
+// `<all_reduce|all_gather|broadcast>[@<max_ranks>]=<max_bytes>` entries, e.g.
+// "all_reduce=65536,all_reduce@4=16384,broadcast=0". An entry with `@n` applies to groups of at
+// most n ranks, the one without to all larger groups, and 0 bytes disables the algorithm.
+Maybe<bool> UseLatencyOptimizedAlgorithm(CpuCollectiveType type, int64_t num_ranks, size_t bytes);
+// Same for the ranks of `parallel_desc`, always false if a process holds several of its devices.
+Maybe<bool> UseLatencyOptimizedAlgorithm(CpuCollectiveType type,
+                                         Symbol<ParallelDesc> parallel_desc, size_t bytes);
+
+// A point-to-point message of the transport, sent from or received into `ptr`.
+std::unique_ptr<NaiveAsyncTransportCtx> NewBufferTransportCtx(const TransportToken& token,
+                                                              void* ptr, size_t size);
+
+// Comm over the process transport for the ranks of a cpu placement.
+class TransportPeerComm final {
+ public:
+  OF_DISALLOW_COPY_AND_MOVE(TransportPeerComm);
+  TransportPeerComm() = default;
+  ~TransportPeerComm() = default;
+
+  Maybe<void> Init(Symbol<ParallelDesc> parallel_desc, const TransportToken& token);
+
+  int64_t rank() const { return rank_; }
+  int64_t size() const { return process_ranks_.size(); }
+  // The parallel id of the process `process_rank`.
+  Maybe<int64_t> PeerOfProcessRank(int64_t process_rank) const;
+
+  Maybe<void> Send(int64_t peer, const void* buf, size_t size);
+  Maybe<void> Recv(int64_t peer, void* buf, size_t size);
+  Maybe<void> Wait();
+
+ private:
+  TransportToken token_;
+  std::vector<int64_t> process_ranks_;
+  int64_t rank_;
+  std::vector<std::unique_ptr<NaiveAsyncTransportCtx>> ctxs_;
+};
+
+// Recursive doubling: in round k every rank exchanges its partial result with the rank whose id
+// differs in bit k. With p not a power of two, the first 2 * (p - pof2) ranks are folded in pairs
+// before and unfolded after. Every rank computes the same combinations of the same operands, so
+// all ranks end up with bitwise identical results.
+template<typename T, ReduceType reduce_type, typename Comm>
+Maybe<void> RecursiveDoublingAllReduce(Comm* comm, const T* in, T* out, size_t elem_cnt) {
+  const int64_t size = comm->size();
+  const int64_t rank = comm->rank();
+  const size_t bytes = elem_cnt * sizeof(T);
+  if (in != out) { std::memcpy(out, in, bytes); }
+  if (size == 1 || elem_cnt == 0) { return Maybe<void>::Ok(); }
+  int64_t pof2 = 1;
+  while (pof2 * 2 <= size) { pof2 *= 2; }
+  const int64_t rem = size - pof2;
+  std::unique_ptr<T[]> tmp(new T[elem_cnt]);
+
+  int64_t new_rank = -1;
+  if (rank < 2 * rem) {
+    if (rank % 2 == 0) {
+      JUST(comm->Send(rank + 1, out, bytes));
+    } else {
+      JUST(comm->Recv(rank - 1, tmp.get(), bytes));
+      new_rank = rank / 2;
+    }
+    JUST(comm->Wait());
+    if (new_rank >= 0) { ReduceChunk<T, reduce_type>(elem_cnt, out, out, tmp.get()); }
+  } else {
+    new_rank = rank - rem;
+  }
+  if (new_rank >= 0) {
+    for (int64_t mask = 1; mask < pof2; mask *= 2) {
+      const int64_t new_peer = new_rank ^ mask;
+      const int64_t peer = new_peer < rem ? new_peer * 2 + 1 : new_peer + rem;
+      JUST(comm->Send(peer, out, bytes));
+      JUST(comm->Recv(peer, tmp.get(), bytes));
+      JUST(comm->Wait());
+      ReduceChunk<T, reduce_type>(elem_cnt, out, out, tmp.get());
+    }
+  }
+  if (rank < 2 * rem) {
+    if (rank % 2 == 0) {
+      JUST(comm->Recv(rank + 1, out, bytes));
+    } else {
+      JUST(comm->Send(rank - 1, out, bytes));
+    }
+    JUST(comm->Wait());
+  }
+  return Maybe<void>::Ok();
+}
+
+// Bruck all-gather: after round k every rank holds the blocks of the 2^(k+1) ranks following it,
+// for any number of ranks. `out` receives the block of rank i at offset i * block_size.
+template<typename Comm>
+Maybe<void> BruckAllGather(Comm* comm, const void* in, void* out, size_t block_size) {
+  const int64_t size = comm->size();
+  const int64_t rank = comm->rank();
+  char* char_out = reinterpret_cast<char*>(out);
+  if (size == 1 || block_size == 0) {
+    if (in != out) { std::memmove(out, in, block_size); }
+    return Maybe<void>::Ok();
+  }
+  // Blocks in the order rank, rank + 1, ..., rank - 1.
+  std::unique_ptr<char[]> tmp(new char[size * block_size]);
+  std::memcpy(tmp.get(), in, block_size);
+  for (int64_t distance = 1; distance < size; distance *= 2) {
+    const int64_t count = std::min(distance, size - distance);
+    JUST(comm->Send((rank - distance + size) % size, tmp.get(), count * block_size));
+    JUST(comm->Recv((rank + distance) % size, tmp.get() + distance * block_size,
+                    count * block_size));
+    JUST(comm->Wait());
+  }
+  for (int64_t i = 0; i < size; ++i) {
+    std::memcpy(char_out + ((rank + i) % size) * block_size, tmp.get() + i * block_size,
+                block_size);
+  }
+  return Maybe<void>::Ok();
+}
+
+// Binomial tree broadcast: a rank receives once from its parent and then forwards to its children
+// in decreasing subtree size, so the whole group is covered in ceil(log2(p)) rounds.
+template<typename Comm>
+Maybe<void> BinomialTreeBroadcast(Comm* comm, const void* in, void* out, size_t size,
+                                  int64_t root) {
+  const int64_t num_ranks = comm->size();
+  const int64_t relative_rank = (comm->rank() - root + num_ranks) % num_ranks;
+  if (relative_rank == 0 && in != out) { std::memcpy(out, in, size); }
+  if (num_ranks == 1 || size == 0) { return Maybe<void>::Ok(); }
+  int64_t mask = 1;
+  for (; mask < num_ranks; mask *= 2) {
+    if (relative_rank & mask) {
+      JUST(comm->Recv((relative_rank - mask + root) % num_ranks, out, size));
+      JUST(comm->Wait());
+      break;
+    }
+  }
+  for (mask /= 2; mask > 0; mask /= 2) {
+    if (relative_rank + mask < num_ranks) {
+      JUST(comm->Send((relative_rank + mask + root) % num_ranks, out, size));
+    }
+  }
+  JUST(comm->Wait());
+  return Maybe<void>::Ok();
+}
+
+}  // namespace ccl
+
+}  // namespace oneflow
+
+#endif  // ONEFLOW_USER_KERNELS_COLLECTIVE_COMMUNICATION_CPU_CPU_LATENCY_COLLECTIVE_H_
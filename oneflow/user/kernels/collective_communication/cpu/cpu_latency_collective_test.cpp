@@ -0,0 +1,359 @@
+/*
+Copyright 2020 The OneFlow Authors. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include <gtest/gtest.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include "oneflow/user/kernels/collective_communication/cpu/cpu_latency_collective.h"
+
+namespace oneflow {
+namespace ccl {
+namespace test {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Ranks emulated by threads exchanging messages through in-memory mailboxes. Every message becomes
+// visible to its receiver `latency` after the sender's link has pushed it out at `bytes_per_ns`,
+// which is how a socket between two processes behaves to first order.
+class LocalCommGroup final {
+ public:
+  OF_DISALLOW_COPY_AND_MOVE(LocalCommGroup);
+  LocalCommGroup(int64_t size, std::chrono::nanoseconds latency, double bytes_per_ns)
+      : size_(size),
+        latency_(latency),
+        bytes_per_ns_(bytes_per_ns),
+        mailboxes_(size * size),
+        barrier_count_(0),
+        barrier_generation_(0) {}
+  ~LocalCommGroup() = default;
+
+  class Comm final {
+   public:
+    Comm(LocalCommGroup* group, int64_t rank) : group_(group), rank_(rank), link_free_time_() {}
+
+    int64_t rank() const { return rank_; }
+    int64_t size() const { return group_->size_; }
+
+    Maybe<void> Send(int64_t peer, const void* buf, size_t size) {
+      if (size == 0) { return Maybe<void>::Ok(); }
+      const auto transfer_time = std::chrono::nanoseconds(
+          static_cast<int64_t>(static_cast<double>(size) / group_->bytes_per_ns_));
+      link_free_time_ = std::max(link_free_time_, Clock::now()) + transfer_time;
+      Message message{std::vector<char>(size), link_free_time_ + group_->latency_};
+      std::memcpy(message.data.data(), buf, size);
+      Mailbox* mailbox = group_->mailbox(rank_, peer);
+      std::unique_lock<std::mutex> lock(mailbox->mutex);
+      mailbox->queue.emplace_back(std::move(message));
+      mailbox->cond.notify_one();
+      return Maybe<void>::Ok();
+    }
+
+    Maybe<void> Recv(int64_t peer, void* buf, size_t size) {
+      if (size == 0) { return Maybe<void>::Ok(); }
+      pending_recvs_.emplace_back(PendingRecv{peer, buf, size});
+      return Maybe<void>::Ok();
+    }
+
+    Maybe<void> Wait() {
+      for (const auto& recv : pending_recvs_) {
+        Mailbox* mailbox = group_->mailbox(recv.peer, rank_);
+        Message message;
+        {
+          std::unique_lock<std::mutex> lock(mailbox->mutex);
+          mailbox->cond.wait(lock, [&]() { return !mailbox->queue.empty(); });
+          message = std::move(mailbox->queue.front());
+          mailbox->queue.pop_front();
+        }
+        CHECK_EQ_OR_RETURN(message.data.size(), recv.size);
+        while (Clock::now() < message.ready_time) { std::this_thread::yield(); }
+        std::memcpy(recv.buf, message.data.data(), recv.size);
+      }
+      pending_recvs_.clear();
+      return Maybe<void>::Ok();
+    }
+
+   private:
+    struct PendingRecv {
+      int64_t peer;
+      void* buf;
+      size_t size;
+    };
+    LocalCommGroup* group_;
+    int64_t rank_;
+    Clock::time_point link_free_time_;
+    std::vector<PendingRecv> pending_recvs_;
+  };
+
+  void Barrier() {
+    std::unique_lock<std::mutex> lock(barrier_mutex_);
+    const int64_t generation = barrier_generation_;
+    if (++barrier_count_ == size_) {
+      barrier_count_ = 0;
+      ++barrier_generation_;
+      barrier_cond_.notify_all();
+    } else {
+      barrier_cond_.wait(lock, [&]() { return barrier_generation_ != generation; });
+    }
+  }
+
+  void Run(const std::function<void(Comm*)>& func) {
+    std::vector<std::thread> threads;
+    for (int64_t rank = 0; rank < size_; ++rank) {
+      threads.emplace_back([this, rank, &func]() {
+        Comm comm(this, rank);
+        func(&comm);
+      });
+    }
+    for (auto& thread : threads) { thread.join(); }
+  }
+
+ private:
+  struct Message {
+    std::vector<char> data;
+    Clock::time_point ready_time;
+  };
+  struct Mailbox {
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<Message> queue;
+  };
+
+  Mailbox* mailbox(int64_t src, int64_t dst) { return &mailboxes_.at(src * size_ + dst); }
+
+  int64_t size_;
+  std::chrono::nanoseconds latency_;
+  double bytes_per_ns_;
+  std::vector<Mailbox> mailboxes_;
+  std::mutex barrier_mutex_;
+  std::condition_variable barrier_cond_;
+  int64_t barrier_count_;
+  int64_t barrier_generation_;
+};
+
+using Comm = LocalCommGroup::Comm;
+
+// Baselines with the message pattern of the ring and rank heap implementations.
+Maybe<void> RingAllReduce(Comm* comm, const float* in, float* out, size_t elem_cnt) {
+  const int64_t size = comm->size();
+  const int64_t rank = comm->rank();
+  BalancedSplitter bs(elem_cnt, size);
+  std::vector<float> recv_buffer(bs.At(0).size());
+  std::memcpy(out, in, elem_cnt * sizeof(float));
+  for (int64_t i = 0, part_id = rank; i < size - 1; ++i, part_id = RingDecrease(part_id, size)) {
+    const Range recv_range = bs.At(RingDecrease(part_id, size));
+    JUST(comm->Send(RingIncrease(rank, size), out + bs.At(part_id).begin(),
+                    bs.At(part_id).size() * sizeof(float)));
+    JUST(comm->Recv(RingDecrease(rank, size), recv_buffer.data(),
+                    recv_range.size() * sizeof(float)));
+    JUST(comm->Wait());
+    ReduceChunk<float, kSum>(recv_range.size(), out + recv_range.begin(), out + recv_range.begin(),
+                             recv_buffer.data());
+  }
+  for (int64_t i = 0, part_id = RingIncrease(rank, size); i < size - 1;
+       ++i, part_id = RingDecrease(part_id, size)) {
+    const Range recv_range = bs.At(RingDecrease(part_id, size));
+    JUST(comm->Send(RingIncrease(rank, size), out + bs.At(part_id).begin(),
+                    bs.At(part_id).size() * sizeof(float)));
+    JUST(comm->Recv(RingDecrease(rank, size), out + recv_range.begin(),
+                    recv_range.size() * sizeof(float)));
+    JUST(comm->Wait());
+  }
+  return Maybe<void>::Ok();
+}
+
+Maybe<void> RingAllGather(Comm* comm, const void* in, void* out, size_t block_size) {
+  const int64_t size = comm->size();
+  const int64_t rank = comm->rank();
+  char* char_out = reinterpret_cast<char*>(out);
+  std::memcpy(char_out + rank * block_size, in, block_size);
+  for (int64_t i = 0, part_id = rank; i < size - 1; ++i, part_id = RingDecrease(part_id, size)) {
+    JUST(comm->Send(RingIncrease(rank, size), char_out + part_id * block_size, block_size));
+    JUST(comm->Recv(RingDecrease(rank, size),
+                    char_out + RingDecrease(part_id, size) * block_size, block_size));
+    JUST(comm->Wait());
+  }
+  return Maybe<void>::Ok();
+}
+
+Maybe<void> HeapBroadcast(Comm* comm, const void* in, void* out, size_t size) {
+  const int64_t index = comm->rank();
+  if (index == 0) {
+    std::memcpy(out, in, size);
+  } else {
+    JUST(comm->Recv((index - 1) / 2, out, size));
+    JUST(comm->Wait());
+  }
+  for (int64_t child = index * 2 + 1; child <= index * 2 + 2 && child < comm->size(); ++child) {
+    JUST(comm->Send(child, out, size));
+  }
+  JUST(comm->Wait());
+  return Maybe<void>::Ok();
+}
+
+float Value(int64_t rank, size_t i) { return static_cast<float>((i * 3 + rank * 5) % 17); }
+
+template<ReduceType reduce_type>
+void TestAllReduce(int64_t num_ranks, size_t elem_cnt, bool inplace) {
+  LocalCommGroup group(num_ranks, std::chrono::nanoseconds(0), 1e9);
+  group.Run([&](Comm* comm) {
+    std::vector<float> in(elem_cnt);
+    std::vector<float> out(elem_cnt, -1.f);
+    for (size_t i = 0; i < elem_cnt; ++i) { in[i] = Value(comm->rank(), i); }
+    float* out_ptr = inplace ? in.data() : out.data();
+    CHECK_JUST(
+        (RecursiveDoublingAllReduce<float, reduce_type>(comm, in.data(), out_ptr, elem_cnt)));
+    for (size_t i = 0; i < elem_cnt; ++i) {
+      float expected = Value(0, i);
+      for (int64_t r = 1; r < num_ranks; ++r) {
+        expected = BinaryReduceOp<float, reduce_type>::Apply(expected, Value(r, i));
+      }
+      ASSERT_EQ(out_ptr[i], expected) << "ranks " << num_ranks << ", rank " << comm->rank();
+    }
+  });
+}
+
+template<typename F>
+double BenchmarkUs(LocalCommGroup* group, int64_t repeat, const F& func) {
+  const auto start = Clock::now();
+  group->Run([&](Comm* comm) {
+    for (int64_t i = 0; i < repeat; ++i) {
+      CHECK_JUST(func(comm));
+      // Measure latency rather than the throughput of back-to-back collectives.
+      group->Barrier();
+    }
+  });
+  return std::chrono::duration<double, std::micro>(Clock::now() - start).count() / repeat;
+}
+
+}  // namespace
+
+TEST(CpuLatencyCollective, RecursiveDoublingAllReduce) {
+  for (int64_t num_ranks = 1; num_ranks <= 9; ++num_ranks) {
+    for (size_t elem_cnt : {1, 5, 1000}) {
+      TestAllReduce<kSum>(num_ranks, elem_cnt, false);
+      TestAllReduce<kMax>(num_ranks, elem_cnt, true);
+    }
+  }
+}
+
+TEST(CpuLatencyCollective, BruckAllGather) {
+  for (int64_t num_ranks = 1; num_ranks <= 9; ++num_ranks) {
+    for (size_t elem_cnt : {1, 3, 100}) {
+      LocalCommGroup group(num_ranks, std::chrono::nanoseconds(0), 1e9);
+      group.Run([&](Comm* comm) {
+        std::vector<float> out(elem_cnt * num_ranks, -1.f);
+        std::vector<float> in(elem_cnt);
+        for (size_t i = 0; i < elem_cnt; ++i) { in[i] = Value(comm->rank(), i); }
+        // The in-place case, the own block is already in place.
+        const bool inplace = comm->rank() % 2 == 1;
+        float* in_ptr = in.data();
+        if (inplace) {
+          in_ptr = out.data() + comm->rank() * elem_cnt;
+          std::copy(in.begin(), in.end(), in_ptr);
+        }
+        CHECK_JUST(BruckAllGather(comm, in_ptr, out.data(), elem_cnt * sizeof(float)));
+        for (int64_t r = 0; r < num_ranks; ++r) {
+          for (size_t i = 0; i < elem_cnt; ++i) {
+            ASSERT_EQ(out[r * elem_cnt + i], Value(r, i)) << num_ranks << " " << comm->rank();
+          }
+        }
+      });
+    }
+  }
+}
+
+TEST(CpuLatencyCollective, BinomialTreeBroadcast) {
+  for (int64_t num_ranks = 1; num_ranks <= 9; ++num_ranks) {
+    for (int64_t root = 0; root < num_ranks; ++root) {
+      LocalCommGroup group(num_ranks, std::chrono::nanoseconds(0), 1e9);
+      group.Run([&](Comm* comm) {
+        std::vector<float> in(7, 0.f);
+        if (comm->rank() == root) {
+          for (size_t i = 0; i < in.size(); ++i) { in[i] = Value(root, i); }
+        }
+        std::vector<float> out(in.size(), -1.f);
+        CHECK_JUST(BinomialTreeBroadcast(comm, in.data(), out.data(), in.size() * sizeof(float),
+                                         root));
+        for (size_t i = 0; i < in.size(); ++i) { ASSERT_EQ(out[i], Value(root, i)); }
+      });
+    }
+  }
+}
+
+TEST(CpuLatencyCollective, ThresholdTable) {
+  setenv("ONEFLOW_CPU_CCL_LATENCY_THRESHOLDS", "all_reduce@4=1024,all_reduce=4096,broadcast=0", 1);
+  ASSERT_TRUE(CHECK_JUST(UseLatencyOptimizedAlgorithm(CpuCollectiveType::kAllReduce, 4, 1024)));
+  ASSERT_FALSE(CHECK_JUST(UseLatencyOptimizedAlgorithm(CpuCollectiveType::kAllReduce, 4, 1025)));
+  ASSERT_TRUE(CHECK_JUST(UseLatencyOptimizedAlgorithm(CpuCollectiveType::kAllReduce, 16, 4096)));
+  ASSERT_FALSE(CHECK_JUST(UseLatencyOptimizedAlgorithm(CpuCollectiveType::kBroadcast, 2, 4)));
+  // Collectives without entries keep their defaults.
+  ASSERT_TRUE(CHECK_JUST(UseLatencyOptimizedAlgorithm(CpuCollectiveType::kAllGather, 8, 4)));
+  ASSERT_FALSE(CHECK_JUST(UseLatencyOptimizedAlgorithm(CpuCollectiveType::kAllGather, 1, 4)));
+  unsetenv("ONEFLOW_CPU_CCL_LATENCY_THRESHOLDS");
+}
+
+TEST(CpuLatencyCollective, Benchmark) {
+  // Roughly a 10GbE socket between two processes.
+  const std::chrono::nanoseconds latency(20000);
+  const double bytes_per_ns = 1.25;
+  for (int64_t num_ranks : {2, 4, 8}) {
+    for (size_t bytes : {size_t(4), size_t(4) << 10, size_t(64) << 10, size_t(1) << 20}) {
+      const size_t elem_cnt = bytes / sizeof(float);
+      const int64_t repeat = bytes > (64 << 10) ? 4 : 16;
+      LocalCommGroup group(num_ranks, latency, bytes_per_ns);
+      std::vector<std::vector<float>> ins(num_ranks, std::vector<float>(elem_cnt, 1.f));
+      std::vector<std::vector<float>> outs(num_ranks, std::vector<float>(elem_cnt * num_ranks));
+      const double rd_us = BenchmarkUs(&group, repeat, [&](Comm* comm) {
+        return RecursiveDoublingAllReduce<float, kSum>(comm, ins.at(comm->rank()).data(),
+                                                       outs.at(comm->rank()).data(), elem_cnt);
+      });
+      const double ring_us = BenchmarkUs(&group, repeat, [&](Comm* comm) {
+        return RingAllReduce(comm, ins.at(comm->rank()).data(), outs.at(comm->rank()).data(),
+                             elem_cnt);
+      });
+      // All-gather and broadcast move `bytes` in total.
+      const size_t block_size = std::max<size_t>(bytes / num_ranks, 1);
+      const double bruck_us = BenchmarkUs(&group, repeat, [&](Comm* comm) {
+        return BruckAllGather(comm, ins.at(comm->rank()).data(), outs.at(comm->rank()).data(),
+                              block_size);
+      });
+      const double ring_gather_us = BenchmarkUs(&group, repeat, [&](Comm* comm) {
+        return RingAllGather(comm, ins.at(comm->rank()).data(), outs.at(comm->rank()).data(),
+                             block_size);
+      });
+      const double binomial_us = BenchmarkUs(&group, repeat, [&](Comm* comm) {
+        return BinomialTreeBroadcast(comm, ins.at(comm->rank()).data(),
+                                     outs.at(comm->rank()).data(), bytes, 0);
+      });
+      const double heap_us = BenchmarkUs(&group, repeat, [&](Comm* comm) {
+        return HeapBroadcast(comm, ins.at(comm->rank()).data(), outs.at(comm->rank()).data(),
+                             bytes);
+      });
+      std::cout << "ranks " << num_ranks << ", bytes " << bytes
+                << ", all_reduce recursive doubling " << rd_us << " us vs ring " << ring_us
+                << " us, all_gather bruck " << bruck_us << " us vs ring " << ring_gather_us
+                << " us, broadcast binomial " << binomial_us << " us vs heap " << heap_us << " us"
+                << std::endl;
+    }
+  }
+}
+
+}  // namespace test
+}  // namespace ccl
+}  // namespace oneflow
@@ -0,0 +1,169 @@
+/*
+Copyright 2020 The OneFlow Authors. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "oneflow/user/kernels/collective_communication/cpu/cpu_shm_all_reduce.h"
+#include "oneflow/core/common/optional.h"
+#include "oneflow/core/framework/transport_util.h"
+#include "oneflow/core/ipc/shared_memory.h"
+#include "oneflow/core/job/parallel_desc.h"
+#include "oneflow/core/job/rank_group.h"
+#include "oneflow/core/rpc/include/global_process_ctx.h"
+
+namespace oneflow {
+
+namespace ccl {
+
+namespace {
+
+constexpr size_t kShmNameCapacity = 64;
+
+struct ShmSegmentInfo {
+  int64_t parallel_id;
+  char name[kShmNameCapacity];
+};
+
+size_t ShmAllReduceBufferSize() {
+  const int64_t size = ParseIntegerFromEnv("ONEFLOW_CPU_ALL_REDUCE_SHM_BUFFER_SIZE", 4 << 20);
+  return RoundUp(std::max<int64_t>(size, 1), 64);
+}
+
+bool AreAllRanksOnThisNode(Symbol<ParallelDesc> parallel_desc) {
+  for (int64_t machine_id : parallel_desc->sorted_machine_ids()) {
+    if (GlobalProcessCtx::NodeId(machine_id) != GlobalProcessCtx::ThisNodeId()) { return false; }
+  }
+  return true;
+}
+
+class ShmAllReduceGroup final {
+ public:
+  OF_DISALLOW_COPY_AND_MOVE(ShmAllReduceGroup);
+  ShmAllReduceGroup() = default;
+  ~ShmAllReduceGroup() = default;
+
+  ShmAllReduceEngine* engine() const { return engine_.get(); }
+
+  // Every rank creates its own segment and maps the segments of all the others.
+  Maybe<void> Init(Symbol<ParallelDesc> parallel_desc) {
+    const size_t buffer_size = ShmAllReduceBufferSize();
+    Optional<int64_t> opt_parallel_id;
+    JUST(GetTensorDevice4CurrentProcessCtx(parallel_desc, &opt_parallel_id));
+    const int64_t parallel_id = JUST(opt_parallel_id);
+    const int64_t parallel_num = parallel_desc->parallel_num();
+    const auto& rank_group = JUST(RankGroup::New(parallel_desc));
+
+    std::shared_ptr<ipc::SharedMemory> own_segment =
+        JUST(ipc::SharedMemory::Open(ShmAllReduceEngine::SegmentSize(buffer_size), true));
+    ShmSegmentInfo own_info{};
+    own_info.parallel_id = parallel_id;
+    CHECK_LT_OR_RETURN(own_segment->name().size(), kShmNameCapacity);
+    std::strncpy(own_info.name, own_segment->name().c_str(), kShmNameCapacity - 1);
+    std::vector<ShmSegmentInfo> peer_infos(parallel_num - 1);
+    {
+      TransportToken transport_token =
+          JUST(TransportToken::NewTransportToken(kTransportTokenTypeData));
+      size_t num_received = 0;
+      NaiveAsyncTransportCtx ctx(
+          transport_token,
+          [&](void** buffer, std::size_t* size, std::function<void()>* Cb) -> Maybe<void> {
+            *buffer = &own_info;
+            *size = sizeof(ShmSegmentInfo);
+            *Cb = [] {};
+            return Maybe<void>::Ok();
+          },
+          [&](int64_t rank, void** buffer, std::size_t* size,
+              std::function<void()>* Cb) -> Maybe<void> {
+            CHECK_LT_OR_RETURN(num_received, peer_infos.size());
+            *buffer = &peer_infos.at(num_received++);
+            *size = sizeof(ShmSegmentInfo);
+            *Cb = [] {};
+            return Maybe<void>::Ok();
+          });
+      JUST(TransportUtil::BroadcastToAllOtherRanks(rank_group, transport_token, &ctx));
+      JUST(TransportUtil::CollectFromAllOtherRanks(rank_group, transport_token, &ctx));
+      JUST(ctx.WaitDone());
+    }
+
+    segments_.resize(parallel_num);
+    segments_.at(parallel_id) = own_segment;
+    for (const auto& info : peer_infos) {
+      CHECK_GE_OR_RETURN(info.parallel_id, 0);
+      CHECK_LT_OR_RETURN(info.parallel_id, parallel_num);
+      CHECK_OR_RETURN(!segments_.at(info.parallel_id)) << "duplicated parallel id";
+      segments_.at(info.parallel_id) = JUST(ipc::SharedMemory::Open(std::string(info.name), false));
+      CHECK_EQ_OR_RETURN(segments_.at(info.parallel_id)->size(), own_segment->size());
+    }
+
+    // Once every peer has mapped our segment its name is not needed anymore. Unlinking it right
+    // away keeps /dev/shm clean even if the process is killed.
+    {
+      TransportToken transport_token =
+          JUST(TransportToken::NewTransportToken(kTransportTokenTypeData));
+      int64_t send_value = 0;
+      std::vector<int64_t> recv_values(parallel_num - 1);
+      size_t num_received = 0;
+      NaiveAsyncTransportCtx ctx(
+          transport_token,
+          [&](void** buffer, std::size_t* size, std::function<void()>* Cb) -> Maybe<void> {
+            *buffer = &send_value;
+            *size = sizeof(int64_t);
+            *Cb = [] {};
+            return Maybe<void>::Ok();
+          },
+          [&](void** buffer, std::size_t* size, std::function<void()>* Cb) -> Maybe<void> {
+            *buffer = &recv_values.at(num_received++);
+            *size = sizeof(int64_t);
+            *Cb = [] {};
+            return Maybe<void>::Ok();
+          });
+      JUST(TransportUtil::BroadcastToAllOtherRanks(rank_group, transport_token, &ctx));
+      JUST(TransportUtil::CollectFromAllOtherRanks(rank_group, transport_token, &ctx));
+      JUST(ctx.WaitDone());
+    }
+    JUST(own_segment->Unlink());
+
+    std::vector<char*> buffers;
+    buffers.reserve(parallel_num);
+    for (const auto& segment : segments_) { buffers.emplace_back(segment->mut_buf()); }
+    engine_.reset(new ShmAllReduceEngine(std::move(buffers), parallel_id, buffer_size));
+    return Maybe<void>::Ok();
+  }
+
+ private:
+  std::vector<std::shared_ptr<ipc::SharedMemory>> segments_;
+  std::unique_ptr<ShmAllReduceEngine> engine_;
+};
+
+}  // namespace
+
+Maybe<ShmAllReduceEngine*> GetShmAllReduceEngine(Symbol<ParallelDesc> parallel_desc) {
+  static const bool enabled = ParseBooleanFromEnv("ONEFLOW_CPU_ALL_REDUCE_USE_SHM", true);
+  if (!enabled || parallel_desc->parallel_num() <= 1 || !AreAllRanksOnThisNode(parallel_desc)) {
+    return static_cast<ShmAllReduceEngine*>(nullptr);
+  }
+  static std::mutex mutex;
+  static HashMap<Symbol<ParallelDesc>, std::unique_ptr<ShmAllReduceGroup>> groups;
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = groups.find(parallel_desc);
+  if (it == groups.end()) {
+    std::unique_ptr<ShmAllReduceGroup> group(new ShmAllReduceGroup());
+    JUST(group->Init(parallel_desc));
+    it = groups.emplace(parallel_desc, std::move(group)).first;
+  }
+  return it->second->engine();
+}
+
+}  // namespace ccl
+
+}  // namespace oneflow
@@ -0,0 +1,168 @@
+/*
+Copyright 2020 The OneFlow Authors. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef ONEFLOW_USER_KERNELS_COLLECTIVE_COMMUNICATION_CPU_CPU_SHM_ALL_REDUCE_H_
+#define ONEFLOW_USER_KERNELS_COLLECTIVE_COMMUNICATION_CPU_CPU_SHM_ALL_REDUCE_H_
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "oneflow/core/common/maybe.h"
+#include "oneflow/core/common/spin_wait.h"
+#include "oneflow/core/common/symbol.h"
+#include "oneflow/user/kernels/collective_communication/include/collective_communication.h"
+#include "oneflow/user/kernels/collective_communication/cpu/cpu_collective_communication_util.h"
+
+namespace oneflow {
+
+class ParallelDesc;
+
+namespace ccl {
+
+using ParallelForFn =
+    std::function<void(int64_t, int64_t, const std::function<void(int64_t, int64_t)>&)>;
+
+// All-reduce among the ranks of one host through memory they all map.
+//
+// Every rank owns a segment made of a header of progress counters and two staging buffers. Large
+// tensors are processed in pieces of one staging buffer each, alternating between the two buffers
+// so that a rank can start staging piece i + 1 while slower peers are still copying out piece i:
+//   1. copy the piece of the input into the own staging buffer, publish `written`;
+//   2. reduce the own slice of the piece across the staging buffers of all ranks, in place into
+//      the own buffer, publish `reduced`;
+//   3. gather the reduced slices of all the other ranks into the output, publish `consumed`.
+// Counters count pieces and keep increasing across calls, so all ranks of a group must issue the
+// same sequence of all-reduces, which collectives do anyway. Calls from several threads of one
+// process are serialized.
+class ShmAllReduceEngine final {
+ public:
+  OF_DISALLOW_COPY_AND_MOVE(ShmAllReduceEngine);
+  // segments[i] is the segment of rank i mapped in this process, each of SegmentSize(buffer_size)
+  // bytes and zero-initialized.
+  ShmAllReduceEngine(std::vector<char*> segments, int64_t rank, size_t buffer_size)
+      : segments_(std::move(segments)), rank_(rank), buffer_size_(buffer_size), seq_(0) {
+    CHECK_GE(buffer_size_, kAlignment);
+    CHECK_EQ(buffer_size_ % kAlignment, 0);
+    CHECK_GE(rank_, 0);
+    CHECK_LT(rank_, num_ranks());
+  }
+  ~ShmAllReduceEngine() = default;
+
+  static size_t SegmentSize(size_t buffer_size) { return sizeof(Header) + 2 * buffer_size; }
+
+  int64_t num_ranks() const { return segments_.size(); }
+
+  template<typename T, ReduceType reduce_type>
+  void AllReduce(const T* in, T* out, size_t elem_cnt, const ParallelForFn& parallel_for) {
+    const size_t piece_elem_cnt = buffer_size_ / sizeof(T);
+    CHECK_GT(piece_elem_cnt, 0);
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t offset = 0; offset < elem_cnt; offset += piece_elem_cnt) {
+      const size_t piece_size = std::min(piece_elem_cnt, elem_cnt - offset);
+      AllReducePiece<T, reduce_type>(in + offset, out + offset, piece_size, parallel_for);
+    }
+  }
+
+ private:
+  static constexpr size_t kAlignment = 64;
+  static constexpr size_t kSpinCountBeforeYield = 64;
+
+  struct alignas(kAlignment) Counter {
+    std::atomic<uint64_t> value;
+  };
+  struct Header {
+    Counter written;
+    Counter reduced;
+    Counter consumed;
+  };
+
+  Header* header(int64_t rank) const { return reinterpret_cast<Header*>(segments_.at(rank)); }
+
+  template<typename T>
+  T* buffer(int64_t rank, uint64_t seq) const {
+    return reinterpret_cast<T*>(segments_.at(rank) + sizeof(Header) + (seq % 2) * buffer_size_);
+  }
+
+  // Waits until every rank has published at least `target` pieces on `counter`.
+  void WaitAll(Counter Header::*counter, uint64_t target) const {
+    for (int64_t rank = 0; rank < num_ranks(); ++rank) {
+      const std::atomic<uint64_t>& value = (header(rank)->*counter).value;
+      for (size_t i = 1; value.load(std::memory_order_acquire) < target; ++i) {
+        // Peers are usually other processes which may share our cores, so do not spin forever.
+        if (i % kSpinCountBeforeYield == 0) {
+          std::this_thread::yield();
+        } else {
+          CpuRelax();
+        }
+      }
+    }
+  }
+
+  template<typename T, ReduceType reduce_type>
+  void AllReducePiece(const T* in, T* out, size_t size, const ParallelForFn& parallel_for) {
+    const uint64_t seq = seq_++;
+    BalancedSplitter bs(size, num_ranks());
+    // The staging buffer of this piece was last used by piece seq - 2.
+    if (seq >= 2) { WaitAll(&Header::consumed, seq - 1); }
+    std::memcpy(buffer<T>(rank_, seq), in, size * sizeof(T));
+    header(rank_)->written.value.store(seq + 1, std::memory_order_release);
+
+    WaitAll(&Header::written, seq + 1);
+    const Range own_slice = bs.At(rank_);
+    T* own_buffer = buffer<T>(rank_, seq);
+    parallel_for(own_slice.begin(), own_slice.end(), [&](int64_t begin, int64_t end) {
+      for (int64_t peer = 1; peer < num_ranks(); ++peer) {
+        const T* peer_buffer = buffer<T>((rank_ + peer) % num_ranks(), seq);
+        ReduceChunk<T, reduce_type>(end - begin, own_buffer + begin, own_buffer + begin,
+                                    peer_buffer + begin);
+      }
+      std::memcpy(out + begin, own_buffer + begin, (end - begin) * sizeof(T));
+    });
+    header(rank_)->reduced.value.store(seq + 1, std::memory_order_release);
+
+    WaitAll(&Header::reduced, seq + 1);
+    parallel_for(0, size, [&](int64_t begin, int64_t end) {
+      for (int64_t peer = 1; peer < num_ranks(); ++peer) {
+        const int64_t peer_rank = (rank_ + peer) % num_ranks();
+        const Range slice = bs.At(peer_rank);
+        const int64_t slice_begin = std::max<int64_t>(slice.begin(), begin);
+        const int64_t slice_end = std::min<int64_t>(slice.end(), end);
+        if (slice_begin >= slice_end) { continue; }
+        std::memcpy(out + slice_begin, buffer<T>(peer_rank, seq) + slice_begin,
+                    (slice_end - slice_begin) * sizeof(T));
+      }
+    });
+    header(rank_)->consumed.value.store(seq + 1, std::memory_order_release);
+  }
+
+  std::vector<char*> segments_;
+  int64_t rank_;
+  size_t buffer_size_;
+  uint64_t seq_;
+  std::mutex mutex_;
+};
+
+// The shared-memory all-reduce of the ranks of `parallel_desc`, set up collectively the first time
+// it is requested. Returns nullptr if the ranks are spread over several hosts or the shared-memory
+// path is disabled by ONEFLOW_CPU_ALL_REDUCE_USE_SHM=0.
+Maybe<ShmAllReduceEngine*> GetShmAllReduceEngine(Symbol<ParallelDesc> parallel_desc);
+
+}  // namespace ccl
+
+}  // namespace oneflow
+
+#endif  // ONEFLOW_USER_KERNELS_COLLECTIVE_COMMUNICATION_CPU_CPU_SHM_ALL_REDUCE_H_
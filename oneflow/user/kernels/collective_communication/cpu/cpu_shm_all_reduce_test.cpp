@@ -0,0 +1,208 @@
+/*
+Copyright 2020 The OneFlow Authors. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include <gtest/gtest.h>
+#include <chrono>
+#include <cstdlib>
+#include "oneflow/user/kernels/collective_communication/cpu/cpu_shm_all_reduce.h"
+
+namespace oneflow {
+namespace ccl {
+namespace test {
+
+namespace {
+
+void SerialParallelFor(int64_t begin, int64_t end,
+                       const std::function<void(int64_t, int64_t)>& func) {
+  func(begin, end);
+}
+
+// Ranks are emulated by threads of this process, their segments live in ordinary memory.
+class LocalShmGroup final {
+ public:
+  OF_DISALLOW_COPY_AND_MOVE(LocalShmGroup);
+  LocalShmGroup(int64_t num_ranks, size_t buffer_size) {
+    const size_t segment_size = RoundUp(ShmAllReduceEngine::SegmentSize(buffer_size), 64);
+    std::vector<char*> segments;
+    for (int64_t i = 0; i < num_ranks; ++i) {
+      segments.emplace_back(static_cast<char*>(std::aligned_alloc(64, segment_size)));
+      std::memset(segments.back(), 0, segment_size);
+    }
+    for (int64_t i = 0; i < num_ranks; ++i) {
+      engines_.emplace_back(new ShmAllReduceEngine(segments, i, buffer_size));
+    }
+    segments_ = segments;
+  }
+  ~LocalShmGroup() {
+    for (char* segment : segments_) { std::free(segment); }
+  }
+
+  int64_t num_ranks() const { return engines_.size(); }
+
+  void Run(const std::function<void(int64_t, ShmAllReduceEngine*)>& func) {
+    std::vector<std::thread> threads;
+    for (int64_t i = 0; i < num_ranks(); ++i) {
+      threads.emplace_back([&, i]() { func(i, engines_.at(i).get()); });
+    }
+    for (auto& thread : threads) { thread.join(); }
+  }
+
+ private:
+  std::vector<char*> segments_;
+  std::vector<std::unique_ptr<ShmAllReduceEngine>> engines_;
+};
+
+template<ReduceType reduce_type>
+void TestAllReduce(int64_t num_ranks, size_t buffer_size, const std::vector<size_t>& elem_cnts,
+                   bool inplace) {
+  LocalShmGroup group(num_ranks, buffer_size);
+  const auto& Value = [](int64_t rank, size_t i) -> int32_t {
+    return static_cast<int32_t>((i * 7 + rank * 13) % 101) - 50;
+  };
+  group.Run([&](int64_t rank, ShmAllReduceEngine* engine) {
+    for (size_t elem_cnt : elem_cnts) {
+      std::vector<int32_t> in(elem_cnt);
+      std::vector<int32_t> out(elem_cnt, 0);
+      for (size_t i = 0; i < elem_cnt; ++i) { in[i] = Value(rank, i); }
+      int32_t* out_ptr = inplace ? in.data() : out.data();
+      engine->AllReduce<int32_t, reduce_type>(in.data(), out_ptr, elem_cnt, SerialParallelFor);
+      for (size_t i = 0; i < elem_cnt; ++i) {
+        int32_t expected = Value(0, i);
+        for (int64_t r = 1; r < num_ranks; ++r) {
+          expected = BinaryReduceOp<int32_t, reduce_type>::Apply(expected, Value(r, i));
+        }
+        ASSERT_EQ(out_ptr[i], expected) << "rank " << rank << ", elem_cnt " << elem_cnt;
+      }
+    }
+  });
+}
+
+// Spinning barrier for the emulated ranks of the baseline.
+class SpinBarrier final {
+ public:
+  explicit SpinBarrier(int64_t num_threads) : num_threads_(num_threads), count_(0), phase_(0) {}
+
+  void Wait() {
+    const int64_t phase = phase_.load(std::memory_order_acquire);
+    if (count_.fetch_add(1, std::memory_order_acq_rel) + 1 == num_threads_) {
+      count_.store(0, std::memory_order_relaxed);
+      phase_.store(phase + 1, std::memory_order_release);
+    } else {
+      while (phase_.load(std::memory_order_acquire) == phase) { std::this_thread::yield(); }
+    }
+  }
+
+ private:
+  const int64_t num_threads_;
+  std::atomic<int64_t> count_;
+  std::atomic<int64_t> phase_;
+};
+
+// The ring all-reduce this engine replaces: every step moves one whole partition to the next rank,
+// waits for it, then reduces it. The transfer is a plain memcpy here, which is far cheaper than the
+// sockets the ring actually goes through, so the baseline is flattered.
+void RingAllReduceBaseline(int64_t rank, int64_t num_ranks, const float* in, float* out,
+                           size_t elem_cnt, std::vector<std::vector<float>>* inboxes,
+                           SpinBarrier* barrier) {
+  BalancedSplitter bs(elem_cnt, num_ranks);
+  const int64_t next = RingIncrease(rank, num_ranks);
+  std::vector<float>* inbox = &inboxes->at(rank);
+  for (int64_t i = 0, part_id = rank; i < num_ranks - 1;
+       ++i, part_id = RingDecrease(part_id, num_ranks)) {
+    const float* send_ptr = (i == 0 ? in : out) + bs.At(part_id).begin();
+    std::memcpy(inboxes->at(next).data(), send_ptr, bs.At(part_id).size() * sizeof(float));
+    barrier->Wait();
+    const Range recv_range = bs.At(RingDecrease(part_id, num_ranks));
+    ReduceChunk<float, kSum>(recv_range.size(), out + recv_range.begin(),
+                             in + recv_range.begin(), inbox->data());
+    barrier->Wait();
+  }
+  for (int64_t i = 0, part_id = RingIncrease(rank, num_ranks); i < num_ranks - 1;
+       ++i, part_id = RingDecrease(part_id, num_ranks)) {
+    const Range recv_range = bs.At(RingDecrease(part_id, num_ranks));
+    std::memcpy(inboxes->at(next).data(), out + bs.At(part_id).begin(),
+                bs.At(part_id).size() * sizeof(float));
+    barrier->Wait();
+    std::memcpy(out + recv_range.begin(), inbox->data(), recv_range.size() * sizeof(float));
+    barrier->Wait();
+  }
+}
+
+}  // namespace
+
+TEST(ShmAllReduce, Sum) {
+  for (int64_t num_ranks : {2, 3, 4, 8}) {
+    // A 256-byte staging buffer forces most tensors through several pieces.
+    TestAllReduce<kSum>(num_ranks, 256, {1, 7, 64, 65, 1000, 4099}, false);
+  }
+}
+
+TEST(ShmAllReduce, MaxInplace) {
+  for (int64_t num_ranks : {2, 5}) {
+    TestAllReduce<kMax>(num_ranks, 128, {3, 100, 2049}, true);
+    TestAllReduce<kMax>(num_ranks, 1 << 16, {3, 100, 2049}, true);
+  }
+}
+
+TEST(ShmAllReduce, Benchmark) {
+  const size_t buffer_size = 4 << 20;
+  for (int64_t num_ranks : {2, 4, 8}) {
+    for (size_t elem_cnt : {size_t(1) << 12, size_t(1) << 18, size_t(1) << 23}) {
+      const int64_t repeat = std::max<int64_t>((1 << 24) / elem_cnt, 2);
+      std::vector<std::vector<float>> ins(num_ranks, std::vector<float>(elem_cnt, 1.f));
+      std::vector<std::vector<float>> outs(num_ranks, std::vector<float>(elem_cnt));
+
+      LocalShmGroup group(num_ranks, buffer_size);
+      auto start = std::chrono::steady_clock::now();
+      group.Run([&](int64_t rank, ShmAllReduceEngine* engine) {
+        for (int64_t i = 0; i < repeat; ++i) {
+          engine->AllReduce<float, kSum>(ins.at(rank).data(), outs.at(rank).data(), elem_cnt,
+                                         SerialParallelFor);
+        }
+      });
+      const double shm_us = std::chrono::duration<double, std::micro>(
+                                std::chrono::steady_clock::now() - start)
+                                .count()
+                            / repeat;
+      ASSERT_EQ(outs.at(0).at(elem_cnt - 1), static_cast<float>(num_ranks));
+
+      std::vector<std::vector<float>> inboxes(
+          num_ranks, std::vector<float>(BalancedSplitter(elem_cnt, num_ranks).At(0).size()));
+      SpinBarrier barrier(num_ranks);
+      std::vector<std::thread> threads;
+      start = std::chrono::steady_clock::now();
+      for (int64_t rank = 0; rank < num_ranks; ++rank) {
+        threads.emplace_back([&, rank]() {
+          for (int64_t i = 0; i < repeat; ++i) {
+            RingAllReduceBaseline(rank, num_ranks, ins.at(rank).data(), outs.at(rank).data(),
+                                  elem_cnt, &inboxes, &barrier);
+          }
+        });
+      }
+      for (auto& thread : threads) { thread.join(); }
+      const double ring_us = std::chrono::duration<double, std::micro>(
+                                 std::chrono::steady_clock::now() - start)
+                                 .count()
+                             / repeat;
+      ASSERT_EQ(outs.at(0).at(elem_cnt - 1), static_cast<float>(num_ranks));
+      std::cout << "ranks " << num_ranks << ", elements " << elem_cnt << ", shm " << shm_us
+                << " us, whole-partition ring " << ring_us << " us" << std::endl;
+    }
+  }
+}
+
+}  // namespace test
+}  // namespace ccl
+}  // namespace oneflow
@@ -14,9 +14,27 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 #include "oneflow/core/framework/framework.h"
+#include "oneflow/core/ep/cpu/cpu_stream.h"
+#include "oneflow/user/kernels/layer_norm_cpu_kernel_util.h"
 
 namespace oneflow {
 
+namespace {
+
+// Rows are normalized independently, hand out about 32K elements per ParallelFor chunk.
+int64_t GetRowGrainSize(int64_t norm_size) {
+  return std::max<int64_t>(1, 32768 / std::max<int64_t>(norm_size, 1));
+}
+
+// The param grad reduction accumulates row blocks into separate partial sums first.
+constexpr int64_t kMaxParamGradBlocks = 64;
+
+int64_t GetNumParamGradBlocks(int64_t num_instances) {
+  return std::max<int64_t>(std::min(num_instances, kMaxParamGradBlocks), 1);
+}
+
+}  // namespace
+
 template<typename T>
 class LayerNormCpuKernel final : public user_op::OpKernel {
  public:
@@ -24,8 +42,41 @@ class LayerNormCpuKernel final : public user_op::OpKernel {
   ~LayerNormCpuKernel() = default;
 
  private:
+  using user_op::OpKernel::Compute;
   bool AlwaysComputeWhenAllOutputsEmpty() const override { return false; }
-  void Compute(user_op::KernelComputeContext* ctx) const override { TODO(); };
+  void Compute(user_op::KernelComputeContext* ctx) const override {
+    using ComputeType = typename layer_norm::DefaultComputeType<T>::type;
+    const user_op::Tensor* x = ctx->Tensor4ArgNameAndIndex("x", 0);
+    user_op::Tensor* y = ctx->Tensor4ArgNameAndIndex("y", 0);
+    user_op::Tensor* mean = ctx->Tensor4ArgNameAndIndex("mean", 0);
+    user_op::Tensor* inv_variance = ctx->Tensor4ArgNameAndIndex("inv_variance", 0);
+    const double epsilon = ctx->Attr<double>("epsilon");
+    const int64_t num_instances = mean->shape_view().elem_cnt();
+    if (num_instances == 0) { return; }
+    const int64_t norm_size = x->shape_view().elem_cnt() / num_instances;
+    const T* gamma_ptr = nullptr;
+    const T* beta_ptr = nullptr;
+    if (ctx->has_input("gamma", 0)) {
+      const user_op::Tensor* gamma = ctx->Tensor4ArgNameAndIndex("gamma", 0);
+      gamma_ptr = gamma->dptr<T>();
+      CHECK_EQ(gamma->shape_view().elem_cnt(), norm_size);
+    }
+    if (ctx->has_input("beta", 0)) { beta_ptr = ctx->Tensor4ArgNameAndIndex("beta", 0)->dptr<T>(); }
+    const T* x_ptr = x->dptr<T>();
+    T* y_ptr = y->mut_dptr<T>();
+    ComputeType* mean_ptr = mean->mut_dptr<ComputeType>();
+    ComputeType* inv_variance_ptr = inv_variance->mut_dptr<ComputeType>();
+    ctx->stream()->As<ep::CpuStream>()->ParallelFor(
+        0, num_instances,
+        [&](int64_t begin, int64_t end) {
+          for (int64_t row = begin; row < end; ++row) {
+            layer_norm::LayerNormForwardRow<T, ComputeType>(
+                x_ptr + row * norm_size, gamma_ptr, beta_ptr, norm_size, epsilon,
+                y_ptr + row * norm_size, mean_ptr + row, inv_variance_ptr + row);
+          }
+        },
+        GetRowGrainSize(norm_size));
+  };
 };
 
 #define REGISTER_LAYER_NORM_CPU_KERNEL(dtype)                         \
@@ -36,6 +87,8 @@ class LayerNormCpuKernel final : public user_op::OpKernel {
 
 REGISTER_LAYER_NORM_CPU_KERNEL(float)
 REGISTER_LAYER_NORM_CPU_KERNEL(double)
+REGISTER_LAYER_NORM_CPU_KERNEL(float16)
+REGISTER_LAYER_NORM_CPU_KERNEL(bfloat16)
 
 template<typename T>
 class LayerNormGradCpuKernel final : public user_op::OpKernel {
@@ -44,18 +97,67 @@ class LayerNormGradCpuKernel final : public user_op::OpKernel {
   ~LayerNormGradCpuKernel() = default;
 
  private:
+  using user_op::OpKernel::Compute;
   bool AlwaysComputeWhenAllOutputsEmpty() const override { return false; }
-  void Compute(user_op::KernelComputeContext* ctx) const override { TODO(); };
+  void Compute(user_op::KernelComputeContext* ctx) const override {
+    using ComputeType = typename layer_norm::DefaultComputeType<T>::type;
+    const user_op::Tensor* dy = ctx->Tensor4ArgNameAndIndex("dy", 0);
+    const user_op::Tensor* x = ctx->Tensor4ArgNameAndIndex("x", 0);
+    const user_op::Tensor* mean = ctx->Tensor4ArgNameAndIndex("mean", 0);
+    const user_op::Tensor* inv_variance = ctx->Tensor4ArgNameAndIndex("inv_variance", 0);
+    user_op::Tensor* dx = ctx->Tensor4ArgNameAndIndex("dx", 0);
+    const int64_t num_instances = mean->shape_view().elem_cnt();
+    if (num_instances == 0) { return; }
+    const int64_t norm_size = x->shape_view().elem_cnt() / num_instances;
+    const T* gamma_ptr = nullptr;
+    if (ctx->has_input("gamma", 0)) {
+      gamma_ptr = ctx->Tensor4ArgNameAndIndex("gamma", 0)->dptr<T>();
+    }
+    const T* add_to_output_ptr = nullptr;
+    if (ctx->has_input("_add_to_output", 0)) {
+      const user_op::Tensor* add_to_output = ctx->Tensor4ArgNameAndIndex("_add_to_output", 0);
+      CHECK_EQ(add_to_output->data_type(), dx->data_type());
+      CHECK_EQ(add_to_output->shape_view(), dx->shape_view());
+      add_to_output_ptr = add_to_output->dptr<T>();
+    }
+    const T* dy_ptr = dy->dptr<T>();
+    const T* x_ptr = x->dptr<T>();
+    const ComputeType* mean_ptr = mean->dptr<ComputeType>();
+    const ComputeType* inv_variance_ptr = inv_variance->dptr<ComputeType>();
+    T* dx_ptr = dx->mut_dptr<T>();
+    ctx->stream()->As<ep::CpuStream>()->ParallelFor(
+        0, num_instances,
+        [&](int64_t begin, int64_t end) {
+          for (int64_t row = begin; row < end; ++row) {
+            const int64_t offset = row * norm_size;
+            layer_norm::LayerNormBackwardRow<T, ComputeType>(
+                dy_ptr + offset, x_ptr + offset, mean_ptr[row], inv_variance_ptr[row], gamma_ptr,
+                add_to_output_ptr == nullptr ? nullptr : add_to_output_ptr + offset, norm_size,
+                dx_ptr + offset);
+          }
+        },
+        GetRowGrainSize(norm_size));
+  };
 };
 
-#define REGISTER_LAYER_NORM_GRAD_CPU_KERNEL(dtype)                    \
-  REGISTER_USER_KERNEL("layer_norm_grad")                             \
-      .SetCreateFn<LayerNormGradCpuKernel<dtype>>()                   \
-      .SetIsMatchedHob((user_op::HobDeviceType() == DeviceType::kCPU) \
-                       && (user_op::HobDataType("dy", 0) == GetDataType<dtype>::value));
+#define REGISTER_LAYER_NORM_GRAD_CPU_KERNEL(dtype)                                         \
+  REGISTER_USER_KERNEL("layer_norm_grad")                                                  \
+      .SetCreateFn<LayerNormGradCpuKernel<dtype>>()                                        \
+      .SetIsMatchedHob((user_op::HobDeviceType() == DeviceType::kCPU)                      \
+                       && (user_op::HobDataType("dy", 0) == GetDataType<dtype>::value))    \
+      .SetInplaceProposalFn(                                                               \
+          [](const user_op::InferContext& ctx,                                             \
+             const user_op::AddInplaceArgPair& AddInplaceArgPairFn) -> Maybe<void> {       \
+            if (ctx.has_input("_add_to_output", 0)) {                                      \
+              OF_RETURN_IF_ERROR(AddInplaceArgPairFn("dx", 0, "_add_to_output", 0, true)); \
+            }                                                                              \
+            return Maybe<void>::Ok();                                                      \
+          });
 
 REGISTER_LAYER_NORM_GRAD_CPU_KERNEL(float)
 REGISTER_LAYER_NORM_GRAD_CPU_KERNEL(double)
+REGISTER_LAYER_NORM_GRAD_CPU_KERNEL(float16)
+REGISTER_LAYER_NORM_GRAD_CPU_KERNEL(bfloat16)
 
 template<typename T>
 class LayerNormParamGradCpuKernel final : public user_op::OpKernel {
@@ -64,17 +166,95 @@ class LayerNormParamGradCpuKernel final : public user_op::OpKernel {
   ~LayerNormParamGradCpuKernel() = default;
 
  private:
+  using user_op::OpKernel::Compute;
   bool AlwaysComputeWhenAllOutputsEmpty() const override { return false; }
-  void Compute(user_op::KernelComputeContext* ctx) const override { TODO(); };
+  void Compute(user_op::KernelComputeContext* ctx) const override {
+    using ComputeType = typename layer_norm::DefaultComputeType<T>::type;
+    const user_op::Tensor* dy = ctx->Tensor4ArgNameAndIndex("dy", 0);
+    const user_op::Tensor* x = ctx->Tensor4ArgNameAndIndex("x", 0);
+    const user_op::Tensor* mean = ctx->Tensor4ArgNameAndIndex("mean", 0);
+    const user_op::Tensor* inv_variance = ctx->Tensor4ArgNameAndIndex("inv_variance", 0);
+    user_op::Tensor* tmp_buffer = ctx->Tensor4ArgNameAndIndex("tmp_buffer", 0);
+    const int64_t num_instances = mean->shape_view().elem_cnt();
+    const int64_t norm_size = x->shape_view().elem_cnt() / std::max<int64_t>(num_instances, 1);
+    T* gamma_diff_ptr = nullptr;
+    T* beta_diff_ptr = nullptr;
+    if (ctx->has_output("gamma_diff", 0)) {
+      gamma_diff_ptr = ctx->Tensor4ArgNameAndIndex("gamma_diff", 0)->mut_dptr<T>();
+    }
+    if (ctx->has_output("beta_diff", 0)) {
+      beta_diff_ptr = ctx->Tensor4ArgNameAndIndex("beta_diff", 0)->mut_dptr<T>();
+    }
+    const int64_t num_blocks = GetNumParamGradBlocks(num_instances);
+    // Partial sums of block b live at [b * norm_size, (b + 1) * norm_size) of each buffer.
+    ComputeType* tmp_gamma_diff_ptr = tmp_buffer->mut_dptr<ComputeType>();
+    ComputeType* tmp_beta_diff_ptr = tmp_gamma_diff_ptr + num_blocks * norm_size;
+    const T* dy_ptr = dy->dptr<T>();
+    const T* x_ptr = x->dptr<T>();
+    const ComputeType* mean_ptr = mean->dptr<ComputeType>();
+    const ComputeType* inv_variance_ptr = inv_variance->dptr<ComputeType>();
+    auto* cpu_stream = ctx->stream()->As<ep::CpuStream>();
+    cpu_stream->ParallelFor(
+        0, num_blocks,
+        [&](int64_t begin, int64_t end) {
+          for (int64_t block = begin; block < end; ++block) {
+            ComputeType* block_gamma_diff =
+                gamma_diff_ptr == nullptr ? nullptr : tmp_gamma_diff_ptr + block * norm_size;
+            ComputeType* block_beta_diff =
+                beta_diff_ptr == nullptr ? nullptr : tmp_beta_diff_ptr + block * norm_size;
+            if (block_gamma_diff != nullptr) {
+              std::fill(block_gamma_diff, block_gamma_diff + norm_size, ComputeType(0));
+            }
+            if (block_beta_diff != nullptr) {
+              std::fill(block_beta_diff, block_beta_diff + norm_size, ComputeType(0));
+            }
+            layer_norm::LayerNormParamGradRows<T, ComputeType>(
+                dy_ptr, x_ptr, mean_ptr, inv_variance_ptr, num_instances * block / num_blocks,
+                num_instances * (block + 1) / num_blocks, norm_size, block_gamma_diff,
+                block_beta_diff);
+          }
+        },
+        1);
+    cpu_stream->ParallelFor(
+        0, norm_size,
+        [&](int64_t begin, int64_t end) {
+          for (int64_t i = begin; i < end; ++i) {
+            ComputeType gamma_diff = 0;
+            ComputeType beta_diff = 0;
+            for (int64_t block = 0; block < num_blocks; ++block) {
+              if (gamma_diff_ptr != nullptr) {
+                gamma_diff += tmp_gamma_diff_ptr[block * norm_size + i];
+              }
+              if (beta_diff_ptr != nullptr) {
+                beta_diff += tmp_beta_diff_ptr[block * norm_size + i];
+              }
+            }
+            if (gamma_diff_ptr != nullptr) { gamma_diff_ptr[i] = static_cast<T>(gamma_diff); }
+            if (beta_diff_ptr != nullptr) { beta_diff_ptr[i] = static_cast<T>(beta_diff); }
+          }
+        },
+        std::max<int64_t>(1, 32768 / num_blocks));
+  };
 };
 
-#define REGISTER_LAYER_NORM_PARAM_GRAD_CPU_KERNEL(dtype)              \
-  REGISTER_USER_KERNEL("layer_norm_param_grad")                       \
-      .SetCreateFn<LayerNormParamGradCpuKernel<dtype>>()              \
-      .SetIsMatchedHob((user_op::HobDeviceType() == DeviceType::kCPU) \
-                       && (user_op::HobDataType("dy", 0) == GetDataType<dtype>::value));
+#define REGISTER_LAYER_NORM_PARAM_GRAD_CPU_KERNEL(dtype)                                \
+  REGISTER_USER_KERNEL("layer_norm_param_grad")                                         \
+      .SetCreateFn<LayerNormParamGradCpuKernel<dtype>>()                                \
+      .SetIsMatchedHob((user_op::HobDeviceType() == DeviceType::kCPU)                   \
+                       && (user_op::HobDataType("dy", 0) == GetDataType<dtype>::value)) \
+      .SetInferTmpSizeFn([](user_op::InferContext* ctx) {                               \
+        using ComputeType = typename layer_norm::DefaultComputeType<dtype>::type;       \
+        const int64_t begin_params_axis = ctx->Attr<int64_t>("begin_params_axis");      \
+        const auto& dy = ctx->InputTensorDesc("dy", 0);                                 \
+        const int64_t num_instances = dy.shape().Count(0, begin_params_axis);           \
+        const int64_t norm_size = dy.shape().Count(begin_params_axis);                  \
+        const int64_t num_blocks = GetNumParamGradBlocks(num_instances);                \
+        return 2 * num_blocks * norm_size * sizeof(ComputeType);                        \
+      });
 
 REGISTER_LAYER_NORM_PARAM_GRAD_CPU_KERNEL(float)
 REGISTER_LAYER_NORM_PARAM_GRAD_CPU_KERNEL(double)
+REGISTER_LAYER_NORM_PARAM_GRAD_CPU_KERNEL(float16)
+REGISTER_LAYER_NORM_PARAM_GRAD_CPU_KERNEL(bfloat16)
 
 }  // namespace oneflow
@@ -0,0 +1,393 @@
+/*
+Copyright 2020 The OneFlow Authors. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef ONEFLOW_USER_KERNELS_LAYER_NORM_CPU_KERNEL_UTIL_H_
+#define ONEFLOW_USER_KERNELS_LAYER_NORM_CPU_KERNEL_UTIL_H_
+
+#include <cmath>
+#include "oneflow/core/common/data_type.h"
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace oneflow {
+
+namespace layer_norm {
+
+// Half precision inputs are normalized in float, mean and inv_variance are kept in ComputeType.
+template<typename T>
+struct DefaultComputeType {
+  using type = float;
+};
+
+template<>
+struct DefaultComputeType<double> {
+  using type = double;
+};
+
+// A pack of ComputeType lanes. The generic one is a plain array the compiler may vectorize,
+// float gets the widest SIMD register the target is compiled for.
+template<typename ComputeType, int N>
+struct ArrayPack {
+  static constexpr int kSize = N;
+  ComputeType v[N];
+
+  static ArrayPack Set1(ComputeType a) {
+    ArrayPack pack;
+    for (int i = 0; i < N; ++i) { pack.v[i] = a; }
+    return pack;
+  }
+  template<typename T>
+  static ArrayPack Load(const T* ptr) {
+    ArrayPack pack;
+    for (int i = 0; i < N; ++i) { pack.v[i] = static_cast<ComputeType>(ptr[i]); }
+    return pack;
+  }
+  template<typename T>
+  void Store(T* ptr) const {
+    for (int i = 0; i < N; ++i) { ptr[i] = static_cast<T>(v[i]); }
+  }
+  void StoreLanes(ComputeType* lanes) const { Store(lanes); }
+  ArrayPack operator+(const ArrayPack& o) const {
+    ArrayPack pack;
+    for (int i = 0; i < N; ++i) { pack.v[i] = v[i] + o.v[i]; }
+    return pack;
+  }
+  ArrayPack operator-(const ArrayPack& o) const {
+    ArrayPack pack;
+    for (int i = 0; i < N; ++i) { pack.v[i] = v[i] - o.v[i]; }
+    return pack;
+  }
+  ArrayPack operator*(const ArrayPack& o) const {
+    ArrayPack pack;
+    for (int i = 0; i < N; ++i) { pack.v[i] = v[i] * o.v[i]; }
+    return pack;
+  }
+  ComputeType ReduceSum() const {
+    ComputeType sum = 0;
+    for (int i = 0; i < N; ++i) { sum += v[i]; }
+    return sum;
+  }
+};
+
+template<typename ComputeType>
+using DefaultArrayPack = ArrayPack<ComputeType, 32 / sizeof(ComputeType)>;
+
+#if defined(__x86_64__) && (defined(__AVX512F__) || defined(__AVX2__))
+
+#if defined(__AVX512F__)
+
+struct FloatPack {
+  static constexpr int kSize = 16;
+  __m512 v;
+
+  static FloatPack Set1(float a) { return {_mm512_set1_ps(a)}; }
+  template<typename T>
+  static FloatPack Load(const T* ptr) {
+    float lanes[kSize];
+    for (int i = 0; i < kSize; ++i) { lanes[i] = static_cast<float>(ptr[i]); }
+    return {_mm512_loadu_ps(lanes)};
+  }
+  template<typename T>
+  void Store(T* ptr) const {
+    float lanes[kSize];
+    _mm512_storeu_ps(lanes, v);
+    for (int i = 0; i < kSize; ++i) { ptr[i] = static_cast<T>(lanes[i]); }
+  }
+  void StoreLanes(float* lanes) const { _mm512_storeu_ps(lanes, v); }
+  FloatPack operator+(const FloatPack& o) const { return {_mm512_add_ps(v, o.v)}; }
+  FloatPack operator-(const FloatPack& o) const { return {_mm512_sub_ps(v, o.v)}; }
+  FloatPack operator*(const FloatPack& o) const { return {_mm512_mul_ps(v, o.v)}; }
+  float ReduceSum() const { return _mm512_reduce_add_ps(v); }
+};
+
+template<>
+inline FloatPack FloatPack::Load<float>(const float* ptr) {
+  return {_mm512_loadu_ps(ptr)};
+}
+
+template<>
+inline FloatPack FloatPack::Load<bfloat16>(const bfloat16* ptr) {
+  const __m256i raw = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr));
+  const __m512i bits = _mm512_cvtepu16_epi32(raw);
+  return {_mm512_castsi512_ps(_mm512_slli_epi32(bits, 16))};
+}
+
+template<>
+inline FloatPack FloatPack::Load<float16>(const float16* ptr) {
+  return {_mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr)))};
+}
+
+template<>
+inline void FloatPack::Store<float>(float* ptr) const {
+  _mm512_storeu_ps(ptr, v);
+}
+
+#else
+
+struct FloatPack {
+  static constexpr int kSize = 8;
+  __m256 v;
+
+  static FloatPack Set1(float a) { return {_mm256_set1_ps(a)}; }
+  template<typename T>
+  static FloatPack Load(const T* ptr) {
+    float lanes[kSize];
+    for (int i = 0; i < kSize; ++i) { lanes[i] = static_cast<float>(ptr[i]); }
+    return {_mm256_loadu_ps(lanes)};
+  }
+  template<typename T>
+  void Store(T* ptr) const {
+    float lanes[kSize];
+    _mm256_storeu_ps(lanes, v);
+    for (int i = 0; i < kSize; ++i) { ptr[i] = static_cast<T>(lanes[i]); }
+  }
+  void StoreLanes(float* lanes) const { _mm256_storeu_ps(lanes, v); }
+  FloatPack operator+(const FloatPack& o) const { return {_mm256_add_ps(v, o.v)}; }
+  FloatPack operator-(const FloatPack& o) const { return {_mm256_sub_ps(v, o.v)}; }
+  FloatPack operator*(const FloatPack& o) const { return {_mm256_mul_ps(v, o.v)}; }
+  float ReduceSum() const {
+    const __m128 sum4 = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    const __m128 sum2 = _mm_add_ps(sum4, _mm_movehl_ps(sum4, sum4));
+    return _mm_cvtss_f32(_mm_add_ss(sum2, _mm_shuffle_ps(sum2, sum2, 1)));
+  }
+};
+
+template<>
+inline FloatPack FloatPack::Load<float>(const float* ptr) {
+  return {_mm256_loadu_ps(ptr)};
+}
+
+template<>
+inline FloatPack FloatPack::Load<bfloat16>(const bfloat16* ptr) {
+  const __m128i raw = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr));
+  const __m256i bits = _mm256_cvtepu16_epi32(raw);
+  return {_mm256_castsi256_ps(_mm256_slli_epi32(bits, 16))};
+}
+
+#if defined(__F16C__)
+template<>
+inline FloatPack FloatPack::Load<float16>(const float16* ptr) {
+  return {_mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr)))};
+}
+#endif  // __F16C__
+
+template<>
+inline void FloatPack::Store<float>(float* ptr) const {
+  _mm256_storeu_ps(ptr, v);
+}
+
+#endif  // __AVX512F__
+
+template<typename ComputeType>
+struct PackType {
+  using type = DefaultArrayPack<ComputeType>;
+};
+
+template<>
+struct PackType<float> {
+  using type = FloatPack;
+};
+
+#else
+
+template<typename ComputeType>
+struct PackType {
+  using type = DefaultArrayPack<ComputeType>;
+};
+
+#endif  // __x86_64__ && (__AVX512F__ || __AVX2__)
+
+template<typename ComputeType>
+struct WelfordState {
+  ComputeType mean;
+  ComputeType m2;
+  ComputeType count;
+
+  void Update(ComputeType x) {
+    count += 1;
+    const ComputeType delta = x - mean;
+    mean += delta / count;
+    m2 += delta * (x - mean);
+  }
+
+  // Chan et al. parallel combination of two partial states.
+  void Merge(ComputeType other_mean, ComputeType other_m2, ComputeType other_count) {
+    if (other_count == 0) { return; }
+    const ComputeType new_count = count + other_count;
+    const ComputeType delta = other_mean - mean;
+    const ComputeType other_ratio = other_count / new_count;
+    mean += delta * other_ratio;
+    m2 += other_m2 + delta * delta * count * other_ratio;
+    count = new_count;
+  }
+};
+
+// Single-pass Welford mean and biased variance of one row. Every lane of a pack runs its own
+// Welford recurrence over a strided subsequence, the lanes are merged at the end. Values are
+// shifted by the first element of the row, so that rows with a large mean do not lose the
+// low-order bits of every update.
+template<typename T, typename ComputeType>
+void WelfordRow(const T* x, int64_t norm_size, ComputeType* mean, ComputeType* variance) {
+  using Pack = typename PackType<ComputeType>::type;
+  constexpr int kPackSize = Pack::kSize;
+  const int64_t pack_end = norm_size / kPackSize * kPackSize;
+  const ComputeType shift = norm_size > 0 ? static_cast<ComputeType>(x[0]) : 0;
+  WelfordState<ComputeType> state{0, 0, 0};
+  if (pack_end > 0) {
+    const Pack pack_shift = Pack::Set1(shift);
+    Pack pack_mean = Pack::Set1(0);
+    Pack pack_m2 = Pack::Set1(0);
+    ComputeType count = 0;
+    for (int64_t i = 0; i < pack_end; i += kPackSize) {
+      count += 1;
+      const Pack pack_x = Pack::Load(x + i) - pack_shift;
+      const Pack delta = pack_x - pack_mean;
+      pack_mean = pack_mean + delta * Pack::Set1(1 / count);
+      pack_m2 = pack_m2 + delta * (pack_x - pack_mean);
+    }
+    ComputeType lane_mean[kPackSize];
+    ComputeType lane_m2[kPackSize];
+    pack_mean.StoreLanes(lane_mean);
+    pack_m2.StoreLanes(lane_m2);
+    for (int i = 0; i < kPackSize; ++i) { state.Merge(lane_mean[i], lane_m2[i], count); }
+  }
+  for (int64_t i = pack_end; i < norm_size; ++i) {
+    state.Update(static_cast<ComputeType>(x[i]) - shift);
+  }
+  *mean = state.mean + shift;
+  *variance = state.m2 / norm_size;
+}
+
+// y = (x - mean) * inv_variance * gamma + beta, gamma and beta may be null.
+template<typename T, typename ComputeType>
+void LayerNormForwardRow(const T* x, const T* gamma, const T* beta, int64_t norm_size,
+                         double epsilon, T* y, ComputeType* mean, ComputeType* inv_variance) {
+  using Pack = typename PackType<ComputeType>::type;
+  constexpr int kPackSize = Pack::kSize;
+  ComputeType row_mean = 0;
+  ComputeType row_variance = 0;
+  WelfordRow(x, norm_size, &row_mean, &row_variance);
+  const ComputeType row_inv_variance =
+      1 / std::sqrt(row_variance + static_cast<ComputeType>(epsilon));
+  *mean = row_mean;
+  *inv_variance = row_inv_variance;
+  // Centering before scaling keeps the precision of rows with a large mean.
+  const Pack pack_mean = Pack::Set1(row_mean);
+  const Pack pack_scale = Pack::Set1(row_inv_variance);
+  const int64_t pack_end = norm_size / kPackSize * kPackSize;
+  for (int64_t i = 0; i < pack_end; i += kPackSize) {
+    Pack normalized = (Pack::Load(x + i) - pack_mean) * pack_scale;
+    if (gamma != nullptr) { normalized = normalized * Pack::Load(gamma + i); }
+    if (beta != nullptr) { normalized = normalized + Pack::Load(beta + i); }
+    normalized.Store(y + i);
+  }
+  for (int64_t i = pack_end; i < norm_size; ++i) {
+    ComputeType normalized = (static_cast<ComputeType>(x[i]) - row_mean) * row_inv_variance;
+    if (gamma != nullptr) { normalized *= static_cast<ComputeType>(gamma[i]); }
+    if (beta != nullptr) { normalized += static_cast<ComputeType>(beta[i]); }
+    y[i] = static_cast<T>(normalized);
+  }
+}
+
+// dx = inv_variance * (g - mean(g) - x_hat * mean(g * x_hat)) with g = dy * gamma, plus
+// add_to_output when it is not null. dx may alias add_to_output.
+template<typename T, typename ComputeType>
+void LayerNormBackwardRow(const T* dy, const T* x, ComputeType mean, ComputeType inv_variance,
+                          const T* gamma, const T* add_to_output, int64_t norm_size, T* dx) {
+  using Pack = typename PackType<ComputeType>::type;
+  constexpr int kPackSize = Pack::kSize;
+  const int64_t pack_end = norm_size / kPackSize * kPackSize;
+  const Pack pack_mean = Pack::Set1(mean);
+  const Pack pack_scale = Pack::Set1(inv_variance);
+  Pack pack_sum_g = Pack::Set1(0);
+  Pack pack_sum_g_x_hat = Pack::Set1(0);
+  for (int64_t i = 0; i < pack_end; i += kPackSize) {
+    Pack g = Pack::Load(dy + i);
+    if (gamma != nullptr) { g = g * Pack::Load(gamma + i); }
+    const Pack x_hat = (Pack::Load(x + i) - pack_mean) * pack_scale;
+    pack_sum_g = pack_sum_g + g;
+    pack_sum_g_x_hat = pack_sum_g_x_hat + g * x_hat;
+  }
+  ComputeType sum_g = pack_sum_g.ReduceSum();
+  ComputeType sum_g_x_hat = pack_sum_g_x_hat.ReduceSum();
+  for (int64_t i = pack_end; i < norm_size; ++i) {
+    ComputeType g = static_cast<ComputeType>(dy[i]);
+    if (gamma != nullptr) { g *= static_cast<ComputeType>(gamma[i]); }
+    const ComputeType x_hat = (static_cast<ComputeType>(x[i]) - mean) * inv_variance;
+    sum_g += g;
+    sum_g_x_hat += g * x_hat;
+  }
+  const ComputeType mean_g = sum_g / norm_size;
+  const ComputeType mean_g_x_hat = sum_g_x_hat / norm_size;
+  const Pack pack_mean_g = Pack::Set1(mean_g);
+  const Pack pack_mean_g_x_hat = Pack::Set1(mean_g_x_hat);
+  for (int64_t i = 0; i < pack_end; i += kPackSize) {
+    Pack g = Pack::Load(dy + i);
+    if (gamma != nullptr) { g = g * Pack::Load(gamma + i); }
+    const Pack x_hat = (Pack::Load(x + i) - pack_mean) * pack_scale;
+    Pack grad = (g - pack_mean_g - x_hat * pack_mean_g_x_hat) * pack_scale;
+    if (add_to_output != nullptr) { grad = grad + Pack::Load(add_to_output + i); }
+    grad.Store(dx + i);
+  }
+  for (int64_t i = pack_end; i < norm_size; ++i) {
+    ComputeType g = static_cast<ComputeType>(dy[i]);
+    if (gamma != nullptr) { g *= static_cast<ComputeType>(gamma[i]); }
+    const ComputeType x_hat = (static_cast<ComputeType>(x[i]) - mean) * inv_variance;
+    ComputeType grad = (g - mean_g - x_hat * mean_g_x_hat) * inv_variance;
+    if (add_to_output != nullptr) { grad += static_cast<ComputeType>(add_to_output[i]); }
+    dx[i] = static_cast<T>(grad);
+  }
+}
+
+// Accumulates sum(dy * x_hat) and sum(dy) of rows [row_begin, row_end) into gamma_diff and
+// beta_diff, either of which may be null.
+template<typename T, typename ComputeType>
+void LayerNormParamGradRows(const T* dy, const T* x, const ComputeType* mean,
+                            const ComputeType* inv_variance, int64_t row_begin, int64_t row_end,
+                            int64_t norm_size, ComputeType* gamma_diff, ComputeType* beta_diff) {
+  using Pack = typename PackType<ComputeType>::type;
+  constexpr int kPackSize = Pack::kSize;
+  const int64_t pack_end = norm_size / kPackSize * kPackSize;
+  for (int64_t row = row_begin; row < row_end; ++row) {
+    const T* row_dy = dy + row * norm_size;
+    const T* row_x = x + row * norm_size;
+    const ComputeType scale = inv_variance[row];
+    const ComputeType row_mean = mean[row];
+    const Pack pack_mean = Pack::Set1(row_mean);
+    const Pack pack_scale = Pack::Set1(scale);
+    for (int64_t i = 0; i < pack_end; i += kPackSize) {
+      const Pack pack_dy = Pack::Load(row_dy + i);
+      if (gamma_diff != nullptr) {
+        const Pack x_hat = (Pack::Load(row_x + i) - pack_mean) * pack_scale;
+        (Pack::Load(gamma_diff + i) + pack_dy * x_hat).Store(gamma_diff + i);
+      }
+      if (beta_diff != nullptr) { (Pack::Load(beta_diff + i) + pack_dy).Store(beta_diff + i); }
+    }
+    for (int64_t i = pack_end; i < norm_size; ++i) {
+      const ComputeType row_dy_i = static_cast<ComputeType>(row_dy[i]);
+      if (gamma_diff != nullptr) {
+        gamma_diff[i] += row_dy_i * (static_cast<ComputeType>(row_x[i]) - row_mean) * scale;
+      }
+      if (beta_diff != nullptr) { beta_diff[i] += row_dy_i; }
+    }
+  }
+}
+
+}  // namespace layer_norm
+
+}  // namespace oneflow
+
+#endif  // ONEFLOW_USER_KERNELS_LAYER_NORM_CPU_KERNEL_UTIL_H_
@@ -0,0 +1,244 @@
+/*
+Copyright 2020 The OneFlow Authors. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include <gtest/gtest.h>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include "oneflow/user/kernels/layer_norm_cpu_kernel_util.h"
+
+namespace oneflow {
+namespace test {
+
+namespace {
+
+constexpr double kEpsilon = 1e-5;
+
+std::vector<float> RandomVector(int64_t size, float offset, uint32_t seed) {
+  std::mt19937 gen(seed);
+  std::uniform_real_distribution<float> dis(-1.f, 1.f);
+  std::vector<float> vec(size);
+  for (auto& v : vec) { v = offset + dis(gen); }
+  return vec;
+}
+
+template<typename T, typename U>
+std::vector<T> Cast(const std::vector<U>& vec) {
+  std::vector<T> casted(vec.size());
+  for (size_t i = 0; i < vec.size(); ++i) {
+    casted[i] = static_cast<T>(static_cast<float>(vec[i]));
+  }
+  return casted;
+}
+
+// The layer norm as a chain of separate reductions and elementwise passes, like the
+// decomposed ops a graph falls back to. Computed in double it is the reference result.
+template<typename T, typename ComputeType>
+void DecomposedForward(const T* x, const T* gamma, const T* beta, int64_t num_instances,
+                       int64_t norm_size, T* y, ComputeType* mean, ComputeType* inv_variance) {
+  std::vector<ComputeType> centered(num_instances * norm_size);
+  for (int64_t row = 0; row < num_instances; ++row) {
+    ComputeType sum = 0;
+    for (int64_t i = 0; i < norm_size; ++i) { sum += x[row * norm_size + i]; }
+    mean[row] = sum / norm_size;
+  }
+  for (int64_t row = 0; row < num_instances; ++row) {
+    for (int64_t i = 0; i < norm_size; ++i) {
+      centered[row * norm_size + i] = x[row * norm_size + i] - mean[row];
+    }
+  }
+  for (int64_t row = 0; row < num_instances; ++row) {
+    ComputeType sum = 0;
+    for (int64_t i = 0; i < norm_size; ++i) {
+      sum += centered[row * norm_size + i] * centered[row * norm_size + i];
+    }
+    inv_variance[row] = 1 / std::sqrt(sum / norm_size + static_cast<ComputeType>(kEpsilon));
+  }
+  for (int64_t row = 0; row < num_instances; ++row) {
+    for (int64_t i = 0; i < norm_size; ++i) {
+      ComputeType normalized = centered[row * norm_size + i] * inv_variance[row];
+      if (gamma != nullptr) { normalized *= gamma[i]; }
+      if (beta != nullptr) { normalized += beta[i]; }
+      y[row * norm_size + i] = static_cast<T>(normalized);
+    }
+  }
+}
+
+void ReferenceBackward(const std::vector<double>& dy, const std::vector<double>& x,
+                       const std::vector<double>& gamma, int64_t num_instances, int64_t norm_size,
+                       std::vector<double>* dx, std::vector<double>* gamma_diff,
+                       std::vector<double>* beta_diff) {
+  std::vector<double> y(x.size());
+  std::vector<double> mean(num_instances);
+  std::vector<double> inv_variance(num_instances);
+  DecomposedForward<double, double>(x.data(), nullptr, nullptr, num_instances, norm_size,
+                                    y.data(), mean.data(), inv_variance.data());
+  dx->assign(x.size(), 0);
+  gamma_diff->assign(norm_size, 0);
+  beta_diff->assign(norm_size, 0);
+  for (int64_t row = 0; row < num_instances; ++row) {
+    double sum_g = 0;
+    double sum_g_x_hat = 0;
+    for (int64_t i = 0; i < norm_size; ++i) {
+      const int64_t offset = row * norm_size + i;
+      const double g = dy[offset] * gamma[i];
+      sum_g += g;
+      sum_g_x_hat += g * y[offset];
+      (*gamma_diff)[i] += dy[offset] * y[offset];
+      (*beta_diff)[i] += dy[offset];
+    }
+    for (int64_t i = 0; i < norm_size; ++i) {
+      const int64_t offset = row * norm_size + i;
+      const double g = dy[offset] * gamma[i];
+      (*dx)[offset] =
+          inv_variance[row] * (g - sum_g / norm_size - y[offset] * sum_g_x_hat / norm_size);
+    }
+  }
+}
+
+template<typename T>
+void TestForward(int64_t num_instances, int64_t norm_size, float offset, bool affine,
+                 double tolerance) {
+  using ComputeType = typename layer_norm::DefaultComputeType<T>::type;
+  const std::vector<float> x = RandomVector(num_instances * norm_size, offset, 1);
+  const std::vector<float> gamma = RandomVector(norm_size, 1.f, 2);
+  const std::vector<float> beta = RandomVector(norm_size, 0.f, 3);
+  const std::vector<T> x_t = Cast<T>(x);
+  const std::vector<T> gamma_t = Cast<T>(gamma);
+  const std::vector<T> beta_t = Cast<T>(beta);
+  std::vector<T> y(x.size());
+  std::vector<ComputeType> mean(num_instances);
+  std::vector<ComputeType> inv_variance(num_instances);
+  for (int64_t row = 0; row < num_instances; ++row) {
+    layer_norm::LayerNormForwardRow<T, ComputeType>(
+        x_t.data() + row * norm_size, affine ? gamma_t.data() : nullptr,
+        affine ? beta_t.data() : nullptr, norm_size, kEpsilon, y.data() + row * norm_size,
+        mean.data() + row, inv_variance.data() + row);
+  }
+  // The reference sees the same rounded inputs.
+  const std::vector<double> x_ref = Cast<double>(x_t);
+  const std::vector<double> gamma_ref = Cast<double>(gamma_t);
+  const std::vector<double> beta_ref = Cast<double>(beta_t);
+  std::vector<double> y_ref(x.size());
+  std::vector<double> mean_ref(num_instances);
+  std::vector<double> inv_variance_ref(num_instances);
+  DecomposedForward<double, double>(x_ref.data(), affine ? gamma_ref.data() : nullptr,
+                                    affine ? beta_ref.data() : nullptr, num_instances, norm_size,
+                                    y_ref.data(), mean_ref.data(), inv_variance_ref.data());
+  for (int64_t row = 0; row < num_instances; ++row) {
+    ASSERT_NEAR(mean[row], mean_ref[row], 1e-5 * (1 + std::abs(offset)));
+    ASSERT_NEAR(inv_variance[row], inv_variance_ref[row], 1e-3 * inv_variance_ref[row]);
+  }
+  for (size_t i = 0; i < y.size(); ++i) {
+    ASSERT_NEAR(static_cast<double>(y[i]), y_ref[i], tolerance) << i;
+  }
+}
+
+}  // namespace
+
+TEST(LayerNormCpuKernel, Forward) {
+  for (int64_t norm_size : {1, 7, 16, 64, 100, 768, 4099}) {
+    for (bool affine : {false, true}) { TestForward<float>(5, norm_size, 0.f, affine, 1e-4); }
+  }
+  TestForward<double>(5, 1000, 0.f, true, 1e-6);
+}
+
+TEST(LayerNormCpuKernel, ForwardLargeMean) {
+  // A naive sum of squares loses most digits of the variance with an offset this large.
+  TestForward<float>(4, 4096, 3000.f, false, 1e-3);
+}
+
+TEST(LayerNormCpuKernel, ForwardHalf) {
+  TestForward<float16>(3, 1024, 0.f, true, 2e-2);
+  TestForward<bfloat16>(3, 1024, 0.f, true, 1e-1);
+}
+
+TEST(LayerNormCpuKernel, Backward) {
+  const int64_t num_instances = 9;
+  for (int64_t norm_size : {1, 13, 768}) {
+    const std::vector<float> x = RandomVector(num_instances * norm_size, 0.5f, 4);
+    const std::vector<float> dy = RandomVector(num_instances * norm_size, 0.f, 5);
+    const std::vector<float> gamma = RandomVector(norm_size, 1.f, 6);
+    const std::vector<float> add_to_output = RandomVector(num_instances * norm_size, 0.f, 7);
+    std::vector<float> y(x.size());
+    std::vector<float> mean(num_instances);
+    std::vector<float> inv_variance(num_instances);
+    std::vector<float> dx(add_to_output);
+    std::vector<float> gamma_diff(norm_size, 0.f);
+    std::vector<float> beta_diff(norm_size, 0.f);
+    for (int64_t row = 0; row < num_instances; ++row) {
+      const int64_t offset = row * norm_size;
+      layer_norm::LayerNormForwardRow<float, float>(x.data() + offset, nullptr, nullptr,
+                                                    norm_size, kEpsilon, y.data() + offset,
+                                                    mean.data() + row, inv_variance.data() + row);
+      // dx aliases add_to_output like the inplace proposal of the kernel.
+      layer_norm::LayerNormBackwardRow<float, float>(
+          dy.data() + offset, x.data() + offset, mean[row], inv_variance[row], gamma.data(),
+          dx.data() + offset, norm_size, dx.data() + offset);
+    }
+    layer_norm::LayerNormParamGradRows<float, float>(dy.data(), x.data(), mean.data(),
+                                                     inv_variance.data(), 0, num_instances,
+                                                     norm_size, gamma_diff.data(),
+                                                     beta_diff.data());
+    std::vector<double> dx_ref;
+    std::vector<double> gamma_diff_ref;
+    std::vector<double> beta_diff_ref;
+    ReferenceBackward(Cast<double>(dy), Cast<double>(x), Cast<double>(gamma), num_instances,
+                      norm_size, &dx_ref, &gamma_diff_ref, &beta_diff_ref);
+    for (size_t i = 0; i < dx.size(); ++i) {
+      ASSERT_NEAR(dx[i], dx_ref[i] + add_to_output[i], 1e-3) << norm_size << " " << i;
+    }
+    for (int64_t i = 0; i < norm_size; ++i) {
+      ASSERT_NEAR(gamma_diff[i], gamma_diff_ref[i], 1e-3) << norm_size << " " << i;
+      ASSERT_NEAR(beta_diff[i], beta_diff_ref[i], 1e-4) << norm_size << " " << i;
+    }
+  }
+}
+
+TEST(LayerNormCpuKernel, Benchmark) {
+  for (int64_t norm_size : {64, 768, 4096}) {
+    const int64_t num_instances = (1 << 22) / norm_size;
+    const std::vector<float> x = RandomVector(num_instances * norm_size, 0.f, 8);
+    const std::vector<float> gamma = RandomVector(norm_size, 1.f, 9);
+    const std::vector<float> beta = RandomVector(norm_size, 0.f, 10);
+    std::vector<float> y(x.size());
+    std::vector<float> mean(num_instances);
+    std::vector<float> inv_variance(num_instances);
+    const int repeat = 10;
+    const auto fused_start = std::chrono::steady_clock::now();
+    for (int r = 0; r < repeat; ++r) {
+      for (int64_t row = 0; row < num_instances; ++row) {
+        layer_norm::LayerNormForwardRow<float, float>(
+            x.data() + row * norm_size, gamma.data(), beta.data(), norm_size, kEpsilon,
+            y.data() + row * norm_size, mean.data() + row, inv_variance.data() + row);
+      }
+    }
+    const auto fused_elapsed = std::chrono::steady_clock::now() - fused_start;
+    const auto decomposed_start = std::chrono::steady_clock::now();
+    for (int r = 0; r < repeat; ++r) {
+      DecomposedForward<float, float>(x.data(), gamma.data(), beta.data(), num_instances,
+                                      norm_size, y.data(), mean.data(), inv_variance.data());
+    }
+    const auto decomposed_elapsed = std::chrono::steady_clock::now() - decomposed_start;
+    std::cout << "layer norm " << num_instances << "x" << norm_size << ", fused "
+              << std::chrono::duration<double, std::milli>(fused_elapsed).count() / repeat
+              << " ms, decomposed "
+              << std::chrono::duration<double, std::milli>(decomposed_elapsed).count() / repeat
+              << " ms" << std::endl;
+  }
+}
+
+}  // namespace test
+}  // namespace oneflow
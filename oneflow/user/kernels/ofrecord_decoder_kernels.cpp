@@ -173,23 +173,19 @@ void DecodeRandomCropImageFromOneRecord(const OFRecord& record, TensorBuffer* bu
   CHECK(feature.has_bytes_list());
   CHECK(feature.bytes_list().value_size() == 1);
   const std::string& src_data = feature.bytes_list().value(0);
+  // libjpeg decodes the crop straight into the buffer in the requested color space.
+  if (JpegDecodeRandomCropImage(reinterpret_cast<const unsigned char*>(src_data.data()),
+                                src_data.size(), random_crop_gen, color_space, 0, 0, nullptr, 0,
+                                buffer)) {
+    return;
+  }
   cv::Mat image;
-
-  if (JpegPartialDecodeRandomCropImage(reinterpret_cast<const unsigned char*>(src_data.data()),
-                                       src_data.size(), random_crop_gen, nullptr, 0, &image)) {
-    // convert color space
-    // jpeg decode output RGB
-    if (ImageUtil::IsColor(color_space) && color_space != "RGB") {
-      ImageUtil::ConvertColor("RGB", image, color_space, image);
-    }
-  } else {
-    OpenCvPartialDecodeRandomCropImage(reinterpret_cast<const unsigned char*>(src_data.data()),
-                                       src_data.size(), random_crop_gen, color_space, image);
-    // convert color space
-    // opencv decode output BGR
-    if (ImageUtil::IsColor(color_space) && color_space != "BGR") {
-      ImageUtil::ConvertColor("BGR", image, color_space, image);
-    }
+  OpenCvPartialDecodeRandomCropImage(reinterpret_cast<const unsigned char*>(src_data.data()),
+                                     src_data.size(), random_crop_gen, color_space, image);
+  // convert color space
+  // opencv decode output BGR
+  if (ImageUtil::IsColor(color_space) && color_space != "BGR") {
+    ImageUtil::ConvertColor("BGR", image, color_space, image);
   }
 
   int W = image.cols;
@@ -25,6 +25,7 @@ limitations under the License.
 #include "oneflow/core/profiler/profiler.h"
 #include "oneflow/core/profiler/profile_manager.h"
 #include "oneflow/core/profiler/event_recorder.h"
+#include "oneflow/core/profiler/trace_recorder.h"
 #include "oneflow/core/eager/call_context.h"
 
 namespace oneflow {
@@ -830,6 +831,8 @@ Maybe<void> InitTensorTupleIndexes4Bns(const std::shared_ptr<const OperatorConf>
   opkernel->stream_ = stream;
   opkernel->input_arg_tuple_ = input_arg_tuple;
   opkernel->output_arg_tuple_ = output_arg_tuple;
+  opkernel->trace_name_id_ =
+      profiler::TraceRecorder::Get()->InternName(op_conf->user_conf().op_type_name());
 
   const DeviceType device_type = CHECK_JUST(DeviceType4DeviceTag(op_conf->device_tag()));
   const user_op::UserOpConfWrapper* user_op_conf = opkernel->user_op_conf_.get();
@@ -886,6 +889,7 @@ Maybe<void> StatefulOpKernel::ChooseOpKernel(eager::CallContext* call_ctx,
   }
 
   UserKernelRegContext reg_ctx(reg_ctx_helper_.get(), call_ctx);
+  std::unique_lock<std::mutex> lock(cached_kernels_mutex_);
   for (const auto& pair : dtype2cached_kernels_[primary_dtype]) {
     if (likely(pair.first->is_matched_hob->get(reg_ctx))) {
       *need_temp_storage = pair.first->need_temp_storage;
@@ -938,6 +942,7 @@ void StatefulOpKernel::TryInitOpKernelStateAndCache(eager::CallContext* call_ctx
 
 const user_op::InferTmpSizeFn& StatefulOpKernel::GetInferTmpSizeFn(
     const user_op::OpKernel* op_kernel) const {
+  std::unique_lock<std::mutex> lock(cached_kernels_mutex_);
   return *infer_tmp_size_fn_map_.at(op_kernel);
 }
 
@@ -954,6 +959,7 @@ void StatefulOpKernel::Compute(eager::CallContext* call_ctx, ep::Stream* stream,
   UserKernelComputeContext compute_context(compute_ctx_helper_.get(), call_ctx, stream);
   auto* compute_ctx = &compute_context;
   OF_PROFILER_RANGE_GUARD("Compute");
+  profiler::TraceScope trace_scope(trace_name_id_);
   auto er_guard = CHECK_JUST(profiler::EventRecorder::CreateKernelEventRecorder(
       op_type_name(),
 #if defined(WITH_CUDA)
@@ -16,6 +16,7 @@ limitations under the License.
 #ifndef ONEFLOW_USER_KERNELS_STATEFUL_OPKERNEL_H_
 #define ONEFLOW_USER_KERNELS_STATEFUL_OPKERNEL_H_
 
+#include <mutex>
 #include "oneflow/core/eager/eager_blob_object.h"
 #include "oneflow/core/common/tensor_meta.h"
 #include "oneflow/core/kernel/kernel.h"
@@ -127,11 +128,15 @@ class StatefulOpKernel final {
   HashMap<const user_op::OpKernel*, std::shared_ptr<user_op::OpKernelState>> op_kernel_state_map_;
   HashMap<const user_op::OpKernel*, std::shared_ptr<user_op::OpKernelCache>> op_kernel_cache_map_;
   HashMap<const user_op::OpKernel*, const user_op::InferTmpSizeFn*> infer_tmp_size_fn_map_;
+  // Guards the cached kernels, which are chosen on the threads dispatching ops and looked up on the
+  // scheduler thread.
+  mutable std::mutex cached_kernels_mutex_;
   OpArgsVector<int64_t> input_tuple_indexes4const_ibns_;
   OpArgsVector<int64_t> input_tuple_indexes4mut_ibns_;
   OpArgsVector<int64_t> output_tuple_indexes4mut_obns_;
   OpArgsVector<int64_t> output_tuple_indexes4mut2_obns_;
   OpArgsVector<bool> output_tuple_indexes2is_mut2_type_;
+  uint32_t trace_name_id_;
 };
 
 }  // namespace one
@@ -139,6 +139,10 @@ def _init(
             persistent_table["capacity_hint"] // parallel_num
         )
     key_value_store_options["kv_store"] = kv_store
+    # the device running the lookups, "cpu" selects the host caches
+    if store_options.__contains__("device_type"):
+        assert store_options["device_type"] in ["cuda", "cpu"]
+        key_value_store_options["device_type"] = store_options["device_type"]
     # initializer
     if tables is not None:
         assert isinstance(tables, (list, tuple))
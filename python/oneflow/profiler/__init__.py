@@ -34,6 +34,9 @@ __all__ = [
     "kineto_available",
     "tensorboard_trace_handler",
     "ProfilerAction",
+    "start_trace",
+    "stop_trace",
+    "trace_step",
 ]
 
 
@@ -55,3 +58,19 @@ def profiler_stop():
 
 def kineto_available():
     return True
+
+
+def start_trace(path, sample_period=1):
+    r"""Streams the host time of every kernel to a Chrome trace file at `path`, which can be
+    opened by chrome://tracing or Perfetto. Only the kernels of every `sample_period`-th step
+    are recorded, steps are advanced by :func:`trace_step`.
+    """
+    oneflow._oneflow_internal.profiler.StartTrace(path, sample_period)
+
+
+def stop_trace():
+    oneflow._oneflow_internal.profiler.StopTrace()
+
+
+def trace_step():
+    oneflow._oneflow_internal.profiler.TraceStep()
@@ -0,0 +1,160 @@
+"""
+Copyright 2020 The OneFlow Authors. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+"""
+import os
+
+# Small buckets so that the parameters below are split into several buckets, it must be set
+# before the first backward.
+os.environ["ONEFLOW_EAGER_GLOBAL_GRAD_BUCKET_SIZE"] = "64"
+
+import unittest
+import numpy as np
+import oneflow as flow
+import oneflow.unittest
+
+
+class Model(flow.nn.Module):
+    def __init__(self, placement, param_num):
+        super().__init__()
+        self.param_num = param_num
+        for i in range(param_num):
+            self.register_parameter(
+                f"w{i}",
+                flow.nn.Parameter(
+                    flow.ones(4 * (i + 1), placement=placement, sbp=flow.sbp.broadcast)
+                ),
+            )
+        self.unused = flow.nn.Parameter(
+            flow.ones(4, placement=placement, sbp=flow.sbp.broadcast)
+        )
+
+    def forward(self, xs):
+        loss = None
+        for i in range(self.param_num):
+            y = (xs[i] * getattr(self, f"w{i}")).sum()
+            loss = y if loss is None else loss + y
+        return loss
+
+
+def _inputs(placement, param_num):
+    rank = flow.env.get_rank()
+    xs = []
+    for i in range(param_num):
+        local = np.full((1, 4 * (i + 1)), (rank + 1) * (i + 1), dtype=np.float32)
+        xs.append(
+            flow.tensor(local).to_global(placement=placement, sbp=flow.sbp.split(0))
+        )
+    return xs
+
+
+class TwoPlacementModel(flow.nn.Module):
+    # Parameters alternate between the two placements, so they are registered
+    # interleaved.
+    def __init__(self, placements, param_num):
+        super().__init__()
+        self.placements = placements
+        self.param_num = param_num
+        for i in range(param_num):
+            self.register_parameter(
+                f"w{i}",
+                flow.nn.Parameter(
+                    flow.ones(
+                        4 * (i + 1), placement=placements[i % 2], sbp=flow.sbp.broadcast
+                    )
+                ),
+            )
+
+    def forward(self, xs):
+        losses = [None, None]
+        for i in range(self.param_num):
+            y = (xs[i] * getattr(self, f"w{i}")).sum()
+            losses[i % 2] = y if losses[i % 2] is None else losses[i % 2] + y
+        return losses[0] + losses[1].to_global(
+            placement=self.placements[0], sbp=flow.sbp.broadcast
+        )
+
+
+@flow.unittest.skip_unless_1n2d()
+class TestGlobalGradBucket(flow.unittest.TestCase):
+    def test_global_grad_bucket(test_case):
+        placement = flow.placement("cpu", ranks=[0, 1])
+        param_num = 6
+        m = Model(placement, param_num)
+        xs = _inputs(placement, param_num)
+        m(xs).backward()
+        for i in range(param_num):
+            grad = getattr(m, f"w{i}").grad
+            test_case.assertTrue(grad.is_global)
+            test_case.assertEqual(grad.sbp, (flow.sbp.broadcast,))
+            # rows of rank 0 and rank 1 are summed
+            test_case.assertTrue(
+                np.allclose(grad.numpy(), np.full(4 * (i + 1), 3 * (i + 1)))
+            )
+        test_case.assertIsNone(m.unused.grad)
+
+    def test_global_grad_bucket_accumulation(test_case):
+        placement = flow.placement("cpu", ranks=[0, 1])
+        param_num = 4
+        m = Model(placement, param_num)
+        xs = _inputs(placement, param_num)
+        m(xs).backward()
+        m(xs).backward()
+        for i in range(param_num):
+            grad = getattr(m, f"w{i}").grad
+            test_case.assertEqual(grad.sbp, (flow.sbp.broadcast,))
+            test_case.assertTrue(
+                np.allclose(grad.numpy(), np.full(4 * (i + 1), 6 * (i + 1)))
+            )
+
+    def test_global_grad_bucket_two_placements(test_case):
+        # Rank 1 holds no grads of the parameters placed on rank 0 only, which must
+        # not change the buckets of the parameters placed on both ranks.
+        placements = [
+            flow.placement("cpu", ranks=[0, 1]),
+            flow.placement("cpu", ranks=[0]),
+        ]
+        param_num = 8
+        m = TwoPlacementModel(placements, param_num)
+        all_ranks_xs = _inputs(placements[0], param_num)
+        xs = []
+        for i in range(param_num):
+            if i % 2 == 0:
+                xs.append(all_ranks_xs[i])
+            else:
+                xs.append(
+                    flow.ones(
+                        (1, 4 * (i + 1)),
+                        placement=placements[1],
+                        sbp=flow.sbp.broadcast,
+                    )
+                    * (i + 1)
+                )
+        m(xs).backward()
+        for i in range(param_num):
+            grad = getattr(m, f"w{i}").grad
+            test_case.assertEqual(grad.sbp, (flow.sbp.broadcast,))
+            if i % 2 == 0:
+                test_case.assertTrue(
+                    np.allclose(grad.numpy(), np.full(4 * (i + 1), 3 * (i + 1)))
+                )
+            elif flow.env.get_rank() == 0:
+                test_case.assertTrue(
+                    np.allclose(grad.to_local().numpy(), np.full(4 * (i + 1), i + 1))
+                )
+
+
+
+if __name__ == "__main__":
+    unittest.main()